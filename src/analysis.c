@@ -0,0 +1,820 @@
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void visitChildren(struct ASTNode *n, Visit visit, void *ctx)
+{
+    switch (n->type)
+    {
+    case NODE_BINOP:
+        visit(&n->binop.left, ctx);
+        visit(&n->binop.right, ctx);
+        break;
+    case NODE_LOGICAL:
+        visit(&n->logical.left, ctx);
+        visit(&n->logical.right, ctx);
+        break;
+    case NODE_ASSIGN:
+        visit(&n->assign.value, ctx);
+        break;
+    case NODE_PRINT:
+        for (int i = 0; i < n->print.count; ++i)
+            visit(&n->print.exprs[i], ctx);
+        break;
+    case NODE_BLOCK:
+        for (int i = 0; i < n->block.count; ++i)
+            visit(&n->block.items[i], ctx);
+        break;
+    case NODE_IF:
+        visit(&n->ifstmt.cond, ctx);
+        visit(&n->ifstmt.thenBlock, ctx);
+        visit(&n->ifstmt.elseBlock, ctx);
+        break;
+    case NODE_FOR:
+        visit(&n->forstmt.init, ctx);
+        visit(&n->forstmt.cond, ctx);
+        visit(&n->forstmt.incr, ctx);
+        visit(&n->forstmt.body, ctx);
+        break;
+    case NODE_WHILE:
+        visit(&n->WhileStmt.cond, ctx);
+        visit(&n->WhileStmt.body, ctx);
+        break;
+    case NODE_SWITCH:
+        visit(&n->switchStmt.value, ctx);
+        for (int i = 0; i < n->switchStmt.bodyCount; ++i)
+            visit(&n->switchStmt.bodies[i], ctx);
+        break;
+    case NODE_FOR_IN:
+        visit(&n->forIn.start, ctx);
+        visit(&n->forIn.end, ctx);
+        visit(&n->forIn.step, ctx);
+        visit(&n->forIn.array, ctx);
+        visit(&n->forIn.body, ctx);
+        break;
+    case NODE_ARRAY:
+        for (int i = 0; i < n->ArrayNode.count; ++i)
+            visit(&n->ArrayNode.elements[i], ctx);
+        break;
+    case NODE_ARR_ACCESS:
+        visit(&n->ArrAccessNode.index, ctx);
+        break;
+    case NODE_ARR_ASSIGN:
+        visit(&n->arrAssign.index, ctx);
+        visit(&n->arrAssign.value, ctx);
+        break;
+    case NODE_FUNC_DEF:
+        visit(&n->funcDef.body, ctx);
+        break;
+    case NODE_RETURN:
+        visit(&n->returnStmt.value, ctx);
+        break;
+    case NODE_FUNC_CALL:
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            visit(&n->funcCall.args[i], ctx);
+        break;
+    default:
+        break;
+    }
+}
+
+void addNode(NodeList *l, struct ASTNode *n)
+{
+    if (l->count >= l->cap)
+        l->items = (struct ASTNode **)growArray(l->items, &l->cap, sizeof(struct ASTNode *));
+    l->items[l->count++] = n;
+}
+
+void insertItems(struct ASTNode *block, int at, struct ASTNode **items, int count)
+{
+    block->block.items = (struct ASTNode **)realloc(block->block.items,
+                                                    sizeof(struct ASTNode *) * (block->block.count + count));
+    if (!block->block.items)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    memmove(block->block.items + at + count, block->block.items + at,
+            sizeof(struct ASTNode *) * (block->block.count - at));
+    memcpy(block->block.items + at, items, sizeof(struct ASTNode *) * count);
+    block->block.count += count;
+}
+
+int sameExpr(struct ASTNode *a, struct ASTNode *b)
+{
+    if (a->type != b->type)
+        return 0;
+    switch (a->type)
+    {
+    case NODE_NUM:
+        return a->num.isInt == b->num.isInt &&
+               (a->num.isInt ? a->num.intValue == b->num.intValue
+                             : memcmp(&a->num.value, &b->num.value, sizeof(double)) == 0);
+    case NODE_VAR:
+        return strcmp(a->varName, b->varName) == 0;
+    case NODE_BINOP:
+        return a->binop.op == b->binop.op && sameExpr(a->binop.left, b->binop.left) &&
+               sameExpr(a->binop.right, b->binop.right);
+    case NODE_LOGICAL:
+        return a->logical.op == b->logical.op && sameExpr(a->logical.left, b->logical.left) &&
+               sameExpr(a->logical.right, b->logical.right);
+    case NODE_FUNC_CALL:
+        if (strcmp(a->funcCall.funcName, b->funcCall.funcName) != 0 ||
+            a->funcCall.argCount != b->funcCall.argCount)
+            return 0;
+        for (int i = 0; i < a->funcCall.argCount; ++i)
+            if (!sameExpr(a->funcCall.args[i], b->funcCall.args[i]))
+                return 0;
+        return 1;
+    case NODE_ARR_ACCESS:
+        return strcmp(a->ArrAccessNode.varName, b->ArrAccessNode.varName) == 0 &&
+               sameExpr(a->ArrAccessNode.index, b->ArrAccessNode.index);
+    default:
+        return 0;
+    }
+}
+
+void collectFunctions(struct ASTNode **slot, void *ctx)
+{
+    if (!*slot)
+        return;
+    if ((*slot)->type == NODE_FUNC_DEF)
+        addNode((NodeList *)ctx, *slot);
+    visitChildren(*slot, collectFunctions, ctx);
+}
+
+// ------------------- NAMES -------------------
+
+void scanFrame(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    NameUse *u = (NameUse *)ctx;
+    if (!n)
+        return;
+    if (n->type == NODE_ASSIGN && strcmp(n->assign.varName, u->name) == 0)
+    {
+        if (n->assign.isLet)
+            u->decls++;
+        else
+            u->writes++;
+    }
+    else if (n->type == NODE_FUNC_CALL)
+    {
+        const char *buf = chunkBuffer(n);
+        if (buf && strcmp(buf, u->name) == 0)
+            u->writes++;
+    }
+    else if (n->type == NODE_FOR_IN && strcmp(n->forIn.varName, u->name) == 0)
+        u->decls++; // binds like a `let` on every trip
+    else if (n->type == NODE_FUNC_DEF)
+    {
+        if (strcmp(n->funcDef.funcName, u->name) == 0)
+            u->decls++;
+        return; // its body is another frame
+    }
+    visitChildren(n, scanFrame, u);
+}
+
+void countRefs(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    NameUse *u = (NameUse *)ctx;
+    if (!n)
+        return;
+    const char *name = NULL;
+    switch (n->type)
+    {
+    case NODE_VAR:
+        name = n->varName;
+        break;
+    case NODE_ARR_ACCESS:
+        name = n->ArrAccessNode.varName;
+        break;
+    case NODE_ARR_ASSIGN:
+        name = n->arrAssign.varName;
+        break;
+    case NODE_FUNC_CALL:
+        name = n->funcCall.funcName;
+        break;
+    case NODE_ASSIGN:
+        name = n->assign.isLet ? NULL : n->assign.varName;
+        break;
+    default:
+        break;
+    }
+    if (name && strcmp(name, u->name) == 0)
+        u->refs++;
+    visitChildren(n, countRefs, u);
+}
+
+FrameBinding functionBinding(struct ASTNode *def, const char *name)
+{
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        if (strcmp(def->funcDef.params[i], name) == 0)
+            return SHADOWS;
+    // an assignment before the function's own `let` still reaches the
+    // script's variable
+    NameUse u = {name, 0, 0, 0};
+    scanFrame(&def->funcDef.body, &u);
+    return u.writes ? WRITES : u.decls ? SHADOWS : SEES_GLOBAL;
+}
+
+// ------------------- TYPES -------------------
+
+StaticType meet(StaticType a, StaticType b)
+{
+    if (a == TYPE_NONE)
+        return b;
+    if (b == TYPE_NONE || a == b)
+        return a;
+    return TYPE_ANY;
+}
+
+int frameAddName(Frame *f, const char *name, StaticType type)
+{
+    int i = addName(&f->names, name);
+    int cap = f->names.cap;
+    f->types = (StaticType *)realloc(f->types, sizeof(StaticType) * (cap ? cap : 1));
+    if (!f->types)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    f->types[i] = type;
+    return i;
+}
+
+StaticType nameType(Frame *f, const char *name)
+{
+    int i = findName(&f->names, name);
+    return i >= 0 ? f->types[i] : TYPE_ANY;
+}
+
+StaticType binopType(BinOpType op, StaticType l, StaticType r)
+{
+    // errors give 0: only + can make anything but a number
+    if (op != OP_ADD)
+        return TYPE_NUMBER;
+    if (l == TYPE_NONE || r == TYPE_NONE)
+        return TYPE_NONE;
+    if (l == TYPE_ANY || r == TYPE_ANY)
+        return TYPE_ANY;
+    if (l == TYPE_STRING || r == TYPE_STRING)
+        return l == TYPE_ARRAY || r == TYPE_ARRAY ? TYPE_NUMBER : TYPE_STRING;
+    return TYPE_NUMBER;
+}
+
+int binopFails(BinOpType op, StaticType l, StaticType r)
+{
+    if (l == TYPE_NONE || l == TYPE_ANY || r == TYPE_NONE || r == TYPE_ANY)
+        return 0;
+    switch (op)
+    {
+    case OP_ADD:
+        return l == TYPE_ARRAY || r == TYPE_ARRAY;
+    case OP_EQ:
+    case OP_NE:
+        return 0;
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+        return l != r || l == TYPE_ARRAY;
+    default:
+        return l != TYPE_NUMBER || r != TYPE_NUMBER;
+    }
+}
+
+StaticType exprType(Frame *f, struct ASTNode *e, NameList *bound)
+{
+    if (!e)
+        return TYPE_ANY;
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return TYPE_NUMBER;
+    case NODE_STR:
+        return TYPE_STRING;
+    case NODE_ARRAY:
+        return TYPE_ARRAY;
+    case NODE_VAR:
+    {
+        int i = findName(&f->names, e->varName);
+        if (i < 0)
+            return TYPE_ANY;
+        if (findName(bound, e->varName) >= 0)
+            return f->types[i];
+        // unbound, the script's variables read as 0 and a function's
+        // locals as the global of that name
+        return f->def ? TYPE_ANY : meet(f->types[i], TYPE_NUMBER);
+    }
+    case NODE_LOGICAL:
+        return TYPE_NUMBER;
+    case NODE_BINOP:
+        if (e->binop.op != OP_ADD)
+            return TYPE_NUMBER;
+        return binopType(OP_ADD, exprType(f, e->binop.left, bound), exprType(f, e->binop.right, bound));
+    case NODE_FUNC_CALL:
+    {
+        int b = findBuiltin(e->funcCall.funcName);
+        if (b < 0 || e->funcCall.argCount != builtinArity(b))
+            return TYPE_ANY;
+        if (b == BI_VECTOR) // the loop's start when it ran nothing
+        {
+            struct ASTNode *args = e->funcCall.args[1];
+            if (args->type != NODE_ARRAY || args->ArrayNode.count == 0)
+                return TYPE_ANY;
+            return meet(TYPE_NUMBER, exprType(f, args->ArrayNode.elements[0], bound));
+        }
+        return b == BI_LENGTH || b == BI_EOF || b == BI_READ_CHUNK ? TYPE_NUMBER : TYPE_ANY;
+    }
+    default:
+        return TYPE_ANY;
+    }
+}
+
+void bindStmt(Frame *f, NameList *bound, struct ASTNode *s)
+{
+    if (!s)
+        return;
+    if (s->type == NODE_ASSIGN && (s->assign.isLet || !f->def))
+        addName(bound, s->assign.varName);
+    else if (s->type == NODE_FUNC_DEF)
+        addName(bound, s->funcDef.funcName);
+}
+
+void popNames(NameList *l, int count)
+{
+    while (l->count > count)
+        free(l->names[--l->count]);
+}
+
+typedef struct
+{
+    ProgramTypes *prog;
+    Frame *frame;
+    NameList bound;
+    int changed;
+    int calls; // this pass gathers the argument types of calls instead
+} TypeWalk;
+
+static void bindType(TypeWalk *w, const char *name, StaticType type)
+{
+    int i = findName(&w->frame->names, name);
+    if (i < 0)
+        return;
+    StaticType t = meet(w->frame->types[i], type);
+    if (t != w->frame->types[i])
+    {
+        w->frame->types[i] = t;
+        w->changed = 1;
+    }
+}
+
+static void typeExpr(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *e = *slot;
+    TypeWalk *w = (TypeWalk *)ctx;
+    if (!e)
+        return;
+    if (e->type == NODE_FUNC_CALL)
+    {
+        const char *buf = chunkBuffer(e);
+        if (buf && !w->calls)
+            bindType(w, buf, TYPE_ARRAY);
+        Frame *callee = w->calls ? calleeFrame(w->prog, e) : NULL;
+        for (int i = 0; callee && i < e->funcCall.argCount; ++i)
+        {
+            StaticType p = meet(callee->params[i], exprType(w->frame, e->funcCall.args[i], &w->bound));
+            w->changed |= p != callee->params[i];
+            callee->params[i] = p;
+        }
+    }
+    visitChildren(e, typeExpr, ctx);
+}
+
+static void typeStmt(TypeWalk *w, struct ASTNode *s);
+
+static void typeMaybe(TypeWalk *w, struct ASTNode *s, struct ASTNode *then)
+{
+    int mark = w->bound.count;
+    typeStmt(w, s);
+    typeStmt(w, then);
+    popNames(&w->bound, mark);
+}
+
+/* in evaluation order, so reads know which variables are bound */
+static void typeStmt(TypeWalk *w, struct ASTNode *s)
+{
+    if (!s)
+        return;
+    switch (s->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < s->block.count; ++i)
+            typeStmt(w, s->block.items[i]);
+        break;
+    case NODE_IF:
+        typeExpr(&s->ifstmt.cond, w);
+        typeMaybe(w, s->ifstmt.thenBlock, NULL);
+        typeMaybe(w, s->ifstmt.elseBlock, NULL);
+        break;
+    case NODE_FOR:
+        typeStmt(w, s->forstmt.init);
+        typeExpr(&s->forstmt.cond, w);
+        typeMaybe(w, s->forstmt.body, s->forstmt.incr);
+        break;
+    case NODE_WHILE:
+        typeExpr(&s->WhileStmt.cond, w);
+        typeMaybe(w, s->WhileStmt.body, NULL);
+        break;
+    case NODE_SWITCH:
+        typeExpr(&s->switchStmt.value, w);
+        for (int i = 0; i < s->switchStmt.bodyCount; ++i)
+            typeMaybe(w, s->switchStmt.bodies[i], NULL);
+        break;
+    case NODE_FOR_IN:
+    {
+        typeExpr(&s->forIn.start, w);
+        typeExpr(&s->forIn.end, w);
+        typeExpr(&s->forIn.step, w);
+        typeExpr(&s->forIn.array, w);
+        int mark = w->bound.count;
+        if (!w->calls)
+            bindType(w, s->forIn.varName, s->forIn.array ? TYPE_ANY : TYPE_NUMBER);
+        addName(&w->bound, s->forIn.varName);
+        typeStmt(w, s->forIn.body);
+        popNames(&w->bound, mark);
+        break;
+    }
+    case NODE_ASSIGN:
+        typeExpr(&s->assign.value, w);
+        if (!w->calls)
+            bindType(w, s->assign.varName, exprType(w->frame, s->assign.value, &w->bound));
+        bindStmt(w->frame, &w->bound, s);
+        break;
+    case NODE_FUNC_DEF:
+        if (!w->calls)
+            bindType(w, s->funcDef.funcName, TYPE_ANY);
+        bindStmt(w->frame, &w->bound, s);
+        break;
+    default:
+        typeExpr(&s, w);
+        break;
+    }
+}
+
+/* returns whether anything changed: with calls set, only the types of
+   the parameters of closed functions */
+static int walkFrame(ProgramTypes *t, Frame *f, int calls)
+{
+    int changed = 0;
+    TypeWalk w = {t, f, {0}, 1, calls};
+    struct ASTNode *body = f->def ? f->def->funcDef.body : t->root;
+    // optimistic: a variable only fed by itself and numbers is a number
+    while (w.changed)
+    {
+        w.changed = 0;
+        for (int i = 0; f->def && i < f->def->funcDef.paramCount; ++i)
+            addName(&w.bound, f->def->funcDef.params[i]);
+        typeStmt(&w, body);
+        freeNames(&w.bound);
+        w.bound = (NameList){0};
+        changed |= w.changed;
+        if (calls)
+            break;
+    }
+    return changed;
+}
+
+Frame *calleeFrame(ProgramTypes *t, struct ASTNode *call)
+{
+    for (int i = 0; i < t->functions.count; ++i)
+    {
+        Frame *f = &t->frames[i];
+        if (f->params && strcmp(f->def->funcDef.funcName, call->funcCall.funcName) == 0)
+            return call->funcCall.argCount == f->def->funcDef.paramCount ? f : NULL;
+    }
+    return NULL;
+}
+
+Frame *frameOf(ProgramTypes *t, struct ASTNode *def)
+{
+    for (int i = 0; def && i < t->functions.count; ++i)
+        if (t->functions.items[i] == def)
+            return &t->frames[i];
+    return &t->script;
+}
+
+static void countCalls(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    NameUse *u = (NameUse *)ctx;
+    if (!n)
+        return;
+    if (n->type == NODE_FUNC_CALL && strcmp(n->funcCall.funcName, u->name) == 0)
+        u->refs++;
+    visitChildren(n, countCalls, u);
+}
+
+int isClosed(ProgramTypes *t, struct ASTNode *def)
+{
+    const char *name = def->funcDef.funcName;
+    struct ASTNode *root = t->root;
+    int top = 0;
+    for (int i = 0; i < root->block.count; ++i)
+        top |= root->block.items[i] == def;
+    NameUse u = {name, 0, 0, 0};
+    scanFrame(&root, &u);
+    if (!top || u.decls != 1 || u.writes != 0 || findBuiltin(name) >= 0)
+        return 0;
+    for (int i = 0; i < t->functions.count; ++i)
+        if (functionBinding(t->functions.items[i], name) != SEES_GLOBAL)
+            return 0;
+    NameUse refs = {name, 0, 0, 0}, calls = {name, 0, 0, 0};
+    countRefs(&root, &refs);
+    countCalls(&root, &calls);
+    return refs.refs == calls.refs;
+}
+
+static void initFrame(ProgramTypes *t, Frame *f, struct ASTNode *def)
+{
+    memset(f, 0, sizeof(*f));
+    f->def = def;
+    NameList names = {0};
+    for (int i = 0; def && i < def->funcDef.paramCount; ++i)
+        appendName(&names, def->funcDef.params[i]);
+    scanBindings(def ? def->funcDef.body : t->root, &names);
+    for (int i = 0; i < names.count; ++i)
+        frameAddName(f, names.names[i], TYPE_NONE);
+    freeNames(&names);
+    if (def && def->funcDef.paramCount > 0 && isClosed(t, def))
+    {
+        f->params = (StaticType *)calloc(def->funcDef.paramCount, sizeof(StaticType));
+        if (!f->params)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+    }
+}
+
+/* types f from scratch under the current parameter types */
+static void typeFrame(ProgramTypes *t, Frame *f, int *fixed)
+{
+    for (int i = 0; i < f->names.count; ++i)
+        f->types[i] = fixed && fixed[i] ? TYPE_ANY : TYPE_NONE;
+    for (int i = 0; f->def && i < f->def->funcDef.paramCount; ++i)
+        f->types[findName(&f->names, f->def->funcDef.params[i])] = f->params ? f->params[i] : TYPE_ANY;
+    walkFrame(t, f, 0);
+}
+
+void inferProgram(ProgramTypes *t, struct ASTNode *root)
+{
+    memset(t, 0, sizeof(*t));
+    t->root = root;
+    collectFunctions(&root, &t->functions);
+    int n = t->functions.count;
+    t->frames = (Frame *)calloc(n ? n : 1, sizeof(Frame));
+    initFrame(t, &t->script, NULL);
+    for (int i = 0; i < n; ++i)
+    {
+        initFrame(t, &t->frames[i], t->functions.items[i]);
+        t->functionsReadChunks |= readsChunks(t->functions.items[i]->funcDef.body);
+    }
+
+    // a script variable some function assigns can hold anything
+    int *fixed = (int *)calloc(t->script.names.count ? t->script.names.count : 1, sizeof(int));
+    if (!t->frames || !fixed)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < t->script.names.count; ++i)
+        for (int k = 0; k < n; ++k)
+            fixed[i] |= functionBinding(t->functions.items[k], t->script.names.names[i]) == WRITES;
+
+    // a closed function's parameters hold what its calls pass, so the
+    // frames are retyped until no call passes anything new
+    int changed = 1;
+    while (changed)
+    {
+        typeFrame(t, &t->script, fixed);
+        for (int i = 0; i < n; ++i)
+            typeFrame(t, &t->frames[i], NULL);
+
+        changed = walkFrame(t, &t->script, 1);
+        for (int i = 0; i < n; ++i)
+            changed |= walkFrame(t, &t->frames[i], 1);
+    }
+    free(fixed);
+
+    // what no binding reaches is never read bound
+    for (int i = 0; i <= n; ++i)
+    {
+        Frame *f = i < n ? &t->frames[i] : &t->script;
+        for (int k = 0; k < f->names.count; ++k)
+            if (f->types[k] == TYPE_NONE)
+                f->types[k] = TYPE_ANY;
+    }
+}
+
+static void freeFrame(Frame *f)
+{
+    freeNames(&f->names);
+    free(f->types);
+    free(f->params);
+}
+
+void freeProgramTypes(ProgramTypes *t)
+{
+    freeFrame(&t->script);
+    for (int i = 0; i < t->functions.count; ++i)
+        freeFrame(&t->frames[i]);
+    free(t->frames);
+    free(t->functions.items);
+    memset(t, 0, sizeof(*t));
+}
+
+// ------------------- LOOPS -------------------
+
+static void findReadChunk(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n)
+        return;
+    if (n->type == NODE_FUNC_CALL && findBuiltin(n->funcCall.funcName) == BI_READ_CHUNK)
+        *(int *)ctx = 1;
+    visitChildren(n, findReadChunk, ctx);
+}
+
+int readsChunks(struct ASTNode *n)
+{
+    int found = 0;
+    findReadChunk(&n, &found);
+    return found;
+}
+
+static void scanEffects(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    LoopEffects *e = (LoopEffects *)ctx;
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_ASSIGN:
+        addName(&e->written, n->assign.varName);
+        break;
+    case NODE_FUNC_DEF:
+        addName(&e->written, n->funcDef.funcName);
+        return;
+    case NODE_FOR_IN:
+        addName(&e->written, n->forIn.varName);
+        break;
+    case NODE_FUNC_CALL:
+    {
+        int b = findBuiltin(n->funcCall.funcName);
+        if (b < 0)
+            e->calls = 1;
+        else if (b == BI_READ_CHUNK)
+            e->readsChunks = 1;
+        if (chunkBuffer(n))
+            addName(&e->written, chunkBuffer(n));
+        break;
+    }
+    default:
+        break;
+    }
+    visitChildren(n, scanEffects, e);
+}
+
+void scanLoop(struct ASTNode *loop, LoopEffects *e)
+{
+    if (loop->type == NODE_FOR)
+    {
+        scanEffects(&loop->forstmt.cond, e);
+        scanEffects(&loop->forstmt.incr, e);
+        scanEffects(&loop->forstmt.body, e);
+    }
+    else if (loop->type == NODE_FOR_IN)
+    {
+        // the header runs once, before the loop
+        addName(&e->written, loop->forIn.varName);
+        scanEffects(&loop->forIn.body, e);
+    }
+    else
+    {
+        scanEffects(&loop->WhileStmt.cond, e);
+        scanEffects(&loop->WhileStmt.body, e);
+    }
+}
+
+int isStable(ProgramTypes *t, Frame *f, NameList *bound, LoopEffects *e, const char *name)
+{
+    if (findName(&f->names, name) < 0 || findName(bound, name) < 0 || findName(&e->written, name) >= 0)
+        return 0;
+    for (int i = 0; !f->def && e->calls && i < t->functions.count; ++i)
+        if (functionBinding(t->functions.items[i], name) == WRITES)
+            return 0;
+    return 1;
+}
+
+int keepsLengths(ProgramTypes *t, LoopEffects *e)
+{
+    return !e->readsChunks && !(e->calls && t->functionsReadChunks);
+}
+
+static void walkFunction(FrameWalk *outer, struct ASTNode *def);
+static void walkBlock(FrameWalk *w, struct ASTNode *block);
+
+/* code that may not run: its bindings are not definite afterwards */
+static void walkMaybe(FrameWalk *w, struct ASTNode *s);
+
+static void walkStmt(FrameWalk *w, struct ASTNode *s)
+{
+    if (!s)
+        return;
+    switch (s->type)
+    {
+    case NODE_BLOCK:
+        walkBlock(w, s);
+        break;
+    case NODE_IF:
+        walkMaybe(w, s->ifstmt.thenBlock);
+        walkMaybe(w, s->ifstmt.elseBlock);
+        break;
+    case NODE_SWITCH:
+        for (int i = 0; i < s->switchStmt.bodyCount; ++i)
+            walkMaybe(w, s->switchStmt.bodies[i]);
+        break;
+    case NODE_FOR:
+        bindStmt(w->frame, &w->bound, s->forstmt.init);
+        addNode(&w->loops, s);
+        walkMaybe(w, s->forstmt.body);
+        w->loops.count--;
+        break;
+    case NODE_WHILE:
+        addNode(&w->loops, s);
+        walkMaybe(w, s->WhileStmt.body);
+        w->loops.count--;
+        break;
+    case NODE_FOR_IN:
+    {
+        int mark = w->bound.count;
+        addNode(&w->loops, s);
+        addName(&w->bound, s->forIn.varName);
+        walkStmt(w, s->forIn.body);
+        popNames(&w->bound, mark);
+        w->loops.count--;
+        break;
+    }
+    case NODE_FUNC_DEF:
+        walkFunction(w, s);
+        bindStmt(w->frame, &w->bound, s);
+        break;
+    default:
+        bindStmt(w->frame, &w->bound, s);
+        break;
+    }
+}
+
+static void walkMaybe(FrameWalk *w, struct ASTNode *s)
+{
+    int mark = w->bound.count;
+    walkStmt(w, s);
+    popNames(&w->bound, mark);
+}
+
+static void walkBlock(FrameWalk *w, struct ASTNode *block)
+{
+    for (int i = 0; i < block->block.count; ++i)
+    {
+        struct ASTNode *s = block->block.items[i];
+        if (s->type == NODE_FOR || s->type == NODE_WHILE || s->type == NODE_FOR_IN)
+            i += w->visit(w, block, i, w->ctx);
+        walkStmt(w, block->block.items[i]);
+    }
+}
+
+static void walkFunction(FrameWalk *outer, struct ASTNode *def)
+{
+    if (!def->funcDef.body || def->funcDef.body->type != NODE_BLOCK)
+        return;
+    FrameWalk w = {outer->types, frameOf(outer->types, def), {0}, {0}, outer->visit, outer->ctx};
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        addName(&w.bound, def->funcDef.params[i]);
+    walkBlock(&w, def->funcDef.body);
+    freeNames(&w.bound);
+    free(w.loops.items);
+}
+
+void walkLoops(ProgramTypes *t, LoopVisit visit, void *ctx)
+{
+    FrameWalk w = {t, &t->script, {0}, {0}, visit, ctx};
+    walkBlock(&w, t->root);
+    freeNames(&w.bound);
+    free(w.loops.items);
+}
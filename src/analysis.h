@@ -0,0 +1,146 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "ast.h"
+#include "scope.h"
+
+/* Tree walks and facts about names and types shared by the optimizer's
+   passes (optimize.c, inline.c, bounds.c, licm.c, vectorize.c, cse.c,
+   memoize.c, typecheck.c). Frames are the script and each function
+   body; a nested function body is a frame of its own. */
+
+typedef void (*Visit)(struct ASTNode **slot, void *ctx);
+
+/* calls visit on the slot of each direct child, NULL ones included */
+void visitChildren(struct ASTNode *n, Visit visit, void *ctx);
+
+typedef struct
+{
+    struct ASTNode **items;
+    int count, cap;
+} NodeList;
+
+void addNode(NodeList *l, struct ASTNode *n);
+void insertItems(struct ASTNode *block, int at, struct ASTNode **items, int count); // before items[at]
+/* the same numbers, variables, operators, calls and array reads */
+int sameExpr(struct ASTNode *a, struct ASTNode *b);
+
+void collectFunctions(struct ASTNode **slot, void *ctx); // every NODE_FUNC_DEF into a NodeList
+
+typedef struct
+{
+    const char *name;
+    int decls;  // let, const, function definitions
+    int writes; // plain assignments and readChunk buffers
+    int refs;   // everything that is not a declaration
+} NameUse;
+
+void scanFrame(struct ASTNode **slot, void *ctx); // decls and writes in one frame
+void countRefs(struct ASTNode **slot, void *ctx); // refs in every frame
+
+typedef enum
+{
+    SEES_GLOBAL, // the function only ever reads the script's variable
+    SHADOWS,     // it has a local of that name
+    WRITES       // it may assign the script's variable
+} FrameBinding;
+
+FrameBinding functionBinding(struct ASTNode *def, const char *name);
+
+// ------------------- TYPES -------------------
+
+/* what a variable can hold whenever it is bound; TYPE_NONE while no
+   binding has been seen */
+typedef enum
+{
+    TYPE_NONE,
+    TYPE_NUMBER, // ints, big ints and doubles
+    TYPE_STRING,
+    TYPE_ARRAY,
+    TYPE_ANY
+} StaticType;
+
+typedef struct
+{
+    struct ASTNode *def; // NULL: the script
+    NameList names;      // the frame's variables (for a function, its locals)
+    StaticType *types;
+    StaticType *params; // the types calls pass, when every call is known
+} Frame;
+
+typedef struct
+{
+    struct ASTNode *root;
+    NodeList functions; // every definition, frames[i] is functions.items[i]
+    Frame *frames;
+    Frame script;
+    int functionsReadChunks; // some function calls readChunk
+} ProgramTypes;
+
+/* A script variable some function assigns, a parameter of a function
+   that may be called indirectly and a local read before its function
+   binds it (it reads the global) can hold anything. */
+void inferProgram(ProgramTypes *t, struct ASTNode *root);
+void freeProgramTypes(ProgramTypes *t);
+Frame *frameOf(ProgramTypes *t, struct ASTNode *def); // def NULL: the script
+Frame *calleeFrame(ProgramTypes *t, struct ASTNode *call); // NULL unless its parameters are typed
+/* defined once by the script, bound by nothing else and only ever
+   called: every call site reaches this definition */
+int isClosed(ProgramTypes *t, struct ASTNode *def);
+
+int frameAddName(Frame *f, const char *name, StaticType type);
+StaticType nameType(Frame *f, const char *name); // TYPE_ANY outside the frame
+
+StaticType meet(StaticType a, StaticType b); // what holds one or the other
+
+/* of l op r; binopFails: it is a type error whatever values l and r hold */
+StaticType binopType(BinOpType op, StaticType l, StaticType r);
+int binopFails(BinOpType op, StaticType l, StaticType r);
+
+/* bound: the names definitely bound where e is evaluated */
+StaticType exprType(Frame *f, struct ASTNode *e, NameList *bound);
+void bindStmt(Frame *f, NameList *bound, struct ASTNode *s); // adds a statement's definite bindings
+void popNames(NameList *l, int count);                       // back to its first count names
+
+// ------------------- LOOPS -------------------
+
+/* what a for or while loop (its condition, body and increment, not a
+   for's init) can change while it runs */
+typedef struct
+{
+    NameList written; // names it binds
+    int calls;        // it calls user functions
+    int readsChunks;  // it calls readChunk
+} LoopEffects;
+
+void scanLoop(struct ASTNode *loop, LoopEffects *e);
+int readsChunks(struct ASTNode *n); // readChunk is called somewhere in n
+
+/* name is a variable of f bound before the loop that nothing in it
+   rebinds (bound: the names bound where the loop starts) */
+int isStable(ProgramTypes *t, Frame *f, NameList *bound, LoopEffects *e, const char *name);
+
+/* arrays only change length in readChunk (which resizes its buffer in
+   place): no array does while the loop runs */
+int keepsLengths(ProgramTypes *t, LoopEffects *e);
+
+typedef struct FrameWalk FrameWalk;
+
+/* called on block->block.items[at], a loop; returns the number of
+   statements it put in front of it */
+typedef int (*LoopVisit)(FrameWalk *w, struct ASTNode *block, int at, void *ctx);
+
+struct FrameWalk
+{
+    ProgramTypes *types;
+    Frame *frame;
+    NameList bound; // definitely bound at this point of the frame
+    NodeList loops; // the loops around it, outermost first
+    LoopVisit visit;
+    void *ctx;
+};
+
+/* visits the loops of every frame in order, each before the loops in it */
+void walkLoops(ProgramTypes *t, LoopVisit visit, void *ctx);
+
+#endif
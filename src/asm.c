@@ -0,0 +1,247 @@
+#include "asm.h"
+#include "scope.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+
+void emitByte(Asm *a, int b)
+{
+    if (a->len >= a->cap)
+        a->code = (unsigned char *)growArray(a->code, &a->cap, 1);
+    a->code[a->len++] = (unsigned char)b;
+}
+
+void emitInt32(Asm *a, int32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        emitByte(a, (int)(((uint32_t)v >> (8 * i)) & 0xff));
+}
+
+void emitInt64(Asm *a, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        emitByte(a, (int)((v >> (8 * i)) & 0xff));
+}
+
+void patchRel32(Asm *a, int at, int target)
+{
+    int32_t rel = target - (at + 4);
+    memcpy(a->code + at, &rel, 4);
+}
+
+void rex(Asm *a, int w, int reg, int index, int rm)
+{
+    int r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((rm & 8) >> 3);
+    if (r != 0x40)
+        emitByte(a, r);
+}
+
+/* op with a register r/m operand; two-byte opcodes are passed as 0x0fxx */
+void opRR(Asm *a, int w, int op, int reg, int rm)
+{
+    rex(a, w, reg, 0, rm);
+    if (op > 0xff)
+        emitByte(a, op >> 8);
+    emitByte(a, op & 0xff);
+    emitByte(a, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op with a [base + disp32] operand */
+void opRM(Asm *a, int w, int op, int reg, int base, int32_t disp)
+{
+    rex(a, w, reg, 0, base);
+    if (op > 0xff)
+        emitByte(a, op >> 8);
+    emitByte(a, op & 0xff);
+    emitByte(a, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        emitByte(a, 0x24);
+    emitInt32(a, disp);
+}
+
+/* op with a [base + index*8] operand; base is never rbp or r13 */
+void opRX(Asm *a, int op, int reg, int base, int index)
+{
+    rex(a, 1, reg, index, base);
+    emitByte(a, op);
+    emitByte(a, 0x04 | ((reg & 7) << 3));
+    emitByte(a, 0xc0 | ((index & 7) << 3) | (base & 7));
+}
+
+void movRR(Asm *a, int dst, int src)
+{
+    if (dst != src)
+        opRR(a, 1, 0x89, src, dst);
+}
+
+void load(Asm *a, int dst, int base, int32_t disp)
+{
+    opRM(a, 1, 0x8b, dst, base, disp);
+}
+
+void store(Asm *a, int base, int32_t disp, int src)
+{
+    opRM(a, 1, 0x89, src, base, disp);
+}
+
+void movImm(Asm *a, int dst, uint64_t v)
+{
+    if (v <= 0xffffffffu)
+    {
+        rex(a, 0, 0, 0, dst);
+        emitByte(a, 0xb8 | (dst & 7));
+        emitInt32(a, (int32_t)(uint32_t)v);
+    }
+    else
+    {
+        rex(a, 1, 0, 0, dst);
+        emitByte(a, 0xb8 | (dst & 7));
+        emitInt64(a, v);
+    }
+}
+
+void alu(Asm *a, int op, int dst, int src)
+{
+    opRR(a, 1, op, src, dst);
+}
+
+void aluImm(Asm *a, int w, int ext, int r, int32_t imm)
+{
+    rex(a, w, 0, 0, r);
+    emitByte(a, 0x81);
+    emitByte(a, 0xc0 | (ext << 3) | (r & 7));
+    emitInt32(a, imm);
+}
+
+void shiftImm(Asm *a, int ext, int r, int n)
+{
+    rex(a, 1, 0, 0, r);
+    emitByte(a, 0xc1);
+    emitByte(a, 0xc0 | (ext << 3) | (r & 7));
+    emitByte(a, n);
+}
+
+void setcc(Asm *a, int cc, int r8) // al or cl
+{
+    emitByte(a, 0x0f);
+    emitByte(a, 0x90 | cc);
+    emitByte(a, 0xc0 | r8);
+}
+
+void sse(Asm *a, int prefix, int op, int xmm, int rm, int w)
+{
+    emitByte(a, prefix);
+    rex(a, w, xmm, 0, rm);
+    emitByte(a, 0x0f);
+    emitByte(a, op);
+    emitByte(a, 0xc0 | ((xmm & 7) << 3) | (rm & 7));
+}
+
+
+int jcc(Asm *a, int cc)
+{
+    emitByte(a, 0x0f);
+    emitByte(a, 0x80 | cc);
+    emitInt32(a, 0);
+    return a->len - 4;
+}
+
+int jmp(Asm *a)
+{
+    emitByte(a, 0xe9);
+    emitInt32(a, 0);
+    return a->len - 4;
+}
+
+void patchHere(Asm *a, int at)
+{
+    patchRel32(a, at, a->len);
+}
+
+void pushReg(Asm *a, int r)
+{
+    if (r >= R8)
+        emitByte(a, 0x41);
+    emitByte(a, 0x50 | (r & 7));
+}
+
+void popReg(Asm *a, int r)
+{
+    if (r >= R8)
+        emitByte(a, 0x41);
+    emitByte(a, 0x58 | (r & 7));
+}
+
+/* sign-extends a small int's 48-bit payload */
+void untag(Asm *a, int r)
+{
+    shiftImm(a, EXT_SHL, r, 16);
+    shiftImm(a, EXT_SAR, r, 16);
+}
+
+/* compares r's top 16 bits with tag (clobbers rdx) */
+void testTag(Asm *a, int r, int tag)
+{
+    movRR(a, RDX, r);
+    shiftImm(a, EXT_SHR, RDX, 48);
+    aluImm(a, 0, EXT_CMP, RDX, tag);
+}
+
+// ------------------- EXECUTABLE MEMORY -------------------
+
+typedef struct
+{
+    void *mem;
+    size_t size;
+} CodeBlock;
+
+static CodeBlock *blocks = NULL;
+static int blockCount = 0, blockCap = 0;
+
+/* mapped writable, then switched to executable: never both at once */
+void *installCode(Asm *a)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)a->len + page - 1) / page * page;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+    memcpy(mem, a->code, a->len);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, size);
+        return NULL;
+    }
+    if (blockCount >= blockCap)
+        blocks = (CodeBlock *)growArray(blocks, &blockCap, sizeof(CodeBlock));
+    blocks[blockCount].mem = mem;
+    blocks[blockCount].size = size;
+    blockCount++;
+    return mem;
+}
+
+void freeCode(void)
+{
+    for (int i = 0; i < blockCount; ++i)
+        munmap(blocks[i].mem, blocks[i].size);
+    free(blocks);
+    blocks = NULL;
+    blockCount = blockCap = 0;
+}
+
+#else
+
+void *installCode(Asm *a)
+{
+    (void)a;
+    return NULL;
+}
+
+void freeCode(void)
+{
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdint.h>
+
+/* x86-64 code buffer and the few instruction encodings the JITs use.
+   Operands are register numbers; memory operands are [base + disp32]
+   or [base + index*8]. */
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && !defined(SLANG_NO_JIT)
+#define JIT_SUPPORTED 1
+#endif
+
+typedef struct
+{
+    unsigned char *code;
+    int len, cap;
+} Asm;
+
+enum
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum
+{
+    CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_A = 0x7, CC_P = 0xa, CC_NP = 0xb, CC_L = 0xc, CC_GE = 0xd,
+    CC_LE = 0xe, CC_G = 0xf
+};
+
+/* opcode-extension fields of the 0x81 (immediate) and 0xc1 (shift) groups */
+enum
+{
+    EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_CMP = 7,
+    EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7
+};
+
+/* register-to-register ALU forms: op r/m64, r64 */
+enum
+{
+    ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_CMP = 0x39
+};
+
+void emitByte(Asm *a, int b);
+void emitInt32(Asm *a, int32_t v);
+void emitInt64(Asm *a, uint64_t v);
+void patchRel32(Asm *a, int at, int target);
+void rex(Asm *a, int w, int reg, int index, int rm);
+void opRR(Asm *a, int w, int op, int reg, int rm);
+void opRM(Asm *a, int w, int op, int reg, int base, int32_t disp);
+void opRX(Asm *a, int op, int reg, int base, int index);
+void movRR(Asm *a, int dst, int src);
+void load(Asm *a, int dst, int base, int32_t disp);
+void store(Asm *a, int base, int32_t disp, int src);
+void movImm(Asm *a, int dst, uint64_t v);
+void alu(Asm *a, int op, int dst, int src);
+void aluImm(Asm *a, int w, int ext, int r, int32_t imm);
+void shiftImm(Asm *a, int ext, int r, int n);
+void setcc(Asm *a, int cc, int r8); // al or cl
+void sse(Asm *a, int prefix, int op, int xmm, int rm, int w);
+int jcc(Asm *a, int cc);
+int jmp(Asm *a);
+void patchHere(Asm *a, int at);
+void pushReg(Asm *a, int r);
+void popReg(Asm *a, int r);
+void untag(Asm *a, int r);
+void testTag(Asm *a, int r, int tag);
+
+#define MOVQ_TO_XMM(as, x, r) sse(as, 0x66, 0x6e, x, r, 1)
+#define MOVQ_FROM_XMM(as, r, x) sse(as, 0x66, 0x7e, x, r, 1)
+#define CVTSI2SD(as, x, r) sse(as, 0xf2, 0x2a, x, r, 1)
+#define UCOMISD(as, x, y) sse(as, 0x66, 0x2e, x, y, 0)
+#define XORPD(as, x) sse(as, 0x66, 0x57, x, x, 0)
+
+/* copies the code into executable pages; NULL when that fails */
+void *installCode(Asm *a);
+void freeCode(void); // unmaps everything installCode returned
+
+#endif
@@ -1,4 +1,5 @@
 #include "ast.h"
+#include "memo.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,6 +24,10 @@ void freeNode(struct ASTNode *node)
         freeNode(node->binop.left);
         freeNode(node->binop.right);
         break;
+    case NODE_LOGICAL:
+        freeNode(node->logical.left);
+        freeNode(node->logical.right);
+        break;
     case NODE_ASSIGN:
         freeNode(node->assign.value);
         break;
@@ -53,9 +58,16 @@ void freeNode(struct ASTNode *node)
         freeNode(node->forstmt.incr);
         freeNode(node->forstmt.body);
         break;
+    case NODE_FOR_IN:
+        freeNode(node->forIn.start);
+        freeNode(node->forIn.end);
+        freeNode(node->forIn.step);
+        freeNode(node->forIn.array);
+        freeNode(node->forIn.body);
+        break;
     case NODE_STR:
-        if (node->string)
-            free(node->string);
+        if (node->str.text)
+            free(node->str.text);
         break;
     case NODE_ARRAY:
         if (node->ArrayNode.elements)
@@ -83,13 +95,94 @@ void freeNode(struct ASTNode *node)
             free(node->funcDef.params);
         }
         freeNode(node->funcDef.body);
+        freeMemoTable(node->funcDef.memo);
         break;
     case NODE_RETURN:
         freeNode(node->returnStmt.value);
         break;
+    case NODE_SWITCH:
+        freeNode(node->switchStmt.value);
+        for (int i = 0; i < node->switchStmt.bodyCount; ++i)
+            freeNode(node->switchStmt.bodies[i]);
+        free(node->switchStmt.bodies);
+        freeCases(&node->switchStmt.cases);
+        break;
     default:
         break;
     }
 
     free(node);
 }
+
+// jump tables: at most this many entries, a quarter of them labels
+#define MAX_CASE_SPAN 4096
+
+int indexCases(CaseTable *t)
+{
+    // insertion sort: switches are short, and usually written in order
+    for (int i = 1; i < t->count; ++i)
+    {
+        int64_t label = t->labels[i];
+        int target = t->targets[i], j = i;
+        for (; j > 0 && t->labels[j - 1] > label; --j)
+        {
+            t->labels[j] = t->labels[j - 1];
+            t->targets[j] = t->targets[j - 1];
+        }
+        t->labels[j] = label;
+        t->targets[j] = target;
+    }
+    for (int i = 1; i < t->count; ++i)
+        if (t->labels[i] == t->labels[i - 1])
+            return 0;
+
+    free(t->table);
+    t->table = NULL;
+    t->span = 0;
+    if (t->count == 0)
+        return 1;
+    int64_t span = t->labels[t->count - 1] - t->labels[0] + 1;
+    if (span > MAX_CASE_SPAN || span > 4 * (int64_t)t->count)
+        return 1;
+    t->span = (int)span;
+    t->table = malloc(sizeof(int) * t->span);
+    for (int i = 0; i < t->span; ++i)
+        t->table[i] = t->otherwise;
+    for (int i = 0; i < t->count; ++i)
+        t->table[t->labels[i] - t->labels[0]] = t->targets[i];
+    return 1;
+}
+
+void copyCases(CaseTable *to, const CaseTable *from)
+{
+    *to = *from;
+    int n = from->count ? from->count : 1;
+    to->labels = malloc(sizeof(int64_t) * n);
+    to->targets = malloc(sizeof(int) * n);
+    memcpy(to->labels, from->labels, sizeof(int64_t) * from->count);
+    memcpy(to->targets, from->targets, sizeof(int) * from->count);
+    to->table = NULL;
+    indexCases(to);
+}
+
+void freeCases(CaseTable *t)
+{
+    free(t->labels);
+    free(t->targets);
+    free(t->table);
+}
+
+struct ASTNode *updateOperand(struct ASTNode *stmt)
+{
+    struct ASTNode *v = stmt->type == NODE_ASSIGN ? stmt->assign.value : stmt->arrAssign.value;
+    if (stmt->type == NODE_ASSIGN ? !stmt->assign.update : !stmt->arrAssign.update)
+        return NULL;
+    if (!v || v->type != NODE_BINOP)
+        return NULL;
+    struct ASTNode *l = v->binop.left;
+    if (stmt->type == NODE_ASSIGN)
+        return l->type == NODE_VAR && strcmp(l->varName, stmt->assign.varName) == 0 ? v->binop.right : NULL;
+    return l->type == NODE_ARR_ACCESS && strcmp(l->ArrAccessNode.varName, stmt->arrAssign.varName) == 0
+               ? v->binop.right
+               : NULL;
+}
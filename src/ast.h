@@ -2,18 +2,22 @@
 #define AST_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "value.h"
 
 typedef enum
 {
     NODE_NUM,
     NODE_VAR,
     NODE_BINOP,
+    NODE_LOGICAL,
     NODE_ASSIGN,
     NODE_PRINT,
     NODE_BLOCK,
     NODE_IF,
     NODE_FOR,
     NODE_WHILE,
+    NODE_FOR_IN,
     NODE_STR,
     NODE_ARRAY,
     NODE_ARR_ACCESS,
@@ -21,6 +25,9 @@ typedef enum
     NODE_FUNC_CALL,
     NODE_FUNC_DEF,
     NODE_RETURN,
+    NODE_BREAK,
+    NODE_CONTINUE,
+    NODE_SWITCH,
 } NodeType;
 
 typedef enum
@@ -37,15 +44,55 @@ typedef enum
     OP_GE
 } BinOpType;
 
+typedef enum
+{
+    LOGIC_AND,
+    LOGIC_OR,
+    LOGIC_NOT
+} LogicOpType;
+
+/* the labels of a switch, ascending, each with the case it selects: an
+   index into its bodies, or a code offset once compiled. Dense labels
+   also get a jump table, by label - labels[0]. See selectCase(). */
+typedef struct
+{
+    int64_t *labels;
+    int *targets;
+    int count;
+    int *table;    // NULL: labels are searched
+    int span;      // entries of table
+    int otherwise; // selected when no label matches: default, or -1
+} CaseTable;
+
 typedef struct ASTNode
 {
     NodeType type;
+    /* the specialized form the tree walker has rewritten this node to,
+       with its operands (see interpreter.c) */
+    unsigned char spec;
+    unsigned char deopts;
+    int slot;    // symbol slot relative to the current frame
+    Value cache; // NODE_NUM: the literal's value
+    /* inline cache: the symbol table entry the node's name resolved to,
+       valid while the table's epoch is still icEpoch */
+    int icIndex;
+    uint64_t icEpoch;
     union
     {
-        double number;    // NODE_NUM
-        char *string;     // NODE_STR
+        struct
+        {
+            double value;
+            int64_t intValue;
+            int isInt; // integer literal that fits in int64
+        } num; // NODE_NUM
         char varName[64]; // NODE_VAR
 
+        struct
+        {
+            char *text;
+            struct SlString *value; // interned on first evaluation
+        } str;                      // NODE_STR
+
         struct
         {
             BinOpType op;
@@ -53,10 +100,20 @@ typedef struct ASTNode
             struct ASTNode *right;
         } binop;
 
+        struct
+        {
+            LogicOpType op;
+            struct ASTNode *left;
+            struct ASTNode *right; // NULL for !; runs only when left does not decide
+        } logical;
+
         struct
         {
             char varName[64];
             struct ASTNode *value;
+            int isLet;   // `let` declares in the current function frame
+            int isConst; // `const`: a `let` the program never assigns again
+            int update;  // x += v, x++ ...: value is x <op> v (see updateOperand)
         } assign;
 
         struct
@@ -85,6 +142,15 @@ typedef struct ASTNode
             struct ASTNode *body;
         } WhileStmt;
         struct
+        {
+            char varName[64];
+            struct ASTNode *start; // range(): NULL when omitted
+            struct ASTNode *end;
+            struct ASTNode *step;  // NULL when omitted
+            struct ASTNode *array; // for x in array; NULL for range()
+            struct ASTNode *body;
+        } forIn;
+        struct
         {
             struct ASTNode **exprs;
             int count;
@@ -100,12 +166,17 @@ typedef struct ASTNode
             char varName[32];
             struct ASTNode *index;
             struct ASTNode *value;
+            int inBounds;   // optimizer: index is a small int in range of an array
+            int knownArray; // optimizer: the name holds an array here
+            int update;     // a[i] += v ...: value is a[<copy of i>] <op> v
         } arrAssign;
 
         struct
         {
             char varName[32];
             struct ASTNode *index;
+            int inBounds;
+            int knownArray;
         } ArrAccessNode;
 
         struct
@@ -114,6 +185,8 @@ typedef struct ASTNode
             char **params;
             int paramCount;
             struct ASTNode *body;
+            int memoize;            // written with @memo
+            struct MemoTable *memo; // optimizer: its calls are memoized
         } funcDef;
 
         struct
@@ -121,6 +194,13 @@ typedef struct ASTNode
             struct ASTNode *value;
         } returnStmt;
         struct
+        {
+            struct ASTNode *value;
+            struct ASTNode **bodies; // blocks, in source order
+            int bodyCount;
+            CaseTable cases;
+        } switchStmt;
+        struct
         {
             char *funcName;
             struct ASTNode **args;
@@ -133,4 +213,15 @@ typedef struct ASTNode
 struct ASTNode *newNode(NodeType type);
 void freeNode(struct ASTNode *node);
 
+/* sorts the labels and builds the jump table when they are dense;
+   0 when two labels are equal */
+int indexCases(CaseTable *t);
+void copyCases(CaseTable *to, const CaseTable *from);
+void freeCases(CaseTable *t);
+
+/* v when stmt is an update x op= v or a[i] op= v whose value still reads
+   its target (x, or a at the same index): engines read the element or
+   binding they store to, once. NULL for plain assignments. */
+struct ASTNode *updateOperand(struct ASTNode *stmt);
+
 #endif
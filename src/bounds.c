@@ -0,0 +1,314 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bounds-check elimination. A counted loop
+
+       for (let i = <start>; i < <limit>; i = i + <int above 0>)
+
+   whose condition and body never bind i keeps i a small int, no less
+   than its start (an int, or an enclosing counter plus one), below the
+   limit whenever the body runs. When
+   the limit is length(a) less constants and counters of enclosing loops
+   (which are never negative), and a stays the same array of the same
+   length while the loop runs, a[i + c] in the body is in range for
+   small enough c. So is b[i + c] when the limit is a constant and every
+   binding of b is one array literal, in a program that never calls
+   readChunk. Such accesses are marked inBounds and the engines skip
+   their checks: the loop condition is the one range check. */
+
+typedef struct
+{
+    struct ASTNode *loop;
+    const char *var;
+    int64_t low;       // its first value: it only grows
+    const char *array; // var + slack < length(array) in the body...
+    int64_t slack;
+    int64_t limit; // ...or, with array NULL, var < limit
+} Counter;
+
+static Counter *counters;
+static int counterCount, counterCap;
+static int programReadsChunks;
+
+#define MAX_OFFSET 1000000 // larger constants are not worth proving
+
+static Counter *findCounter(struct ASTNode *loop)
+{
+    for (int i = 0; i < counterCount; ++i)
+        if (counters[i].loop == loop)
+            return &counters[i];
+    return NULL;
+}
+
+static int isSmallInt(struct ASTNode *n, int64_t *out)
+{
+    if (!n || n->type != NODE_NUM || !n->num.isInt || n->num.intValue < -MAX_OFFSET ||
+        n->num.intValue > MAX_OFFSET)
+        return 0;
+    *out = n->num.intValue;
+    return 1;
+}
+
+static int isVar(struct ASTNode *n, const char *name)
+{
+    return n && n->type == NODE_VAR && strcmp(n->varName, name) == 0;
+}
+
+/* the counter of a loop around the one being visited, for name */
+static Counter *enclosingCounter(FrameWalk *w, const char *name)
+{
+    for (int i = w->loops.count - 1; i >= 0; --i)
+    {
+        Counter *c = findCounter(w->loops.items[i]);
+        if (c && strcmp(c->var, name) == 0)
+            return c;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    FrameWalk *walk;
+    LoopEffects *effects;
+    const char *array;
+    int64_t constant;
+    int terms;
+} Limit;
+
+/* adds sign * e to the limit; 0 when e is not of the form above */
+static int addTerms(Limit *l, struct ASTNode *e, int sign)
+{
+    int64_t k;
+    if (++l->terms > 8)
+        return 0;
+    if (isSmallInt(e, &k))
+    {
+        l->constant += sign * k;
+        return 1;
+    }
+    switch (e->type)
+    {
+    case NODE_BINOP:
+        if (e->binop.op != OP_ADD && e->binop.op != OP_SUB)
+            return 0;
+        return addTerms(l, e->binop.left, sign) &&
+               addTerms(l, e->binop.right, e->binop.op == OP_SUB ? -sign : sign);
+    case NODE_FUNC_CALL:
+        if (sign < 0 || l->array || findBuiltin(e->funcCall.funcName) != BI_LENGTH ||
+            e->funcCall.argCount != 1 || e->funcCall.args[0]->type != NODE_VAR)
+            return 0;
+        l->array = e->funcCall.args[0]->varName;
+        return 1;
+    case NODE_VAR:
+    {
+        // less a counter of an enclosing loop that this one leaves alone
+        Counter *c = sign < 0 ? enclosingCounter(l->walk, e->varName) : NULL;
+        return c && c->low >= 0 && findName(&l->effects->written, e->varName) < 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+/* the let and const declarations of one frame */
+static void collectLets(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n || n->type == NODE_FUNC_DEF)
+        return;
+    if (n->type == NODE_ASSIGN && n->assign.isLet)
+        addNode((NodeList *)ctx, n);
+    visitChildren(n, collectLets, ctx);
+}
+
+/* name is only ever bound, in frame f, to array literals of one length */
+static int fixedLength(FrameWalk *w, const char *name)
+{
+    if (programReadsChunks)
+        return -1;
+    Frame *f = w->frame;
+    struct ASTNode *body = f->def ? f->def->funcDef.body : w->types->root;
+    NameUse u = {name, 0, 0, 0};
+    scanFrame(&body, &u);
+    if (u.decls != 1 || u.writes != 0 || findName(&f->names, name) < 0)
+        return -1;
+    for (int i = 0; f->def && i < f->def->funcDef.paramCount; ++i)
+        if (strcmp(f->def->funcDef.params[i], name) == 0)
+            return -1;
+    for (int i = 0; !f->def && i < w->types->functions.count; ++i)
+        if (functionBinding(w->types->functions.items[i], name) == WRITES)
+            return -1;
+    NodeList lets = {0};
+    collectLets(&body, &lets);
+    int length = -1;
+    for (int i = 0; i < lets.count; ++i)
+    {
+        struct ASTNode *let = lets.items[i];
+        if (strcmp(let->assign.varName, name) == 0 && let->assign.value &&
+            let->assign.value->type == NODE_ARRAY)
+            length = let->assign.value->ArrayNode.count;
+    }
+    free(lets.items);
+    return length;
+}
+
+/* an int literal, or a counter of an enclosing loop plus one */
+static int lowerBound(FrameWalk *w, struct ASTNode *e, int64_t *low)
+{
+    if (isSmallInt(e, low))
+        return 1;
+    int64_t c = 0;
+    const char *name = NULL;
+    if (e->type == NODE_VAR)
+        name = e->varName;
+    else if (e->type == NODE_BINOP && e->binop.op == OP_ADD && e->binop.left->type == NODE_VAR &&
+             isSmallInt(e->binop.right, &c))
+        name = e->binop.left->varName;
+    Counter *k = name ? enclosingCounter(w, name) : NULL;
+    if (!k)
+        return 0;
+    *low = k->low + c;
+    return 1;
+}
+
+/* the loop's counter, when it is one; effects: the whole loop's */
+static int findLimit(FrameWalk *w, struct ASTNode *loop, LoopEffects *effects, Counter *out)
+{
+    struct ASTNode *init = loop->forstmt.init, *cond = loop->forstmt.cond, *incr = loop->forstmt.incr;
+    int64_t step;
+    if (!init || init->type != NODE_ASSIGN || !(init->assign.isLet || !w->frame->def) ||
+        !init->assign.value || !lowerBound(w, init->assign.value, &out->low))
+        return 0;
+    const char *var = init->assign.varName;
+    if (!cond || cond->type != NODE_BINOP || cond->binop.op != OP_LT || !isVar(cond->binop.left, var))
+        return 0;
+    if (!incr || incr->type != NODE_ASSIGN || strcmp(incr->assign.varName, var) != 0 ||
+        !incr->assign.value || incr->assign.value->type != NODE_BINOP || incr->assign.value->binop.op != OP_ADD)
+        return 0;
+    struct ASTNode *l = incr->assign.value->binop.left, *r = incr->assign.value->binop.right;
+    if (!((isVar(l, var) && isSmallInt(r, &step)) || (isVar(r, var) && isSmallInt(l, &step))) || step <= 0)
+        return 0;
+
+    // nothing else binds it: not the condition, the body or a call
+    NameUse u = {var, 0, 0, 0};
+    scanFrame(&loop->forstmt.cond, &u);
+    scanFrame(&loop->forstmt.body, &u);
+    if (u.decls || u.writes)
+        return 0;
+    for (int i = 0; !w->frame->def && effects->calls && i < w->types->functions.count; ++i)
+        if (functionBinding(w->types->functions.items[i], var) == WRITES)
+            return 0;
+
+    Limit limit = {w, effects, NULL, 0, 0};
+    if (!addTerms(&limit, cond->binop.right, 1))
+        return 0;
+    out->loop = loop;
+    out->var = var;
+    out->array = NULL;
+    out->limit = limit.constant;
+    if (limit.array)
+    {
+        if (!isStable(w->types, w->frame, &w->bound, effects, limit.array) ||
+            nameType(w->frame, limit.array) != TYPE_ARRAY || !keepsLengths(w->types, effects))
+            return 0;
+        out->array = limit.array;
+        out->slack = -limit.constant;
+    }
+    return 1;
+}
+
+/* the counter and offset of an index counter + c */
+static Counter *indexOffset(FrameWalk *w, Counter *own, struct ASTNode *index, int64_t *c)
+{
+    const char *name = NULL;
+    *c = 0;
+    if (index->type == NODE_VAR)
+        name = index->varName;
+    else if (index->type == NODE_BINOP && (index->binop.op == OP_ADD || index->binop.op == OP_SUB))
+    {
+        struct ASTNode *l = index->binop.left, *r = index->binop.right;
+        if (l->type == NODE_VAR && isSmallInt(r, c))
+            name = l->varName;
+        else if (index->binop.op == OP_ADD && r->type == NODE_VAR && isSmallInt(l, c))
+            name = r->varName;
+        if (index->binop.op == OP_SUB)
+            *c = -*c;
+    }
+    if (!name)
+        return NULL;
+    return strcmp(own->var, name) == 0 ? own : enclosingCounter(w, name);
+}
+
+static int inRange(FrameWalk *w, Counter *own, const char *array, struct ASTNode *index)
+{
+    int64_t c;
+    Counter *k = indexOffset(w, own, index, &c);
+    if (!k || k->low + c < 0)
+        return 0;
+    if (k->array)
+        return strcmp(k->array, array) == 0 && c <= k->slack;
+    // bound before the loop: every binding of it is the same literal
+    if (findName(&w->bound, array) < 0)
+        return 0;
+    int length = fixedLength(w, array);
+    return length >= 0 && k->limit + c <= length;
+}
+
+typedef struct
+{
+    FrameWalk *walk;
+    Counter *own;
+} Marking;
+
+static void markAccesses(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Marking *m = (Marking *)ctx;
+    if (!n || n->type == NODE_FUNC_DEF)
+        return;
+    if (n->type == NODE_ARR_ACCESS && !n->ArrAccessNode.inBounds)
+        n->ArrAccessNode.inBounds = inRange(m->walk, m->own, n->ArrAccessNode.varName, n->ArrAccessNode.index);
+    else if (n->type == NODE_ARR_ASSIGN && !n->arrAssign.inBounds)
+        n->arrAssign.inBounds = inRange(m->walk, m->own, n->arrAssign.varName, n->arrAssign.index);
+    visitChildren(n, markAccesses, ctx);
+}
+
+static int checkLoop(FrameWalk *w, struct ASTNode *block, int at, void *ctx)
+{
+    (void)ctx;
+    struct ASTNode *loop = block->block.items[at];
+    if (loop->type != NODE_FOR)
+        return 0;
+    LoopEffects effects = {{0}, 0, 0};
+    Counter c;
+    int mark = w->bound.count;
+    bindStmt(w->frame, &w->bound, loop->forstmt.init);
+    scanLoop(loop, &effects);
+    if (findLimit(w, loop, &effects, &c))
+    {
+        if (counterCount >= counterCap)
+            counters = (Counter *)growArray(counters, &counterCap, sizeof(Counter));
+        counters[counterCount++] = c;
+        Marking m = {w, &counters[counterCount - 1]};
+        markAccesses(&loop->forstmt.body, &m);
+    }
+    popNames(&w->bound, mark);
+    freeNames(&effects.written);
+    return 0;
+}
+
+void eliminateBoundsChecks(struct ASTNode *root)
+{
+    ProgramTypes types;
+    inferProgram(&types, root);
+    programReadsChunks = readsChunks(root);
+    walkLoops(&types, checkLoop, NULL);
+    freeProgramTypes(&types);
+    free(counters);
+    counters = NULL;
+    counterCount = counterCap = 0;
+}
@@ -0,0 +1,115 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include "value.h"
+#include "ast.h"
+
+/* Instruction set of the VM.
+   Each instruction is an opcode word followed by its int32 operands.
+   Variables are resolved at compile time to a local slot (function
+   frame) or a global slot. A name that can be both - a function local
+   that shadows a global only once its `let` has run - is addressed by
+   the pair (local, global) and checked at run time, exactly like the
+   tree walker's frame-then-globals lookup. */
+#define OPCODES(X)                                                   \
+    X(BC_CONST)             /* k        push consts[k] */            \
+    X(BC_POP)               /*          drop top */                  \
+    X(BC_DUP)               /*          push a copy of top */        \
+    X(BC_GET_LOCAL)         /* s */                                  \
+    X(BC_SET_LOCAL)         /* s        pops */                      \
+    X(BC_GET_GLOBAL)        /* g */                                  \
+    X(BC_SET_GLOBAL)        /* g        pops */                      \
+    X(BC_GET_VAR)           /* s g      local if bound, else global */ \
+    X(BC_SET_VAR)           /* s g */                                \
+    X(BC_PEEK_VAR)          /* s g      no error when unbound */     \
+    X(BC_ADD)                                                        \
+    X(BC_SUB)                                                        \
+    X(BC_MUL)                                                        \
+    X(BC_DIV)                                                        \
+    X(BC_EQ)                                                         \
+    X(BC_NE)                                                         \
+    X(BC_LT)                                                         \
+    X(BC_LE)                                                         \
+    X(BC_GT)                                                         \
+    X(BC_GE)                                                         \
+    X(BC_ADD_CONST)         /* k        top + consts[k] */           \
+    X(BC_SUB_CONST)         /* k */                                  \
+    X(BC_JUMP)              /* off      relative to the next op */   \
+    X(BC_JUMP_IF_FALSE)     /* off      pops the condition */        \
+    X(BC_LOOP)              /* off      backward jump, GC safe point */ \
+    X(BC_JUMP_IF_NOT_EQ)    /* off      compare and branch */        \
+    X(BC_JUMP_IF_NOT_NE)                                             \
+    X(BC_JUMP_IF_NOT_LT)                                             \
+    X(BC_JUMP_IF_NOT_LE)                                             \
+    X(BC_JUMP_IF_NOT_GT)                                             \
+    X(BC_JUMP_IF_NOT_GE)                                             \
+    X(BC_SWITCH)            /* t        pops; jumps by the case switches[t] selects */ \
+    X(BC_FOR_RANGE)         /* s off    [start end step] -> []: locals s.. get */ \
+                            /*          the value, last and step; jumps if none */ \
+    X(BC_FOR_EACH)          /* s off    [array] -> []: the index, last, 1, array */ \
+    X(BC_FOR_NEXT)          /* s off    jumps once local s is last, else adds the step */ \
+    X(BC_ARRAY)             /* n        pops n elements */           \
+    X(BC_INDEX_LOCAL)       /* s        [idx] -> [elem] */           \
+    X(BC_INDEX_GLOBAL)      /* g */                                  \
+    X(BC_INDEX_VAR)         /* s g */                                \
+    X(BC_STORE_INDEX_LOCAL) /* s        [idx value] -> [] */         \
+    X(BC_STORE_INDEX_GLOBAL) /* g */                                 \
+    X(BC_STORE_INDEX_VAR)   /* s g */                                \
+    X(BC_ELEMENT_LOCAL)     /* s        an index proved in range */  \
+    X(BC_ELEMENT_GLOBAL)    /* g */                                  \
+    X(BC_STORE_ELEMENT_LOCAL) /* s */                                \
+    X(BC_STORE_ELEMENT_GLOBAL) /* g */                               \
+    X(BC_PRINT)             /* last     pops, then ' ' or '\n' */    \
+    X(BC_PRINT_NEWLINE)                                              \
+    X(BC_FUNCTION)          /* p        new function for protos[p] */ \
+    X(BC_CALLEE)            /* s g argc skip  push checked callee */ \
+    X(BC_CALL)              /* argc */                               \
+    X(BC_TAIL_CALL)         /* argc     return f(...) in this frame */ \
+    X(BC_RETURN)                                                     \
+    X(BC_MEMO_FIND)         /* s        args to s..: return a known result */ \
+    X(BC_MEMO_STORE)        /* s        record top for the args at s */ \
+    X(BC_BUILTIN)           /* b argc */                             \
+    X(BC_LENGTH)                                                     \
+    X(BC_READ_CHUNK)        /* isVar    [h buf max] -> [n buf] */    \
+    X(BC_ARITY_ERROR)       /* b argc */                             \
+    X(BC_HALT)
+
+#define OPCODE_ENUM(op) op,
+typedef enum
+{
+    OPCODES(OPCODE_ENUM) BC_COUNT
+} OpCode;
+#undef OPCODE_ENUM
+
+/* compiled function (or the top-level script) */
+typedef struct Proto
+{
+    struct ASTNode *def; // NODE_FUNC_DEF, NULL for the script
+    int32_t *code;
+    int count, cap;
+    Value *consts;
+    int constCount, constCap;
+    int arity;
+    int localCount; // parameters first
+    char **localNames;
+    CaseTable *switches; // targets are offsets from the op after BC_SWITCH
+    int switchCount, switchCap;
+    // method JIT (jit.c)
+    int calls;    // counted toward jitThreshold
+    int jitState; // JitState
+    int deopts;
+    void *native; // machine code once JIT_READY
+    // tracing JIT (trace.c)
+    struct TraceLoop *loops; // per pc, used at loop headers; NULL until one is hot
+} Proto;
+
+typedef struct
+{
+    Proto **protos; // protos[0] is the script
+    int protoCount;
+    char **globalNames;
+    int globalCount;
+} Program;
+
+#endif
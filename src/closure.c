@@ -0,0 +1,1306 @@
+#include "closure.h"
+#include "scope.h"
+#include "object.h"
+#include "runtime.h"
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#define STACK_MAX (1 << 20)
+#define FRAMES_MAX 4096
+
+typedef struct Thunk Thunk;
+typedef struct ThunkFunction ThunkFunction;
+typedef Value (*EvalFn)(Thunk *t, Value *base);
+typedef int (*TestFn)(Thunk *t, Value *base);
+typedef int (*ExecFn)(Thunk *t, Value *base); // an ExecStatus
+
+/* how a statement finished; a loop stops at EXEC_BREAK, a call at EXEC_RETURN */
+enum
+{
+    EXEC_NORMAL,
+    EXEC_RETURN,
+    EXEC_BREAK,
+    EXEC_CONTINUE
+};
+
+/* A compiled node. base is the running function's frame (parameters
+   first); the fields a thunk reads depend on its function:
+     variables, calls, array access: a = local slot, b = global slot
+       (-1 when the name cannot be one), c = local slot of the index
+     binary operators: a, b = local slots of the operands, k = constant
+     builtins: a = builtin id (c for an arity error) */
+struct Thunk
+{
+    EvalFn eval; // expressions
+    TestFn test; // conditions; fused for comparisons
+    ExecFn exec; // statements
+    int a, b, c;
+    Value k;
+    const char *name; // for error messages
+    Thunk *x, *y, *z, *w;
+    Thunk **items; // arguments, array elements, block statements
+    int count;
+    struct ASTNode *def; // function definitions
+    const CaseTable *cases; // switches: targets index items
+    ThunkFunction *fn;
+    Thunk *next; // every thunk, for freeing
+};
+
+struct ThunkFunction
+{
+    Thunk *body;
+    int localCount; // parameters first
+    MemoTable *memo; // its definition's, when it is memoized
+    ThunkFunction *next;
+};
+
+static Thunk *allThunks = NULL;
+static ThunkFunction *allFunctions = NULL;
+static NameList globalNames; // every global slot
+static NameList globalBound; // names the script itself can bind
+static Scope *scope = NULL;   // while compiling
+
+static Value *globals = NULL;
+static Value *stack = NULL;
+static Value *stackTop = NULL;
+static int depth = 0; // active user function calls
+static Value returnValue;
+static ThunkFunction *tailCallee; // set by a return that makes a tail call
+static jmp_buf abortRun;
+
+// ------------------- HELPERS -------------------
+
+static Value undefinedVariable(const char *name)
+{
+    printf("Error: variable '%s' not found\n", name);
+    return NUM_VAL(0.0);
+}
+
+static void stackOverflow(void)
+{
+    printf("Runtime Error: stack overflow\n");
+    longjmp(abortRun, 1);
+}
+
+/* the roots are the globals and every active frame */
+static void collect(void)
+{
+    for (int i = 0; i < globalNames.count; ++i)
+        markValue(globals[i]);
+    for (Value *v = stack; v < stackTop; ++v)
+        markValue(*v);
+    sweepObjects();
+}
+
+/* loops and calls collect here: every object in use is in a root */
+static inline void safePoint(void)
+{
+    if (gcShouldCollect())
+        collect();
+}
+
+/* an object a thunk keeps while it runs more code goes on the stack,
+   above the frame, until the thunk drops it; 1 when v was pushed */
+static inline int hold(Value v)
+{
+    if (!IS_OBJ(v))
+        return 0;
+    if (stackTop >= stack + STACK_MAX)
+        stackOverflow();
+    *stackTop++ = v;
+    return 1;
+}
+
+/* the dynamic (local, global) pair: the local once bound */
+static Value peekVar(Thunk *t, Value *base)
+{
+    Value v = t->a >= 0 ? base[t->a] : UNDEF_VAL;
+    if (v == UNDEF_VAL && t->b >= 0)
+        v = globals[t->b];
+    return v;
+}
+
+static void storeVar(Thunk *t, Value *base, Value v)
+{
+    if (t->b < 0)
+        base[t->a] = v;
+    else if (t->a < 0 || (base[t->a] == UNDEF_VAL && globals[t->b] != UNDEF_VAL))
+        globals[t->b] = v;
+    else
+        base[t->a] = v;
+}
+
+// ------------------- EXPRESSIONS -------------------
+
+static int testValue(Thunk *t, Value *base)
+{
+    return truthy(t->eval(t, base));
+}
+
+static Value evalConst(Thunk *t, Value *base)
+{
+    (void)base;
+    return t->k;
+}
+
+static Value evalLocal(Thunk *t, Value *base)
+{
+    Value v = base[t->a];
+    return v != UNDEF_VAL ? v : undefinedVariable(t->name);
+}
+
+static Value evalGlobal(Thunk *t, Value *base)
+{
+    (void)base;
+    Value v = globals[t->b];
+    return v != UNDEF_VAL ? v : undefinedVariable(t->name);
+}
+
+static Value evalVar(Thunk *t, Value *base)
+{
+    Value v = base[t->a] != UNDEF_VAL ? base[t->a] : globals[t->b];
+    return v != UNDEF_VAL ? v : undefinedVariable(t->name);
+}
+
+/* binaryFast/compareFast: op is a constant in every caller, so each
+   specialized thunk keeps only its own int and double paths */
+static inline Value binaryFast(BinOpType op, Value l, Value r)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+    {
+        int64_t a = AS_SMALL_INT(l), b = AS_SMALL_INT(r), res;
+        switch (op)
+        {
+        case OP_ADD:
+            return intValue(a + b);
+        case OP_SUB:
+            return intValue(a - b);
+        case OP_MUL:
+            if (!__builtin_mul_overflow(a, b, &res))
+                return intValue(res);
+            break;
+        case OP_EQ:
+            return INT_VAL(a == b);
+        case OP_NE:
+            return INT_VAL(a != b);
+        case OP_LT:
+            return INT_VAL(a < b);
+        case OP_LE:
+            return INT_VAL(a <= b);
+        case OP_GT:
+            return INT_VAL(a > b);
+        case OP_GE:
+            return INT_VAL(a >= b);
+        default:
+            break;
+        }
+    }
+    else if (IS_NUM(l) && IS_NUM(r))
+    {
+        double a = AS_NUM(l), b = AS_NUM(r);
+        switch (op)
+        {
+        case OP_ADD:
+            return NUM_VAL(a + b);
+        case OP_SUB:
+            return NUM_VAL(a - b);
+        case OP_MUL:
+            return NUM_VAL(a * b);
+        case OP_EQ:
+            return INT_VAL(a == b);
+        case OP_NE:
+            return INT_VAL(a != b);
+        case OP_LT:
+            return INT_VAL(a < b);
+        case OP_LE:
+            return INT_VAL(a <= b);
+        case OP_GT:
+            return INT_VAL(a > b);
+        case OP_GE:
+            return INT_VAL(a >= b);
+        default:
+            break;
+        }
+    }
+    return binaryOp(op, l, r);
+}
+
+static inline int compareFast(BinOpType op, Value l, Value r)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+    {
+        int64_t a = AS_SMALL_INT(l), b = AS_SMALL_INT(r);
+        switch (op)
+        {
+        case OP_EQ:
+            return a == b;
+        case OP_NE:
+            return a != b;
+        case OP_LT:
+            return a < b;
+        case OP_LE:
+            return a <= b;
+        case OP_GT:
+            return a > b;
+        case OP_GE:
+            return a >= b;
+        default:
+            break;
+        }
+    }
+    return truthy(binaryFast(op, l, r));
+}
+
+/* operand shapes: E any expression, L a local slot (the child thunk
+   reports it when unbound), K a numeric constant */
+#define OPERAND_E(kid, slot) ((kid)->eval((kid), base))
+#define OPERAND_L(kid, slot) (base[slot] != UNDEF_VAL ? base[slot] : (kid)->eval((kid), base))
+#define OPERAND_K(kid, slot) (t->k)
+
+/* an E right operand may make a call: the left one is held meanwhile */
+#define HOLD_E(v) int held = hold(v)
+#define HOLD_L(v)
+#define HOLD_K(v)
+#define DROP_E() stackTop -= held
+#define DROP_L()
+#define DROP_K()
+
+#define BINARY_THUNK(name, op, L, R)                           \
+    static Value name##_##L##R(Thunk *t, Value *base)          \
+    {                                                          \
+        Value l = OPERAND_##L(t->x, t->a);                     \
+        HOLD_##R(l);                                           \
+        Value r = OPERAND_##R(t->y, t->b);                     \
+        DROP_##R();                                            \
+        return binaryFast(op, l, r);                           \
+    }                                                          \
+    static int name##_##L##R##_test(Thunk *t, Value *base)     \
+    {                                                          \
+        Value l = OPERAND_##L(t->x, t->a);                     \
+        HOLD_##R(l);                                           \
+        Value r = OPERAND_##R(t->y, t->b);                     \
+        DROP_##R();                                            \
+        return compareFast(op, l, r);                          \
+    }
+
+#define BINARY_THUNKS(name, op)     \
+    BINARY_THUNK(name, op, E, E)    \
+    BINARY_THUNK(name, op, E, L)    \
+    BINARY_THUNK(name, op, E, K)    \
+    BINARY_THUNK(name, op, L, E)    \
+    BINARY_THUNK(name, op, L, L)    \
+    BINARY_THUNK(name, op, L, K)
+
+BINARY_THUNKS(add, OP_ADD)
+BINARY_THUNKS(sub, OP_SUB)
+BINARY_THUNKS(mul, OP_MUL)
+BINARY_THUNKS(div, OP_DIV)
+BINARY_THUNKS(eq, OP_EQ)
+BINARY_THUNKS(ne, OP_NE)
+BINARY_THUNKS(lt, OP_LT)
+BINARY_THUNKS(le, OP_LE)
+BINARY_THUNKS(gt, OP_GT)
+BINARY_THUNKS(ge, OP_GE)
+
+#define SHAPES 6 // left (E, L) x right (E, L, K)
+#define EVAL_ROW(name) {name##_EE, name##_EL, name##_EK, name##_LE, name##_LL, name##_LK}
+#define TEST_ROW(name) {name##_EE_test, name##_EL_test, name##_EK_test, \
+                        name##_LE_test, name##_LL_test, name##_LK_test}
+
+/* indexed by BinOpType */
+static const EvalFn binaryEval[][SHAPES] = {
+    EVAL_ROW(add), EVAL_ROW(sub), EVAL_ROW(mul), EVAL_ROW(div), EVAL_ROW(eq),
+    EVAL_ROW(ne), EVAL_ROW(lt), EVAL_ROW(le), EVAL_ROW(gt), EVAL_ROW(ge)};
+static const TestFn binaryTest[][SHAPES] = {
+    TEST_ROW(add), TEST_ROW(sub), TEST_ROW(mul), TEST_ROW(div), TEST_ROW(eq),
+    TEST_ROW(ne), TEST_ROW(lt), TEST_ROW(le), TEST_ROW(gt), TEST_ROW(ge)};
+
+/* && || !: x and y are the operands, y running only when x does not
+   decide; conditions use the operands' own tests */
+static int testAnd(Thunk *t, Value *base)
+{
+    return t->x->test(t->x, base) && t->y->test(t->y, base);
+}
+
+static int testOr(Thunk *t, Value *base)
+{
+    return t->x->test(t->x, base) || t->y->test(t->y, base);
+}
+
+static int testNot(Thunk *t, Value *base)
+{
+    return !t->x->test(t->x, base);
+}
+
+static Value evalLogical(Thunk *t, Value *base)
+{
+    return INT_VAL(t->test(t, base));
+}
+
+static Value evalArray(Thunk *t, Value *base)
+{
+    ObjArray *arr = newArray(t->count);
+    hold(OBJ_VAL(arr));
+    for (int i = 0; i < t->count; ++i)
+        arr->data[i] = t->items[i]->eval(t->items[i], base);
+    stackTop--;
+    return OBJ_VAL(arr);
+}
+
+/* array element loads; c is the index's local slot in the _LL form */
+static Value evalIndexLocal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    return indexArray(t->name, base[t->a], idx);
+}
+
+static Value evalIndexLocalLL(Thunk *t, Value *base)
+{
+    Value idx = OPERAND_L(t->x, t->c);
+    return indexArray(t->name, base[t->a], idx);
+}
+
+static Value evalIndexGlobal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    return indexArray(t->name, globals[t->b], idx);
+}
+
+static Value evalIndexVar(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    return indexArray(t->name, peekVar(t, base), idx);
+}
+
+/* the local holds an array (knownArray) */
+static Value evalKnownLocal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    return indexKnownArray(t->name, base[t->a], idx);
+}
+
+static Value evalKnownLocalLL(Thunk *t, Value *base)
+{
+    Value idx = OPERAND_L(t->x, t->c);
+    return indexKnownArray(t->name, base[t->a], idx);
+}
+
+/* the index was proved in range (inBounds) */
+static Value evalElementLocal(Thunk *t, Value *base)
+{
+    return elementAt(base[t->a], t->x->eval(t->x, base));
+}
+
+static Value evalElementLocalLL(Thunk *t, Value *base)
+{
+    return elementAt(base[t->a], OPERAND_L(t->x, t->c));
+}
+
+static Value evalElementGlobal(Thunk *t, Value *base)
+{
+    return elementAt(globals[t->b], t->x->eval(t->x, base));
+}
+
+/* the function a call reaches, or NULL after reporting why there is
+   none; it is checked before any argument is evaluated */
+static ThunkFunction *findCallee(Thunk *t, Value *base)
+{
+    Value callee = peekVar(t, base);
+    if (!IS_FUNC(callee))
+    {
+        printf("Runtime Error: unknown function '%s'\n", t->name);
+        return NULL;
+    }
+    struct ASTNode *def = AS_FUNC(callee)->def;
+    if (def->funcDef.paramCount != t->count)
+    {
+        printf("Runtime Error: function '%s' expects %d args, got %d\n",
+               def->funcDef.funcName, def->funcDef.paramCount, t->count);
+        return NULL;
+    }
+    return AS_FUNC(callee)->thunks;
+}
+
+static Value evalCall(Thunk *t, Value *base)
+{
+    ThunkFunction *fn = findCallee(t, base);
+    if (!fn)
+        return NUM_VAL(0.0);
+    Value *frame = stackTop;
+    if (frame + fn->localCount > stack + STACK_MAX)
+        stackOverflow();
+    // arguments are evaluated in the caller's frame, straight into the
+    // callee's parameter slots, each above those already evaluated
+    for (int i = 0; i < t->count; ++i)
+    {
+        stackTop = frame + i;
+        frame[i] = t->items[i]->eval(t->items[i], base);
+    }
+    for (int i = t->count; i < fn->localCount; ++i)
+        frame[i] = UNDEF_VAL;
+    stackTop = frame + fn->localCount;
+    MemoTable *memo = fn->memo;
+    Value key[MEMO_MAX_ARGS], result;
+    if (memo)
+    {
+        if (memoFind(memo, frame, &result))
+        {
+            stackTop = frame;
+            return result;
+        }
+        memcpy(key, frame, sizeof(Value) * t->count);
+    }
+    if (depth >= FRAMES_MAX - 1 || cStackExhausted())
+        stackOverflow();
+    safePoint();
+
+    // a body that ends in a tail call has set up the callee's frame in
+    // place of its own: run it there
+    depth++;
+    int returned;
+    while ((returned = fn->body->exec(fn->body, frame) == EXEC_RETURN) && tailCallee)
+    {
+        fn = tailCallee;
+        tailCallee = NULL;
+    }
+    depth--;
+    result = returned ? returnValue : NUM_VAL(0.0);
+    stackTop = frame;
+    if (memo)
+        memoStore(memo, key, result);
+    return result;
+}
+
+static Value evalLength(Thunk *t, Value *base)
+{
+    Value v = t->x->eval(t->x, base);
+    if (IS_ARRAY(v))
+        return INT_VAL(AS_ARRAY(v)->len);
+    return callBuiltin(BI_LENGTH, &v);
+}
+
+static Value evalBuiltin(Thunk *t, Value *base)
+{
+    Value args[3];
+    int held = 0;
+    for (int i = 0; i < t->count; ++i)
+    {
+        args[i] = t->items[i]->eval(t->items[i], base);
+        held += hold(args[i]);
+    }
+    stackTop -= held;
+    return callBuiltin(t->a, args);
+}
+
+static Value evalArityError(Thunk *t, Value *base)
+{
+    (void)base;
+    return builtinArityError(t->c, t->count);
+}
+
+/* readChunk(reader, buf, max); name is NULL when buf is not a variable */
+static Value evalReadChunk(Thunk *t, Value *base)
+{
+    Value h = t->x->eval(t->x, base);
+    Value buf = t->name ? peekVar(t, base) : UNDEF_VAL;
+    int held = hold(h) + hold(buf);
+    Value max = t->y->eval(t->y, base);
+    stackTop -= held;
+    Value n = builtinReadChunk(h, t->name ? &buf : NULL, max);
+    if (t->name)
+        storeVar(t, base, buf);
+    return n;
+}
+
+// ------------------- STATEMENTS -------------------
+
+static int execNothing(Thunk *t, Value *base)
+{
+    (void)t;
+    (void)base;
+    return 0;
+}
+
+static int execBlock(Thunk *t, Value *base)
+{
+    for (int i = 0; i < t->count; ++i)
+    {
+        int status = t->items[i]->exec(t->items[i], base);
+        if (status)
+            return status;
+    }
+    return EXEC_NORMAL;
+}
+
+/* top-level blocks collect between statements too */
+static int execScriptBlock(Thunk *t, Value *base)
+{
+    for (int i = 0; i < t->count; ++i)
+    {
+        int status = t->items[i]->exec(t->items[i], base);
+        if (status)
+            return status;
+        safePoint();
+    }
+    return EXEC_NORMAL;
+}
+
+static int execBreak(Thunk *t, Value *base)
+{
+    (void)t;
+    (void)base;
+    return EXEC_BREAK;
+}
+
+static int execContinue(Thunk *t, Value *base)
+{
+    (void)t;
+    (void)base;
+    return EXEC_CONTINUE;
+}
+
+static int execExpr(Thunk *t, Value *base)
+{
+    t->x->eval(t->x, base);
+    return 0;
+}
+
+static int execPrint(Thunk *t, Value *base)
+{
+    for (int i = 0; i < t->count; ++i)
+    {
+        printValue(t->items[i]->eval(t->items[i], base));
+        putchar(i == t->count - 1 ? '\n' : ' ');
+    }
+    if (t->count == 0)
+        putchar('\n');
+    return 0;
+}
+
+static int execIf(Thunk *t, Value *base)
+{
+    Thunk *branch = t->x->test(t->x, base) ? t->y : t->z;
+    return branch->exec(branch, base);
+}
+
+static int execSwitch(Thunk *t, Value *base)
+{
+    int k = selectCase(t->cases, t->x->eval(t->x, base));
+    if (k < 0)
+        return EXEC_NORMAL;
+    int status = t->items[k]->exec(t->items[k], base);
+    return status == EXEC_BREAK ? EXEC_NORMAL : status;
+}
+
+static int execFor(Thunk *t, Value *base)
+{
+    Thunk *cond = t->x, *body = t->y, *incr = t->z;
+    t->w->exec(t->w, base);
+    while (cond->test(cond, base))
+    {
+        int status = body->exec(body, base);
+        if (status == EXEC_RETURN)
+            return status;
+        if (status == EXEC_BREAK)
+            break;
+        incr->exec(incr, base);
+        safePoint();
+    }
+    return EXEC_NORMAL;
+}
+
+/* for x in range(...): x is bound like `let`, at local a or global b */
+static int execForRange(Thunk *t, Value *base)
+{
+    Value args[3] = {t->x->eval(t->x, base), t->y->eval(t->y, base), t->z->eval(t->z, base)};
+    Value bounds[3];
+    if (rangeBounds(args, bounds, 0) <= 0)
+        return 0;
+    Value *var = t->a >= 0 ? &base[t->a] : &globals[t->b];
+    Thunk *body = t->w;
+    int64_t i = AS_SMALL_INT(bounds[0]), last = AS_SMALL_INT(bounds[1]), step = AS_SMALL_INT(bounds[2]);
+    for (;; i += step)
+    {
+        *var = INT_VAL(i);
+        int status = body->exec(body, base);
+        if (status == EXEC_RETURN)
+            return status;
+        if (status == EXEC_BREAK || i == last)
+            return EXEC_NORMAL;
+        safePoint();
+    }
+}
+
+/* for x in array: the array is held while the loop runs, and left on
+   a return, which may have replaced the frame with a tail callee's */
+static int execForEach(Thunk *t, Value *base)
+{
+    Value arr = t->x->eval(t->x, base), bounds[3];
+    if (eachBounds(arr, bounds, 0) <= 0)
+        return 0;
+    hold(arr);
+    Value *var = t->a >= 0 ? &base[t->a] : &globals[t->b];
+    Thunk *body = t->w;
+    int64_t last = AS_SMALL_INT(bounds[1]);
+    int status = EXEC_NORMAL;
+    for (int64_t i = 0;; ++i)
+    {
+        *var = indexArray(t->name, arr, INT_VAL(i));
+        status = body->exec(body, base);
+        if (status == EXEC_RETURN)
+            return status;
+        if (status == EXEC_BREAK || i == last)
+            break;
+        safePoint();
+    }
+    stackTop--;
+    return EXEC_NORMAL;
+}
+
+static int execWhile(Thunk *t, Value *base)
+{
+    Thunk *cond = t->x, *body = t->y;
+    while (cond->test(cond, base))
+    {
+        int status = body->exec(body, base);
+        if (status == EXEC_RETURN)
+            return status;
+        if (status == EXEC_BREAK)
+            break;
+        safePoint();
+    }
+    return EXEC_NORMAL;
+}
+
+static int execSetLocal(Thunk *t, Value *base)
+{
+    base[t->a] = t->x->eval(t->x, base);
+    return 0;
+}
+
+static int execSetGlobal(Thunk *t, Value *base)
+{
+    globals[t->b] = t->x->eval(t->x, base);
+    return 0;
+}
+
+static int execSetVar(Thunk *t, Value *base)
+{
+    storeVar(t, base, t->x->eval(t->x, base));
+    return 0;
+}
+
+static int execStoreLocal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    int held = hold(idx);
+    Value v = t->y->eval(t->y, base);
+    stackTop -= held;
+    storeArray(t->name, base[t->a], idx, v);
+    return 0;
+}
+
+static int execStoreGlobal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    int held = hold(idx);
+    Value v = t->y->eval(t->y, base);
+    stackTop -= held;
+    storeArray(t->name, globals[t->b], idx, v);
+    return 0;
+}
+
+static int execStoreVar(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    int held = hold(idx);
+    Value v = t->y->eval(t->y, base);
+    stackTop -= held;
+    storeArray(t->name, peekVar(t, base), idx, v);
+    return 0;
+}
+
+static int execStoreKnownLocal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    int held = hold(idx);
+    Value v = t->y->eval(t->y, base);
+    stackTop -= held;
+    storeKnownArray(t->name, base[t->a], idx, v);
+    return 0;
+}
+
+static int execStoreElementLocal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    setElementAt(base[t->a], idx, t->y->eval(t->y, base));
+    return 0;
+}
+
+static int execStoreElementGlobal(Thunk *t, Value *base)
+{
+    Value idx = t->x->eval(t->x, base);
+    setElementAt(globals[t->b], idx, t->y->eval(t->y, base));
+    return 0;
+}
+
+/* x op= v and a[i] op= v (see updateOperand), which read the target
+   where they store it. Variables: x = v, k = v when it is a numeric
+   constant (_K); y = the whole value, which runs instead when the
+   variable is unbound and reports it. Elements: x = i, y = v; c = 1
+   when v runs no code, so the element read is the one written. */
+#define UPDATE_THUNK(opName, op, Target, target, R)                        \
+    static int execUpdate##Target##_##opName##R(Thunk *t, Value *base)     \
+    {                                                                      \
+        Value l = target;                                                  \
+        if (l == UNDEF_VAL)                                                \
+        {                                                                  \
+            target = t->y->eval(t->y, base);                               \
+            return 0;                                                      \
+        }                                                                  \
+        HOLD_##R(l);                                                       \
+        Value r = OPERAND_##R(t->x, 0);                                    \
+        DROP_##R();                                                        \
+        target = binaryFast(op, l, r);                                     \
+        return 0;                                                          \
+    }
+
+#define UPDATE_INDEX_THUNK(opName, op, Target, array)                    \
+    static int execUpdateIndex##Target##_##opName(Thunk *t, Value *base) \
+    {                                                                    \
+        Value idx = t->x->eval(t->x, base);                              \
+        Value *e = t->c ? elementSlot(array, idx) : NULL;                \
+        if (e)                                                           \
+        {                                                                \
+            *e = binaryFast(op, *e, t->y->eval(t->y, base));             \
+            return 0;                                                    \
+        }                                                                \
+        Value l = indexArray(t->name, array, idx);                       \
+        int held = hold(idx) + hold(l);                                  \
+        Value r = t->y->eval(t->y, base);                                \
+        stackTop -= held;                                                \
+        storeArray(t->name, array, idx, binaryFast(op, l, r));           \
+        return 0;                                                        \
+    }
+
+#define UPDATE_THUNKS(opName, op)                         \
+    UPDATE_THUNK(opName, op, Local, base[t->a], E)        \
+    UPDATE_THUNK(opName, op, Local, base[t->a], K)        \
+    UPDATE_THUNK(opName, op, Global, globals[t->b], E)    \
+    UPDATE_THUNK(opName, op, Global, globals[t->b], K)    \
+    UPDATE_INDEX_THUNK(opName, op, Local, base[t->a])     \
+    UPDATE_INDEX_THUNK(opName, op, Global, globals[t->b])
+
+UPDATE_THUNKS(add, OP_ADD)
+UPDATE_THUNKS(sub, OP_SUB)
+UPDATE_THUNKS(mul, OP_MUL)
+UPDATE_THUNKS(div, OP_DIV)
+
+#define UPDATE_ROW(opName)                                                                        \
+    {execUpdateLocal_##opName##E, execUpdateLocal_##opName##K, execUpdateGlobal_##opName##E,      \
+     execUpdateGlobal_##opName##K, execUpdateIndexLocal_##opName, execUpdateIndexGlobal_##opName}
+
+/* indexed by BinOpType, then: local E, K; global E, K; element of a
+   local, of a global */
+static const ExecFn updateExec[][6] = {UPDATE_ROW(add), UPDATE_ROW(sub), UPDATE_ROW(mul), UPDATE_ROW(div)};
+
+/* function definitions bind like `let`: a slot of the current frame */
+static int execFuncDef(Thunk *t, Value *base)
+{
+    ObjFunction *fn = newFunction(t->def);
+    fn->thunks = t->fn;
+    storeVar(t, base, OBJ_VAL(fn));
+    return 0;
+}
+
+static int execReturn(Thunk *t, Value *base)
+{
+    returnValue = t->x->eval(t->x, base);
+    return EXEC_RETURN;
+}
+
+/* return f(...): the arguments go above this frame, then over it, and
+   evalCall runs f in it */
+static int execTailCall(Thunk *t, Value *base)
+{
+    Thunk *call = t->x;
+    ThunkFunction *fn = findCallee(call, base);
+    if (!fn)
+    {
+        returnValue = NUM_VAL(0.0);
+        return EXEC_RETURN;
+    }
+    Value *args = stackTop;
+    if (args + call->count > stack + STACK_MAX || base + fn->localCount > stack + STACK_MAX)
+        stackOverflow();
+    for (int i = 0; i < call->count; ++i)
+    {
+        stackTop = args + i;
+        args[i] = call->items[i]->eval(call->items[i], base);
+    }
+    for (int i = 0; i < call->count; ++i)
+        base[i] = args[i];
+    for (int i = call->count; i < fn->localCount; ++i)
+        base[i] = UNDEF_VAL;
+    stackTop = base + fn->localCount;
+    tailCallee = fn;
+    return EXEC_RETURN;
+}
+
+// ------------------- COMPILING -------------------
+
+static Thunk *newThunk(void)
+{
+    Thunk *t = (Thunk *)calloc(1, sizeof(Thunk));
+    if (!t)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    t->a = t->b = t->c = -1;
+    t->test = testValue;
+    t->exec = execNothing;
+    t->next = allThunks;
+    allThunks = t;
+    return t;
+}
+
+static Thunk **newItems(int count)
+{
+    Thunk **items = (Thunk **)calloc(count ? count : 1, sizeof(Thunk *));
+    if (!items)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    return items;
+}
+
+static Thunk *constThunk(Value v)
+{
+    Thunk *t = newThunk();
+    t->eval = evalConst;
+    t->k = v;
+    return t;
+}
+
+static void bindName(Thunk *t, const char *name)
+{
+    VarRef r = resolveName(scope, &globalNames, name);
+    t->a = r.local;
+    t->b = r.global;
+    t->name = name;
+}
+
+/* `let` and function definitions bind in the current frame */
+static void bindDeclared(Thunk *t, const char *name)
+{
+    if (scope->isScript)
+        t->b = addName(&globalNames, name);
+    else
+        t->a = findName(&scope->locals, name);
+    t->name = name;
+}
+
+/* the slot of a variable that can only be a local, or -1 */
+static int localSlot(struct ASTNode *node)
+{
+    if (!node || node->type != NODE_VAR)
+        return -1;
+    VarRef r = resolveName(scope, &globalNames, node->varName);
+    return r.global < 0 ? r.local : -1;
+}
+
+static Thunk *compileExpr(struct ASTNode *node);
+static Thunk *compileStmt(struct ASTNode *node);
+static ThunkFunction *compileFunction(struct ASTNode *def);
+
+static Thunk *compileBinary(struct ASTNode *node)
+{
+    Thunk *t = newThunk();
+    struct ASTNode *left = node->binop.left, *right = node->binop.right;
+    t->x = compileExpr(left);
+    t->y = compileExpr(right);
+    t->a = localSlot(left);
+    t->b = localSlot(right);
+    int shape = t->a >= 0 ? 3 : 0;
+    if (t->b >= 0)
+        shape += 1;
+    else if (right && right->type == NODE_NUM)
+    {
+        t->k = literalValue(right);
+        shape += 2;
+    }
+    t->eval = binaryEval[node->binop.op][shape];
+    t->test = binaryTest[node->binop.op][shape];
+    return t;
+}
+
+static Thunk *compileCall(struct ASTNode *node)
+{
+    Thunk *t = newThunk();
+    int argc = node->funcCall.argCount;
+    int b = findBuiltin(node->funcCall.funcName);
+    if (b >= 0 && argc != builtinArity(b))
+    {
+        t->eval = evalArityError;
+        t->c = b;
+        t->count = argc;
+        return t;
+    }
+    if (b == BI_READ_CHUNK)
+    {
+        const char *buf = chunkBuffer(node);
+        t->x = compileExpr(node->funcCall.args[0]);
+        t->y = compileExpr(node->funcCall.args[2]);
+        if (buf)
+            bindName(t, buf);
+        t->eval = evalReadChunk;
+        return t;
+    }
+    if (b == BI_LENGTH)
+    {
+        t->x = compileExpr(node->funcCall.args[0]);
+        t->eval = evalLength;
+        return t;
+    }
+
+    t->items = newItems(argc);
+    t->count = argc;
+    for (int i = 0; i < argc; ++i)
+        t->items[i] = compileExpr(node->funcCall.args[i]);
+    if (b >= 0)
+    {
+        t->a = b;
+        t->eval = evalBuiltin;
+    }
+    else
+    {
+        bindName(t, node->funcCall.funcName);
+        t->eval = evalCall;
+    }
+    return t;
+}
+
+static Thunk *compileExpr(struct ASTNode *node)
+{
+    if (!node)
+        return constThunk(NUM_VAL(0.0));
+
+    switch (node->type)
+    {
+    case NODE_NUM:
+        return constThunk(literalValue(node));
+
+    case NODE_STR:
+        if (!node->str.value)
+            node->str.value = slLiteral(node->str.text);
+        return constThunk(STR_VAL(node->str.value));
+
+    case NODE_VAR:
+    {
+        Thunk *t = newThunk();
+        bindName(t, node->varName);
+        t->eval = t->b < 0 ? evalLocal : t->a < 0 ? evalGlobal : evalVar;
+        return t;
+    }
+
+    case NODE_BINOP:
+        return compileBinary(node);
+
+    case NODE_LOGICAL:
+    {
+        static const TestFn tests[] = {[LOGIC_AND] = testAnd, [LOGIC_OR] = testOr, [LOGIC_NOT] = testNot};
+        Thunk *t = newThunk();
+        t->x = compileExpr(node->logical.left);
+        if (node->logical.right)
+            t->y = compileExpr(node->logical.right);
+        t->test = tests[node->logical.op];
+        t->eval = evalLogical;
+        return t;
+    }
+
+    case NODE_ARRAY:
+    {
+        Thunk *t = newThunk();
+        t->count = node->ArrayNode.count;
+        t->items = newItems(t->count);
+        for (int i = 0; i < t->count; ++i)
+            t->items[i] = compileExpr(node->ArrayNode.elements[i]);
+        t->eval = evalArray;
+        return t;
+    }
+
+    case NODE_ARR_ACCESS:
+    {
+        Thunk *t = newThunk();
+        t->x = compileExpr(node->ArrAccessNode.index);
+        bindName(t, node->ArrAccessNode.varName);
+        int checked = !node->ArrAccessNode.inBounds;
+        int known = node->ArrAccessNode.knownArray;
+        if (t->b < 0)
+        {
+            t->c = localSlot(node->ArrAccessNode.index);
+            if (t->c >= 0)
+                t->eval = !checked ? evalElementLocalLL : known ? evalKnownLocalLL : evalIndexLocalLL;
+            else
+                t->eval = !checked ? evalElementLocal : known ? evalKnownLocal : evalIndexLocal;
+        }
+        else if (t->a < 0)
+            t->eval = checked ? evalIndexGlobal : evalElementGlobal;
+        else
+            t->eval = evalIndexVar;
+        return t;
+    }
+
+    case NODE_FUNC_CALL:
+        return compileCall(node);
+
+    default:
+        return constThunk(NUM_VAL(0.0));
+    }
+}
+
+static Thunk *compileStmt(struct ASTNode *node)
+{
+    Thunk *t = newThunk();
+    if (!node)
+        return t;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        t->count = node->block.count;
+        t->items = newItems(t->count);
+        for (int i = 0; i < t->count; ++i)
+            t->items[i] = compileStmt(node->block.items[i]);
+        t->exec = scope->isScript ? execScriptBlock : execBlock;
+        break;
+
+    case NODE_PRINT:
+        t->count = node->print.count;
+        t->items = newItems(t->count);
+        for (int i = 0; i < t->count; ++i)
+            t->items[i] = compileExpr(node->print.exprs[i]);
+        t->exec = execPrint;
+        break;
+
+    case NODE_IF:
+        t->x = compileExpr(node->ifstmt.cond);
+        t->y = compileStmt(node->ifstmt.thenBlock);
+        t->z = compileStmt(node->ifstmt.elseBlock);
+        t->exec = execIf;
+        break;
+
+    case NODE_SWITCH:
+        t->x = compileExpr(node->switchStmt.value);
+        t->count = node->switchStmt.bodyCount;
+        t->items = newItems(t->count);
+        for (int i = 0; i < t->count; ++i)
+            t->items[i] = compileStmt(node->switchStmt.bodies[i]);
+        t->cases = &node->switchStmt.cases;
+        t->exec = execSwitch;
+        break;
+
+    case NODE_FOR:
+        t->w = compileStmt(node->forstmt.init);
+        t->x = node->forstmt.cond ? compileExpr(node->forstmt.cond) : constThunk(INT_VAL(1));
+        t->y = compileStmt(node->forstmt.body);
+        t->z = compileStmt(node->forstmt.incr);
+        t->exec = execFor;
+        break;
+
+    case NODE_WHILE:
+        // a while without condition never runs
+        if (!node->WhileStmt.cond)
+            break;
+        t->x = compileExpr(node->WhileStmt.cond);
+        t->y = compileStmt(node->WhileStmt.body);
+        t->exec = execWhile;
+        break;
+
+    case NODE_FOR_IN:
+    {
+        struct ASTNode *array = node->forIn.array;
+        if (array)
+        {
+            t->x = compileExpr(array);
+            t->exec = execForEach;
+        }
+        else
+        {
+            t->x = compileExpr(node->forIn.start);
+            t->y = compileExpr(node->forIn.end);
+            t->z = node->forIn.step ? compileExpr(node->forIn.step) : constThunk(INT_VAL(1));
+            t->exec = execForRange;
+        }
+        bindDeclared(t, node->forIn.varName);
+        t->w = compileStmt(node->forIn.body);
+        if (array)
+            t->name = array->type == NODE_VAR ? array->varName : "in";
+        break;
+    }
+
+    case NODE_ASSIGN:
+    {
+        struct ASTNode *operand = updateOperand(node);
+        t->x = compileExpr(node->assign.value);
+        if (node->assign.isLet)
+            bindDeclared(t, node->assign.varName);
+        else
+            bindName(t, node->assign.varName);
+        t->exec = t->b < 0 ? execSetLocal : t->a < 0 ? execSetGlobal : execSetVar;
+        if (operand && (t->a < 0 || t->b < 0))
+        {
+            int shape = t->b < 0 ? 0 : 2;
+            t->y = t->x;
+            t->x = compileExpr(operand);
+            if (operand->type == NODE_NUM)
+            {
+                t->k = literalValue(operand);
+                shape++;
+            }
+            t->exec = updateExec[node->assign.value->binop.op][shape];
+        }
+        break;
+    }
+
+    case NODE_ARR_ASSIGN:
+    {
+        struct ASTNode *operand = updateOperand(node);
+        t->x = compileExpr(node->arrAssign.index);
+        bindName(t, node->arrAssign.varName);
+        if (operand && (t->a < 0 || t->b < 0))
+        {
+            t->y = compileExpr(operand);
+            t->c = operand->type == NODE_NUM || operand->type == NODE_VAR;
+            t->exec = updateExec[node->arrAssign.value->binop.op][t->b < 0 ? 4 : 5];
+            break;
+        }
+        t->y = compileExpr(node->arrAssign.value);
+        if (node->arrAssign.inBounds && (t->a < 0 || t->b < 0))
+            t->exec = t->b < 0 ? execStoreElementLocal : execStoreElementGlobal;
+        else if (node->arrAssign.knownArray && t->b < 0)
+            t->exec = execStoreKnownLocal;
+        else
+            t->exec = t->b < 0 ? execStoreLocal : t->a < 0 ? execStoreGlobal : execStoreVar;
+        break;
+    }
+
+    case NODE_FUNC_DEF:
+        bindDeclared(t, node->funcDef.funcName);
+        t->def = node;
+        t->fn = compileFunction(node);
+        t->exec = execFuncDef;
+        break;
+
+    case NODE_RETURN:
+        // like the tree walker, a top-level return does nothing
+        if (scope->isScript)
+            break;
+        t->x = compileExpr(node->returnStmt.value);
+        t->exec = tailCall(node) ? execTailCall : execReturn;
+        break;
+
+    case NODE_BREAK:
+        t->exec = execBreak;
+        break;
+
+    case NODE_CONTINUE:
+        t->exec = execContinue;
+        break;
+
+    case NODE_FUNC_CALL:
+        t->x = compileExpr(node);
+        t->exec = execExpr;
+        break;
+
+    default:
+        break;
+    }
+    return t;
+}
+
+static ThunkFunction *compileFunction(struct ASTNode *def)
+{
+    ThunkFunction *fn = (ThunkFunction *)calloc(1, sizeof(ThunkFunction));
+    if (!fn)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    fn->next = allFunctions;
+    allFunctions = fn;
+
+    Scope s;
+    beginFunctionScope(&s, def, &globalBound);
+    Scope *enclosing = scope;
+    scope = &s;
+    fn->body = compileStmt(def->funcDef.body);
+    fn->localCount = s.locals.count;
+    fn->memo = def->funcDef.memo;
+    scope = enclosing;
+    endScope(&s);
+    freeNames(&s.locals);
+    return fn;
+}
+
+// ------------------- RUNNING -------------------
+
+static void freeThunks(void)
+{
+    while (allThunks)
+    {
+        Thunk *next = allThunks->next;
+        free(allThunks->items);
+        free(allThunks);
+        allThunks = next;
+    }
+    while (allFunctions)
+    {
+        ThunkFunction *next = allFunctions->next;
+        free(allFunctions);
+        allFunctions = next;
+    }
+}
+
+int runClosures(struct ASTNode *root)
+{
+    scanBindings(root, &globalBound);
+    Scope script = {0};
+    script.isScript = 1;
+    scope = &script;
+    Thunk *program = compileStmt(root);
+    scope = NULL;
+    freeNames(&globalBound);
+
+    int count = globalNames.count;
+    globals = (Value *)malloc(sizeof(Value) * (count ? count : 1));
+    stack = (Value *)malloc(sizeof(Value) * STACK_MAX);
+    if (!globals || !stack)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; ++i)
+        globals[i] = UNDEF_VAL;
+    stackTop = stack;
+    depth = 0;
+    tailCallee = NULL;
+
+    int status = 0;
+    if (setjmp(abortRun) == 0)
+        program->exec(program, stack);
+    else
+        status = 1;
+
+    freeThunks();
+    freeNames(&globalNames);
+    free(globals);
+    free(stack);
+    globals = stack = stackTop = NULL;
+    return status;
+}
@@ -0,0 +1,12 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "ast.h"
+
+/* Closure-threaded engine: every AST node is compiled once into a thunk,
+   a C function pointer plus pre-resolved operands (variable slots,
+   constants, builtin ids), so running it never inspects node->type or
+   binop.op again. Returns 0, or 1 if the program had to be aborted. */
+int runClosures(struct ASTNode *root);
+
+#endif
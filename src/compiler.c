@@ -0,0 +1,755 @@
+#include "compiler.h"
+#include "scope.h"
+#include "object.h"
+#include "runtime.h"
+#include "jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* forward jumps to one target, patched once it is known */
+typedef struct
+{
+    int *at;
+    int count, cap;
+} JumpList;
+
+/* the loop being compiled: its break and continue jumps, patched once
+   the exit and the point that starts the next trip are known. A switch
+   takes the breaks in its cases, and no continues. */
+typedef struct Loop
+{
+    JumpList breaks, continues;
+    int isSwitch;
+    struct Loop *enclosing;
+} Loop;
+
+typedef struct
+{
+    Proto *proto;
+    Scope scope;
+    int memoKey; // memoized: the first local holding a copy of the arguments, else -1
+    Loop *loop;  // innermost
+} Compiler;
+
+static Program *prog = NULL;
+static NameList globals;     // every global slot
+static NameList globalBound; // names the script itself can bind
+static Compiler *current = NULL;
+
+static void compileStmt(struct ASTNode *node);
+static void compileExpr(struct ASTNode *node);
+
+// ------------------- EMITTING -------------------
+
+static void emit(int32_t word)
+{
+    Proto *p = current->proto;
+    if (p->count >= p->cap)
+        p->code = (int32_t *)growArray(p->code, &p->cap, sizeof(int32_t));
+    p->code[p->count++] = word;
+}
+
+static void emit2(int32_t op, int32_t a)
+{
+    emit(op);
+    emit(a);
+}
+
+static int addConst(Value v)
+{
+    Proto *p = current->proto;
+    for (int i = 0; i < p->constCount; ++i)
+        if (p->consts[i] == v)
+            return i;
+    if (p->constCount >= p->constCap)
+        p->consts = (Value *)growArray(p->consts, &p->constCap, sizeof(Value));
+    p->consts[p->constCount] = v;
+    return p->constCount++;
+}
+
+static void emitConst(Value v)
+{
+    emit2(BC_CONST, addConst(v));
+}
+
+/* emitJump: returns the operand position to patch */
+static int emitJump(int32_t op)
+{
+    emit2(op, 0);
+    return current->proto->count - 1;
+}
+
+static void patchJump(int at)
+{
+    current->proto->code[at] = current->proto->count - (at + 1);
+}
+
+static void emitLoop(int loopStart)
+{
+    emit(BC_LOOP);
+    emit(current->proto->count + 1 - loopStart);
+}
+
+static void beginLoop(Loop *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->enclosing = current->loop;
+    current->loop = loop;
+}
+
+static void addJump(JumpList *l, int at)
+{
+    if (l->count >= l->cap)
+        l->at = (int *)growArray(l->at, &l->cap, sizeof(int));
+    l->at[l->count++] = at;
+}
+
+/* the jumps land here; the list is done with */
+static void patchJumps(JumpList *l)
+{
+    for (int i = 0; i < l->count; ++i)
+        patchJump(l->at[i]);
+    free(l->at);
+    *l = (JumpList){0};
+}
+
+/* the loop is done: breaks land here */
+static void endLoop(Loop *loop)
+{
+    patchJumps(&loop->breaks);
+    current->loop = loop->enclosing;
+}
+
+/* the value picks a case through switches[t], a copy of the node's
+   cases with code offsets for targets; each case ends with a jump past
+   the rest, like a break */
+static void compileSwitch(struct ASTNode *node)
+{
+    Proto *p = current->proto;
+    compileExpr(node->switchStmt.value);
+    if (p->switchCount >= p->switchCap)
+        p->switches = (CaseTable *)growArray(p->switches, &p->switchCap, sizeof(CaseTable));
+    int t = p->switchCount++;
+    emit2(BC_SWITCH, t);
+    int from = p->count;
+
+    int count = node->switchStmt.bodyCount;
+    int *offsets = (int *)malloc(sizeof(int) * (count ? count : 1));
+    Loop cases;
+    beginLoop(&cases);
+    cases.isSwitch = 1;
+    for (int i = 0; i < count; ++i)
+    {
+        offsets[i] = p->count - from;
+        compileStmt(node->switchStmt.bodies[i]);
+        if (i < count - 1)
+            addJump(&cases.breaks, emitJump(BC_JUMP));
+    }
+    endLoop(&cases);
+
+    const CaseTable *src = &node->switchStmt.cases;
+    CaseTable table = {.count = src->count};
+    table.labels = (int64_t *)malloc(sizeof(int64_t) * (src->count ? src->count : 1));
+    table.targets = (int *)malloc(sizeof(int) * (src->count ? src->count : 1));
+    for (int i = 0; i < src->count; ++i)
+    {
+        table.labels[i] = src->labels[i];
+        table.targets[i] = offsets[src->targets[i]];
+    }
+    table.otherwise = src->otherwise >= 0 ? offsets[src->otherwise] : p->count - from;
+    indexCases(&table);
+    p->switches[t] = table;
+    free(offsets);
+}
+
+static void emitReturn(void)
+{
+    if (current->memoKey >= 0)
+        emit2(BC_MEMO_STORE, current->memoKey);
+    emit(BC_RETURN);
+}
+
+// ------------------- VARIABLES -------------------
+
+static VarRef resolve(const char *name)
+{
+    return resolveName(&current->scope, &globals, name);
+}
+
+/* emitVar: picks the local, global or run-time checked form of op */
+static void emitVar(int32_t localOp, int32_t globalOp, int32_t varOp, VarRef r)
+{
+    if (r.global < 0)
+        emit2(localOp, r.local);
+    else if (r.local < 0)
+        emit2(globalOp, r.global);
+    else
+    {
+        emit2(varOp, r.local);
+        emit(r.global);
+    }
+}
+
+static void emitGet(const char *name)
+{
+    emitVar(BC_GET_LOCAL, BC_GET_GLOBAL, BC_GET_VAR, resolve(name));
+}
+
+static void emitSet(const char *name)
+{
+    emitVar(BC_SET_LOCAL, BC_SET_GLOBAL, BC_SET_VAR, resolve(name));
+}
+
+/* emitDeclare: `let` and function definitions bind in the current frame */
+static void emitDeclare(const char *name)
+{
+    if (current->scope.isScript)
+        emit2(BC_SET_GLOBAL, addName(&globals, name));
+    else
+        emit2(BC_SET_LOCAL, findName(&current->scope.locals, name));
+}
+
+static void emitPeek(VarRef r)
+{
+    emit(BC_PEEK_VAR);
+    emit(r.local);
+    emit(r.global);
+}
+
+// ------------------- EXPRESSIONS -------------------
+
+/* tail: `return f(...)`, whose call replaces the current frame */
+static void compileCall(struct ASTNode *node, int tail)
+{
+    int argc = node->funcCall.argCount;
+    int b = findBuiltin(node->funcCall.funcName);
+    if (b >= 0)
+    {
+        if (argc != builtinArity(b))
+        {
+            emit2(BC_ARITY_ERROR, b);
+            emit(argc);
+            return;
+        }
+        if (b == BI_READ_CHUNK)
+        {
+            const char *buf = chunkBuffer(node);
+            compileExpr(node->funcCall.args[0]);
+            if (buf)
+                emitPeek(resolve(buf));
+            else
+                emitConst(NUM_VAL(0.0));
+            compileExpr(node->funcCall.args[2]);
+            emit2(BC_READ_CHUNK, buf != NULL);
+            if (buf)
+                emitSet(buf); // stores the (possibly new) buffer, leaves n
+            return;
+        }
+        if (b == BI_VECTOR && jitEnabled)
+        {
+            // traces compile the loop, and the loops around it, to machine
+            // code: it runs from its start
+            compileExpr(node->funcCall.args[1]->ArrayNode.elements[0]);
+            return;
+        }
+        for (int i = 0; i < argc; ++i)
+            compileExpr(node->funcCall.args[i]);
+        if (b == BI_LENGTH)
+            emit(BC_LENGTH);
+        else
+        {
+            emit2(BC_BUILTIN, b);
+            emit(argc);
+        }
+        return;
+    }
+
+    // the callee is checked before any argument is evaluated; on error
+    // it pushes 0 and skips the arguments and the call
+    VarRef r = resolve(node->funcCall.funcName);
+    emit(BC_CALLEE);
+    emit(r.local);
+    emit(r.global);
+    emit(argc);
+    emit(0);
+    int skip = current->proto->count - 1;
+    for (int i = 0; i < argc; ++i)
+        compileExpr(node->funcCall.args[i]);
+    emit2(tail ? BC_TAIL_CALL : BC_CALL, argc);
+    patchJump(skip);
+}
+
+/* compileJump: jumps to the targets in list when cond is true (sense 1)
+   or false (sense 0), else falls through. Comparisons compile to a fused
+   compare-and-branch, && || and ! to jumps between their operands: an
+   operand that decides the result jumps past the rest. */
+static void compileJump(struct ASTNode *cond, int sense, JumpList *list)
+{
+    if (cond->type == NODE_LOGICAL && cond->logical.op == LOGIC_NOT)
+    {
+        compileJump(cond->logical.left, !sense, list);
+        return;
+    }
+    if (cond->type == NODE_LOGICAL)
+    {
+        // && jumps when false as soon as an operand is, || when true
+        if ((cond->logical.op == LOGIC_AND) != sense)
+        {
+            compileJump(cond->logical.left, sense, list);
+            compileJump(cond->logical.right, sense, list);
+            return;
+        }
+        // a left operand that decides the other way skips the right one
+        JumpList decided = {0};
+        compileJump(cond->logical.left, !sense, &decided);
+        compileJump(cond->logical.right, sense, list);
+        patchJumps(&decided);
+        return;
+    }
+
+    int32_t op = BC_JUMP_IF_FALSE;
+    if (cond->type == NODE_BINOP && cond->binop.op >= OP_EQ)
+    {
+        compileExpr(cond->binop.left);
+        compileExpr(cond->binop.right);
+        op = BC_JUMP_IF_NOT_EQ + (cond->binop.op - OP_EQ);
+        // == and != are each other's negation; with NaN, < and >= are not
+        if (sense && (cond->binop.op == OP_EQ || cond->binop.op == OP_NE))
+        {
+            addJump(list, emitJump(cond->binop.op == OP_EQ ? BC_JUMP_IF_NOT_NE : BC_JUMP_IF_NOT_EQ));
+            return;
+        }
+    }
+    else
+        compileExpr(cond);
+    if (!sense)
+    {
+        addJump(list, emitJump(op));
+        return;
+    }
+    int over = emitJump(op);
+    addJump(list, emitJump(BC_JUMP));
+    patchJump(over);
+}
+
+/* a binary operator whose left operand is on the stack */
+static void emitOperator(struct ASTNode *node)
+{
+    if ((node->binop.op == OP_ADD || node->binop.op == OP_SUB) &&
+        node->binop.right->type == NODE_NUM)
+    {
+        // x + 1, n - 1: the constant rides along as an operand
+        emit2(node->binop.op == OP_ADD ? BC_ADD_CONST : BC_SUB_CONST,
+              addConst(literalValue(node->binop.right)));
+        return;
+    }
+    compileExpr(node->binop.right);
+    emit(BC_ADD + node->binop.op);
+}
+
+/* an array access whose index is on the stack */
+static void emitIndex(struct ASTNode *node)
+{
+    if (node->ArrAccessNode.inBounds)
+        emitVar(BC_ELEMENT_LOCAL, BC_ELEMENT_GLOBAL, BC_INDEX_VAR,
+                resolve(node->ArrAccessNode.varName));
+    else
+        emitVar(BC_INDEX_LOCAL, BC_INDEX_GLOBAL, BC_INDEX_VAR,
+                resolve(node->ArrAccessNode.varName));
+}
+
+static void compileExpr(struct ASTNode *node)
+{
+    if (!node)
+    {
+        emitConst(NUM_VAL(0.0));
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_NUM:
+        emitConst(literalValue(node));
+        break;
+
+    case NODE_STR:
+        if (!node->str.value)
+            node->str.value = slLiteral(node->str.text);
+        emitConst(STR_VAL(node->str.value));
+        break;
+
+    case NODE_VAR:
+        emitGet(node->varName);
+        break;
+
+    case NODE_BINOP:
+        compileExpr(node->binop.left);
+        emitOperator(node);
+        break;
+
+    case NODE_LOGICAL:
+    {
+        // && and || jump to the 0 when they are false, ! to the 1 when its operand is
+        int sense = node->logical.op == LOGIC_NOT;
+        JumpList jumps = {0};
+        compileJump(node, sense, &jumps);
+        emitConst(INT_VAL(!sense));
+        int end = emitJump(BC_JUMP);
+        patchJumps(&jumps);
+        emitConst(INT_VAL(sense));
+        patchJump(end);
+        break;
+    }
+
+    case NODE_ARRAY:
+        for (int i = 0; i < node->ArrayNode.count; ++i)
+            compileExpr(node->ArrayNode.elements[i]);
+        emit2(BC_ARRAY, node->ArrayNode.count);
+        break;
+
+    case NODE_ARR_ACCESS:
+        compileExpr(node->ArrAccessNode.index);
+        emitIndex(node);
+        break;
+
+    case NODE_FUNC_CALL:
+        compileCall(node, 0);
+        break;
+
+    default:
+        emitConst(NUM_VAL(0.0));
+        break;
+    }
+}
+
+// ------------------- STATEMENTS -------------------
+
+
+static int compileFunction(struct ASTNode *def);
+
+static void compileStmt(struct ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < node->block.count; ++i)
+            compileStmt(node->block.items[i]);
+        break;
+
+    case NODE_PRINT:
+        // each value is printed as soon as it is evaluated
+        for (int i = 0; i < node->print.count; ++i)
+        {
+            compileExpr(node->print.exprs[i]);
+            emit2(BC_PRINT, i == node->print.count - 1);
+        }
+        if (node->print.count == 0)
+            emit(BC_PRINT_NEWLINE);
+        break;
+
+    case NODE_IF:
+    {
+        JumpList toElse = {0};
+        compileJump(node->ifstmt.cond, 0, &toElse);
+        compileStmt(node->ifstmt.thenBlock);
+        if (node->ifstmt.elseBlock)
+        {
+            int toEnd = emitJump(BC_JUMP);
+            patchJumps(&toElse);
+            compileStmt(node->ifstmt.elseBlock);
+            patchJump(toEnd);
+        }
+        else
+            patchJumps(&toElse);
+        break;
+    }
+
+    case NODE_SWITCH:
+        compileSwitch(node);
+        break;
+
+    case NODE_FOR:
+    {
+        compileStmt(node->forstmt.init);
+        Loop loop;
+        beginLoop(&loop);
+        int loopStart = current->proto->count;
+        JumpList exit = {0};
+        if (node->forstmt.cond)
+            compileJump(node->forstmt.cond, 0, &exit);
+        compileStmt(node->forstmt.body);
+        patchJumps(&loop.continues);
+        compileStmt(node->forstmt.incr);
+        emitLoop(loopStart);
+        patchJumps(&exit);
+        endLoop(&loop);
+        break;
+    }
+
+    case NODE_WHILE:
+    {
+        // a while without condition never runs
+        if (!node->WhileStmt.cond)
+            break;
+        Loop loop;
+        beginLoop(&loop);
+        int loopStart = current->proto->count;
+        JumpList exit = {0};
+        compileJump(node->WhileStmt.cond, 0, &exit);
+        compileStmt(node->WhileStmt.body);
+        patchJumps(&loop.continues); // one back edge per loop, for the tracer
+        emitLoop(loopStart);
+        patchJumps(&exit);
+        endLoop(&loop);
+        break;
+    }
+
+    case NODE_FOR_IN:
+    {
+        // hidden locals: the value (or index), the last one, the step and
+        // the array; no name resolves to them
+        int slot = current->scope.locals.count;
+        for (int i = 0; i < 3; ++i)
+            appendName(&current->scope.locals, "@for");
+        struct ASTNode *arr = node->forIn.array;
+        int exit;
+        if (arr)
+        {
+            char name[80];
+            snprintf(name, sizeof(name), "@in_%s", arr->type == NODE_VAR ? arr->varName : "in");
+            appendName(&current->scope.locals, name);
+            compileExpr(arr);
+            emit2(BC_FOR_EACH, slot);
+        }
+        else
+        {
+            if (node->forIn.start)
+                compileExpr(node->forIn.start);
+            else
+                emitConst(INT_VAL(0));
+            compileExpr(node->forIn.end);
+            if (node->forIn.step)
+                compileExpr(node->forIn.step);
+            else
+                emitConst(INT_VAL(1));
+            emit2(BC_FOR_RANGE, slot);
+        }
+        emit(0);
+        exit = current->proto->count - 1;
+        int loopStart = current->proto->count;
+        emit2(BC_GET_LOCAL, slot);
+        if (arr)
+            emit2(BC_INDEX_LOCAL, slot + 3);
+        emitDeclare(node->forIn.varName);
+        Loop loop;
+        beginLoop(&loop);
+        compileStmt(node->forIn.body);
+        patchJumps(&loop.continues);
+        emit2(BC_FOR_NEXT, slot);
+        emit(0);
+        int next = current->proto->count - 1;
+        emitLoop(loopStart);
+        patchJump(exit);
+        patchJump(next);
+        endLoop(&loop);
+        if (arr && current->scope.isScript)
+        {
+            // the script's frame lasts: drop the array so it can be collected
+            emitConst(UNDEF_VAL);
+            emit2(BC_SET_LOCAL, slot + 3);
+        }
+        break;
+    }
+
+    case NODE_ASSIGN:
+        compileExpr(node->assign.value);
+        if (node->assign.isLet)
+            emitDeclare(node->assign.varName);
+        else
+            emitSet(node->assign.varName);
+        break;
+
+    case NODE_ARR_ASSIGN:
+        compileExpr(node->arrAssign.index);
+        if (updateOperand(node))
+        {
+            // a[i] op= v: i is computed once, and its copy reads a[i]
+            emit(BC_DUP);
+            emitIndex(node->arrAssign.value->binop.left);
+            emitOperator(node->arrAssign.value);
+        }
+        else
+            compileExpr(node->arrAssign.value);
+        if (node->arrAssign.inBounds)
+            emitVar(BC_STORE_ELEMENT_LOCAL, BC_STORE_ELEMENT_GLOBAL, BC_STORE_INDEX_VAR,
+                    resolve(node->arrAssign.varName));
+        else
+            emitVar(BC_STORE_INDEX_LOCAL, BC_STORE_INDEX_GLOBAL, BC_STORE_INDEX_VAR,
+                    resolve(node->arrAssign.varName));
+        break;
+
+    case NODE_FUNC_DEF:
+        emit2(BC_FUNCTION, compileFunction(node));
+        emitDeclare(node->funcDef.funcName);
+        break;
+
+    case NODE_RETURN:
+        // like the tree walker, a top-level return does nothing
+        if (current->scope.isScript)
+            break;
+        // a memoized function stores its result, so it makes no tail calls
+        if (tailCall(node) && current->memoKey < 0)
+            compileCall(tailCall(node), 1); // the RETURN is only reached on error
+        else if (node->returnStmt.value)
+            compileExpr(node->returnStmt.value);
+        else
+            emitConst(NUM_VAL(0.0));
+        emitReturn();
+        break;
+
+    case NODE_BREAK:
+        addJump(&current->loop->breaks, emitJump(BC_JUMP));
+        break;
+
+    case NODE_CONTINUE:
+    {
+        Loop *loop = current->loop;
+        while (loop->isSwitch)
+            loop = loop->enclosing;
+        addJump(&loop->continues, emitJump(BC_JUMP));
+        break;
+    }
+
+    case NODE_FUNC_CALL:
+        compileExpr(node);
+        emit(BC_POP);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// ------------------- FUNCTIONS -------------------
+
+static int addProto(struct ASTNode *def)
+{
+    Proto *p = (Proto *)calloc(1, sizeof(Proto));
+    if (!p)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    p->def = def;
+    if (prog->protoCount % 16 == 0)
+    {
+        Proto **grown = (Proto **)realloc(prog->protos, sizeof(Proto *) * (prog->protoCount + 16));
+        if (!grown)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        prog->protos = grown;
+    }
+    prog->protos[prog->protoCount] = p;
+    return prog->protoCount++;
+}
+
+static int compileFunction(struct ASTNode *def)
+{
+    int index = addProto(def);
+    Proto *p = prog->protos[index];
+
+    Compiler c;
+    c.proto = p;
+    c.loop = NULL;
+    beginFunctionScope(&c.scope, def, &globalBound);
+
+    Compiler *enclosing = current;
+    current = &c;
+
+    // the body may assign its parameters: a memoized function keys its
+    // result on a copy of the arguments, in locals no name resolves to
+    c.memoKey = -1;
+    if (def->funcDef.memo)
+    {
+        c.memoKey = c.scope.locals.count;
+        for (int i = 0; i < def->funcDef.paramCount; ++i)
+            appendName(&c.scope.locals, "@memo");
+        emit2(BC_MEMO_FIND, c.memoKey);
+    }
+    compileStmt(def->funcDef.body);
+    emitConst(NUM_VAL(0.0));
+    emitReturn();
+
+    p->arity = def->funcDef.paramCount;
+    p->localCount = c.scope.locals.count;
+    p->localNames = c.scope.locals.names; // the proto takes the names
+    endScope(&c.scope);
+
+    current = enclosing;
+    return index;
+}
+
+// ------------------- PROGRAM -------------------
+
+Program *compileProgram(struct ASTNode *root)
+{
+    prog = (Program *)calloc(1, sizeof(Program));
+    if (!prog)
+        return NULL;
+
+    scanBindings(root, &globalBound);
+
+    Compiler script = {0};
+    script.scope.isScript = 1;
+    script.memoKey = -1;
+    int index = addProto(NULL);
+    script.proto = prog->protos[index];
+    current = &script;
+    compileStmt(root);
+    emit(BC_HALT);
+    current = NULL;
+    // the script's only locals are the hidden ones of its loops
+    script.proto->localCount = script.scope.locals.count;
+    script.proto->localNames = script.scope.locals.names;
+
+    freeNames(&globalBound);
+    prog->globalNames = globals.names;
+    prog->globalCount = globals.count;
+    globals.names = NULL;
+    globals.count = globals.cap = 0;
+
+    Program *done = prog;
+    prog = NULL;
+    return done;
+}
+
+void freeProgram(Program *p)
+{
+    if (!p)
+        return;
+    for (int i = 0; i < p->protoCount; ++i)
+    {
+        Proto *proto = p->protos[i];
+        for (int j = 0; j < proto->localCount; ++j)
+            free(proto->localNames[j]);
+        free(proto->localNames);
+        free(proto->code);
+        free(proto->consts);
+        for (int j = 0; j < proto->switchCount; ++j)
+            freeCases(&proto->switches[j]);
+        free(proto->switches);
+        free(proto->loops);
+        free(proto);
+    }
+    free(p->protos);
+    for (int i = 0; i < p->globalCount; ++i)
+        free(p->globalNames[i]);
+    free(p->globalNames);
+    free(p);
+}
@@ -0,0 +1,11 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "bytecode.h"
+
+/* compiles a parsed program (and every function in it) to bytecode */
+Program *compileProgram(struct ASTNode *root);
+void freeProgram(Program *prog);
+
+#endif
@@ -0,0 +1,484 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Common-subexpression elimination. Within a block, an expression that
+   cannot fail or change anything (arithmetic and comparisons on numbers,
+   length() of an array or string, an array read the bounds pass proved
+   in range) keeps its value until a statement assigns one of its
+   variables, stores into an array (any array: two names may hold the
+   same one) or calls a function. Evaluating it again before then, later
+   in the block or in the branches of an `if` it is part of, reads the
+   value instead: the first evaluation moves into a variable of its own
+   (_cse<n>) set just before its statement.
+
+   That costs a statement, so an expression only gets one when the reads
+   that run whenever it does save more than that; reads in branches use
+   the variable once there is one. Loop bodies and functions start with
+   nothing known. Statements with calls are left alone. */
+
+#define TEMP_COST 1 // nodes: about what the new statement costs
+
+typedef struct
+{
+    struct ASTNode **slot;
+    int depth; // branches around it
+    int dead;  // it was part of a read another expression replaced
+} Use;
+
+typedef struct
+{
+    Use *uses; // uses[0] is the first evaluation
+    int count, cap;
+    struct ASTNode *block, *stmt; // where its statement would go; block NULL: nowhere
+    int size;                     // its nodes
+} Expr;
+
+typedef struct
+{
+    Expr **items;
+    int count, cap;
+} ExprList;
+
+typedef struct
+{
+    Frame *frame;
+    NameList bound;  // definitely bound at this point of the frame
+    ExprList avail;  // expressions whose value is known here
+    struct ASTNode *block, *stmt;
+    int depth;
+} Scan;
+
+static ProgramTypes types;
+static ExprList exprs; // all of them, in the order they were first seen
+static int nextTemp;
+
+static void addExpr(ExprList *l, Expr *e)
+{
+    if (l->count >= l->cap)
+        l->items = (Expr **)growArray(l->items, &l->cap, sizeof(Expr *));
+    l->items[l->count++] = e;
+}
+
+static void addUse(Expr *e, struct ASTNode **slot, int depth)
+{
+    if (e->count >= e->cap)
+        e->uses = (Use *)growArray(e->uses, &e->cap, sizeof(Use));
+    e->uses[e->count++] = (Use){slot, depth, 0};
+}
+
+static int countNodes(struct ASTNode *n)
+{
+    if (!n)
+        return 0;
+    switch (n->type)
+    {
+    case NODE_BINOP:
+        return 1 + countNodes(n->binop.left) + countNodes(n->binop.right);
+    case NODE_ARR_ACCESS:
+        return 1 + countNodes(n->ArrAccessNode.index);
+    case NODE_FUNC_CALL:
+        return 1 + (n->funcCall.argCount ? countNodes(n->funcCall.args[0]) : 0);
+    default:
+        return 1;
+    }
+}
+
+/* e's type when evaluating it can neither fail nor change anything,
+   TYPE_NONE otherwise */
+static StaticType pureType(Scan *s, struct ASTNode *e)
+{
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return TYPE_NUMBER;
+    case NODE_VAR:
+        return findName(&s->bound, e->varName) >= 0 ? nameType(s->frame, e->varName) : TYPE_NONE;
+    case NODE_BINOP:
+        return e->binop.op != OP_DIV && pureType(s, e->binop.left) == TYPE_NUMBER &&
+                       pureType(s, e->binop.right) == TYPE_NUMBER
+                   ? TYPE_NUMBER
+                   : TYPE_NONE;
+    case NODE_ARR_ACCESS:
+        return e->ArrAccessNode.inBounds ? TYPE_ANY : TYPE_NONE;
+    case NODE_FUNC_CALL:
+    {
+        if (findBuiltin(e->funcCall.funcName) != BI_LENGTH || e->funcCall.argCount != 1)
+            return TYPE_NONE;
+        StaticType t = pureType(s, e->funcCall.args[0]);
+        return t == TYPE_STRING || t == TYPE_ARRAY ? TYPE_NUMBER : TYPE_NONE;
+    }
+    default:
+        return TYPE_NONE;
+    }
+}
+
+static void gatherExpr(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Scan *s = (Scan *)ctx;
+    if (!n)
+        return;
+    if ((n->type == NODE_BINOP || n->type == NODE_ARR_ACCESS || n->type == NODE_FUNC_CALL) &&
+        pureType(s, n) != TYPE_NONE)
+    {
+        int k = 0;
+        while (k < s->avail.count && !sameExpr(*s->avail.items[k]->uses[0].slot, n))
+            k++;
+        if (k < s->avail.count)
+            addUse(s->avail.items[k], slot, s->depth);
+        else
+        {
+            Expr *e = (Expr *)calloc(1, sizeof(Expr));
+            if (!e)
+            {
+                printf("Error: out of memory\n");
+                exit(1);
+            }
+            e->block = s->block;
+            e->stmt = s->stmt;
+            e->size = countNodes(n);
+            addUse(e, slot, s->depth);
+            addExpr(&exprs, e);
+            addExpr(&s->avail, e);
+        }
+    }
+    if (n->type == NODE_LOGICAL)
+    {
+        // the right operand may not run: its reads are like a branch's
+        gatherExpr(&n->logical.left, ctx);
+        s->depth++;
+        gatherExpr(&n->logical.right, ctx);
+        s->depth--;
+        return;
+    }
+    visitChildren(n, gatherExpr, ctx);
+}
+
+// ------------------- INVALIDATION -------------------
+
+static int mentions(struct ASTNode *n, const char *name)
+{
+    if (!n)
+        return 0;
+    switch (n->type)
+    {
+    case NODE_VAR:
+        return strcmp(n->varName, name) == 0;
+    case NODE_BINOP:
+        return mentions(n->binop.left, name) || mentions(n->binop.right, name);
+    case NODE_ARR_ACCESS:
+        return strcmp(n->ArrAccessNode.varName, name) == 0 || mentions(n->ArrAccessNode.index, name);
+    case NODE_FUNC_CALL:
+        return n->funcCall.argCount && mentions(n->funcCall.args[0], name);
+    default:
+        return 0;
+    }
+}
+
+static int readsArray(struct ASTNode *n)
+{
+    if (!n)
+        return 0;
+    switch (n->type)
+    {
+    case NODE_BINOP:
+        return readsArray(n->binop.left) || readsArray(n->binop.right);
+    case NODE_ARR_ACCESS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* forgets the expressions that name reads (NULL: those reading arrays) */
+static void forget(Scan *s, const char *name)
+{
+    int kept = 0;
+    for (int i = 0; i < s->avail.count; ++i)
+    {
+        struct ASTNode *n = *s->avail.items[i]->uses[0].slot;
+        if (!(name ? mentions(n, name) : readsArray(n)))
+            s->avail.items[kept++] = s->avail.items[i];
+    }
+    s->avail.count = kept;
+}
+
+static int isCall(struct ASTNode *n)
+{
+    int b = findBuiltin(n->funcCall.funcName);
+    return b < 0 || b == BI_READ_CHUNK;
+}
+
+static void forgetWrites(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Scan *s = (Scan *)ctx;
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_ASSIGN:
+        forget(s, n->assign.varName);
+        break;
+    case NODE_ARR_ASSIGN:
+        forget(s, NULL);
+        break;
+    case NODE_FUNC_DEF:
+        forget(s, n->funcDef.funcName);
+        return;
+    case NODE_FOR_IN:
+        forget(s, n->forIn.varName);
+        break;
+    case NODE_FUNC_CALL:
+        if (isCall(n))
+            s->avail.count = 0;
+        break;
+    default:
+        break;
+    }
+    visitChildren(n, forgetWrites, ctx);
+}
+
+static void findCall(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n)
+        return;
+    if (n->type == NODE_FUNC_CALL && isCall(n))
+        *(int *)ctx = 1;
+    visitChildren(n, findCall, ctx);
+}
+
+static int hasCalls(struct ASTNode *n)
+{
+    int found = 0;
+    findCall(&n, &found);
+    return found;
+}
+
+// ------------------- STATEMENTS -------------------
+
+static void gatherBlock(Scan *s, struct ASTNode *block);
+static void gatherStmt(Scan *s, struct ASTNode *block, struct ASTNode *stmt);
+
+static void gatherFunction(struct ASTNode *def)
+{
+    Scan s = {frameOf(&types, def), {0}, {0}, NULL, NULL, 0};
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        addName(&s.bound, def->funcDef.params[i]);
+    if (def->funcDef.body && def->funcDef.body->type == NODE_BLOCK)
+        gatherBlock(&s, def->funcDef.body);
+    freeNames(&s.bound);
+    free(s.avail.items);
+}
+
+/* a branch of an if: what is known before it stays known in it */
+static void gatherBranch(Scan *s, struct ASTNode *branch)
+{
+    if (!branch)
+        return;
+    ExprList known = s->avail;
+    s->avail.items = (Expr **)malloc(sizeof(Expr *) * (known.count ? known.count : 1));
+    if (!s->avail.items)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    if (known.count)
+        memcpy(s->avail.items, known.items, sizeof(Expr *) * known.count);
+    s->avail.cap = known.count ? known.count : 1;
+    int mark = s->bound.count;
+    s->depth++;
+    if (branch->type == NODE_BLOCK)
+        gatherBlock(s, branch);
+    else
+        gatherStmt(s, NULL, branch); // an else-if: nowhere to put a statement
+    s->depth--;
+    popNames(&s->bound, mark);
+    free(s->avail.items);
+    s->avail = known;
+}
+
+/* a loop body runs again after its own writes: nothing is known in it */
+static void gatherLoopBody(Scan *s, struct ASTNode *body)
+{
+    if (!body)
+        return;
+    ExprList known = s->avail;
+    s->avail = (ExprList){0};
+    int mark = s->bound.count;
+    if (body->type == NODE_BLOCK)
+        gatherBlock(s, body);
+    else
+        gatherStmt(s, NULL, body);
+    popNames(&s->bound, mark);
+    free(s->avail.items);
+    s->avail = known;
+}
+
+static void gatherStmt(Scan *s, struct ASTNode *block, struct ASTNode *stmt)
+{
+    if (!stmt)
+        return;
+    s->block = block;
+    s->stmt = stmt;
+    switch (stmt->type)
+    {
+    case NODE_BLOCK:
+        gatherBlock(s, stmt);
+        return;
+    case NODE_IF:
+        if (!hasCalls(stmt->ifstmt.cond))
+            gatherExpr(&stmt->ifstmt.cond, s);
+        forgetWrites(&stmt->ifstmt.cond, s);
+        gatherBranch(s, stmt->ifstmt.thenBlock);
+        gatherBranch(s, stmt->ifstmt.elseBlock);
+        break;
+    case NODE_SWITCH:
+        if (!hasCalls(stmt->switchStmt.value))
+            gatherExpr(&stmt->switchStmt.value, s);
+        forgetWrites(&stmt->switchStmt.value, s);
+        for (int i = 0; i < stmt->switchStmt.bodyCount; ++i)
+            gatherBranch(s, stmt->switchStmt.bodies[i]);
+        break;
+    case NODE_FOR:
+        if (stmt->forstmt.init && !hasCalls(stmt->forstmt.init))
+            visitChildren(stmt->forstmt.init, gatherExpr, s);
+        bindStmt(s->frame, &s->bound, stmt->forstmt.init);
+        gatherLoopBody(s, stmt->forstmt.body);
+        break;
+    case NODE_WHILE:
+        gatherLoopBody(s, stmt->WhileStmt.body);
+        break;
+    case NODE_FOR_IN:
+    {
+        int mark = s->bound.count;
+        addName(&s->bound, stmt->forIn.varName);
+        gatherLoopBody(s, stmt->forIn.body);
+        popNames(&s->bound, mark);
+        break;
+    }
+    case NODE_FUNC_DEF:
+        gatherFunction(stmt);
+        break;
+    default:
+        if (!hasCalls(stmt))
+            visitChildren(stmt, gatherExpr, s);
+        break;
+    }
+    forgetWrites(&stmt, s);
+    bindStmt(s->frame, &s->bound, stmt);
+}
+
+static void gatherBlock(Scan *s, struct ASTNode *block)
+{
+    for (int i = 0; i < block->block.count; ++i)
+        gatherStmt(s, block, block->block.items[i]);
+}
+
+// ------------------- REWRITING -------------------
+
+static Use *findUse(struct ASTNode **slot)
+{
+    for (int i = 0; i < exprs.count; ++i)
+        for (int k = 0; k < exprs.items[i]->count; ++k)
+            if (exprs.items[i]->uses[k].slot == slot)
+                return &exprs.items[i]->uses[k];
+    return NULL;
+}
+
+/* the reads inside a subtree about to be freed */
+static void markDead(struct ASTNode **slot, void *ctx)
+{
+    if (!*slot)
+        return;
+    Use *u = findUse(slot);
+    if (u)
+        u->dead = 1;
+    visitChildren(*slot, markDead, ctx);
+}
+
+static struct ASTNode *tempVar(const char *name)
+{
+    struct ASTNode *v = newNode(NODE_VAR);
+    snprintf(v->varName, sizeof(v->varName), "%s", name);
+    return v;
+}
+
+/* nodes the reads outside branches no longer evaluate */
+static int saving(Expr *e)
+{
+    int total = 0;
+    for (int k = 1; k < e->count; ++k)
+        if (!e->uses[k].dead && e->uses[k].depth == e->uses[0].depth)
+            total += e->size - 1;
+    return total;
+}
+
+static void replace(Expr *e)
+{
+    struct ASTNode *let = newNode(NODE_ASSIGN);
+    snprintf(let->assign.varName, sizeof(let->assign.varName), "_cse%d", nextTemp++);
+    let->assign.isLet = 1;
+    let->assign.value = *e->uses[0].slot;
+    *e->uses[0].slot = tempVar(let->assign.varName);
+    for (int k = 1; k < e->count; ++k)
+    {
+        Use *u = &e->uses[k];
+        if (u->dead)
+            continue;
+        visitChildren(*u->slot, markDead, NULL);
+        freeNode(*u->slot);
+        *u->slot = tempVar(let->assign.varName);
+    }
+
+    /* smaller expressions of the same statement, this one's parts among
+       them, go before it */
+    for (int i = 0; i < exprs.count; ++i)
+        if (exprs.items[i] != e && exprs.items[i]->stmt == e->stmt)
+            exprs.items[i]->stmt = let;
+    int at = 0;
+    while (e->block->block.items[at] != e->stmt)
+        at++;
+    insertItems(e->block, at, &let, 1);
+    e->uses[0].slot = &let->assign.value;
+    e->stmt = let;
+}
+
+static int bySize(const void *a, const void *b)
+{
+    const Expr *x = *(Expr *const *)a, *y = *(Expr *const *)b;
+    return y->size - x->size;
+}
+
+void eliminateCommonSubexpressions(struct ASTNode *root)
+{
+    inferProgram(&types, root);
+    Scan s = {&types.script, {0}, {0}, NULL, NULL, 0};
+    gatherBlock(&s, root);
+    freeNames(&s.bound);
+    free(s.avail.items);
+
+    // larger expressions first: the reads they replace take their parts along
+    if (exprs.count)
+        qsort(exprs.items, exprs.count, sizeof(Expr *), bySize);
+    for (int i = 0; i < exprs.count; ++i)
+    {
+        Expr *e = exprs.items[i];
+        if (e->block && !e->uses[0].dead && saving(e) > TEMP_COST)
+            replace(e);
+    }
+
+    for (int i = 0; i < exprs.count; ++i)
+    {
+        free(exprs.items[i]->uses);
+        free(exprs.items[i]);
+    }
+    free(exprs.items);
+    exprs = (ExprList){0};
+    freeProgramTypes(&types);
+}
@@ -0,0 +1,740 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Inlining. A call to a small function the script defines once, that
+   nothing rebinds and that is only ever called (so every call reaches
+   that definition), and that cannot reach itself through its calls, is
+   replaced by a copy of its body. Only calls that run after the
+   definition has: later in the script, or in a function defined after
+   it.
+
+   A body that is just `return e;`, with no calls in e, replaces the
+   call expression itself, with the arguments in place of the
+   parameters, when no argument can fail or change anything: literals,
+   variables bound there, and arithmetic on numbers where e reads its
+   parameter at most once. A parameter e indexes must be passed a
+   variable of its own name.
+
+   Otherwise, when the call is a statement of its own or the first
+   thing one evaluates (`let y = f(...)`, `y = f(...)`, `return f(...)`,
+   `if (f(...))`, `print f(...), ...`), the body goes in front of that
+   statement: the parameters become variables set to the arguments (an
+   array argument is the same array, as it is in a call), the
+   function's locals get names of their own (_<copy>_<name>: names the
+   lexer never makes) and its final `return e` becomes the statement's
+   value. That body may only return at its end, and each local must be
+   first set by a `let` in its top-level statements, so no read ever
+   falls through to a global of the same name.
+
+   Whatever else the body names must mean the same in the caller: a
+   function caller may not have a local of that name, and a global the
+   body assigns must be bound before the definition (in the function,
+   assigning an unbound name would make a local). */
+
+#define INLINE_BUDGET 40 // nodes in a body worth copying
+#define INLINE_ROUNDS 4  // a body copied into another is copied with it
+
+typedef struct
+{
+    struct ASTNode *def;
+    int index;       // its statement in the script
+    NameList locals; // its parameters, then what it declares with let
+    NameList names;  // everything its body names
+    NameList writes; // names it assigns
+    NameList called; // names it calls
+    int returns;     // return statements
+    int lastReturns; // its last statement is a return
+    int calls;       // calls to user functions or readChunk
+    int bad;         // a nested definition or readChunk
+} Callee;
+
+typedef struct
+{
+    Frame *frame;   // the caller
+    int index;      // the script statement running it (a function: its definition)
+    NameList bound; // definitely bound at this point of the frame
+} Site;
+
+typedef struct
+{
+    NameList *names;       // what gets replaced
+    struct ASTNode **args; // names[i] reads args[i]; NULL: it is renamed
+    int id;                // _<id>_<name>; 0: nothing is renamed
+} Copy;
+
+static ProgramTypes types;
+static struct ASTNode *program;
+static NodeList candidates; // closed, small, non-recursive definitions without @memo
+static int nextCopy, inlined;
+
+static void countNode(struct ASTNode **slot, void *ctx)
+{
+    if (!*slot)
+        return;
+    ++*(int *)ctx;
+    visitChildren(*slot, countNode, ctx);
+}
+
+static int isUserCall(struct ASTNode *n)
+{
+    int b = findBuiltin(n->funcCall.funcName);
+    return b < 0 || b == BI_READ_CHUNK;
+}
+
+static int scriptIndex(struct ASTNode *def)
+{
+    for (int i = 0; i < program->block.count; ++i)
+        if (program->block.items[i] == def)
+            return i;
+    return -1;
+}
+
+static struct ASTNode *scriptFunction(const char *name)
+{
+    for (int i = 0; i < program->block.count; ++i)
+    {
+        struct ASTNode *s = program->block.items[i];
+        if (s->type == NODE_FUNC_DEF && strcmp(s->funcDef.funcName, name) == 0)
+            return s;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    const char *target;
+    NodeList seen;
+    int found;
+} Reach;
+
+/* a call in n can lead to target's definition */
+static void findReach(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Reach *r = (Reach *)ctx;
+    if (!n || r->found)
+        return;
+    if (n->type == NODE_FUNC_CALL)
+    {
+        struct ASTNode *def = scriptFunction(n->funcCall.funcName);
+        int seen = 0;
+        for (int i = 0; i < r->seen.count; ++i)
+            seen |= r->seen.items[i] == def;
+        if (strcmp(n->funcCall.funcName, r->target) == 0)
+            r->found = 1;
+        else if (def && !seen)
+        {
+            addNode(&r->seen, def);
+            findReach(&def->funcDef.body, ctx);
+        }
+    }
+    visitChildren(n, findReach, ctx);
+}
+
+static int isRecursive(struct ASTNode *def)
+{
+    Reach r = {def->funcDef.funcName, {0}, 0};
+    findReach(&def->funcDef.body, &r);
+    free(r.seen.items);
+    return r.found;
+}
+
+// ------------------- CALLEES -------------------
+
+static void scanBody(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Callee *c = (Callee *)ctx;
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_VAR:
+        addName(&c->names, n->varName);
+        break;
+    case NODE_ASSIGN:
+        addName(&c->names, n->assign.varName);
+        addName(n->assign.isLet ? &c->locals : &c->writes, n->assign.varName);
+        break;
+    case NODE_FOR_IN:
+        addName(&c->names, n->forIn.varName);
+        addName(&c->locals, n->forIn.varName);
+        break;
+    case NODE_ARR_ACCESS:
+        addName(&c->names, n->ArrAccessNode.varName);
+        break;
+    case NODE_ARR_ASSIGN:
+        addName(&c->names, n->arrAssign.varName);
+        break;
+    case NODE_FUNC_CALL:
+        addName(&c->names, n->funcCall.funcName);
+        addName(&c->called, n->funcCall.funcName);
+        if (isUserCall(n))
+            c->calls++;
+        c->bad |= findBuiltin(n->funcCall.funcName) == BI_READ_CHUNK;
+        break;
+    case NODE_RETURN:
+        c->returns++;
+        break;
+    case NODE_FUNC_DEF:
+        c->bad = 1;
+        return;
+    default:
+        break;
+    }
+    visitChildren(n, scanBody, ctx);
+}
+
+static int mentions(struct ASTNode *n, const char *name)
+{
+    NameUse u = {name, 0, 0, 0};
+    countRefs(&n, &u);
+    scanFrame(&n, &u);
+    return u.refs + u.decls > 0;
+}
+
+/* the first top-level statement naming it is `let name = e`, e without it */
+static int setFirst(struct ASTNode *body, const char *name)
+{
+    for (int i = 0; i < body->block.count; ++i)
+    {
+        struct ASTNode *s = body->block.items[i];
+        if (!mentions(s, name))
+            continue;
+        return s->type == NODE_ASSIGN && s->assign.isLet && strcmp(s->assign.varName, name) == 0 &&
+               !mentions(s->assign.value, name);
+    }
+    return 1;
+}
+
+/* the script binds name before its statement at index */
+static int boundBefore(const char *name, int index)
+{
+    for (int i = 0; i < index; ++i)
+    {
+        struct ASTNode *s = program->block.items[i];
+        if (s->type == NODE_ASSIGN && strcmp(s->assign.varName, name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void freeCallee(Callee *c)
+{
+    freeNames(&c->locals);
+    freeNames(&c->names);
+    freeNames(&c->writes);
+    freeNames(&c->called);
+}
+
+static int examine(Callee *c, struct ASTNode *def)
+{
+    struct ASTNode *body = def->funcDef.body;
+    memset(c, 0, sizeof(*c));
+    c->def = def;
+    c->index = scriptIndex(def);
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        addName(&c->locals, def->funcDef.params[i]);
+    c->bad = c->locals.count < def->funcDef.paramCount; // a parameter named twice
+    scanBody(&body, c);
+    int last = body->block.count - 1;
+    c->lastReturns = last >= 0 && body->block.items[last]->type == NODE_RETURN;
+    if (c->bad)
+        return 0;
+
+    for (int i = def->funcDef.paramCount; i < c->locals.count; ++i)
+        if (!setFirst(body, c->locals.names[i]))
+            return 0;
+    for (int i = 0; i < c->locals.count; ++i)
+    {
+        // renamed array names must still fit
+        char buf[64];
+        int len = snprintf(buf, sizeof(buf), "_%d_%s", nextCopy + 1, c->locals.names[i]);
+        if (len >= (int)sizeof(((struct ASTNode *)0)->ArrAccessNode.varName))
+            return 0;
+    }
+    for (int i = 0; i < c->writes.count; ++i)
+        if (findName(&c->locals, c->writes.names[i]) < 0 && !boundBefore(c->writes.names[i], c->index))
+            return 0;
+    for (int i = 0; i < c->called.count; ++i)
+        if (findName(&c->locals, c->called.names[i]) >= 0)
+            return 0;
+    return 1;
+}
+
+/* the callee call runs, if it can be inlined at s */
+static int findCallee(Site *s, struct ASTNode *call, Callee *c)
+{
+    struct ASTNode *def = NULL;
+    for (int i = 0; i < candidates.count && !def; ++i)
+        if (strcmp(candidates.items[i]->funcDef.funcName, call->funcCall.funcName) == 0)
+            def = candidates.items[i];
+    if (!def || call->funcCall.argCount != def->funcDef.paramCount)
+        return 0;
+    if (!examine(c, def) || c->index >= s->index)
+    {
+        freeCallee(c);
+        return 0;
+    }
+    for (int i = 0; s->frame->def && i < c->names.count; ++i)
+    {
+        const char *name = c->names.names[i];
+        if (findName(&c->locals, name) < 0 && findName(&s->frame->names, name) >= 0)
+        {
+            freeCallee(c);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ------------------- COPYING -------------------
+
+static struct ASTNode *copyTree(struct ASTNode *n, Copy *c);
+
+static struct ASTNode **copyList(struct ASTNode **items, int count, Copy *c)
+{
+    if (!items)
+        return NULL;
+    struct ASTNode **out = (struct ASTNode **)malloc(sizeof(struct ASTNode *) * (count ? count : 1));
+    if (!out)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; ++i)
+        out[i] = copyTree(items[i], c);
+    return out;
+}
+
+static void copyName(Copy *c, char *dst, size_t size, const char *name)
+{
+    if (c->id && findName(c->names, name) >= 0)
+        snprintf(dst, size, "_%d_%s", c->id, name);
+    else if (dst != name)
+        snprintf(dst, size, "%s", name);
+}
+
+static char *copyString(const char *s)
+{
+    char *out = (char *)malloc(strlen(s) + 1);
+    if (!out)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    return strcpy(out, s);
+}
+
+static struct ASTNode *copyTree(struct ASTNode *n, Copy *c)
+{
+    if (!n)
+        return NULL;
+    if (n->type == NODE_VAR && c->args)
+    {
+        int k = findName(c->names, n->varName);
+        if (k >= 0)
+            return copyTree(c->args[k], &(Copy){c->names, NULL, 0});
+    }
+    struct ASTNode *m = newNode(n->type);
+    if (!m)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    *m = *n;
+    switch (n->type)
+    {
+    case NODE_VAR:
+        copyName(c, m->varName, sizeof(m->varName), n->varName);
+        break;
+    case NODE_STR:
+        m->str.text = copyString(n->str.text);
+        m->str.value = NULL;
+        break;
+    case NODE_BINOP:
+        m->binop.left = copyTree(n->binop.left, c);
+        m->binop.right = copyTree(n->binop.right, c);
+        break;
+    case NODE_LOGICAL:
+        m->logical.left = copyTree(n->logical.left, c);
+        m->logical.right = copyTree(n->logical.right, c);
+        break;
+    case NODE_ASSIGN:
+        copyName(c, m->assign.varName, sizeof(m->assign.varName), n->assign.varName);
+        m->assign.value = copyTree(n->assign.value, c);
+        break;
+    case NODE_PRINT:
+        m->print.exprs = copyList(n->print.exprs, n->print.count, c);
+        break;
+    case NODE_BLOCK:
+        m->block.items = copyList(n->block.items, n->block.count, c);
+        break;
+    case NODE_IF:
+        m->ifstmt.cond = copyTree(n->ifstmt.cond, c);
+        m->ifstmt.thenBlock = copyTree(n->ifstmt.thenBlock, c);
+        m->ifstmt.elseBlock = copyTree(n->ifstmt.elseBlock, c);
+        break;
+    case NODE_FOR:
+        m->forstmt.init = copyTree(n->forstmt.init, c);
+        m->forstmt.cond = copyTree(n->forstmt.cond, c);
+        m->forstmt.incr = copyTree(n->forstmt.incr, c);
+        m->forstmt.body = copyTree(n->forstmt.body, c);
+        break;
+    case NODE_WHILE:
+        m->WhileStmt.cond = copyTree(n->WhileStmt.cond, c);
+        m->WhileStmt.body = copyTree(n->WhileStmt.body, c);
+        break;
+    case NODE_FOR_IN:
+        copyName(c, m->forIn.varName, sizeof(m->forIn.varName), n->forIn.varName);
+        m->forIn.start = copyTree(n->forIn.start, c);
+        m->forIn.end = copyTree(n->forIn.end, c);
+        m->forIn.step = copyTree(n->forIn.step, c);
+        m->forIn.array = copyTree(n->forIn.array, c);
+        m->forIn.body = copyTree(n->forIn.body, c);
+        break;
+    case NODE_ARRAY:
+        m->ArrayNode.elements = copyList(n->ArrayNode.elements, n->ArrayNode.count, c);
+        break;
+    case NODE_ARR_ACCESS:
+        copyName(c, m->ArrAccessNode.varName, sizeof(m->ArrAccessNode.varName), n->ArrAccessNode.varName);
+        m->ArrAccessNode.index = copyTree(n->ArrAccessNode.index, c);
+        break;
+    case NODE_ARR_ASSIGN:
+        copyName(c, m->arrAssign.varName, sizeof(m->arrAssign.varName), n->arrAssign.varName);
+        m->arrAssign.index = copyTree(n->arrAssign.index, c);
+        m->arrAssign.value = copyTree(n->arrAssign.value, c);
+        break;
+    case NODE_RETURN:
+        m->returnStmt.value = copyTree(n->returnStmt.value, c);
+        break;
+    case NODE_SWITCH:
+        m->switchStmt.value = copyTree(n->switchStmt.value, c);
+        m->switchStmt.bodies = copyList(n->switchStmt.bodies, n->switchStmt.bodyCount, c);
+        copyCases(&m->switchStmt.cases, &n->switchStmt.cases);
+        break;
+    case NODE_FUNC_CALL:
+        m->funcCall.funcName = copyString(n->funcCall.funcName);
+        m->funcCall.args = copyList(n->funcCall.args, n->funcCall.argCount, c);
+        break;
+    default:
+        break; // numbers; callees have no definitions
+    }
+    return m;
+}
+
+/* frees a call node whose arguments were moved or freed */
+static void freeCall(struct ASTNode *call)
+{
+    free(call->funcCall.funcName);
+    free(call->funcCall.args);
+    free(call);
+}
+
+// ------------------- CALL SITES -------------------
+
+/* a parameter the result expression uses as an array or calls */
+static int usesAsName(struct ASTNode *n, const char *name)
+{
+    if (!n)
+        return 0;
+    switch (n->type)
+    {
+    case NODE_BINOP:
+        return usesAsName(n->binop.left, name) || usesAsName(n->binop.right, name);
+    case NODE_LOGICAL:
+        return usesAsName(n->logical.left, name) || usesAsName(n->logical.right, name);
+    case NODE_ARR_ACCESS:
+        return strcmp(n->ArrAccessNode.varName, name) == 0 || usesAsName(n->ArrAccessNode.index, name);
+    case NODE_ARRAY:
+        for (int i = 0; i < n->ArrayNode.count; ++i)
+            if (usesAsName(n->ArrayNode.elements[i], name))
+                return 1;
+        return 0;
+    case NODE_FUNC_CALL:
+        if (strcmp(n->funcCall.funcName, name) == 0)
+            return 1;
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            if (usesAsName(n->funcCall.args[i], name))
+                return 1;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* evaluating arg can neither fail nor change anything, so it can be
+   evaluated where its parameter is read, once per read: literals, bound
+   variables and arithmetic on numbers */
+static int isQuiet(Site *s, struct ASTNode *arg)
+{
+    switch (arg->type)
+    {
+    case NODE_NUM:
+    case NODE_STR:
+        return 1;
+    case NODE_VAR:
+        return findName(&s->bound, arg->varName) >= 0;
+    case NODE_BINOP:
+        return arg->binop.op != OP_DIV && isQuiet(s, arg->binop.left) && isQuiet(s, arg->binop.right) &&
+               exprType(s->frame, arg->binop.left, &s->bound) == TYPE_NUMBER &&
+               exprType(s->frame, arg->binop.right, &s->bound) == TYPE_NUMBER;
+    default:
+        return 0;
+    }
+}
+
+/* arg can replace its parameter in e */
+static int isPlainArg(Site *s, struct ASTNode *arg, struct ASTNode *e, const char *param)
+{
+    NameUse u = {param, 0, 0, 0};
+    countRefs(&e, &u);
+    int same = arg->type == NODE_VAR && strcmp(arg->varName, param) == 0;
+    return isQuiet(s, arg) && (arg->type != NODE_BINOP || u.refs <= 1) && (same || !usesAsName(e, param));
+}
+
+/* replaces calls to functions that only return an expression with it */
+static void inlineExpr(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Site *s = (Site *)ctx;
+    if (!n || n->type == NODE_FUNC_DEF)
+        return;
+    visitChildren(n, inlineExpr, ctx);
+    Callee c;
+    if (n->type != NODE_FUNC_CALL || !findCallee(s, n, &c))
+        return;
+    struct ASTNode *body = c.def->funcDef.body;
+    struct ASTNode *e = body->block.count == 1 && c.lastReturns ? body->block.items[0]->returnStmt.value : NULL;
+    int ok = e && c.calls == 0;
+    for (int i = 0; ok && i < n->funcCall.argCount; ++i)
+        ok = isPlainArg(s, n->funcCall.args[i], e, c.def->funcDef.params[i]);
+    if (ok)
+    {
+        NameList params = {0};
+        for (int i = 0; i < c.def->funcDef.paramCount; ++i)
+            appendName(&params, c.def->funcDef.params[i]);
+        *slot = copyTree(e, &(Copy){&params, n->funcCall.args, 0});
+        freeNames(&params);
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            freeNode(n->funcCall.args[i]);
+        freeCall(n);
+        inlined++;
+    }
+    freeCallee(&c);
+}
+
+/* the call a statement of one of the forms above makes, or NULL */
+static struct ASTNode **hostedCall(struct ASTNode **stmt)
+{
+    struct ASTNode *s = *stmt, **slot = NULL;
+    if (s->type == NODE_ASSIGN)
+        slot = &s->assign.value;
+    else if (s->type == NODE_RETURN)
+        slot = &s->returnStmt.value;
+    else if (s->type == NODE_IF)
+        slot = &s->ifstmt.cond;
+    else if (s->type == NODE_PRINT && s->print.count > 0)
+        slot = &s->print.exprs[0];
+    else if (s->type == NODE_FUNC_CALL)
+        return stmt;
+    return slot && *slot && (*slot)->type == NODE_FUNC_CALL ? slot : NULL;
+}
+
+/* inlines the call of block->block.items[at]; returns the number of
+   statements now in its place, -1 if it was left alone */
+static int inlineStmt(Site *s, struct ASTNode *block, int at)
+{
+    struct ASTNode *stmt = block->block.items[at];
+    struct ASTNode **slot = hostedCall(&block->block.items[at]);
+    Callee c;
+    if (!slot || !findCallee(s, *slot, &c))
+        return -1;
+    struct ASTNode *call = *slot, *body = c.def->funcDef.body;
+    int bare = call == stmt;
+    if (c.returns > (c.lastReturns ? 1 : 0) || (!c.lastReturns && !bare))
+    {
+        freeCallee(&c);
+        return -1;
+    }
+
+    Copy copy = {&c.locals, NULL, ++nextCopy};
+    NodeList out = {0};
+    for (int i = 0; i < call->funcCall.argCount; ++i)
+    {
+        struct ASTNode *let = newNode(NODE_ASSIGN);
+        copyName(&copy, let->assign.varName, sizeof(let->assign.varName), c.def->funcDef.params[i]);
+        let->assign.value = call->funcCall.args[i];
+        let->assign.isLet = 1;
+        addNode(&out, let);
+    }
+    int count = body->block.count - c.lastReturns;
+    for (int i = 0; i < count; ++i)
+        addNode(&out, copyTree(body->block.items[i], &copy));
+    struct ASTNode *result = c.lastReturns ? copyTree(body->block.items[count]->returnStmt.value, &copy) : NULL;
+    freeCall(call);
+
+    if (!bare)
+    {
+        *slot = result;
+        addNode(&out, stmt);
+    }
+    else if (result && result->type != NODE_NUM && result->type != NODE_STR &&
+             !(result->type == NODE_VAR && result->varName[0] == '_'))
+    {
+        // the value is unused, but computing it may still report an error
+        struct ASTNode *let = newNode(NODE_ASSIGN);
+        snprintf(let->assign.varName, sizeof(let->assign.varName), "_%d", copy.id);
+        let->assign.value = result;
+        let->assign.isLet = 1;
+        addNode(&out, let);
+    }
+    else
+        freeNode(result);
+
+    if (out.count == 0)
+    {
+        memmove(block->block.items + at, block->block.items + at + 1,
+                sizeof(struct ASTNode *) * (block->block.count - at - 1));
+        block->block.count--;
+    }
+    else
+    {
+        block->block.items[at] = out.items[0];
+        insertItems(block, at + 1, out.items + 1, out.count - 1);
+    }
+    free(out.items);
+    freeCallee(&c);
+    inlined++;
+    return out.count;
+}
+
+static void inlineBlock(Site *s, struct ASTNode *block);
+
+static void inlineMaybe(Site *s, struct ASTNode *stmt);
+
+static void inlineIn(Site *s, struct ASTNode *stmt)
+{
+    if (!stmt)
+        return;
+    switch (stmt->type)
+    {
+    case NODE_BLOCK:
+        inlineBlock(s, stmt);
+        break;
+    case NODE_IF:
+        inlineExpr(&stmt->ifstmt.cond, s);
+        inlineMaybe(s, stmt->ifstmt.thenBlock);
+        inlineMaybe(s, stmt->ifstmt.elseBlock);
+        break;
+    case NODE_FOR:
+        inlineExpr(&stmt->forstmt.init, s);
+        bindStmt(s->frame, &s->bound, stmt->forstmt.init);
+        inlineExpr(&stmt->forstmt.cond, s);
+        inlineExpr(&stmt->forstmt.incr, s);
+        inlineMaybe(s, stmt->forstmt.body);
+        break;
+    case NODE_WHILE:
+        inlineExpr(&stmt->WhileStmt.cond, s);
+        inlineMaybe(s, stmt->WhileStmt.body);
+        break;
+    case NODE_SWITCH:
+        inlineExpr(&stmt->switchStmt.value, s);
+        for (int i = 0; i < stmt->switchStmt.bodyCount; ++i)
+            inlineMaybe(s, stmt->switchStmt.bodies[i]);
+        break;
+    case NODE_FOR_IN:
+    {
+        inlineExpr(&stmt->forIn.start, s);
+        inlineExpr(&stmt->forIn.end, s);
+        inlineExpr(&stmt->forIn.step, s);
+        inlineExpr(&stmt->forIn.array, s);
+        int mark = s->bound.count;
+        addName(&s->bound, stmt->forIn.varName);
+        inlineIn(s, stmt->forIn.body);
+        popNames(&s->bound, mark);
+        break;
+    }
+    case NODE_FUNC_DEF:
+        break; // inlined into separately, when defined by the script
+    case NODE_FUNC_CALL:
+        // a call statement stays a statement
+        visitChildren(stmt, inlineExpr, s);
+        break;
+    default:
+        visitChildren(stmt, inlineExpr, s);
+        bindStmt(s->frame, &s->bound, stmt);
+        break;
+    }
+}
+
+static void inlineMaybe(Site *s, struct ASTNode *stmt)
+{
+    int mark = s->bound.count;
+    inlineIn(s, stmt);
+    popNames(&s->bound, mark);
+}
+
+static void inlineBlock(Site *s, struct ASTNode *block)
+{
+    for (int i = 0; i < block->block.count; ++i)
+    {
+        if (block == program)
+            s->index = i;
+        inlineIn(s, block->block.items[i]);
+        int count = inlineStmt(s, block, i);
+        for (int k = 0; k < count; ++k)
+            bindStmt(s->frame, &s->bound, block->block.items[i + k]);
+        if (count >= 0)
+            i += count - 1;
+    }
+}
+
+static int inlineRound(struct ASTNode *root)
+{
+    inferProgram(&types, root);
+    for (int i = 0; i < root->block.count; ++i)
+    {
+        struct ASTNode *def = root->block.items[i];
+        int size = 0;
+        if (def->type != NODE_FUNC_DEF || !def->funcDef.body || def->funcDef.body->type != NODE_BLOCK)
+            continue;
+        countNode(&def->funcDef.body, &size);
+        if (size <= INLINE_BUDGET && !def->funcDef.memoize && isClosed(&types, def) && !isRecursive(def))
+            addNode(&candidates, def);
+    }
+
+    inlined = 0;
+    if (candidates.count > 0)
+    {
+        Site script = {&types.script, 0, {0}};
+        inlineBlock(&script, root);
+        freeNames(&script.bound);
+        for (int i = 0; i < root->block.count; ++i)
+        {
+            struct ASTNode *def = root->block.items[i];
+            if (def->type != NODE_FUNC_DEF || !def->funcDef.body || def->funcDef.body->type != NODE_BLOCK)
+                continue;
+            Site s = {frameOf(&types, def), i, {0}};
+            for (int p = 0; p < def->funcDef.paramCount; ++p)
+                addName(&s.bound, def->funcDef.params[p]);
+            inlineBlock(&s, def->funcDef.body);
+            freeNames(&s.bound);
+        }
+    }
+    free(candidates.items);
+    candidates = (NodeList){0};
+    freeProgramTypes(&types);
+    return inlined;
+}
+
+void inlineFunctions(struct ASTNode *root)
+{
+    program = root;
+    for (int round = 0; round < INLINE_ROUNDS && inlineRound(root); ++round)
+        ;
+}
@@ -1,9 +1,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <setjmp.h>
 #include "interpreter.h"
 #include "symbol.h"
+#include "object.h"
 #include "ast.h"
+#include "runtime.h"
+#include "memo.h"
+#include "scope.h"
+
+/* nested calls, as many as the VM and the closure engine allow */
+#define FRAMES_MAX 4096
 
 #define OUTPUT_BUFFER_SIZE (1024 * 1024)
 static char outputBuffer[OUTPUT_BUFFER_SIZE];
@@ -18,453 +26,660 @@ void flushOutput()
     }
 }
 
-/* NOTE:
-   We access the symbol table's table_count here to implement a simple
-   scope mechanism (snapshot & restore). table_count is defined in symbol.c:
-       int table_count = 0;
-   If you prefer encapsulation, implement pushScope()/popScope() in symbol.c instead.
-*/
-extern int table_count;
-
-/* Forward declarations for function execution helpers */
-typedef struct
+/* How a statement finished: normally, or by a return, break or continue
+   that the enclosing loop or function has to act on */
+typedef enum
 {
-    int hasReturn;
-    double value;
-} ReturnStatus;
+    EXEC_NORMAL,
+    EXEC_RETURN, // the value is in returnValue
+    EXEC_BREAK,
+    EXEC_CONTINUE
+} ExecStatus;
 
-static ReturnStatus execWithReturn(struct ASTNode *node);
-static double execASTFunction(struct ASTNode *def, struct ASTNode *call);
+static ExecStatus exec(struct ASTNode *node);
+static Value execASTFunction(struct ASTNode *def, struct ASTNode *call);
 
-// ------------------- AST EVALUATION -------------------
-static void evalArrayLiteral(struct ASTNode *arrNode, double **outData, int *outLen)
-{
-    *outData = NULL;
-    *outLen = 0;
-    if (!arrNode || arrNode->type != NODE_ARRAY)
-        return;
+/* number of active user function calls */
+static int callDepth = 0;
 
-    int n = arrNode->ArrayNode.count;
-    if (n <= 0)
-        return;
+/* a stack overflow ends the run */
+static jmp_buf abortRun;
 
-    double *buf = (double *)malloc(sizeof(double) * n);
-    if (!buf)
-    {
-        printf("Runtime Error: out of memory\n");
-        return;
-    }
+/* the value of the return just executed */
+static Value returnValue;
 
-    for (int i = 0; i < n; ++i)
+/* the call of a `return f(...)` just executed, which execASTFunction makes */
+static struct ASTNode *pendingTail = NULL;
+
+/* Objects held in C locals while more code runs (the arrays for-in
+   loops iterate over, operands and arguments evaluated before the
+   rest): roots, like the table, so loops and calls can collect */
+static Value *roots = NULL;
+static int rootCount = 0, rootCap = 0;
+
+static inline void pushRoot(Value v)
+{
+    if (rootCount >= rootCap)
+        roots = (Value *)growArray(roots, &rootCap, sizeof(Value));
+    roots[rootCount++] = v;
+}
+
+/* a safe point: every object in use is reachable from the table or roots */
+static void safePoint(void)
+{
+    if (gcShouldCollect())
     {
-        struct ASTNode *elem = arrNode->ArrayNode.elements[i];
-        // numeric-only arrays for now
-        double v = 0.0;
-        if (elem->type == NODE_STR)
-        {
-            printf("Type Error: string in numeric array literal\n");
-            v = 0.0;
-        }
-        else
-        {
-            v = evalExpr(elem);
-        }
-        buf[i] = v;
+        for (int k = 0; k < rootCount; ++k)
+            markValue(roots[k]);
+        collectGarbage();
     }
-    *outData = buf;
-    *outLen = n;
 }
 
-double evalExpr(struct ASTNode *node)
+// ------------------- NODE SPECIALIZATION -------------------
+
+/* Nodes start out generic. A generic evaluation records what it saw and
+   rewrites node->spec to a specialized form; the specialized form checks
+   its assumption (a guard) and, when it no longer holds, falls back to
+   the generic path. A node that keeps failing its guards stays generic. */
+enum
 {
-    if (!node)
-        return 0.0;
+    SPEC_NONE,       // generic; specializes on its next evaluation
+    SPEC_GENERIC,    // gave up specializing
+    SPEC_CONST,      // NODE_NUM: the value is in node->cache
+    SPEC_LOCAL,      // NODE_VAR, NODE_ASSIGN: binding at node->slot of the frame
+    SPEC_LOCAL_ELEM, // NODE_ARR_ACCESS, NODE_ARR_ASSIGN: array at node->slot
+    SPEC_BUILTIN,    // NODE_FUNC_CALL: builtin node->slot
+    SPEC_CALL,       // NODE_FUNC_CALL: user function
+    SPEC_INT_OP,     // NODE_BINOP on two small ints: SPEC_INT_OP + op
+    SPEC_NUM_OP = SPEC_INT_OP + OP_GE + 1 // on two doubles: SPEC_NUM_OP + op
+};
+
+#define MAX_DEOPTS 8
+
+static void deoptimize(struct ASTNode *node)
+{
+    if (node->deopts < MAX_DEOPTS)
+        node->deopts++;
+    node->spec = node->deopts < MAX_DEOPTS ? SPEC_NONE : SPEC_GENERIC;
+}
 
-    switch (node->type)
+/* specializeSlot: idx is where lookupSym found the binding; only
+   bindings of the current frame have a stable slot */
+static void specializeSlot(struct ASTNode *node, unsigned char spec, int idx)
+{
+    if (node->spec != SPEC_NONE)
+        return;
+    if (idx >= frameBase)
     {
-    case NODE_NUM:
-        return node->number;
+        node->spec = spec;
+        node->slot = idx - frameBase;
+    }
+    else
+        deoptimize(node);
+}
 
-    case NODE_VAR:
-        // arrays evaluate to their length in numeric contexts
-        if (isArray(node->varName))
-            return getArrayLen(node->varName);
-        return getVar(node->varName);
+// ------------------- INLINE CACHES -------------------
 
-    case NODE_BINOP:
-    {
-        double l = evalExpr(node->binop.left);
-        double r = evalExpr(node->binop.right);
+/* A node that names a variable, array or function remembers the symbol
+   table entry its name resolved to, tagged with the table's epoch. The
+   table bumps its epoch whenever a name may start to resolve elsewhere
+   (a new binding, a call, a return), so a matching epoch means the entry
+   is still the visible binding and the scan is skipped. */
 
-        switch (node->binop.op)
-        {
-        case OP_ADD:
-            return l + r;
-        case OP_SUB:
-            return l - r;
-        case OP_MUL:
-            return l * r;
-        case OP_DIV:
-            return r == 0.0 ? (printf("Runtime Error: Division by zero\n"), 0.0) : l / r;
-        case OP_EQ:
-            return l == r ? 1.0 : 0.0;
-        case OP_NE:
-            return l != r ? 1.0 : 0.0;
-        case OP_LT:
-            return l < r ? 1.0 : 0.0;
-        case OP_LE:
-            return l <= r ? 1.0 : 0.0;
-        case OP_GT:
-            return l > r ? 1.0 : 0.0;
-        case OP_GE:
-            return l >= r ? 1.0 : 0.0;
-        default:
-            return 0.0;
-        }
+static inline int cachedIndex(struct ASTNode *node)
+{
+    if (node->icEpoch == symEpoch)
+    {
+        stats.icHits++;
+        return node->icIndex;
     }
+    stats.icMisses++;
+    return -1;
+}
 
-    case NODE_STR:
-        return 0.0; // numeric value of string is 0
-
-    case NODE_ARRAY:
-        return 0.0; // arrays have no numeric value
+static inline void cacheIndex(struct ASTNode *node, int idx)
+{
+    node->icIndex = idx;
+    node->icEpoch = symEpoch;
+}
 
-    case NODE_ARR_ACCESS:
+/* findSlot: table index of the visible binding of name, -1 if unbound.
+   After a cache miss the node's frame slot (localSpec, SPEC_NONE for
+   nodes without one) is tried before scanning the table. */
+static int findSlot(struct ASTNode *node, const char *name, unsigned char localSpec)
+{
+    int idx = cachedIndex(node);
+    if (idx >= 0)
+        return idx;
+    if (localSpec != SPEC_NONE && node->spec == localSpec)
+    {
+        SymEntry *e = frameEntry(node->slot, name);
+        if (e)
+            idx = (int)(e - table);
+        else
+            deoptimize(node);
+    }
+    if (idx < 0)
     {
-        int idx = (int)evalExpr(node->ArrAccessNode.index);
-        double val = 0.0;
-        if (!getArrayElem(node->ArrAccessNode.varName, idx, &val))
-            return 0.0;
-        return val;
+        idx = lookupSym(name);
+        if (idx < 0)
+            return -1;
+        if (localSpec != SPEC_NONE)
+            specializeSlot(node, localSpec, idx);
     }
+    cacheIndex(node, idx);
+    return idx;
+}
 
-    case NODE_FUNC_CALL:
+/* evalOperand: constants and cached variables without a call */
+static inline Value evalOperand(struct ASTNode *node)
+{
+    if (node)
     {
-        // built-in: length(arrayOrVar)
-        if (strcmp(node->funcCall.funcName, "length") == 0)
+        if (node->spec == SPEC_CONST)
         {
-            if (node->funcCall.argCount != 1)
-            {
-                printf("Runtime Error: length() takes exactly 1 argument\n");
-                return 0.0;
-            }
-            struct ASTNode *arg = node->funcCall.args[0];
-            if (arg->type == NODE_VAR)
-                return (double)getArrayLen(arg->varName);
-            else if (arg->type == NODE_ARRAY)
-                return (double)arg->ArrayNode.count;
-            else
-            {
-                printf("Runtime Error: length() argument must be array or variable\n");
-                return 0.0;
-            }
+            stats.exprEvals++;
+            return node->cache;
         }
-
-        // user-defined function
-        struct ASTNode *def = getFunc(node->funcCall.funcName);
-        if (!def)
+        if (node->type == NODE_VAR && node->icEpoch == symEpoch)
         {
-            printf("Runtime Error: unknown function '%s'\n", node->funcCall.funcName);
-            return 0.0;
+            stats.exprEvals++;
+            stats.icHits++;
+            return table[node->icIndex].value;
         }
-
-        return execASTFunction(def, node);
     }
+    return evalValue(node);
+}
 
-    default:
-        return 0.0;
-    }
+static Value evalVariable(struct ASTNode *node)
+{
+    int idx = findSlot(node, node->varName, SPEC_LOCAL);
+    if (idx < 0)
+        return getValue(node->varName); // reports it
+    return table[idx].value;
 }
 
-// ------------------- Function execution helpers -------------------
+/* the array a NODE_ARR_ACCESS or NODE_ARR_ASSIGN works on, UNDEF_VAL
+   when the name is unbound */
+static Value findArray(struct ASTNode *node, const char *name)
+{
+    int idx = findSlot(node, name, SPEC_LOCAL_ELEM);
+    return idx < 0 ? UNDEF_VAL : table[idx].value;
+}
 
-/* execWithReturn:
-   Executes statements and returns early if it encounters a NODE_RETURN.
-   It handles BLOCK and statement nodes and propagates return upward.
-*/
-static ReturnStatus execWithReturn(struct ASTNode *node)
+/* the binop node on l and r, its operands' values (an update reads its
+   left operand itself) */
+static Value evalBinary(struct ASTNode *node, Value l, Value r)
 {
-    ReturnStatus rs = {0, 0.0};
-    if (!node)
-        return rs;
+    BinOpType op = node->binop.op;
+    int spec = node->spec;
 
-    switch (node->type)
+    if (spec >= SPEC_NUM_OP)
     {
-    case NODE_BLOCK:
-        for (int i = 0; i < node->block.count; ++i)
+        if (IS_NUM(l) && IS_NUM(r))
         {
-            ReturnStatus child = execWithReturn(node->block.items[i]);
-            if (child.hasReturn)
-                return child;
+            double a = AS_NUM(l), b = AS_NUM(r);
+            switch (spec - SPEC_NUM_OP)
+            {
+            case OP_ADD:
+                return NUM_VAL(a + b);
+            case OP_SUB:
+                return NUM_VAL(a - b);
+            case OP_MUL:
+                return NUM_VAL(a * b);
+            case OP_DIV:
+                if (b != 0.0)
+                    return NUM_VAL(a / b);
+                break; // reported by binaryOp
+            case OP_EQ:
+                return INT_VAL(a == b);
+            case OP_NE:
+                return INT_VAL(a != b);
+            case OP_LT:
+                return INT_VAL(a < b);
+            case OP_LE:
+                return INT_VAL(a <= b);
+            case OP_GT:
+                return INT_VAL(a > b);
+            case OP_GE:
+                return INT_VAL(a >= b);
+            }
         }
-        break;
-
-    case NODE_PRINT:
+        else
+            deoptimize(node);
+    }
+    else if (spec >= SPEC_INT_OP)
     {
-        // reuse execAST's print behavior for consistency
-        for (int i = 0; i < node->print.count; ++i)
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
         {
-            struct ASTNode *expr = node->print.exprs[i];
-            if (!expr)
-                continue;
-
-            if (expr->type == NODE_STR)
-                fputs(expr->string, stdout);
-            else if (expr->type == NODE_VAR && isArray(expr->varName))
+            int64_t a = AS_SMALL_INT(l), b = AS_SMALL_INT(r), res;
+            switch (spec - SPEC_INT_OP)
             {
-                int len = getArrayLen(expr->varName);
-                printf("[");
-                for (int j = 0; j < len; j++)
-                {
-                    double val;
-                    if (getArrayElem(expr->varName, j, &val))
-                        printf("%g", val);
-                    else
-                        printf("?");
-                    if (j < len - 1)
-                        printf(", ");
-                }
-                printf("]");
+            case OP_ADD:
+                return intValue(a + b);
+            case OP_SUB:
+                return intValue(a - b);
+            case OP_MUL:
+                if (!__builtin_mul_overflow(a, b, &res))
+                    return intValue(res);
+                break; // continues in double
+            case OP_DIV:
+                if (b != 0)
+                    return NUM_VAL((double)a / (double)b);
+                break;
+            case OP_EQ:
+                return INT_VAL(a == b);
+            case OP_NE:
+                return INT_VAL(a != b);
+            case OP_LT:
+                return INT_VAL(a < b);
+            case OP_LE:
+                return INT_VAL(a <= b);
+            case OP_GT:
+                return INT_VAL(a > b);
+            case OP_GE:
+                return INT_VAL(a >= b);
             }
-            else
-                printf("%g", evalExpr(expr));
-
-            if (i < node->print.count - 1)
-                putchar(' ');
         }
-        putchar('\n');
-        break;
+        else
+            deoptimize(node);
     }
-
-    case NODE_IF:
+    else if (spec == SPEC_NONE)
     {
-        double cond = evalExpr(node->ifstmt.cond);
-        ReturnStatus child = execWithReturn(cond != 0.0 ? node->ifstmt.thenBlock : node->ifstmt.elseBlock);
-        if (child.hasReturn)
-            return child;
-        break;
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+            node->spec = SPEC_INT_OP + op;
+        else if (IS_NUM(l) && IS_NUM(r))
+            node->spec = SPEC_NUM_OP + op;
     }
+    return binaryOp(op, l, r);
+}
 
-    case NODE_FOR:
+/* && and || run their right operand only when the left one does not
+   decide the result */
+static int evalLogical(struct ASTNode *node)
+{
+    int left = truthy(evalValue(node->logical.left));
+    switch (node->logical.op)
     {
-        if (node->forstmt.init)
-            execAST(node->forstmt.init);
+    case LOGIC_AND:
+        return left && truthy(evalValue(node->logical.right));
+    case LOGIC_OR:
+        return left || truthy(evalValue(node->logical.right));
+    default:
+        return !left;
+    }
+}
 
-        struct ASTNode *condNode = node->forstmt.cond;
-        struct ASTNode *incrNode = node->forstmt.incr;
-        struct ASTNode *bodyNode = node->forstmt.body;
+// ------------------- AST EVALUATION -------------------
+static Value evalArrayLiteral(struct ASTNode *arrNode)
+{
+    int n = arrNode->ArrayNode.count;
+    ObjArray *arr = newArray(n);
+    pushRoot(OBJ_VAL(arr));
+    for (int i = 0; i < n; ++i)
+        arr->data[i] = evalValue(arrNode->ArrayNode.elements[i]);
+    rootCount--;
+    return OBJ_VAL(arr);
+}
 
-        while (!condNode || evalExpr(condNode) != 0.0)
-        {
-            if (bodyNode)
-            {
-                ReturnStatus child = execWithReturn(bodyNode);
-                if (child.hasReturn)
-                    return child;
-            }
-            if (incrNode)
-                execAST(incrNode);
-        }
-        break;
+// ------------------- BUILTINS -------------------
+
+static Value evalBuiltin(struct ASTNode *call, int b)
+{
+    int argc = call->funcCall.argCount;
+    struct ASTNode **argNodes = call->funcCall.args;
+    if (argc != builtinArity(b))
+        return builtinArityError(b, argc);
+
+    if (b == BI_READ_CHUNK)
+    {
+        // the buffer argument names the variable to (re)fill
+        struct ASTNode *bufNode = argNodes[1];
+        int isVar = bufNode->type == NODE_VAR;
+        int base = rootCount;
+        Value h = evalValue(argNodes[0]);
+        pushRoot(h);
+        Value buf = isVar ? findValue(bufNode->varName) : UNDEF_VAL;
+        pushRoot(buf);
+        Value max = evalValue(argNodes[2]);
+        rootCount = base;
+        Value before = buf;
+        Value n = builtinReadChunk(h, isVar ? &buf : NULL, max);
+        if (buf != before)
+            setValue(bufNode->varName, buf);
+        return n;
     }
 
-    case NODE_ASSIGN:
+    Value args[3];
+    int base = rootCount;
+    for (int i = 0; i < argc; ++i)
     {
-        struct ASTNode *rhs = node->assign.value;
-        if (rhs && rhs->type == NODE_ARRAY)
-        {
-            double *data = NULL;
-            int len = 0;
-            evalArrayLiteral(rhs, &data, &len);
-            setArray(node->assign.varName, data, len);
-            if (data)
-                free(data);
-        }
-        else
-        {
-            setVar(node->assign.varName, evalExpr(rhs));
-        }
-        break;
+        args[i] = evalValue(argNodes[i]);
+        pushRoot(args[i]);
     }
+    rootCount = base;
+    return callBuiltin(b, args);
+}
 
-    case NODE_ARR_ASSIGN:
+/* a call of a user function rather than a builtin (then in call->slot) */
+static int isUserCall(struct ASTNode *call)
+{
+    if (call->spec == SPEC_NONE)
+    {
+        call->slot = findBuiltin(call->funcCall.funcName);
+        call->spec = call->slot >= 0 ? SPEC_BUILTIN : SPEC_CALL;
+    }
+    return call->spec == SPEC_CALL;
+}
+
+/* the definition a user call reaches, or NULL after reporting it */
+static struct ASTNode *findFunction(struct ASTNode *call)
+{
+    int idx = findSlot(call, call->funcCall.funcName, SPEC_NONE);
+    if (idx >= 0 && IS_FUNC(table[idx].value))
+        return AS_FUNC(table[idx].value)->def;
+    printf("Runtime Error: unknown function '%s'\n", call->funcCall.funcName);
+    return NULL;
+}
+
+Value evalValue(struct ASTNode *node)
+{
+    stats.exprEvals++;
+    if (!node)
+        return NUM_VAL(0.0);
+
+    switch (node->type)
     {
-        int idx = (int)evalExpr(node->arrAssign.index);
-        double val = evalExpr(node->arrAssign.value);
-        if (!setArrayAt(node->arrAssign.varName, idx, val))
+    case NODE_NUM:
+        if (node->spec != SPEC_CONST)
         {
-            printf("Runtime Error: invalid array assignment %s[%d]\n",
-                   node->arrAssign.varName, idx);
+            node->cache = literalValue(node);
+            node->spec = SPEC_CONST;
         }
-        break;
-    }
+        return node->cache;
 
-    case NODE_RETURN:
+    case NODE_STR:
+        if (!node->str.value)
+            node->str.value = slLiteral(node->str.text);
+        return STR_VAL(node->str.value);
+
+    case NODE_VAR:
+        return evalVariable(node);
+
+    case NODE_BINOP:
     {
-        rs.hasReturn = 1;
-        if (node->returnStmt.value)
-            rs.value = evalExpr(node->returnStmt.value);
-        else
-            rs.value = 0.0;
-        return rs;
+        Value l = evalOperand(node->binop.left);
+        if (!IS_OBJ(l))
+            return evalBinary(node, l, evalOperand(node->binop.right));
+        pushRoot(l);
+        Value r = evalOperand(node->binop.right);
+        rootCount--;
+        return evalBinary(node, l, r);
     }
 
-    case NODE_FUNC_DEF:
-        // function definitions inside functions: store it in symbol table
-        setFunc(node->funcDef.funcName, node);
-        break;
+    case NODE_LOGICAL:
+        return INT_VAL(evalLogical(node));
 
-    case NODE_WHILE:
+    case NODE_ARRAY:
+        return evalArrayLiteral(node);
+
+    case NODE_ARR_ACCESS:
     {
-        struct ASTNode *condNode = node->WhileStmt.cond;
-        struct ASTNode *bodyNode = node->WhileStmt.body;
+        Value idx = evalOperand(node->ArrAccessNode.index);
+        const char *name = node->ArrAccessNode.varName;
+        if (node->ArrAccessNode.inBounds)
+            return elementAt(findArray(node, name), idx);
+        if (node->ArrAccessNode.knownArray)
+            return indexKnownArray(name, findArray(node, name), idx);
+        return indexArray(name, findArray(node, name), idx);
+    }
 
-        while (condNode && evalExpr(condNode) != 0.0)
-        {
-            if (bodyNode)
-            {
-                ReturnStatus child = execWithReturn(bodyNode);
-                if (child.hasReturn)
-                    return child;
-            }
-        }
-        break;
+    case NODE_FUNC_CALL:
+    {
+        // built-ins: length() and the numeric input readers
+        if (!isUserCall(node))
+            return evalBuiltin(node, node->slot);
+
+        struct ASTNode *def = findFunction(node);
+        return def ? execASTFunction(def, node) : NUM_VAL(0.0);
     }
 
     default:
-        // For unhandled nodes, fallback to execAST (non-returning)
-        execAST(node);
-        break;
+        return NUM_VAL(0.0);
     }
+}
 
-    return rs;
+/* evalExpr: numeric view of evalValue; other values count as 0 */
+double evalExpr(struct ASTNode *node)
+{
+    Value v = evalValue(node);
+    return IS_NUMERIC(v) ? toNumber(v) : 0.0;
 }
 
-/* execASTFunction:
-   def -> AST node of type NODE_FUNC_DEF
-   call -> AST node of type NODE_FUNC_CALL (contains evaluated args AST)
-   Returns numeric return value (0.0 if none)
-*/
-static double execASTFunction(struct ASTNode *def, struct ASTNode *call)
+// ------------------- Statement helpers shared by both executors -------------------
+
+static void execPrint(struct ASTNode *node)
 {
-    if (!def || def->type != NODE_FUNC_DEF)
+    for (int i = 0; i < node->print.count; ++i)
     {
-        printf("Runtime Error: invalid function definition\n");
-        return 0.0;
+        struct ASTNode *expr = node->print.exprs[i];
+        if (!expr)
+            continue;
+
+        printValue(evalValue(expr));
+
+        if (i < node->print.count - 1)
+            putchar(' ');
     }
+    putchar('\n');
+}
 
-    if (def->funcDef.paramCount != call->funcCall.argCount)
+/* node: the assignment or for-in loop that binds name, caching where */
+static void bindValue(struct ASTNode *node, const char *name, int isLet, Value v)
+{
+    int idx = cachedIndex(node);
+    if (idx < 0 && node->spec == SPEC_LOCAL)
+    {
+        SymEntry *e = frameEntry(node->slot, name);
+        if (e)
+            cacheIndex(node, idx = (int)(e - table));
+        else
+            deoptimize(node);
+    }
+    if (idx >= 0)
     {
-        printf("Runtime Error: function '%s' expects %d args, got %d\n",
-               def->funcDef.funcName, def->funcDef.paramCount, call->funcCall.argCount);
-        return 0.0;
+        table[idx].value = v;
+        return;
+    }
+    idx = isLet ? declareValue(name, v) : setValue(name, v);
+    if (idx >= 0)
+    {
+        specializeSlot(node, SPEC_LOCAL, idx);
+        cacheIndex(node, idx);
     }
+}
 
-    // Snapshot symbol table size to restore later (simple scope)
-    int old_table_count = table_count;
+static void execAssign(struct ASTNode *node)
+{
+    bindValue(node, node->assign.varName, node->assign.isLet, evalValue(node->assign.value));
+}
 
-    // Bind parameters (evaluate args, create new symbols)
-    // Bind parameters (evaluate args, create new symbols)
-    for (int i = 0; i < def->funcDef.paramCount; ++i)
+static void execArrAssign(struct ASTNode *node)
+{
+    Value idx = evalOperand(node->arrAssign.index);
+    int held = IS_OBJ(idx);
+    if (held)
+        pushRoot(idx);
+    Value val = evalValue(node->arrAssign.value);
+    rootCount -= held;
+    const char *name = node->arrAssign.varName;
+    if (node->arrAssign.inBounds)
+        setElementAt(findArray(node, name), idx, val);
+    else if (node->arrAssign.knownArray)
+        storeKnownArray(name, findArray(node, name), idx, val);
+    else
+        storeArray(name, findArray(node, name), idx, val);
+}
+
+/* x op= v: the binding is found once, read, and written in place. v may
+   call a function, but not bind or unbind x, so its slot holds. */
+static void execUpdate(struct ASTNode *node, struct ASTNode *operand)
+{
+    int idx = findSlot(node, node->assign.varName, SPEC_LOCAL);
+    if (idx < 0)
     {
-        struct ASTNode *argNode = call->funcCall.args[i];
+        execAssign(node); // reports it
+        return;
+    }
+    Value old = table[idx].value;
+    int held = IS_OBJ(old);
+    if (held)
+        pushRoot(old);
+    Value v = evalBinary(node->assign.value, old, evalOperand(operand));
+    rootCount -= held;
+    table[idx].value = v; // the call may have moved the table
+}
 
-        // If argument is an array variable, pass by reference
-        if (argNode->type == NODE_VAR && isArray(argNode->varName))
-        {
-            setVarLocalArrayRef(def->funcDef.params[i], argNode->varName);
-        }
-        else
+/* a[i] op= v: i is evaluated once. An operand that runs no code leaves
+   the element where it is, so it is found once; otherwise the store
+   looks again, as a[i] = a[i] op v would. */
+static void execArrUpdate(struct ASTNode *node, struct ASTNode *operand)
+{
+    Value idx = evalOperand(node->arrAssign.index);
+    const char *name = node->arrAssign.varName;
+    Value arr = findArray(node, name);
+    struct ASTNode *bin = node->arrAssign.value;
+    if (operand->type == NODE_NUM || operand->type == NODE_VAR)
+    {
+        Value *e = elementSlot(arr, idx);
+        if (e)
         {
-            double val = evalExpr(argNode);
-            setVar(def->funcDef.params[i], val);
+            *e = evalBinary(bin, *e, evalOperand(operand));
+            return;
         }
     }
+    Value old = node->arrAssign.inBounds     ? elementAt(arr, idx)
+                : node->arrAssign.knownArray ? indexKnownArray(name, arr, idx)
+                                             : indexArray(name, arr, idx);
+    pushRoot(idx);
+    pushRoot(old);
+    Value val = evalBinary(bin, old, evalOperand(operand));
+    rootCount -= 2;
+    arr = findArray(node, name);
+    if (node->arrAssign.inBounds)
+        setElementAt(arr, idx, val);
+    else if (node->arrAssign.knownArray)
+        storeKnownArray(name, arr, idx, val);
+    else
+        storeArray(name, arr, idx, val);
+}
 
-    // Execute function body and capture return if any
-    ReturnStatus rs = execWithReturn(def->funcDef.body);
-
-    // Restore symbol table (remove local variables)
-    // Note: this will drop any variables defined during the function call
-    table_count = old_table_count;
+/* for x in range(...) / array: the bounds are computed once, and x is
+   bound like `let` on every iteration */
+static ExecStatus execForIn(struct ASTNode *node)
+{
+    ExecStatus status = EXEC_NORMAL;
+    struct ASTNode *array = node->forIn.array;
+    Value bounds[3], arr = NUM_VAL(0.0);
+    if (array)
+    {
+        arr = evalValue(array);
+        if (eachBounds(arr, bounds, 0) <= 0)
+            return status;
+        pushRoot(arr);
+    }
+    else
+    {
+        Value args[3] = {INT_VAL(0), INT_VAL(0), INT_VAL(1)};
+        if (node->forIn.start)
+            args[0] = evalValue(node->forIn.start);
+        args[1] = evalValue(node->forIn.end);
+        if (node->forIn.step)
+            args[2] = evalValue(node->forIn.step);
+        if (rangeBounds(args, bounds, 0) <= 0)
+            return status;
+    }
 
-    return rs.hasReturn ? rs.value : 0.0;
+    const char *name = array && array->type == NODE_VAR ? array->varName : "in";
+    int64_t i = AS_SMALL_INT(bounds[0]), last = AS_SMALL_INT(bounds[1]), step = AS_SMALL_INT(bounds[2]);
+    for (;; i += step)
+    {
+        bindValue(node, node->forIn.varName, 1, array ? indexArray(name, arr, INT_VAL(i)) : INT_VAL(i));
+        status = exec(node->forIn.body);
+        if (status == EXEC_RETURN || status == EXEC_BREAK || i == last)
+            break;
+        safePoint();
+    }
+    if (array)
+        rootCount--;
+    return status == EXEC_RETURN ? EXEC_RETURN : EXEC_NORMAL;
 }
 
 // ------------------- AST EXECUTION (statements) -------------------
 
-void execAST(struct ASTNode *node)
+/* exec:
+   Executes one statement. A return, break or continue stops every
+   enclosing block up to the loop or function call it belongs to, which
+   the status tells; a return outside any function does nothing.
+*/
+static ExecStatus exec(struct ASTNode *node)
 {
     if (!node)
-        return;
+        return EXEC_NORMAL;
 
     switch (node->type)
     {
     case NODE_BLOCK:
         for (int i = 0; i < node->block.count; ++i)
-            execAST(node->block.items[i]);
-        break;
-
-    case NODE_PRINT:
-    {
-        for (int i = 0; i < node->print.count; ++i)
         {
-            struct ASTNode *expr = node->print.exprs[i];
-            if (!expr)
-                continue;
+            ExecStatus status = exec(node->block.items[i]);
+            if (status != EXEC_NORMAL)
+                return status;
+            if (callDepth == 0)
+                safePoint();
+        }
+        return EXEC_NORMAL;
 
-            if (expr->type == NODE_STR)
-                fputs(expr->string, stdout);
-            else if (expr->type == NODE_VAR && isArray(expr->varName))
-            {
-                int len = getArrayLen(expr->varName);
-                printf("[");
-                for (int j = 0; j < len; j++)
-                {
-                    double val;
-                    if (getArrayElem(expr->varName, j, &val))
-                        printf("%g", val);
-                    else
-                        printf("?");
-                    if (j < len - 1)
-                        printf(", ");
-                }
-                printf("]");
-            }
-            else
-                printf("%g", evalExpr(expr));
+    case NODE_PRINT:
+        execPrint(node);
+        return EXEC_NORMAL;
 
-            if (i < node->print.count - 1)
-                putchar(' ');
-        }
-        putchar('\n');
-        break;
+    case NODE_IF:
+    {
+        int cond = truthy(evalValue(node->ifstmt.cond));
+        return exec(cond ? node->ifstmt.thenBlock : node->ifstmt.elseBlock);
     }
 
-    case NODE_IF:
+    case NODE_SWITCH:
     {
-        double cond = evalExpr(node->ifstmt.cond);
-        execAST(cond != 0.0 ? node->ifstmt.thenBlock : node->ifstmt.elseBlock);
-        break;
+        int k = selectCase(&node->switchStmt.cases, evalValue(node->switchStmt.value));
+        if (k < 0)
+            return EXEC_NORMAL;
+        ExecStatus status = exec(node->switchStmt.bodies[k]);
+        return status == EXEC_BREAK ? EXEC_NORMAL : status;
     }
 
     case NODE_FOR:
     {
         if (node->forstmt.init)
-            execAST(node->forstmt.init);
+            exec(node->forstmt.init);
 
         struct ASTNode *condNode = node->forstmt.cond;
         struct ASTNode *incrNode = node->forstmt.incr;
         struct ASTNode *bodyNode = node->forstmt.body;
 
-        while (!condNode || evalExpr(condNode) != 0.0)
+        while (!condNode || truthy(evalValue(condNode)))
         {
-            if (bodyNode)
-                execAST(bodyNode);
+            ExecStatus status = exec(bodyNode);
+            if (status == EXEC_RETURN)
+                return status;
+            if (status == EXEC_BREAK)
+                break;
             if (incrNode)
-                execAST(incrNode);
+                exec(incrNode);
+            safePoint();
         }
-        break;
+        return EXEC_NORMAL;
     }
 
     case NODE_WHILE:
@@ -472,56 +687,189 @@ void execAST(struct ASTNode *node)
         struct ASTNode *condNode = node->WhileStmt.cond;
         struct ASTNode *bodyNode = node->WhileStmt.body;
 
-        while (condNode && evalExpr(condNode) != 0.0)
+        while (condNode && truthy(evalValue(condNode)))
         {
-            if (bodyNode)
-                execAST(bodyNode);
+            ExecStatus status = exec(bodyNode);
+            if (status == EXEC_RETURN)
+                return status;
+            if (status == EXEC_BREAK)
+                break;
+            safePoint();
         }
-        break;
+        return EXEC_NORMAL;
     }
+
+    case NODE_FOR_IN:
+        return execForIn(node);
+
     case NODE_ASSIGN:
     {
-        struct ASTNode *rhs = node->assign.value;
-        if (rhs && rhs->type == NODE_ARRAY)
-        {
-            double *data = NULL;
-            int len = 0;
-            evalArrayLiteral(rhs, &data, &len);
-            setArray(node->assign.varName, data, len); // copies
-            if (data)
-                free(data);
-        }
+        struct ASTNode *operand = node->assign.update ? updateOperand(node) : NULL;
+        if (operand)
+            execUpdate(node, operand);
         else
-        {
-            setVar(node->assign.varName, evalExpr(rhs));
-        }
-        break;
+            execAssign(node);
+        return EXEC_NORMAL;
     }
 
     case NODE_ARR_ASSIGN:
     {
-        int idx = (int)evalExpr(node->arrAssign.index);
-        double val = evalExpr(node->arrAssign.value);
-        if (!setArrayAt(node->arrAssign.varName, idx, val))
-        {
-            printf("Runtime Error: invalid array assignment %s[%d]\n",
-                   node->arrAssign.varName, idx);
-        }
-        break;
+        struct ASTNode *operand = node->arrAssign.update ? updateOperand(node) : NULL;
+        if (operand)
+            execArrUpdate(node, operand);
+        else
+            execArrAssign(node);
+        return EXEC_NORMAL;
     }
 
     case NODE_FUNC_DEF:
         // register function in symbol table
         setFunc(node->funcDef.funcName, node);
-        break;
+        return EXEC_NORMAL;
 
     case NODE_RETURN:
-        // return is handled by execWithReturn when executing functions
-        break;
+    {
+        if (callDepth == 0)
+            return EXEC_NORMAL;
+        struct ASTNode *v = node->returnStmt.value;
+        returnValue = NUM_VAL(0.0);
+        if (v && v->type == NODE_FUNC_CALL && isUserCall(v))
+            pendingTail = v;
+        else if (v)
+            returnValue = evalValue(v);
+        return EXEC_RETURN;
+    }
+
+    case NODE_BREAK:
+        return EXEC_BREAK;
+
+    case NODE_CONTINUE:
+        return EXEC_CONTINUE;
+
     case NODE_FUNC_CALL:
         evalExpr(node);
-        break;
+        return EXEC_NORMAL;
+
     default:
-        break;
+        return EXEC_NORMAL;
     }
 }
+
+int execAST(struct ASTNode *node)
+{
+    if (setjmp(abortRun) == 0)
+    {
+        exec(node);
+        return 0;
+    }
+    return 1;
+}
+
+// ------------------- Function execution helpers -------------------
+
+/* the current frame holds exactly def's parameters, in order: a tail call
+   to def can store its arguments in place, and cached lookups stay valid */
+static int holdsParams(struct ASTNode *def)
+{
+    if (table_count != frameBase + def->funcDef.paramCount)
+        return 0;
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        if (strcmp(table[frameBase + i].name, def->funcDef.params[i]) != 0)
+            return 0;
+    return 1;
+}
+
+/* execASTFunction:
+   def -> AST node of type NODE_FUNC_DEF
+   call -> AST node of type NODE_FUNC_CALL (contains evaluated args AST)
+   Returns the function's return value (0 if none)
+   A tail call (return f(...)) is made here, in a loop: its arguments are
+   evaluated in the returning frame, which the callee's frame replaces,
+   so tail recursion takes neither C stack nor symbol table space.
+*/
+static Value execASTFunction(struct ASTNode *def, struct ASTNode *call)
+{
+    if (!def || def->type != NODE_FUNC_DEF)
+    {
+        printf("Runtime Error: invalid function definition\n");
+        return NUM_VAL(0.0);
+    }
+
+    SymFrame frame = {0, 0};
+    int inFrame = 0;
+    Value result = NUM_VAL(0.0);
+    MemoTable *memo = NULL; // stores the result under key
+    Value key[MEMO_MAX_ARGS];
+    while (def)
+    {
+        if (def->funcDef.paramCount != call->funcCall.argCount)
+        {
+            printf("Runtime Error: function '%s' expects %d args, got %d\n",
+                   def->funcDef.funcName, def->funcDef.paramCount, call->funcCall.argCount);
+            break;
+        }
+
+        // Evaluate arguments in the caller's scope before the frame exists
+        int argc = def->funcDef.paramCount;
+        Value args[argc > 0 ? argc : 1];
+        int base = rootCount;
+        for (int i = 0; i < argc; ++i)
+        {
+            args[i] = evalValue(call->funcCall.args[i]);
+            pushRoot(args[i]);
+        }
+        rootCount = base;
+        if (!inFrame && def->funcDef.memo)
+        {
+            if (memoFind(def->funcDef.memo, args, &result))
+                break;
+            memo = def->funcDef.memo;
+            memcpy(key, args, sizeof(Value) * argc);
+        }
+
+        // Parameters are the first locals of the new frame; arrays are
+        // objects, so passing one shares it with the caller (by reference)
+        if (inFrame && holdsParams(def))
+        {
+            for (int i = 0; i < argc; ++i)
+                table[frameBase + i].value = args[i];
+        }
+        else
+        {
+            if (inFrame)
+                popFrame(frame);
+            else if (callDepth >= FRAMES_MAX - 1 || table_count + argc > MAX_SYMBOLS || cStackExhausted())
+            {
+                printf("Runtime Error: stack overflow\n");
+                longjmp(abortRun, 1);
+            }
+            frame = pushFrame();
+            inFrame = 1;
+            for (int i = 0; i < argc; ++i)
+                setValueLocal(def->funcDef.params[i], args[i]);
+        }
+
+        // Execute function body and capture return if any
+        safePoint();
+        callDepth++;
+        ExecStatus status = exec(def->funcDef.body);
+        callDepth--;
+        if (!pendingTail)
+        {
+            if (status == EXEC_RETURN)
+                result = returnValue;
+            break;
+        }
+        call = pendingTail;
+        pendingTail = NULL;
+        def = findFunction(call);
+    }
+
+    // Drop the frame's locals
+    if (inFrame)
+        popFrame(frame);
+    if (memo)
+        memoStore(memo, key, result);
+
+    return result;
+}
@@ -2,9 +2,11 @@
 #define INTERPRETER_H
 
 #include "ast.h"
+#include "value.h"
 
-void execAST(struct ASTNode *node);
-double evalExpr(struct ASTNode *node);
+int execAST(struct ASTNode *node); // 1 if the run was aborted
+Value evalValue(struct ASTNode *node);
+double evalExpr(struct ASTNode *node); // numeric view of evalValue
 
 // buffered output functions
 void flushOutput(void);
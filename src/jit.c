@@ -0,0 +1,1365 @@
+#include "jit.h"
+#include "asm.h"
+#include "object.h"
+#include "runtime.h"
+#include "scope.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+
+int jitEnabled = 1;
+int jitThreshold = JIT_THRESHOLD;
+JitFrame *jitFrames = NULL;
+
+static Value *jitGlobals = NULL;
+static Value *jitStackLimit = NULL; // read by the machine code
+static int jitFrameLimit = 0;
+static int jitDepth = 0; // frame index of the innermost running function
+static int jitFrameCount = 0;
+
+void jitInit(Value *globals, Value *stackLimit, int frameLimit)
+{
+    jitGlobals = globals;
+    jitStackLimit = stackLimit;
+    jitFrameLimit = frameLimit;
+    jitFrames = (JitFrame *)malloc(sizeof(JitFrame) * frameLimit);
+    if (!jitFrames)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+}
+
+/* called by deopt stubs, innermost frame first */
+static void recordFrame(Proto *p, Value *base, int pc, int depth)
+{
+    JitFrame *f = &jitFrames[jitFrameCount++];
+    f->proto = p;
+    f->base = base;
+    f->ip = p->code + pc;
+    f->sp = base + p->localCount + depth;
+}
+
+#ifdef JIT_SUPPORTED
+
+// ------------------- REGISTERS -------------------
+
+/* the first locals live in callee-saved registers, so they survive
+   direct calls; expression temporaries use caller-saved ones, and are
+   written to their stack slots before any call. r10 and r11 hold the
+   QNAN and small-int tag constants for the whole function. */
+#define LOCAL_REGS 5
+#define TEMP_REGS 4
+static const int localRegs[LOCAL_REGS] = {RBX, R12, R13, R14, R15};
+static const int tempRegs[TEMP_REGS] = {RSI, RDI, R8, R9};
+#define REG_QNAN R10
+#define REG_INT_TAG R11
+
+#define SMALL_INT_TAG (QNAN | TAG_INT)
+
+// ------------------- COMPILER STATE -------------------
+
+/* where an operand stack entry is while its instruction is pending */
+typedef enum
+{
+    V_MEM,   // in its VM stack slot
+    V_REG,   // in a temporary register
+    V_LOCAL, // not copied yet: the local itself
+    V_CONST  // not materialized yet: a constant
+} SlotKind;
+
+typedef struct
+{
+    SlotKind kind;
+    int reg;
+    int local;
+    Value k;
+} VSlot;
+
+/* out-of-line exit for one instruction: rebuilds the VM state the
+   instruction started from, then returns to the VM */
+typedef struct
+{
+    int pc;
+    int depth;
+    VSlot *snap;
+    int *patches;
+    int count, cap;
+} Stub;
+
+typedef struct
+{
+    int at; // rel32 position
+    int pc; // target instruction
+} JumpPatch;
+
+/* a dense switch's jump table, placed after the stubs: an int32 per
+   entry, the offset of its case from the table */
+typedef struct
+{
+    int lea;  // disp32 of the lea that finds the table
+    int next; // the pc case targets count from
+    const CaseTable *cases;
+} JumpTable;
+
+typedef struct
+{
+    Proto *proto;
+    Asm as;
+
+    int *depthAt;  // per pc: operand stack depth, -1 if unreachable
+    char *isTarget;
+    int *offsetAt; // per pc: code offset once emitted
+    JumpPatch *jumps;
+    int jumpCount, jumpCap;
+    JumpTable *tables;
+    int tableCount, tableCap;
+
+    VSlot *stack;
+    int depth, maxDepth;
+    VSlot *entry; // the stack as the current instruction found it
+    int entryDepth;
+    int pc;
+    int stub; // current instruction's stub, -1 if none yet
+    Stub *stubs;
+    int stubCount, stubCap;
+
+    Proto **callees; // pending CALLEE targets
+    int calleeCount;
+    int bodyAt; // code offset where the parameters are loaded
+} Jit;
+
+/* r: int64 known to fit in 48 bits -> small int Value */
+static void tagInt(Jit *j, int r)
+{
+    shiftImm(&j->as, EXT_SHL, r, 16);
+    shiftImm(&j->as, EXT_SHR, r, 16);
+    alu(&j->as, ALU_OR, r, REG_INT_TAG);
+}
+
+static void epilogue(Jit *j)
+{
+    aluImm(&j->as, 1, EXT_ADD, RSP, 8);
+    popReg(&j->as, R15);
+    popReg(&j->as, R14);
+    popReg(&j->as, R13);
+    popReg(&j->as, R12);
+    popReg(&j->as, RBX);
+    popReg(&j->as, RBP);
+    emitByte(&j->as, 0xc3);
+}
+
+// ------------------- DEOPT STUBS -------------------
+
+static int newStub(Jit *j, int pc, VSlot *snap, int depth)
+{
+    if (j->stubCount >= j->stubCap)
+        j->stubs = (Stub *)growArray(j->stubs, &j->stubCap, sizeof(Stub));
+    Stub *s = &j->stubs[j->stubCount];
+    memset(s, 0, sizeof(*s));
+    s->pc = pc;
+    s->depth = depth;
+    s->snap = (VSlot *)malloc(sizeof(VSlot) * (depth ? depth : 1));
+    if (!s->snap)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    memcpy(s->snap, snap, sizeof(VSlot) * depth);
+    return j->stubCount++;
+}
+
+static void addStubPatch(Jit *j, int stub, int at)
+{
+    Stub *s = &j->stubs[stub];
+    if (s->count >= s->cap)
+        s->patches = (int *)growArray(s->patches, &s->cap, sizeof(int));
+    s->patches[s->count++] = at;
+}
+
+/* guard: leaves for the interpreter when cc holds */
+static void deoptIf(Jit *j, int cc)
+{
+    if (j->stub < 0)
+        j->stub = newStub(j, j->pc, j->entry, j->entryDepth);
+    addStubPatch(j, j->stub, jcc(&j->as, cc));
+}
+
+// ------------------- OPERAND STACK -------------------
+
+static int32_t slotDisp(Jit *j, int i)
+{
+    return 8 * (j->proto->localCount + i);
+}
+
+static int localReg(int s)
+{
+    return s < LOCAL_REGS ? localRegs[s] : -1;
+}
+
+static void loadLocal(Jit *j, int dst, int s)
+{
+    int r = localReg(s);
+    if (r >= 0)
+        movRR(&j->as, dst, r);
+    else
+        load(&j->as, dst, RBP, 8 * s);
+}
+
+/* e is (or was) the entry at depth i */
+static void loadEntry(Jit *j, int dst, VSlot *e, int i)
+{
+    switch (e->kind)
+    {
+    case V_MEM:
+        load(&j->as, dst, RBP, slotDisp(j, i));
+        break;
+    case V_REG:
+        movRR(&j->as, dst, e->reg);
+        break;
+    case V_LOCAL:
+        loadLocal(j, dst, e->local);
+        break;
+    case V_CONST:
+        movImm(&j->as, dst, e->k);
+        break;
+    }
+}
+
+/* writes the entry to its VM stack slot (clobbers rax) */
+static void materialize(Jit *j, VSlot *e, int i)
+{
+    if (e->kind == V_MEM)
+        return;
+    int r = e->kind == V_REG ? e->reg : e->kind == V_LOCAL ? localReg(e->local) : -1;
+    if (r < 0)
+    {
+        loadEntry(j, RAX, e, i);
+        r = RAX;
+    }
+    store(&j->as, RBP, slotDisp(j, i), r);
+    e->kind = V_MEM;
+}
+
+static void flush(Jit *j)
+{
+    for (int i = 0; i < j->depth; ++i)
+        materialize(j, &j->stack[i], i);
+}
+
+static VSlot *push(Jit *j, SlotKind kind)
+{
+    VSlot *e = &j->stack[j->depth++];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    return e;
+}
+
+static VSlot pop(Jit *j)
+{
+    return j->stack[--j->depth];
+}
+
+static int allocTemp(Jit *j)
+{
+    for (int t = 0; t < TEMP_REGS; ++t)
+    {
+        int used = 0;
+        for (int i = 0; i < j->depth && !used; ++i)
+            used = j->stack[i].kind == V_REG && j->stack[i].reg == tempRegs[t];
+        if (!used)
+            return tempRegs[t];
+    }
+    // all taken: the deepest one goes to its stack slot
+    for (int i = 0;; ++i)
+        if (j->stack[i].kind == V_REG)
+        {
+            int r = j->stack[i].reg;
+            materialize(j, &j->stack[i], i);
+            return r;
+        }
+}
+
+/* pushes rax; only after the instruction's last guard */
+static void pushResult(Jit *j)
+{
+    int r = allocTemp(j);
+    movRR(&j->as, r, RAX);
+    push(j, V_REG)->reg = r;
+}
+
+static int isIntConst(VSlot *e)
+{
+    return e->kind == V_CONST && IS_SMALL_INT(e->k);
+}
+
+static int isNumConst(VSlot *e)
+{
+    return e->kind == V_CONST && IS_NUM(e->k);
+}
+
+// ------------------- TYPE GUARDS -------------------
+
+static void guardInt(Jit *j, int r)
+{
+    testTag(&j->as, r, 0x7ffd);
+    deoptIf(j, CC_NE);
+}
+
+/* r: an array Value -> its ObjArray pointer */
+static void guardArray(Jit *j, int r)
+{
+    testTag(&j->as, r, 0xfffc);
+    deoptIf(j, CC_NE);
+    shiftImm(&j->as, EXT_SHL, r, 16);
+    shiftImm(&j->as, EXT_SHR, r, 16);
+    // cmp byte [r + type], OBJ_ARRAY
+    rex(&j->as, 0, 0, 0, r);
+    emitByte(&j->as, 0x80);
+    emitByte(&j->as, 0x80 | (7 << 3) | (r & 7));
+    emitInt32(&j->as, (int32_t)offsetof(Obj, type));
+    emitByte(&j->as, OBJ_ARRAY);
+    deoptIf(j, CC_NE);
+}
+
+/* loads a numeric Value (small int or double) into xmm */
+static void toDouble(Jit *j, int r, int xmm, VSlot *e)
+{
+    if (isIntConst(e))
+    {
+        double d = (double)AS_SMALL_INT(e->k);
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        movImm(&j->as, r, bits);
+    }
+    if (e->kind == V_CONST)
+    {
+        MOVQ_TO_XMM(&j->as, xmm, r);
+        return;
+    }
+    testTag(&j->as, r, 0x7ffd);
+    int notInt = jcc(&j->as, CC_NE);
+    untag(&j->as, r);
+    CVTSI2SD(&j->as, xmm, r);
+    int done = jmp(&j->as);
+    patchHere(&j->as, notInt);
+    movRR(&j->as, RDX, r);
+    alu(&j->as, ALU_AND, RDX, REG_QNAN);
+    alu(&j->as, ALU_CMP, RDX, REG_QNAN);
+    deoptIf(j, CC_E); // a string, array, big int, ...
+    MOVQ_TO_XMM(&j->as, xmm, r);
+    patchHere(&j->as, done);
+}
+
+// ------------------- ARITHMETIC -------------------
+
+/* l in rax, r in rcx; both small ints take the exact int64 path, any
+   other pair of numbers the double path, like the VM's fast paths */
+static void emitArith(Jit *j, int op)
+{
+    VSlot r = pop(j), l = pop(j);
+    int ld = j->depth;
+    loadEntry(j, RAX, &l, ld);
+    loadEntry(j, RCX, &r, ld + 1);
+
+    int intPath = op != OP_DIV && !isNumConst(&l) && !isNumConst(&r);
+    int fltPath = op == OP_DIV || !(isIntConst(&l) && isIntConst(&r));
+    int notInt[2], n = 0, done = -1;
+    if (intPath)
+    {
+        if (!isIntConst(&l))
+        {
+            testTag(&j->as, RAX, 0x7ffd);
+            notInt[n++] = jcc(&j->as, CC_NE);
+        }
+        if (!isIntConst(&r))
+        {
+            testTag(&j->as, RCX, 0x7ffd);
+            notInt[n++] = jcc(&j->as, CC_NE);
+        }
+        untag(&j->as, RAX);
+        untag(&j->as, RCX);
+        if (op == OP_ADD)
+            alu(&j->as, ALU_ADD, RAX, RCX);
+        else if (op == OP_SUB)
+            alu(&j->as, ALU_SUB, RAX, RCX);
+        else
+        {
+            opRR(&j->as, 1, 0x0faf, RAX, RCX); // imul rax, rcx
+            deoptIf(j, CC_O);
+        }
+        // results outside 48 bits are boxed by the interpreter
+        movRR(&j->as, RDX, RAX);
+        untag(&j->as, RDX);
+        alu(&j->as, ALU_CMP, RDX, RAX);
+        deoptIf(j, CC_NE);
+        tagInt(j, RAX);
+        if (fltPath)
+            done = jmp(&j->as);
+    }
+    if (fltPath)
+    {
+        for (int i = 0; i < n; ++i)
+            patchHere(&j->as, notInt[i]);
+        toDouble(j, RAX, 0, &l);
+        toDouble(j, RCX, 1, &r);
+        static const int sseOps[] = {0x58, 0x5c, 0x59, 0x5e};
+        if (op == OP_DIV)
+        {
+            // division by zero prints its error in the interpreter
+            XORPD(&j->as, 2);
+            UCOMISD(&j->as, 1, 2);
+            int nan = jcc(&j->as, CC_P);
+            deoptIf(j, CC_E);
+            patchHere(&j->as, nan);
+        }
+        sse(&j->as, 0xf2, sseOps[op], 0, 1, 0);
+        MOVQ_FROM_XMM(&j->as, RAX, 0);
+    }
+    if (done >= 0)
+        patchHere(&j->as, done);
+    pushResult(j);
+}
+
+/* leaves the comparison's 0/1 in al */
+static void emitCompare(Jit *j, int op, VSlot *l, VSlot *r, int ld)
+{
+    static const int intCC[] = {CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE};
+    loadEntry(j, RAX, l, ld);
+    loadEntry(j, RCX, r, ld + 1);
+
+    int intPath = !isNumConst(l) && !isNumConst(r);
+    int fltPath = !(isIntConst(l) && isIntConst(r));
+    int notInt[2], n = 0, done = -1;
+    if (intPath)
+    {
+        if (!isIntConst(l))
+        {
+            testTag(&j->as, RAX, 0x7ffd);
+            notInt[n++] = jcc(&j->as, CC_NE);
+        }
+        if (!isIntConst(r))
+        {
+            testTag(&j->as, RCX, 0x7ffd);
+            notInt[n++] = jcc(&j->as, CC_NE);
+        }
+        untag(&j->as, RAX);
+        untag(&j->as, RCX);
+        alu(&j->as, ALU_CMP, RAX, RCX);
+        setcc(&j->as, intCC[op - OP_EQ], RAX);
+        if (fltPath)
+            done = jmp(&j->as);
+    }
+    if (fltPath)
+    {
+        for (int i = 0; i < n; ++i)
+            patchHere(&j->as, notInt[i]);
+        toDouble(j, RAX, 0, l);
+        toDouble(j, RCX, 1, r);
+        // unordered (NaN) operands make every comparison but != false
+        switch (op)
+        {
+        case OP_EQ:
+            UCOMISD(&j->as, 0, 1);
+            setcc(&j->as, CC_E, RAX);
+            setcc(&j->as, CC_NP, RCX);
+            emitByte(&j->as, 0x20); // and al, cl
+            emitByte(&j->as, 0xc8);
+            break;
+        case OP_NE:
+            UCOMISD(&j->as, 0, 1);
+            setcc(&j->as, CC_NE, RAX);
+            setcc(&j->as, CC_P, RCX);
+            emitByte(&j->as, 0x08); // or al, cl
+            emitByte(&j->as, 0xc8);
+            break;
+        case OP_LT:
+            UCOMISD(&j->as, 1, 0);
+            setcc(&j->as, CC_A, RAX);
+            break;
+        case OP_LE:
+            UCOMISD(&j->as, 1, 0);
+            setcc(&j->as, CC_AE, RAX);
+            break;
+        case OP_GT:
+            UCOMISD(&j->as, 0, 1);
+            setcc(&j->as, CC_A, RAX);
+            break;
+        default:
+            UCOMISD(&j->as, 0, 1);
+            setcc(&j->as, CC_AE, RAX);
+            break;
+        }
+    }
+    if (done >= 0)
+        patchHere(&j->as, done);
+}
+
+// ------------------- CONTROL FLOW -------------------
+
+static void jumpTo(Jit *j, int at, int pc)
+{
+    if (j->jumpCount >= j->jumpCap)
+        j->jumps = (JumpPatch *)growArray(j->jumps, &j->jumpCap, sizeof(JumpPatch));
+    j->jumps[j->jumpCount].at = at;
+    j->jumps[j->jumpCount].pc = pc;
+    j->jumpCount++;
+}
+
+/* jumps to pc when the popped value is falsy */
+static void emitJumpIfFalse(Jit *j, int pc)
+{
+    VSlot v = pop(j);
+    flush(j);
+    loadEntry(j, RAX, &v, j->depth);
+    movImm(&j->as, RCX, INT_VAL(0));
+    alu(&j->as, ALU_CMP, RAX, RCX);
+    jumpTo(j, jcc(&j->as, CC_E), pc);
+    testTag(&j->as, RAX, 0x7ffd);
+    int isInt = jcc(&j->as, CC_E); // any other int is true
+    movRR(&j->as, RDX, RAX);
+    alu(&j->as, ALU_AND, RDX, REG_QNAN);
+    alu(&j->as, ALU_CMP, RDX, REG_QNAN);
+    deoptIf(j, CC_E); // nil, booleans, objects
+    MOVQ_TO_XMM(&j->as, 0, RAX);
+    XORPD(&j->as, 1);
+    UCOMISD(&j->as, 0, 1);
+    int nan = jcc(&j->as, CC_P);
+    jumpTo(j, jcc(&j->as, CC_E), pc);
+    patchHere(&j->as, isInt);
+    patchHere(&j->as, nan);
+}
+
+/* rax (a small int's value) against a label */
+static void compareKey(Jit *j, int64_t label)
+{
+    if (label >= INT32_MIN && label <= INT32_MAX)
+        aluImm(&j->as, 1, EXT_CMP, RAX, (int32_t)label);
+    else
+    {
+        movImm(&j->as, RCX, (uint64_t)label);
+        alu(&j->as, ALU_CMP, RAX, RCX);
+    }
+}
+
+/* sparse labels: a binary search in compares, down to a few in a row */
+static void emitCaseTree(Jit *j, const CaseTable *t, int lo, int hi, int next)
+{
+    while (hi - lo >= 4)
+    {
+        int mid = lo + (hi - lo) / 2;
+        compareKey(j, t->labels[mid]);
+        jumpTo(j, jcc(&j->as, CC_E), next + t->targets[mid]);
+        int above = jcc(&j->as, CC_G);
+        emitCaseTree(j, t, lo, mid - 1, next);
+        patchHere(&j->as, above);
+        lo = mid + 1;
+    }
+    for (int i = lo; i <= hi; ++i)
+    {
+        compareKey(j, t->labels[i]);
+        jumpTo(j, jcc(&j->as, CC_E), next + t->targets[i]);
+    }
+    jumpTo(j, jmp(&j->as), next + t->otherwise);
+}
+
+/* a small int goes to its case; anything else, which may equal a label
+   as a double, is left to the interpreter */
+static void emitSwitch(Jit *j, int pc)
+{
+    const CaseTable *t = &j->proto->switches[j->proto->code[pc + 1]];
+    int next = pc + 2;
+    VSlot v = pop(j);
+    flush(j);
+    loadEntry(j, RAX, &v, j->depth);
+    guardInt(j, RAX);
+    untag(&j->as, RAX);
+    if (!t->table)
+    {
+        emitCaseTree(j, t, 0, t->count - 1, next);
+        return;
+    }
+    // unsigned key - labels[0] < span: rax += the table's entry; jmp rax
+    if (t->labels[0] >= INT32_MIN && t->labels[0] <= INT32_MAX)
+        aluImm(&j->as, 1, EXT_SUB, RAX, (int32_t)t->labels[0]);
+    else
+    {
+        movImm(&j->as, RCX, (uint64_t)t->labels[0]);
+        alu(&j->as, ALU_SUB, RAX, RCX);
+    }
+    aluImm(&j->as, 1, EXT_CMP, RAX, t->span);
+    jumpTo(j, jcc(&j->as, CC_AE), next + t->otherwise);
+    emitByte(&j->as, 0x48); // lea rcx, [rip + table]
+    emitByte(&j->as, 0x8d);
+    emitByte(&j->as, 0x0d);
+    emitInt32(&j->as, 0);
+    if (j->tableCount >= j->tableCap)
+        j->tables = (JumpTable *)growArray(j->tables, &j->tableCap, sizeof(JumpTable));
+    j->tables[j->tableCount++] = (JumpTable){j->as.len - 4, next, t};
+    emitByte(&j->as, 0x48); // movsxd rax, dword [rcx + rax*4]
+    emitByte(&j->as, 0x63);
+    emitByte(&j->as, 0x04);
+    emitByte(&j->as, 0x81);
+    alu(&j->as, ALU_ADD, RAX, RCX);
+    emitByte(&j->as, 0xff); // jmp rax
+    emitByte(&j->as, 0xe0);
+}
+
+/* for-in: the runtime helper sets the hidden locals s.. (see
+   BC_FOR_RANGE); an error is left for the interpreter to report */
+static void emitForStart(Jit *j, int op, int s, int exitPc)
+{
+    int argc = op == BC_FOR_RANGE ? 3 : 1;
+    flush(j);
+    memcpy(j->entry, j->stack, sizeof(VSlot) * j->depth); // the call clobbers the temps
+    int at = j->depth - argc;
+    if (op == BC_FOR_EACH)
+    {
+        load(&j->as, RDI, RBP, slotDisp(j, at));
+        store(&j->as, RBP, 8 * (s + 3), RDI);
+        movImm(&j->as, RAX, (uint64_t)(uintptr_t)eachBounds);
+    }
+    else
+    {
+        opRM(&j->as, 1, 0x8d, RDI, RBP, slotDisp(j, at)); // lea
+        movImm(&j->as, RAX, (uint64_t)(uintptr_t)rangeBounds);
+    }
+    opRM(&j->as, 1, 0x8d, RSI, RBP, 8 * s); // lea
+    movImm(&j->as, RDX, 1);
+    emitByte(&j->as, 0xff); // call rax
+    emitByte(&j->as, 0xd0);
+    movImm(&j->as, REG_QNAN, QNAN);
+    movImm(&j->as, REG_INT_TAG, SMALL_INT_TAG);
+    for (int l = s; l <= s + (op == BC_FOR_EACH ? 3 : 2); ++l)
+        if (localReg(l) >= 0)
+            load(&j->as, localReg(l), RBP, 8 * l);
+    aluImm(&j->as, 0, EXT_CMP, RAX, -1);
+    deoptIf(j, CC_E);
+    j->depth = at;
+    emitByte(&j->as, 0x85); // test eax, eax
+    emitByte(&j->as, 0xc0);
+    jumpTo(j, jcc(&j->as, CC_E), exitPc);
+}
+
+/* leaves for exitPc once local s is the last value, else steps it */
+static void emitForNext(Jit *j, int s, int exitPc)
+{
+    flush(j);
+    loadLocal(j, RAX, s);
+    loadLocal(j, RCX, s + 1);
+    alu(&j->as, ALU_CMP, RAX, RCX);
+    jumpTo(j, jcc(&j->as, CC_E), exitPc);
+    loadLocal(j, RCX, s + 2);
+    untag(&j->as, RAX);
+    untag(&j->as, RCX);
+    alu(&j->as, ALU_ADD, RAX, RCX);
+    tagInt(j, RAX);
+    if (localReg(s) >= 0)
+        movRR(&j->as, localReg(s), RAX);
+    else
+        store(&j->as, RBP, 8 * s, RAX);
+}
+
+// ------------------- ARRAYS -------------------
+
+/* rax: the array in local s -> ObjArray *, rcx: in-range index */
+/* checked 0: the optimizer proved the index in range (BC_ELEMENT_*) */
+static void loadElementAddress(Jit *j, int s, VSlot *idx, int i, int checked)
+{
+    loadLocal(j, RAX, s);
+    if (checked)
+        guardArray(j, RAX);
+    else
+    {
+        shiftImm(&j->as, EXT_SHL, RAX, 16); // untag the pointer
+        shiftImm(&j->as, EXT_SHR, RAX, 16);
+    }
+    loadEntry(j, RCX, idx, i);
+    if (checked && !isIntConst(idx))
+        guardInt(j, RCX);
+    untag(&j->as, RCX);
+    if (checked)
+    {
+        opRM(&j->as, 1, 0x63, RDX, RAX, (int32_t)offsetof(ObjArray, len)); // movsxd
+        alu(&j->as, ALU_CMP, RCX, RDX);
+        deoptIf(j, CC_AE); // also catches negative indexes
+    }
+    load(&j->as, RAX, RAX, (int32_t)offsetof(ObjArray, data));
+}
+
+// ------------------- CALLS -------------------
+
+static Proto *calleeProto(int g)
+{
+    Value v = jitGlobals[g];
+    return IS_FUNC(v) ? AS_FUNC(v)->proto : NULL;
+}
+
+static void emitCallee(Jit *j, int g, Proto *q)
+{
+    movImm(&j->as, RAX, (uint64_t)(uintptr_t)&jitGlobals[g]);
+    load(&j->as, RCX, RAX, 0);
+    testTag(&j->as, RCX, 0xfffc);
+    deoptIf(j, CC_NE);
+    movRR(&j->as, RAX, RCX);
+    shiftImm(&j->as, EXT_SHL, RAX, 16);
+    shiftImm(&j->as, EXT_SHR, RAX, 16);
+    rex(&j->as, 0, 0, 0, RAX); // cmp byte [rax + type], OBJ_FUNCTION
+    emitByte(&j->as, 0x80);
+    emitByte(&j->as, 0x80 | (7 << 3) | RAX);
+    emitInt32(&j->as, (int32_t)offsetof(Obj, type));
+    emitByte(&j->as, OBJ_FUNCTION);
+    deoptIf(j, CC_NE);
+    // the global may have been rebound to another function
+    load(&j->as, RAX, RAX, (int32_t)offsetof(ObjFunction, proto));
+    movImm(&j->as, RDX, (uint64_t)(uintptr_t)q);
+    alu(&j->as, ALU_CMP, RAX, RDX);
+    deoptIf(j, CC_NE);
+    movRR(&j->as, RAX, RCX);
+    pushResult(j);
+    j->callees[j->calleeCount++] = q;
+}
+
+/* the callee gets a real VM frame on the value stack (arguments in
+   place, like BC_CALL), so a deopt anywhere below can be resumed */
+static void emitCall(Jit *j, int argc, int nextPc)
+{
+    Proto *q = j->callees[--j->calleeCount];
+    Proto *p = j->proto;
+    flush(j);
+    int d = j->depth;
+
+    // the interpreter reports stack overflow
+    movImm(&j->as, RAX, (uint64_t)(uintptr_t)&jitDepth);
+    opRM(&j->as, 0, 0x8b, RDX, RAX, 0);
+    aluImm(&j->as, 0, EXT_CMP, RDX, jitFrameLimit - 1);
+    deoptIf(j, CC_GE);
+    opRM(&j->as, 1, 0x8d, RDX, RBP, 8 * (p->localCount + d + q->localCount)); // lea
+    movImm(&j->as, RCX, (uint64_t)(uintptr_t)&jitStackLimit);
+    opRM(&j->as, 1, 0x3b, RDX, RCX, 0);
+    deoptIf(j, CC_A);
+
+    opRM(&j->as, 0, 0xff, 0, RAX, 0); // inc dword [jitDepth]
+    opRM(&j->as, 1, 0x8d, RDI, RBP, 8 * (p->localCount + d - argc));
+    if (q == p)
+    {
+        emitByte(&j->as, 0xe8); // call rel32 to our own entry
+        emitInt32(&j->as, -(j->as.len + 4));
+    }
+    else
+    {
+        movImm(&j->as, RAX, (uint64_t)(uintptr_t)q->native);
+        emitByte(&j->as, 0xff); // call rax
+        emitByte(&j->as, 0xd0);
+    }
+    movImm(&j->as, RCX, (uint64_t)(uintptr_t)&jitDepth);
+    opRM(&j->as, 0, 0xff, 1, RCX, 0); // dec dword [jitDepth]
+
+    // the callee deoptimized: this frame resumes after the call, once
+    // the interpreter has finished the callee
+    j->depth -= argc + 1;
+    emitByte(&j->as, 0x85); // test eax, eax
+    emitByte(&j->as, 0xc0);
+    int stub = newStub(j, nextPc, j->stack, j->depth);
+    addStubPatch(j, stub, jcc(&j->as, CC_NE));
+    push(j, V_MEM); // the result, in the callee's slot
+}
+
+static void emitReturn(Jit *j)
+{
+    VSlot v = pop(j);
+    loadEntry(j, RAX, &v, j->depth);
+    store(&j->as, RBP, -8, RAX); // the callee slot, like BC_RETURN
+    emitByte(&j->as, 0x31);      // xor eax, eax
+    emitByte(&j->as, 0xc0);
+    epilogue(j);
+}
+
+/* return f(...): a call to this function itself stores the arguments
+   in the parameters and starts over, as a loop; any other callee is
+   called and its result returned */
+static void emitTailCall(Jit *j, int argc, int nextPc)
+{
+    if (j->callees[j->calleeCount - 1] != j->proto)
+    {
+        emitCall(j, argc, nextPc);
+        emitReturn(j);
+        return;
+    }
+    j->calleeCount--;
+    flush(j);
+    for (int i = 0; i < argc; ++i)
+    {
+        load(&j->as, RAX, RBP, slotDisp(j, j->depth - argc + i));
+        store(&j->as, RBP, 8 * i, RAX);
+    }
+    j->depth -= argc + 1;
+    patchRel32(&j->as, jmp(&j->as), j->bodyAt);
+}
+
+// ------------------- ANALYSIS -------------------
+
+static int opLength(int op)
+{
+    switch (op)
+    {
+    case BC_POP:
+    case BC_DUP:
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+    case BC_DIV:
+    case BC_EQ:
+    case BC_NE:
+    case BC_LT:
+    case BC_LE:
+    case BC_GT:
+    case BC_GE:
+    case BC_RETURN:
+    case BC_LENGTH:
+        return 1;
+    case BC_CALLEE:
+        return 5;
+    case BC_FOR_RANGE:
+    case BC_FOR_EACH:
+    case BC_FOR_NEXT:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+/* the instruction at pc jumps to target with d entries on the stack */
+static int reach(Jit *j, int target, int d, int pc)
+{
+    // a backward jump into code not reached so far was not validated
+    if (target >= j->proto->count || (target <= pc && j->depthAt[target] < 0))
+        return 0;
+    if (j->depthAt[target] >= 0 && j->depthAt[target] != d)
+        return 0;
+    j->depthAt[target] = d;
+    j->isTarget[target] = 1;
+    return 1;
+}
+
+/* validates the function and computes the operand stack depth at each
+   instruction; 0 when it uses something the JIT does not compile */
+static int analyze(Jit *j)
+{
+    Proto *p = j->proto;
+    int32_t *code = p->code;
+    int d = 0, live = 1;
+    for (int pc = 0; pc < p->count; pc += opLength(code[pc]))
+    {
+        int op = code[pc];
+        if (j->depthAt[pc] >= 0)
+        {
+            if (live && j->depthAt[pc] != d)
+                return 0;
+            d = j->depthAt[pc];
+            live = 1;
+        }
+        else if (live)
+            j->depthAt[pc] = d;
+        if (!live)
+            continue;
+
+        int target = -1;
+        switch (op)
+        {
+        case BC_CONST:
+        {
+            Value k = p->consts[code[pc + 1]];
+            if (!IS_NUM(k) && !IS_SMALL_INT(k))
+                return 0;
+            d++;
+            break;
+        }
+        case BC_GET_LOCAL:
+        case BC_DUP:
+        case BC_CALLEE:
+            d++;
+            break;
+        case BC_POP:
+        case BC_SET_LOCAL:
+        case BC_ADD:
+        case BC_SUB:
+        case BC_MUL:
+        case BC_DIV:
+        case BC_EQ:
+        case BC_NE:
+        case BC_LT:
+        case BC_LE:
+        case BC_GT:
+        case BC_GE:
+            d--;
+            break;
+        case BC_ADD_CONST:
+        case BC_SUB_CONST:
+        {
+            Value k = p->consts[code[pc + 1]];
+            if (!IS_NUM(k) && !IS_SMALL_INT(k))
+                return 0;
+            break;
+        }
+        case BC_INDEX_LOCAL:
+        case BC_ELEMENT_LOCAL:
+        case BC_LENGTH:
+            break;
+        case BC_STORE_INDEX_LOCAL:
+        case BC_STORE_ELEMENT_LOCAL:
+            d -= 2;
+            break;
+        case BC_JUMP:
+            target = pc + 2 + code[pc + 1];
+            live = 0;
+            break;
+        case BC_LOOP:
+            target = pc + 2 - code[pc + 1];
+            live = 0;
+            break;
+        case BC_JUMP_IF_FALSE:
+            d--;
+            target = pc + 2 + code[pc + 1];
+            break;
+        case BC_JUMP_IF_NOT_EQ:
+        case BC_JUMP_IF_NOT_NE:
+        case BC_JUMP_IF_NOT_LT:
+        case BC_JUMP_IF_NOT_LE:
+        case BC_JUMP_IF_NOT_GT:
+        case BC_JUMP_IF_NOT_GE:
+            d -= 2;
+            target = pc + 2 + code[pc + 1];
+            break;
+        case BC_FOR_RANGE:
+        case BC_FOR_EACH:
+        case BC_FOR_NEXT:
+            d -= op == BC_FOR_RANGE ? 3 : op == BC_FOR_EACH ? 1 : 0;
+            target = pc + 3 + code[pc + 2];
+            break;
+        case BC_CALL:
+            d -= code[pc + 1];
+            break;
+        case BC_TAIL_CALL:
+            d -= code[pc + 1] + 1;
+            live = 0;
+            break;
+        case BC_RETURN:
+        case BC_SWITCH:
+            d--;
+            live = 0;
+            break;
+        default:
+            return 0; // globals, strings, printing, builtins, ...
+        }
+
+        if (op == BC_SWITCH)
+        {
+            const CaseTable *t = &p->switches[code[pc + 1]];
+            for (int i = 0; i <= t->count; ++i)
+                if (!reach(j, pc + 2 + (i < t->count ? t->targets[i] : t->otherwise), d, pc))
+                    return 0;
+        }
+        if (op == BC_CALLEE)
+        {
+            // only calls through a global bound to a compilable function
+            int s = code[pc + 1], g = code[pc + 2], argc = code[pc + 3];
+            Proto *q = s < 0 && g >= 0 ? calleeProto(g) : NULL;
+            if (!q || q->arity != argc)
+                return 0;
+            if (q != p && q->jitState != JIT_READY && !jitCompile(q))
+                return 0;
+        }
+        if (target >= 0 && !reach(j, target, d, pc))
+            return 0;
+        if (d > j->maxDepth)
+            j->maxDepth = d;
+    }
+    return 1;
+}
+
+// ------------------- CODE GENERATION -------------------
+
+static void prologue(Jit *j)
+{
+    Proto *p = j->proto;
+    pushReg(&j->as, RBP);
+    pushReg(&j->as, RBX);
+    pushReg(&j->as, R12);
+    pushReg(&j->as, R13);
+    pushReg(&j->as, R14);
+    pushReg(&j->as, R15);
+    aluImm(&j->as, 1, EXT_SUB, RSP, 8); // keeps calls 16-byte aligned
+    movRR(&j->as, RBP, RDI);
+    movImm(&j->as, REG_QNAN, QNAN);
+    movImm(&j->as, REG_INT_TAG, SMALL_INT_TAG);
+    j->bodyAt = j->as.len;
+    for (int s = 0; s < p->localCount; ++s)
+    {
+        int r = localReg(s);
+        if (s < p->arity)
+        {
+            if (r >= 0)
+                load(&j->as, r, RBP, 8 * s);
+        }
+        else if (r >= 0)
+            movImm(&j->as, r, UNDEF_VAL);
+        else
+        {
+            movImm(&j->as, RAX, UNDEF_VAL);
+            store(&j->as, RBP, 8 * s, RAX);
+        }
+    }
+}
+
+static void emitInstruction(Jit *j, int pc)
+{
+    Proto *p = j->proto;
+    int32_t *code = p->code;
+    int op = code[pc];
+    switch (op)
+    {
+    case BC_CONST:
+        push(j, V_CONST)->k = p->consts[code[pc + 1]];
+        break;
+    case BC_POP:
+        j->depth--;
+        break;
+    case BC_DUP:
+    {
+        VSlot top = j->stack[j->depth - 1];
+        if (top.kind == V_CONST || top.kind == V_LOCAL)
+            *push(j, top.kind) = top;
+        else
+        {
+            loadEntry(j, RAX, &top, j->depth - 1);
+            pushResult(j);
+        }
+        break;
+    }
+    case BC_GET_LOCAL:
+    {
+        int s = code[pc + 1];
+        if (s >= p->arity)
+        {
+            // not bound yet: the interpreter reports it
+            int r = localReg(s);
+            if (r < 0)
+            {
+                load(&j->as, RAX, RBP, 8 * s);
+                r = RAX;
+            }
+            movImm(&j->as, RCX, UNDEF_VAL);
+            alu(&j->as, ALU_CMP, r, RCX);
+            deoptIf(j, CC_E);
+        }
+        push(j, V_LOCAL)->local = s;
+        break;
+    }
+    case BC_SET_LOCAL:
+    {
+        int s = code[pc + 1];
+        VSlot v = pop(j);
+        for (int i = 0; i < j->depth; ++i)
+            if (j->stack[i].kind == V_LOCAL && j->stack[i].local == s)
+                materialize(j, &j->stack[i], i);
+        int r = localReg(s);
+        if (r >= 0)
+            loadEntry(j, r, &v, j->depth);
+        else
+        {
+            loadEntry(j, RAX, &v, j->depth);
+            store(&j->as, RBP, 8 * s, RAX);
+        }
+        break;
+    }
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+    case BC_DIV:
+        emitArith(j, op - BC_ADD);
+        break;
+    case BC_ADD_CONST:
+    case BC_SUB_CONST:
+        push(j, V_CONST)->k = p->consts[code[pc + 1]];
+        emitArith(j, op == BC_ADD_CONST ? OP_ADD : OP_SUB);
+        break;
+    case BC_EQ:
+    case BC_NE:
+    case BC_LT:
+    case BC_LE:
+    case BC_GT:
+    case BC_GE:
+    {
+        VSlot r = pop(j), l = pop(j);
+        emitCompare(j, OP_EQ + (op - BC_EQ), &l, &r, j->depth);
+        emitByte(&j->as, 0x0f); // movzx eax, al
+        emitByte(&j->as, 0xb6);
+        emitByte(&j->as, 0xc0);
+        alu(&j->as, ALU_OR, RAX, REG_INT_TAG);
+        pushResult(j);
+        break;
+    }
+    case BC_JUMP:
+    case BC_LOOP:
+        flush(j);
+        jumpTo(j, jmp(&j->as), op == BC_JUMP ? pc + 2 + code[pc + 1] : pc + 2 - code[pc + 1]);
+        break;
+    case BC_JUMP_IF_FALSE:
+        emitJumpIfFalse(j, pc + 2 + code[pc + 1]);
+        break;
+    case BC_JUMP_IF_NOT_EQ:
+    case BC_JUMP_IF_NOT_NE:
+    case BC_JUMP_IF_NOT_LT:
+    case BC_JUMP_IF_NOT_LE:
+    case BC_JUMP_IF_NOT_GT:
+    case BC_JUMP_IF_NOT_GE:
+    {
+        VSlot r = pop(j), l = pop(j);
+        int ld = j->depth;
+        flush(j);
+        emitCompare(j, OP_EQ + (op - BC_JUMP_IF_NOT_EQ), &l, &r, ld);
+        emitByte(&j->as, 0x84); // test al, al
+        emitByte(&j->as, 0xc0);
+        jumpTo(j, jcc(&j->as, CC_E), pc + 2 + code[pc + 1]);
+        break;
+    }
+    case BC_FOR_RANGE:
+    case BC_FOR_EACH:
+        emitForStart(j, op, code[pc + 1], pc + 3 + code[pc + 2]);
+        break;
+    case BC_FOR_NEXT:
+        emitForNext(j, code[pc + 1], pc + 3 + code[pc + 2]);
+        break;
+    case BC_INDEX_LOCAL:
+    case BC_ELEMENT_LOCAL:
+    {
+        VSlot idx = pop(j);
+        loadElementAddress(j, code[pc + 1], &idx, j->depth, op == BC_INDEX_LOCAL);
+        opRX(&j->as, 0x8b, RAX, RAX, RCX); // mov rax, [rax + rcx*8]
+        pushResult(j);
+        break;
+    }
+    case BC_STORE_INDEX_LOCAL:
+    case BC_STORE_ELEMENT_LOCAL:
+    {
+        VSlot v = pop(j), idx = pop(j);
+        loadElementAddress(j, code[pc + 1], &idx, j->depth, op == BC_STORE_INDEX_LOCAL);
+        loadEntry(j, RDX, &v, j->depth + 1);
+        opRX(&j->as, 0x89, RDX, RAX, RCX); // mov [rax + rcx*8], rdx
+        break;
+    }
+    case BC_LENGTH:
+    {
+        VSlot v = pop(j);
+        loadEntry(j, RAX, &v, j->depth);
+        guardArray(j, RAX);
+        opRM(&j->as, 1, 0x63, RAX, RAX, (int32_t)offsetof(ObjArray, len)); // movsxd
+        alu(&j->as, ALU_OR, RAX, REG_INT_TAG);
+        pushResult(j);
+        break;
+    }
+    case BC_CALLEE:
+    {
+        int g = code[pc + 2];
+        emitCallee(j, g, calleeProto(g));
+        break;
+    }
+    case BC_CALL:
+        emitCall(j, code[pc + 1], pc + 2);
+        break;
+    case BC_TAIL_CALL:
+        emitTailCall(j, code[pc + 1], pc + 2);
+        break;
+    case BC_RETURN:
+        emitReturn(j);
+        break;
+    case BC_SWITCH:
+        emitSwitch(j, pc);
+        break;
+    default:
+        break;
+    }
+}
+
+static void emitStubs(Jit *j)
+{
+    Proto *p = j->proto;
+    for (int i = 0; i < j->stubCount; ++i)
+    {
+        Stub *s = &j->stubs[i];
+        for (int k = 0; k < s->count; ++k)
+            patchHere(&j->as, s->patches[k]);
+        for (int k = 0; k < s->depth; ++k)
+            materialize(j, &s->snap[k], k);
+        for (int l = 0; l < p->localCount && l < LOCAL_REGS; ++l)
+            store(&j->as, RBP, 8 * l, localRegs[l]);
+        movImm(&j->as, RDI, (uint64_t)(uintptr_t)p);
+        movRR(&j->as, RSI, RBP);
+        movImm(&j->as, RDX, (uint64_t)s->pc);
+        movImm(&j->as, RCX, (uint64_t)s->depth);
+        movImm(&j->as, RAX, (uint64_t)(uintptr_t)recordFrame);
+        emitByte(&j->as, 0xff); // call rax
+        emitByte(&j->as, 0xd0);
+        movImm(&j->as, RAX, 1);
+        epilogue(j);
+    }
+}
+
+static void generate(Jit *j)
+{
+    Proto *p = j->proto;
+    prologue(j);
+    int live = 1;
+    for (int pc = 0; pc < p->count; pc += opLength(p->code[pc]))
+    {
+        if (j->depthAt[pc] < 0)
+            continue;
+        if (!live || j->isTarget[pc])
+        {
+            // every path into a jump target has the stack in memory
+            if (live)
+                flush(j);
+            j->depth = j->depthAt[pc];
+            for (int i = 0; i < j->depth; ++i)
+                j->stack[i].kind = V_MEM;
+        }
+        j->offsetAt[pc] = j->as.len;
+        memcpy(j->entry, j->stack, sizeof(VSlot) * j->depth);
+        j->entryDepth = j->depth;
+        j->pc = pc;
+        j->stub = -1;
+        emitInstruction(j, pc);
+        int op = p->code[pc];
+        live = op != BC_JUMP && op != BC_LOOP && op != BC_RETURN && op != BC_TAIL_CALL && op != BC_SWITCH;
+    }
+    emitStubs(j);
+    for (int i = 0; i < j->jumpCount; ++i)
+        patchRel32(&j->as, j->jumps[i].at, j->offsetAt[j->jumps[i].pc]);
+    for (int i = 0; i < j->tableCount; ++i)
+    {
+        JumpTable *t = &j->tables[i];
+        while (j->as.len % 4)
+            emitByte(&j->as, 0xcc);
+        int at = j->as.len;
+        patchRel32(&j->as, t->lea, at);
+        for (int k = 0; k < t->cases->span; ++k)
+            emitInt32(&j->as, j->offsetAt[t->next + t->cases->table[k]] - at);
+    }
+}
+
+static void freeJit(Jit *j)
+{
+    for (int i = 0; i < j->stubCount; ++i)
+    {
+        free(j->stubs[i].snap);
+        free(j->stubs[i].patches);
+    }
+    free(j->stubs);
+    free(j->as.code);
+    free(j->depthAt);
+    free(j->isTarget);
+    free(j->offsetAt);
+    free(j->jumps);
+    free(j->tables);
+    free(j->stack);
+    free(j->entry);
+    free(j->callees);
+}
+
+int jitCompile(Proto *p)
+{
+    if (p->jitState != JIT_NONE)
+        return p->jitState == JIT_READY;
+    p->jitState = JIT_COMPILING;
+
+    Jit j;
+    memset(&j, 0, sizeof(j));
+    j.proto = p;
+    int n = p->count ? p->count : 1;
+    j.depthAt = (int *)malloc(sizeof(int) * n);
+    j.isTarget = (char *)calloc(n, 1);
+    j.offsetAt = (int *)calloc(n, sizeof(int));
+    if (!j.depthAt || !j.isTarget || !j.offsetAt)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < n; ++i)
+        j.depthAt[i] = -1;
+    j.depthAt[0] = 0;
+
+    void *native = NULL;
+    if (analyze(&j))
+    {
+        int slots = j.maxDepth + 1;
+        j.stack = (VSlot *)malloc(sizeof(VSlot) * slots);
+        j.entry = (VSlot *)malloc(sizeof(VSlot) * slots);
+        j.callees = (Proto **)malloc(sizeof(Proto *) * slots);
+        if (!j.stack || !j.entry || !j.callees)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        generate(&j);
+        native = installCode(&j.as);
+    }
+    freeJit(&j);
+
+    if (!native)
+    {
+        p->jitState = JIT_FAILED;
+        return 0;
+    }
+    p->native = native;
+    p->jitState = JIT_READY;
+    stats.jitCompiled++;
+    return 1;
+}
+
+int jitCall(Proto *p, Value *base, int frameIndex)
+{
+    int (*code)(Value *) = (int (*)(Value *))p->native;
+    jitDepth = frameIndex;
+    jitFrameCount = 0;
+    if (code(base) == 0)
+        return 0;
+    stats.jitDeopts++;
+    if (++p->deopts >= JIT_MAX_DEOPTS)
+        p->jitState = JIT_FAILED;
+    return jitFrameCount;
+}
+
+void jitShutdown(void)
+{
+    freeCode();
+    free(jitFrames);
+    jitFrames = NULL;
+}
+
+#else // no JIT on this platform: everything stays interpreted
+
+int jitCompile(Proto *p)
+{
+    p->jitState = JIT_FAILED;
+    return 0;
+}
+
+int jitCall(Proto *p, Value *base, int frameIndex)
+{
+    (void)p;
+    (void)base;
+    (void)frameIndex;
+    (void)recordFrame;
+    return 0;
+}
+
+void jitShutdown(void)
+{
+    free(jitFrames);
+    jitFrames = NULL;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "bytecode.h"
+
+/* Baseline method JIT for the VM (x86-64 only).
+   A function that only uses numbers, arrays, its own locals and calls
+   to other such functions is compiled to machine code once it has been
+   called jitThreshold times. Values stay NaN-boxed, the first locals
+   live in callee-saved registers and every instruction that can meet a
+   case it does not handle (a string operand, a big int, an index out
+   of range, an error) jumps to a deopt stub instead: the stub writes
+   the registers back into the VM's frame and the VM re-runs that
+   instruction in the interpreter. */
+
+#define JIT_THRESHOLD 1000
+#define JIT_MAX_DEOPTS 64 // after this many the VM stops entering the code
+
+typedef enum
+{
+    JIT_NONE,
+    JIT_COMPILING,
+    JIT_READY,
+    JIT_FAILED // not compilable, or deopts too often
+} JitState;
+
+/* a VM call frame handed back by deoptimized code */
+typedef struct
+{
+    Proto *proto;
+    Value *base;
+    int32_t *ip;
+    Value *sp;
+} JitFrame;
+
+extern int jitEnabled;   // --no-jit clears it
+extern int jitThreshold; // --jit-threshold=N
+
+/* stackLimit: highest sp a new frame's locals may reach */
+void jitInit(Value *globals, Value *stackLimit, int frameLimit);
+void jitShutdown(void); // frees all machine code
+
+int jitCompile(Proto *p); // 1 when p->native is ready
+
+/* runs p's machine code on the frame at base (callee at base[-1]);
+   frameIndex is that frame's index in the VM's frame stack.
+   Returns 0 when it returned (result in base[-1]), or the number of
+   frames it left in jitFrames, innermost first, to resume in the VM. */
+int jitCall(Proto *p, Value *base, int frameIndex);
+extern JitFrame *jitFrames;
+
+#endif
@@ -4,6 +4,15 @@
 #include <string.h>
 #include "lexer.h"
 
+/* ++ and -- are tokens only where they end a statement (x++; or a for
+   loop's i++), so a--b still means a - (-b) */
+static int endsUpdate(const char *s)
+{
+    while (*s && isspace(*s))
+        s++;
+    return *s == ';' || *s == ')';
+}
+
 Token getNextToken(const char **src)
 {
     // Skip whitespace and comments
@@ -123,6 +132,8 @@ Token getNextToken(const char **src)
             tk.type = TOKEN_PRINT;
         else if (strcmp(tk.text, "let") == 0)
             tk.type = TOKEN_LET;
+        else if (strcmp(tk.text, "const") == 0)
+            tk.type = TOKEN_CONST;
         else if (strcmp(tk.text, "if") == 0)
             tk.type = TOKEN_IF;
         else if (strcmp(tk.text, "else") == 0)
@@ -141,6 +152,28 @@ Token getNextToken(const char **src)
             tk.type = TOKEN_FUNC;
         else if (strcmp(tk.text, "return") == 0)
             tk.type = TOKEN_RETURN;
+        else if (strcmp(tk.text, "break") == 0)
+            tk.type = TOKEN_BREAK;
+        else if (strcmp(tk.text, "continue") == 0)
+            tk.type = TOKEN_CONTINUE;
+        else if (strcmp(tk.text, "switch") == 0)
+            tk.type = TOKEN_SWITCH;
+        else if (strcmp(tk.text, "case") == 0)
+            tk.type = TOKEN_CASE;
+        else if (strcmp(tk.text, "default") == 0)
+            tk.type = TOKEN_DEFAULT;
+        return tk;
+    }
+
+    // Annotations: @name
+    if (**src == '@' && isalpha(*(*src + 1)))
+    {
+        Token tk = {TOKEN_ANNOTATION, "@"};
+        size_t i = 1;
+        (*src)++;
+        while (isalnum(**src) && i < sizeof(tk.text) - 1)
+            tk.text[i++] = *(*src)++;
+        tk.text[i] = '\0';
         return tk;
     }
 
@@ -165,6 +198,46 @@ Token getNextToken(const char **src)
         (*src) += 2;
         return (Token){TOKEN_GE, ">="};
     }
+    if (**src == '+' && *(*src + 1) == '=')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_PLUS_EQUAL, "+="};
+    }
+    if (**src == '-' && *(*src + 1) == '=')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_SUB_EQUAL, "-="};
+    }
+    if (**src == '*' && *(*src + 1) == '=')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_MUL_EQUAL, "*="};
+    }
+    if (**src == '/' && *(*src + 1) == '=')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_DIV_EQUAL, "/="};
+    }
+    if (**src == '+' && *(*src + 1) == '+' && endsUpdate(*src + 2))
+    {
+        (*src) += 2;
+        return (Token){TOKEN_INC, "++"};
+    }
+    if (**src == '-' && *(*src + 1) == '-' && endsUpdate(*src + 2))
+    {
+        (*src) += 2;
+        return (Token){TOKEN_DEC, "--"};
+    }
+    if (**src == '&' && *(*src + 1) == '&')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_AND, "&&"};
+    }
+    if (**src == '|' && *(*src + 1) == '|')
+    {
+        (*src) += 2;
+        return (Token){TOKEN_OR, "||"};
+    }
 
     // Single-character tokens
     char ch = **src;
@@ -205,6 +278,9 @@ Token getNextToken(const char **src)
     case '>':
         tk.type = TOKEN_GT;
         break;
+    case '!':
+        tk.type = TOKEN_NOT;
+        break;
     case '{':
         tk.type = TOKEN_LBRACE;
         break;
@@ -214,6 +290,9 @@ Token getNextToken(const char **src)
     case ',':
         tk.type = TOKEN_COMMA;
         break;
+    case ':':
+        tk.type = TOKEN_COLON;
+        break;
     case '[':
         tk.type = TOKEN_LBRACKET;
         break;
@@ -7,6 +7,7 @@ typedef enum
     TOKEN_ID,
     TOKEN_PRINT,
     TOKEN_LET,
+    TOKEN_CONST,
     TOKEN_IF, // New: if keyword
     TOKEN_ELSE,
     TOKEN_ELSEIF,
@@ -15,16 +16,26 @@ typedef enum
     TOKEN_IN,
     TOKEN_RANGE,
     TOKEN_EQUAL, // = (assignment)
+    TOKEN_PLUS_EQUAL, // +=
+    TOKEN_SUB_EQUAL,  // -=
+    TOKEN_MUL_EQUAL,  // *=
+    TOKEN_DIV_EQUAL,  // /=
+    TOKEN_INC,        // ++ before ; or ) (see lexer.c)
+    TOKEN_DEC,        // -- before ; or )
     TOKEN_EQ,    // New: == (comparison)
     TOKEN_NE,    // New: != (not equal)
     TOKEN_LT,    // New: < (less than)
     TOKEN_GT,    // New: > (greater than)
     TOKEN_LE,    // New: <= (less or equal)
     TOKEN_GE,    // New: >= (greater or equal)
+    TOKEN_AND,   // &&
+    TOKEN_OR,    // ||
+    TOKEN_NOT,   // !
     TOKEN_PLUS,
     TOKEN_SUB,
     TOKEN_SEMI,
     TOKEN_COMMA,
+    TOKEN_COLON,
     TOKEN_STR,
     TOKEN_MUL,
     TOKEN_DIV,
@@ -36,6 +47,12 @@ typedef enum
     TOKEN_RBRACKET,
     TOKEN_FUNC,
     TOKEN_RETURN,
+    TOKEN_BREAK,
+    TOKEN_CONTINUE,
+    TOKEN_SWITCH,
+    TOKEN_CASE,
+    TOKEN_DEFAULT,
+    TOKEN_ANNOTATION, // @name
     TOKEN_EOF
 } TokenType;
 
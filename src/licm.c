@@ -0,0 +1,154 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Loop-invariant code motion. Inside a for, for-in or while loop, an expression
+   whose value cannot change while the loop runs, and whose evaluation
+   cannot report an error, is computed once in front of the loop into a
+   variable of its own (_inv<n>: names the lexer never makes). Such an
+   expression is built from numbers, variables bound before the loop that
+   nothing in it rebinds, +, - and * and comparisons on numbers, and
+   length() of an array or string.
+
+   Arrays only change length in readChunk, which resizes its buffer in
+   place, so length() stays in a loop that may call it, directly or
+   through a function. A call may also assign script variables: a loop
+   with calls keeps those that any function assigns. */
+
+typedef struct
+{
+    FrameWalk *walk;
+    LoopEffects effects;
+    NodeList hoisted; // _inv<first + i> holds hoisted.items[i]
+    int first;
+} Loop;
+
+static ProgramTypes types;
+static int nextTemp;
+
+/* bound before the loop, in this frame, and never rebound while it runs */
+static int isLoopStable(Loop *l, const char *name)
+{
+    return isStable(l->walk->types, l->walk->frame, &l->walk->bound, &l->effects, name);
+}
+
+static int isInvariant(Loop *l, struct ASTNode *e)
+{
+    Frame *f = l->walk->frame;
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return 1;
+    case NODE_VAR:
+        return isLoopStable(l, e->varName);
+    case NODE_BINOP:
+        return e->binop.op != OP_DIV && isInvariant(l, e->binop.left) && isInvariant(l, e->binop.right) &&
+               exprType(f, e->binop.left, &l->walk->bound) == TYPE_NUMBER &&
+               exprType(f, e->binop.right, &l->walk->bound) == TYPE_NUMBER;
+    case NODE_FUNC_CALL:
+    {
+        if (findBuiltin(e->funcCall.funcName) != BI_LENGTH || e->funcCall.argCount != 1 ||
+            e->funcCall.args[0]->type != NODE_VAR || !isLoopStable(l, e->funcCall.args[0]->varName))
+            return 0;
+        StaticType t = nameType(f, e->funcCall.args[0]->varName);
+        return t == TYPE_STRING || (t == TYPE_ARRAY && keepsLengths(&types, &l->effects));
+    }
+    default:
+        return 0;
+    }
+}
+
+static struct ASTNode *tempVar(int id)
+{
+    struct ASTNode *v = newNode(NODE_VAR);
+    snprintf(v->varName, sizeof(v->varName), "_inv%d", id);
+    return v;
+}
+
+/* replaces the largest invariant expressions with their variables */
+static void hoistFrom(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    Loop *l = (Loop *)ctx;
+    if (!n || n->type == NODE_FUNC_DEF)
+        return;
+    if ((n->type == NODE_BINOP || n->type == NODE_FUNC_CALL) && isInvariant(l, n))
+    {
+        int k = 0;
+        while (k < l->hoisted.count && !sameExpr(l->hoisted.items[k], n))
+            k++;
+        if (k == l->hoisted.count)
+            addNode(&l->hoisted, n);
+        else
+            freeNode(n);
+        *slot = tempVar(l->first + k);
+        return;
+    }
+    visitChildren(n, hoistFrom, ctx);
+}
+
+/* hoists out of the loop at block->block.items[at]; returns the number
+   of statements put in front of it (its init and the new variables) */
+static int hoistLoop(FrameWalk *w, struct ASTNode *block, int at, void *ctx)
+{
+    (void)ctx;
+    struct ASTNode *loop = block->block.items[at];
+    struct ASTNode **init = loop->type == NODE_FOR ? &loop->forstmt.init : NULL;
+    Loop l = {w, {{0}, 0, 0}, {0}, nextTemp};
+    int mark = w->bound.count;
+    if (init)
+        bindStmt(w->frame, &w->bound, *init);
+
+    scanLoop(loop, &l.effects);
+    if (loop->type == NODE_FOR)
+    {
+        hoistFrom(&loop->forstmt.cond, &l);
+        hoistFrom(&loop->forstmt.incr, &l);
+        hoistFrom(&loop->forstmt.body, &l);
+    }
+    else if (loop->type == NODE_FOR_IN)
+        hoistFrom(&loop->forIn.body, &l); // its header already runs once
+    else
+    {
+        hoistFrom(&loop->WhileStmt.cond, &l);
+        hoistFrom(&loop->WhileStmt.body, &l);
+    }
+    popNames(&w->bound, mark);
+    freeNames(&l.effects.written);
+    if (l.hoisted.count == 0)
+        return 0;
+
+    // the init runs first, then the pre-header; neither opens a scope
+    NodeList header = {0};
+    if (init && *init)
+    {
+        addNode(&header, *init);
+        *init = NULL;
+    }
+    for (int k = 0; k < l.hoisted.count; ++k)
+    {
+        struct ASTNode *let = newNode(NODE_ASSIGN);
+        snprintf(let->assign.varName, sizeof(let->assign.varName), "_inv%d", nextTemp++);
+        let->assign.value = l.hoisted.items[k];
+        let->assign.isLet = 1;
+        frameAddName(w->frame, let->assign.varName, TYPE_NUMBER);
+        addNode(&header, let);
+    }
+    insertItems(block, at, header.items, header.count);
+    for (int k = 0; k < header.count; ++k)
+        bindStmt(w->frame, &w->bound, header.items[k]);
+    int count = header.count;
+    free(header.items);
+    free(l.hoisted.items);
+    return count;
+}
+
+void hoistInvariants(struct ASTNode *root)
+{
+    inferProgram(&types, root);
+    walkLoops(&types, hoistLoop, NULL);
+    freeProgramTypes(&types);
+}
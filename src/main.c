@@ -1,17 +1,114 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include "parser.h"
 #include "interpreter.h"
 #include "symbol.h"
+#include "numio.h"
+#include "compiler.h"
+#include "vm.h"
+#include "closure.h"
+#include "runtime.h"
+#include "jit.h"
+#include "trace.h"
+#include "transpile.h"
+#include "optimize.h"
 
 #define MAX_SRC (1 << 20)
 
+typedef enum
+{
+    ENGINE_AST,
+    ENGINE_VM,
+    ENGINE_CLOSURE,
+    ENGINE_EMIT_C, // write the program as C to stdout
+    ENGINE_BUILD   // and compile that to a native executable
+} Engine;
+
+static void usage(void)
+{
+    printf("Usage: slangc [--engine=ast|vm|closure] [--no-jit] [--jit-threshold=N] [--stats]\n"
+           "       [-O0 | -O1] [--emit-c | --build] <file.slc>\n");
+}
+
+typedef struct
+{
+    int (*run)(struct ASTNode *);
+    struct ASTNode *program;
+    int status;
+} Run;
+
+static void *runThread(void *arg)
+{
+    Run *r = (Run *)arg;
+    setStackLimit(RUN_STACK);
+    r->status = r->run(r->program);
+    return NULL;
+}
+
+/* the engines that recurse on the C stack get RUN_STACK bytes of it, or
+   the main stack's limit when no thread can be made */
+static int runOnLargeStack(int (*run)(struct ASTNode *), struct ASTNode *program)
+{
+    Run r = {run, program, 0};
+    pthread_attr_t attr;
+    pthread_t thread;
+    int started = pthread_attr_init(&attr) == 0 && pthread_attr_setstacksize(&attr, RUN_STACK) == 0 &&
+                  pthread_create(&thread, &attr, runThread, &r) == 0;
+    pthread_attr_destroy(&attr);
+    if (started)
+    {
+        pthread_join(thread, NULL);
+        return r.status;
+    }
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        setStackLimit(limit.rlim_cur);
+    return run(program);
+}
+
 int main(int argc, char **argv)
 {
     const char *fname = NULL;
-    if (argc >= 2)
-        fname = argv[1];
+    Engine engine = ENGINE_VM;
+    int showStats = 0;
+    int optLevel = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--engine=vm") == 0)
+            engine = ENGINE_VM;
+        else if (strcmp(argv[i], "--engine=ast") == 0)
+            engine = ENGINE_AST;
+        else if (strcmp(argv[i], "--engine=closure") == 0)
+            engine = ENGINE_CLOSURE;
+        else if (strcmp(argv[i], "--emit-c") == 0)
+            engine = ENGINE_EMIT_C;
+        else if (strcmp(argv[i], "--build") == 0)
+            engine = ENGINE_BUILD;
+        else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0)
+            optLevel = argv[i][2] - '0';
+        else if (strcmp(argv[i], "--stats") == 0)
+            showStats = 1;
+        else if (strcmp(argv[i], "--no-jit") == 0)
+            jitEnabled = 0;
+        else if (strncmp(argv[i], "--jit-threshold=", 16) == 0 && atoi(argv[i] + 16) > 0)
+            jitThreshold = traceThreshold = atoi(argv[i] + 16);
+        else if (argv[i][0] == '-')
+        {
+            printf("Error: unknown option '%s'\n", argv[i]);
+            usage();
+            return 1;
+        }
+        else
+            fname = argv[i];
+    }
+    if (!fname)
+    {
+        usage();
+        return 1;
+    }
 
     const char *ext = strrchr(fname, '.');
     if (!ext || strcmp(ext, ".slc") != 0)
@@ -52,12 +149,39 @@ int main(int argc, char **argv)
         free(src);
         return 1;
     }
-    execAST(program);
+    if (!optimizeProgram(program, optLevel))
+    {
+        freeNode(program);
+        free(src);
+        return 1;
+    }
+    int status = 0;
+    if (engine == ENGINE_VM)
+    {
+        // compile to bytecode and run it on the VM
+        Program *code = compileProgram(program);
+        status = runProgram(code);
+        freeProgram(code);
+    }
+    else if (engine == ENGINE_CLOSURE)
+        status = runOnLargeStack(runClosures, program);
+    else if (engine == ENGINE_EMIT_C)
+        emitC(program, fname, stdout);
+    else if (engine == ENGINE_BUILD)
+        status = buildNative(program, fname);
+    else
+        status = runOnLargeStack(execAST, program);
     flushOutput();
+    if (showStats)
+    {
+        fflush(stdout);
+        printStats();
+    }
 
     // cleanup
     freeNode(program);
     clearSymbols();
+    numCloseAll();
     free(src);
-    return 0;
+    return status;
 }
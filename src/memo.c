@@ -0,0 +1,201 @@
+#include "memo.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    uint64_t key[MEMO_MAX_ARGS]; // an int's value or a double's bits
+    uint64_t result;
+    uint32_t hash;
+    unsigned char ints;      // bit i: key[i] is an int
+    unsigned char resultInt;
+    int next;                // the next entry in its bucket
+    int newer, older;        // use order; -1 at either end
+} MemoEntry;
+
+struct MemoTable
+{
+    int argc;
+    MemoEntry *entries;
+    int count, cap; // cap is a power of two, and the number of buckets
+    int *buckets;
+    int newest, oldest;
+};
+
+MemoTable *newMemoTable(int argc)
+{
+    MemoTable *t = (MemoTable *)calloc(1, sizeof(MemoTable));
+    if (!t)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    t->argc = argc;
+    t->newest = t->oldest = -1;
+    return t;
+}
+
+void freeMemoTable(MemoTable *t)
+{
+    if (!t)
+        return;
+    free(t->entries);
+    free(t->buckets);
+    free(t);
+}
+
+/* 1 for an int, 0 for a double, -1 for anything else */
+static int encode(Value v, uint64_t *bits)
+{
+    if (IS_INT(v))
+    {
+        *bits = (uint64_t)AS_INT(v);
+        return 1;
+    }
+    if (IS_NUM(v))
+    {
+        *bits = v;
+        return 0;
+    }
+    return -1;
+}
+
+/* 0 when an argument is not a number */
+static int makeKey(MemoTable *t, const Value *args, MemoEntry *k)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull * (uint64_t)(t->argc + 1);
+    k->ints = 0;
+    for (int i = 0; i < t->argc; ++i)
+    {
+        int isInt = encode(args[i], &k->key[i]);
+        if (isInt < 0)
+            return 0;
+        k->ints |= (unsigned char)(isInt << i);
+        h = (h ^ k->key[i] ^ (uint64_t)isInt) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    k->hash = (uint32_t)h;
+    return 1;
+}
+
+static int findEntry(MemoTable *t, const MemoEntry *k)
+{
+    if (!t->cap)
+        return -1;
+    for (int i = t->buckets[k->hash & (t->cap - 1)]; i >= 0; i = t->entries[i].next)
+    {
+        MemoEntry *e = &t->entries[i];
+        if (e->hash == k->hash && e->ints == k->ints &&
+            memcmp(e->key, k->key, sizeof(uint64_t) * t->argc) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void unlinkUse(MemoTable *t, int i)
+{
+    MemoEntry *e = &t->entries[i];
+    if (e->newer >= 0)
+        t->entries[e->newer].older = e->older;
+    else
+        t->newest = e->older;
+    if (e->older >= 0)
+        t->entries[e->older].newer = e->newer;
+    else
+        t->oldest = e->newer;
+}
+
+static void linkNewest(MemoTable *t, int i)
+{
+    MemoEntry *e = &t->entries[i];
+    e->newer = -1;
+    e->older = t->newest;
+    if (t->newest >= 0)
+        t->entries[t->newest].newer = i;
+    else
+        t->oldest = i;
+    t->newest = i;
+}
+
+static void unlinkBucket(MemoTable *t, int i)
+{
+    int *link = &t->buckets[t->entries[i].hash & (t->cap - 1)];
+    while (*link != i)
+        link = &t->entries[*link].next;
+    *link = t->entries[i].next;
+}
+
+static void grow(MemoTable *t)
+{
+    int cap = t->cap ? t->cap * 2 : 64;
+    MemoEntry *entries = (MemoEntry *)realloc(t->entries, sizeof(MemoEntry) * cap);
+    int *buckets = (int *)malloc(sizeof(int) * cap);
+    if (!entries || !buckets)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    t->entries = entries;
+    free(t->buckets);
+    t->buckets = buckets;
+    t->cap = cap;
+    for (int b = 0; b < cap; ++b)
+        buckets[b] = -1;
+    for (int i = 0; i < t->count; ++i)
+    {
+        int *head = &buckets[entries[i].hash & (cap - 1)];
+        entries[i].next = *head;
+        *head = i;
+    }
+}
+
+int memoFind(MemoTable *t, const Value *args, Value *result)
+{
+    MemoEntry k;
+    if (!makeKey(t, args, &k))
+        return 0;
+    int i = findEntry(t, &k);
+    if (i < 0)
+    {
+        stats.memoMisses++;
+        return 0;
+    }
+    stats.memoHits++;
+    if (i != t->newest)
+    {
+        unlinkUse(t, i);
+        linkNewest(t, i);
+    }
+    MemoEntry *e = &t->entries[i];
+    *result = e->resultInt ? intValue((int64_t)e->result) : (Value)e->result;
+    return 1;
+}
+
+void memoStore(MemoTable *t, const Value *args, Value result)
+{
+    MemoEntry k;
+    int resultInt = encode(result, &k.result);
+    if (resultInt < 0 || !makeKey(t, args, &k) || findEntry(t, &k) >= 0)
+        return;
+    k.resultInt = (unsigned char)resultInt;
+
+    int i;
+    if (t->count == t->cap && t->cap < MEMO_CAPACITY)
+        grow(t);
+    if (t->count < t->cap)
+        i = t->count++;
+    else
+    {
+        // full: the least recently used result makes way
+        i = t->oldest;
+        unlinkUse(t, i);
+        unlinkBucket(t, i);
+    }
+    int *head = &t->buckets[k.hash & (t->cap - 1)];
+    k.next = *head;
+    t->entries[i] = k;
+    *head = i;
+    linkNewest(t, i);
+}
@@ -0,0 +1,25 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "value.h"
+
+/* Results of calls to a pure function, keyed on its arguments, for the
+   functions the optimizer memoizes (see memoize.c). Only numbers are
+   kept: a call with any other argument, or that returned anything else,
+   is left alone. A table holds at most MEMO_CAPACITY results and makes
+   room by dropping the one used least recently. */
+
+#define MEMO_MAX_ARGS 4
+#define MEMO_CAPACITY 65536
+
+typedef struct MemoTable MemoTable;
+
+MemoTable *newMemoTable(int argc);
+void freeMemoTable(MemoTable *t);
+
+/* 1 with the result of an earlier call with these arguments; counted in
+   stats unless an argument is not a number */
+int memoFind(MemoTable *t, const Value *args, Value *result);
+void memoStore(MemoTable *t, const Value *args, Value result);
+
+#endif
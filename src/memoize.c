@@ -0,0 +1,201 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "memo.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Memoization. A function the script defines at the top is pure when,
+   called with numbers, it returns a number that depends on nothing but
+   them, and does nothing else: it reads only its parameters and the
+   locals it has definitely bound, assigns only those, divides only by
+   nonzero constants (so no error can print) and calls only pure
+   functions with the right number of arguments, itself or ones defined
+   before it that every call by their name reaches. No printing, arrays,
+   strings, builtins or nested definitions.
+
+   A pure function with at most MEMO_MAX_ARGS parameters gets a table of
+   its results when it is written with @memo, or when it calls itself
+   more than once or from a loop (fib(n - 1) + fib(n - 2)), where the
+   number of calls grows exponentially. The engines answer a call whose
+   arguments the table has seen from it instead of running the body. */
+
+typedef struct
+{
+    ProgramTypes types;
+    struct ASTNode *root;
+    char *closed; // per script statement: a closed definition
+    char *pure;   // a pure one, so far as checked
+    int index;    // the definition being checked
+    NameList bound;
+    int loops;     // enclosing the current statement
+    int selfCalls; // a call from a loop counts twice
+    int continued; // the innermost loop's body has a continue
+} Purity;
+
+static int pureExpr(Purity *c, struct ASTNode *e);
+static int pureStmt(Purity *c, struct ASTNode *s);
+
+static int isNonzeroConstant(struct ASTNode *n)
+{
+    return n && n->type == NODE_NUM && (n->num.isInt ? n->num.intValue != 0 : n->num.value != 0.0);
+}
+
+static int pureCall(Purity *c, struct ASTNode *call)
+{
+    for (int i = 0; i < call->funcCall.argCount; ++i)
+        if (!pureExpr(c, call->funcCall.args[i]))
+            return 0;
+    const char *name = call->funcCall.funcName;
+    if (findBuiltin(name) >= 0)
+        return 0;
+    for (int i = 0; i <= c->index; ++i)
+    {
+        struct ASTNode *def = c->root->block.items[i];
+        if (def->type != NODE_FUNC_DEF || strcmp(def->funcDef.funcName, name) != 0)
+            continue;
+        if (i == c->index)
+            c->selfCalls += c->loops ? 2 : 1;
+        return c->closed[i] && c->pure[i] && def->funcDef.paramCount == call->funcCall.argCount;
+    }
+    return 0;
+}
+
+static int pureExpr(Purity *c, struct ASTNode *e)
+{
+    if (!e)
+        return 1;
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return 1;
+    case NODE_VAR:
+        return findName(&c->bound, e->varName) >= 0;
+    case NODE_BINOP:
+        if (e->binop.op == OP_DIV && !isNonzeroConstant(e->binop.right))
+            return 0;
+        return pureExpr(c, e->binop.left) && pureExpr(c, e->binop.right);
+    case NODE_LOGICAL:
+        return pureExpr(c, e->logical.left) && (!e->logical.right || pureExpr(c, e->logical.right));
+    case NODE_FUNC_CALL:
+        return pureCall(c, e);
+    default:
+        return 0;
+    }
+}
+
+/* what s and then bind is not definitely bound after them */
+static int pureMaybe(Purity *c, struct ASTNode *s, struct ASTNode *then)
+{
+    int mark = c->bound.count;
+    int pure = pureStmt(c, s) && pureStmt(c, then);
+    popNames(&c->bound, mark);
+    return pure;
+}
+
+static int pureLoop(Purity *c, struct ASTNode *cond, struct ASTNode *body, struct ASTNode *incr)
+{
+    int mark = c->bound.count, outer = c->continued;
+    c->loops++;
+    c->continued = 0;
+    int pure = pureExpr(c, cond) && pureStmt(c, body);
+    // a continue goes on with incr, where what the body bound after it may not be
+    if (c->continued)
+        popNames(&c->bound, mark);
+    pure = pure && pureStmt(c, incr);
+    popNames(&c->bound, mark);
+    c->continued = outer;
+    c->loops--;
+    return pure;
+}
+
+static int pureStmt(Purity *c, struct ASTNode *s)
+{
+    if (!s)
+        return 1;
+    switch (s->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < s->block.count; ++i)
+            if (!pureStmt(c, s->block.items[i]))
+                return 0;
+        return 1;
+    case NODE_IF:
+        return pureExpr(c, s->ifstmt.cond) && pureMaybe(c, s->ifstmt.thenBlock, NULL) &&
+               pureMaybe(c, s->ifstmt.elseBlock, NULL);
+    case NODE_FOR:
+        return pureStmt(c, s->forstmt.init) &&
+               pureLoop(c, s->forstmt.cond, s->forstmt.body, s->forstmt.incr);
+    case NODE_WHILE:
+        return pureLoop(c, s->WhileStmt.cond, s->WhileStmt.body, NULL);
+    case NODE_SWITCH:
+        if (!pureExpr(c, s->switchStmt.value))
+            return 0;
+        for (int i = 0; i < s->switchStmt.bodyCount; ++i)
+            if (!pureMaybe(c, s->switchStmt.bodies[i], NULL))
+                return 0;
+        return 1;
+    case NODE_ASSIGN:
+        // a plain assignment to a name the function has not bound may
+        // reach the script's variable
+        if (!pureExpr(c, s->assign.value) ||
+            (!s->assign.isLet && findName(&c->bound, s->assign.varName) < 0))
+            return 0;
+        addName(&c->bound, s->assign.varName);
+        return 1;
+    case NODE_RETURN:
+        return pureExpr(c, s->returnStmt.value);
+    case NODE_BREAK:
+        return 1;
+    case NODE_CONTINUE:
+        c->continued = 1;
+        return 1;
+    case NODE_FUNC_CALL:
+        return pureCall(c, s);
+    default:
+        return 0; // printing, array writes, definitions
+    }
+}
+
+void memoizeFunctions(struct ASTNode *root)
+{
+    Purity c;
+    memset(&c, 0, sizeof(c));
+    c.root = root;
+    int n = root->block.count;
+    c.closed = (char *)calloc(n ? n : 1, 1);
+    c.pure = (char *)calloc(n ? n : 1, 1);
+    if (!c.closed || !c.pure)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    inferProgram(&c.types, root);
+    for (int i = 0; i < n; ++i)
+        if (root->block.items[i]->type == NODE_FUNC_DEF)
+            c.closed[i] = (char)isClosed(&c.types, root->block.items[i]);
+
+    // a pure function only calls earlier ones: one pass in script order
+    for (int i = 0; i < n; ++i)
+    {
+        struct ASTNode *def = root->block.items[i];
+        if (def->type != NODE_FUNC_DEF)
+            continue;
+        c.index = i;
+        c.pure[i] = 1;
+        c.selfCalls = 0;
+        for (int k = 0; k < def->funcDef.paramCount; ++k)
+            addName(&c.bound, def->funcDef.params[k]);
+        c.pure[i] = (char)pureStmt(&c, def->funcDef.body);
+        freeNames(&c.bound);
+        c.bound = (NameList){0};
+        if (c.pure[i] && !def->funcDef.memo && def->funcDef.paramCount <= MEMO_MAX_ARGS &&
+            (def->funcDef.memoize || c.selfCalls > 1))
+            def->funcDef.memo = newMemoTable(def->funcDef.paramCount);
+    }
+
+    free(c.closed);
+    free(c.pure);
+    freeProgramTypes(&c.types);
+}
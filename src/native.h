@@ -0,0 +1,222 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "runtime.h"
+#include "object.h"
+#include "numio.h"
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Included by the C that `slangc --emit-c` writes (see transpile.c):
+   the VM's instructions as inline functions, with the same fast paths
+   and the shared runtime for everything else, so a built program
+   prints exactly what the VM prints. */
+
+#define RT_MAX_DEPTH 4095 // user calls in progress, as many as the VM has frames
+
+#define RT_MAX_ROOTS (1 << 20)
+
+typedef Value (*NativeFn)(Value *args);
+
+static int rtDepth = 0;
+
+/* the shadow stack: the locals of the functions in progress and the
+   values an expression still needs, pushed while a call or a safe
+   point may collect; collect() marks it */
+static Value rtRoots[RT_MAX_ROOTS];
+static Value *rtTop = rtRoots;
+
+static inline Value rtGet(Value v, const char *name)
+{
+    if (v != UNDEF_VAL)
+        return v;
+    printf("Error: variable '%s' not found\n", name);
+    return NUM_VAL(0.0);
+}
+
+static inline Value rtAdd(Value l, Value r)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+        return intValue(AS_SMALL_INT(l) + AS_SMALL_INT(r));
+    if (IS_NUM(l) && IS_NUM(r))
+        return NUM_VAL(AS_NUM(l) + AS_NUM(r));
+    return binaryOp(OP_ADD, l, r);
+}
+
+static inline Value rtSub(Value l, Value r)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+        return intValue(AS_SMALL_INT(l) - AS_SMALL_INT(r));
+    if (IS_NUM(l) && IS_NUM(r))
+        return NUM_VAL(AS_NUM(l) - AS_NUM(r));
+    return binaryOp(OP_SUB, l, r);
+}
+
+static inline Value rtMul(Value l, Value r)
+{
+    int64_t res;
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r) &&
+        !__builtin_mul_overflow(AS_SMALL_INT(l), AS_SMALL_INT(r), &res))
+        return intValue(res);
+    if (IS_NUM(l) && IS_NUM(r))
+        return NUM_VAL(AS_NUM(l) * AS_NUM(r));
+    return binaryOp(OP_MUL, l, r);
+}
+
+static inline Value rtDiv(Value l, Value r)
+{
+    return binaryOp(OP_DIV, l, r);
+}
+
+/* rtLt(l, r) gives the value 0/1; rtTestLt(l, r) the C condition */
+#define RT_COMPARE(name, op, cop)                                     \
+    static inline int rtTest##name(Value l, Value r)                  \
+    {                                                                 \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            return AS_SMALL_INT(l) cop AS_SMALL_INT(r);               \
+        if (IS_NUM(l) && IS_NUM(r))                                   \
+            return AS_NUM(l) cop AS_NUM(r);                           \
+        return truthy(binaryOp(op, l, r));                            \
+    }                                                                 \
+    static inline Value rt##name(Value l, Value r)                    \
+    {                                                                 \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            return INT_VAL(AS_SMALL_INT(l) cop AS_SMALL_INT(r));      \
+        if (IS_NUM(l) && IS_NUM(r))                                   \
+            return INT_VAL(AS_NUM(l) cop AS_NUM(r));                  \
+        return binaryOp(op, l, r);                                    \
+    }
+
+RT_COMPARE(Eq, OP_EQ, ==)
+RT_COMPARE(Ne, OP_NE, !=)
+RT_COMPARE(Lt, OP_LT, <)
+RT_COMPARE(Le, OP_LE, <=)
+RT_COMPARE(Gt, OP_GT, >)
+RT_COMPARE(Ge, OP_GE, >=)
+
+#undef RT_COMPARE
+
+static inline Value rtArray(int n, const Value *items)
+{
+    ObjArray *arr = newArray(n);
+    for (int i = 0; i < n; ++i)
+        arr->data[i] = items[i];
+    return OBJ_VAL(arr);
+}
+
+static inline Value rtLength(Value v)
+{
+    if (IS_ARRAY(v))
+        return INT_VAL(AS_ARRAY(v)->len);
+    return callBuiltin(BI_LENGTH, &v);
+}
+
+/* integer literals beyond 48 bits, boxed once for the whole run */
+static inline Value rtConstInt(int64_t i)
+{
+    Value v = intValue(i);
+    if (IS_OBJ(v))
+        AS_OBJ(v)->pinned = 1;
+    return v;
+}
+
+static inline void rtPrint(Value v, int last)
+{
+    printValue(v);
+    putchar(last ? '\n' : ' ');
+}
+
+/* def carries the name and arity the error messages and printing use */
+static inline Value rtFunction(struct ASTNode *def, NativeFn code)
+{
+    ObjFunction *fn = newFunction(def);
+    fn->native = (void *)code;
+    return OBJ_VAL(fn);
+}
+
+/* the function to call, or NULL after printing why there is none */
+static inline NativeFn rtCallee(Value v, const char *name, int argc)
+{
+    if (!IS_FUNC(v))
+    {
+        printf("Runtime Error: unknown function '%s'\n", name);
+        return NULL;
+    }
+    struct ASTNode *def = AS_FUNC(v)->def;
+    if (def->funcDef.paramCount != argc)
+    {
+        printf("Runtime Error: function '%s' expects %d args, got %d\n",
+               def->funcDef.funcName, def->funcDef.paramCount, argc);
+        return NULL;
+    }
+    return (NativeFn)AS_FUNC(v)->native;
+}
+
+static inline void rtEnter(void)
+{
+    if (rtDepth == RT_MAX_DEPTH)
+    {
+        printf("Runtime Error: stack overflow\n");
+        exit(1);
+    }
+    rtDepth++;
+}
+
+static inline void rtLeave(void)
+{
+    rtDepth--;
+}
+
+static inline void rtHold(Value v)
+{
+    if (rtTop == rtRoots + RT_MAX_ROOTS)
+    {
+        printf("Runtime Error: stack overflow\n");
+        exit(1);
+    }
+    *rtTop++ = v;
+}
+
+static inline void rtDrop(int n)
+{
+    rtTop -= n;
+}
+
+/* a tail call to another function: the function making it returns
+   first, and the call site it returns to makes the call */
+static NativeFn rtTailFn = NULL;
+static Value *rtTailArgs = NULL;
+static int rtTailCap = 0;
+
+static inline Value rtTail(NativeFn c, Value *args, int argc)
+{
+    if (argc > rtTailCap)
+    {
+        rtTailArgs = (Value *)realloc(rtTailArgs, sizeof(Value) * argc);
+        if (!rtTailArgs)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        rtTailCap = argc;
+    }
+    for (int i = 0; i < argc; ++i)
+        rtTailArgs[i] = args[i];
+    rtTailFn = c;
+    return NUM_VAL(0.0);
+}
+
+/* v, or the result of the tail calls the callee left */
+static inline Value rtTailCalls(Value v)
+{
+    while (rtTailFn)
+    {
+        NativeFn c = rtTailFn;
+        rtTailFn = NULL;
+        v = c(rtTailArgs); // the callee copies its arguments first
+    }
+    return v;
+}
+
+#endif
@@ -0,0 +1,372 @@
+#include "numio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* tokens longer than this are never split across a refill */
+#define NUMIO_LOOKAHEAD 256
+
+struct NumReader
+{
+    FILE *f;
+    int ownsFile;
+    int shared;     // the stdin reader is never freed by numClose
+    int column;     // < 0: every field
+    int field;      // current field index in the line
+    int afterToken; // a token ended and no delimiter has been seen yet
+    int eof;
+    char *buf;
+    size_t pos, end;
+};
+
+static NumReader *stdinReader = NULL;
+static NumReader *handles[MAX_READERS];
+/* handles on "-" share stdinReader, so each keeps its own column */
+static int handleColumns[MAX_READERS];
+
+/* exact powers of ten representable as doubles (Clinger's fast path) */
+static const double pow10tab[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* -------------------- NUMBER PARSING -------------------- */
+
+/* parseNumber that also recognizes integer tokens: with whole non-NULL,
+   a token of digits (and a sign) that fits in int64 is stored in *whole,
+   *isWhole is set and *out is left alone */
+static const char *scanNumber(const char *p, const char *end, double *out,
+                              int64_t *whole, int *isWhole)
+{
+    const char *start = p;
+    if (whole)
+        *isWhole = 0;
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        neg = (*p == '-');
+        p++;
+    }
+
+    uint64_t mant = 0;
+    int digits = 0; // significant digits accumulated in mant
+    int exp10 = 0;
+    int inexact = 0; // digits were dropped, fast path not exact
+    int any = 0;
+
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (digits < 19)
+        {
+            mant = mant * 10 + (uint64_t)(*p - '0');
+            if (mant)
+                digits++;
+        }
+        else
+        {
+            exp10++;
+            inexact = 1;
+        }
+        p++;
+        any = 1;
+    }
+    int integral = !inexact; // no point or exponent seen, no digit dropped
+    if (p < end && *p == '.')
+    {
+        integral = 0;
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (digits < 19)
+            {
+                mant = mant * 10 + (uint64_t)(*p - '0');
+                if (mant)
+                    digits++;
+                exp10--;
+            }
+            else
+                inexact = 1;
+            p++;
+            any = 1;
+        }
+    }
+    if (!any)
+        return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        int eneg = 0;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            eneg = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int e = 0;
+            while (q < end && *q >= '0' && *q <= '9')
+            {
+                if (e < 100000)
+                    e = e * 10 + (*q - '0');
+                q++;
+            }
+            exp10 += eneg ? -e : e;
+            p = q;
+            integral = 0;
+        }
+    }
+
+    if (whole && integral && mant <= (uint64_t)INT64_MAX + neg)
+    {
+        *whole = neg ? (int64_t)(0 - mant) : (int64_t)mant;
+        *isWhole = 1;
+        return p;
+    }
+
+    if (!inexact && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        double v = (double)mant;
+        v = exp10 < 0 ? v / pow10tab[-exp10] : v * pow10tab[exp10];
+        *out = neg ? -v : v;
+        return p;
+    }
+
+    // slow path: correctly rounded conversion through strtod
+    size_t len = (size_t)(p - start);
+    char tmp[128];
+    char *s = len < sizeof(tmp) ? tmp : (char *)malloc(len + 1);
+    if (!s)
+        return NULL;
+    memcpy(s, start, len);
+    s[len] = '\0';
+    *out = strtod(s, NULL);
+    if (s != tmp)
+        free(s);
+    return p;
+}
+
+const char *parseNumber(const char *p, const char *end, double *out)
+{
+    return scanNumber(p, end, out, NULL, NULL);
+}
+
+/* -------------------- BUFFERED READER -------------------- */
+
+static NumReader *newReader(FILE *f, int ownsFile, int column)
+{
+    NumReader *r = (NumReader *)calloc(1, sizeof(NumReader));
+    if (!r)
+        return NULL;
+    r->buf = (char *)malloc(NUMIO_CHUNK);
+    if (!r->buf)
+    {
+        free(r);
+        return NULL;
+    }
+    r->f = f;
+    r->ownsFile = ownsFile;
+    r->column = column;
+    return r;
+}
+
+/* move the unread tail to the front and fill the rest of the buffer */
+static void refill(NumReader *r)
+{
+    if (r->eof)
+        return;
+    size_t rest = r->end - r->pos;
+    if (rest && r->pos)
+        memmove(r->buf, r->buf + r->pos, rest);
+    r->pos = 0;
+    r->end = rest;
+
+    // stdin is read a line at a time so readLine() never waits for more input
+    size_t n;
+    if (r->shared)
+        n = fgets(r->buf + r->end, (int)(NUMIO_CHUNK - r->end), r->f) ? strlen(r->buf + r->end) : 0;
+    else
+        n = fread(r->buf + r->end, 1, NUMIO_CHUNK - r->end, r->f);
+    r->end += n;
+    if (n == 0)
+        r->eof = 1;
+}
+
+static int isDelim(char c)
+{
+    return c == ',' || c == ';' || c == '\t';
+}
+
+static int isSep(char c)
+{
+    return c == ',' || c == ';' || c == '\t' || c == ' ' || c == '\r' || c == '\n';
+}
+
+NumReader *numOpen(const char *path, int column)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        NumReader *r = numStdin();
+        if (r)
+            r->column = column; // until the next numStdin or numHandle
+        return r;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    NumReader *r = newReader(f, 1, column);
+    if (!r)
+        fclose(f);
+    return r;
+}
+
+NumReader *numStdin(void)
+{
+    if (!stdinReader)
+    {
+        stdinReader = newReader(stdin, 0, -1);
+        if (stdinReader)
+            stdinReader->shared = 1;
+    }
+    else
+        stdinReader->column = -1;
+    return stdinReader;
+}
+
+/* numRead:
+   Parses up to max numbers into dst and returns how many were stored.
+   With stopAtNewline it returns after the end of the current line.
+   Returns 0 only at end of input (or on an empty line in line mode). */
+int numRead(NumReader *r, Value *dst, int max, int stopAtNewline)
+{
+    int n = 0;
+    while (n < max)
+    {
+        if (r->end - r->pos < NUMIO_LOOKAHEAD &&
+            !memchr(r->buf + r->pos, '\n', r->end - r->pos))
+        {
+            refill(r);
+            if (r->pos >= r->end)
+                break;
+        }
+
+        char c = r->buf[r->pos];
+        if (c == '\n')
+        {
+            r->pos++;
+            r->field = 0;
+            r->afterToken = 0;
+            if (stopAtNewline)
+                break;
+            continue;
+        }
+        if (c == ' ' || c == '\r')
+        {
+            r->pos++;
+            continue;
+        }
+        if (isDelim(c))
+        {
+            r->pos++;
+            r->field++;
+            r->afterToken = 0;
+            continue;
+        }
+
+        // start of a token
+        if (r->afterToken)
+            r->field++;
+        r->afterToken = 1;
+
+        const char *p = r->buf + r->pos;
+        const char *e = r->buf + r->end;
+        if (r->column < 0 || r->field == r->column)
+        {
+            double v;
+            int64_t i;
+            int isWhole;
+            const char *q = scanNumber(p, e, &v, &i, &isWhole);
+            if (q && (q < e ? isSep(*q) : r->eof))
+            {
+                dst[n++] = isWhole ? intValue(i) : NUM_VAL(v);
+                r->pos = (size_t)(q - r->buf);
+                continue;
+            }
+        }
+
+        // not a number (or not our column): skip to the next separator
+        while (1)
+        {
+            while (r->pos < r->end && !isSep(r->buf[r->pos]))
+                r->pos++;
+            if (r->pos < r->end || r->eof)
+                break;
+            refill(r);
+        }
+    }
+    return n;
+}
+
+int numEof(NumReader *r)
+{
+    if (r->pos < r->end)
+        return 0;
+    refill(r);
+    return r->pos >= r->end;
+}
+
+void numClose(NumReader *r)
+{
+    if (!r || r->shared)
+        return;
+    if (r->ownsFile)
+        fclose(r->f);
+    free(r->buf);
+    free(r);
+}
+
+/* -------------------- HANDLES -------------------- */
+
+int numOpenHandle(const char *path, int column)
+{
+    for (int i = 0; i < MAX_READERS; ++i)
+    {
+        if (!handles[i])
+        {
+            handles[i] = numOpen(path, column);
+            handleColumns[i] = column;
+            return handles[i] ? i + 1 : 0;
+        }
+    }
+    printf("Runtime Error: too many open readers (max %d)\n", MAX_READERS);
+    return 0;
+}
+
+NumReader *numHandle(int handle)
+{
+    if (handle < 1 || handle > MAX_READERS || !handles[handle - 1])
+        return NULL;
+    handles[handle - 1]->column = handleColumns[handle - 1];
+    return handles[handle - 1];
+}
+
+void numCloseHandle(int handle)
+{
+    NumReader *r = numHandle(handle);
+    if (!r)
+        return;
+    numClose(r);
+    handles[handle - 1] = NULL;
+}
+
+void numCloseAll(void)
+{
+    for (int i = 1; i <= MAX_READERS; ++i)
+        numCloseHandle(i);
+    if (stdinReader)
+    {
+        free(stdinReader->buf);
+        free(stdinReader);
+        stdinReader = NULL;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef NUMIO_H
+#define NUMIO_H
+
+#include <stddef.h>
+#include "value.h"
+
+/* size of one buffered read from the underlying file */
+#define NUMIO_CHUNK (1 << 20)
+#define MAX_READERS 16
+
+/* Streaming reader for numeric text (CSV or whitespace separated).
+   Fields are separated by ',', ';', tab or runs of spaces; lines by '\n'.
+   Tokens that are not numbers (headers, labels) are skipped. A token of
+   digits that fits in int64 is read as an integer, any other number as
+   a double. */
+typedef struct NumReader NumReader;
+
+/* path "-" reads stdin; column < 0 yields every field, otherwise only
+   the 0-based column of each line */
+NumReader *numOpen(const char *path, int column);
+int numRead(NumReader *r, Value *dst, int max, int stopAtNewline);
+int numEof(NumReader *r);
+void numClose(NumReader *r);
+
+/* shared stdin reader used by readLine(), reading every field */
+NumReader *numStdin(void);
+
+/* script-visible handles (1-based, 0 = invalid) */
+int numOpenHandle(const char *path, int column);
+NumReader *numHandle(int handle);
+void numCloseHandle(int handle);
+void numCloseAll(void);
+
+/* fast float parser: parses one number in [p, end), stores it in *out and
+   returns the position after it, or NULL if no number starts at p */
+const char *parseNumber(const char *p, const char *end, double *out);
+
+#endif
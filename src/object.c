@@ -0,0 +1,222 @@
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GC_MIN_BYTES (1024 * 1024)
+
+static Obj *objects = NULL;
+size_t bytesAllocated = 0;
+size_t nextGC = GC_MIN_BYTES;
+
+/* gray stack: marked objects whose children still need marking */
+static Obj **gray = NULL;
+static int grayCount = 0;
+static int grayCap = 0;
+
+/* -------------------- ALLOCATION -------------------- */
+
+void *allocObject(size_t size, ObjType type)
+{
+    Obj *o = (Obj *)malloc(size);
+    if (!o)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    memset(o, 0, size);
+    o->type = (unsigned char)type;
+    o->next = objects;
+    objects = o;
+    bytesAllocated += size;
+    return o;
+}
+
+void gcAccount(size_t bytes)
+{
+    bytesAllocated += bytes;
+}
+
+ObjArray *newArray(int len)
+{
+    ObjArray *arr = (ObjArray *)allocObject(sizeof(ObjArray), OBJ_ARRAY);
+    if (len > 0)
+    {
+        arr->data = (Value *)malloc(sizeof(Value) * len);
+        if (!arr->data)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < len; ++i)
+            arr->data[i] = INT_VAL(0);
+        arr->len = arr->cap = len;
+        bytesAllocated += sizeof(Value) * len;
+    }
+    return arr;
+}
+
+ObjArray *newArrayOwned(Value *data, int len)
+{
+    ObjArray *arr = (ObjArray *)allocObject(sizeof(ObjArray), OBJ_ARRAY);
+    arr->data = data;
+    arr->len = arr->cap = len > 0 ? len : 0;
+    bytesAllocated += sizeof(Value) * arr->cap;
+    return arr;
+}
+
+/* arrayResize: growing reallocates, shrinking only lowers len, so a
+   buffer refilled in a loop reuses the same storage */
+Value *arrayResize(ObjArray *arr, int len)
+{
+    if (len > arr->cap)
+    {
+        Value *data = (Value *)realloc(arr->data, sizeof(Value) * len);
+        if (!data)
+        {
+            printf("Error: out of memory\n");
+            return NULL;
+        }
+        bytesAllocated += sizeof(Value) * (len - arr->cap);
+        arr->data = data;
+        arr->cap = len;
+    }
+    arr->len = len > 0 ? len : 0;
+    return arr->data;
+}
+
+Value boxInt(int64_t i)
+{
+    ObjInt *box = (ObjInt *)allocObject(sizeof(ObjInt), OBJ_INT);
+    box->value = i;
+    return OBJ_VAL(box);
+}
+
+ObjFunction *newFunction(struct ASTNode *def)
+{
+    ObjFunction *fn = (ObjFunction *)allocObject(sizeof(ObjFunction), OBJ_FUNCTION);
+    fn->def = def;
+    fn->proto = NULL;
+    fn->thunks = NULL;
+    fn->native = NULL;
+    return fn;
+}
+
+/* -------------------- COLLECTION -------------------- */
+
+static void markObject(Obj *o)
+{
+    if (!o || o->marked)
+        return;
+    o->marked = 1;
+    if (grayCount >= grayCap)
+    {
+        grayCap = grayCap ? grayCap * 2 : 256;
+        gray = (Obj **)realloc(gray, sizeof(Obj *) * grayCap);
+        if (!gray)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+    }
+    gray[grayCount++] = o;
+}
+
+/* markValue: marks v and everything reachable from it */
+void markValue(Value v)
+{
+    if (!IS_OBJ(v))
+        return;
+    markObject(AS_OBJ(v));
+    while (grayCount > 0)
+    {
+        Obj *o = gray[--grayCount];
+        if (o->type == OBJ_ARRAY)
+        {
+            ObjArray *arr = (ObjArray *)o;
+            for (int i = 0; i < arr->len; ++i)
+                if (IS_OBJ(arr->data[i]))
+                    markObject(AS_OBJ(arr->data[i]));
+        }
+        else if (o->type == OBJ_STRING)
+        {
+            SlString *s = (SlString *)o;
+            if (!s->chars)
+            {
+                markObject(&s->left->obj);
+                markObject(&s->right->obj);
+            }
+        }
+    }
+}
+
+static size_t objectSize(Obj *o)
+{
+    switch (o->type)
+    {
+    case OBJ_STRING:
+    {
+        SlString *s = (SlString *)o;
+        return sizeof(SlString) + (s->chars == s->data ? s->len + 1 : s->len);
+    }
+    case OBJ_ARRAY:
+        return sizeof(ObjArray) + sizeof(Value) * ((ObjArray *)o)->cap;
+    case OBJ_INT:
+        return sizeof(ObjInt);
+    default:
+        return sizeof(ObjFunction);
+    }
+}
+
+static void freeObject(Obj *o)
+{
+    switch (o->type)
+    {
+    case OBJ_STRING:
+        slFree((SlString *)o);
+        break;
+    case OBJ_ARRAY:
+        free(((ObjArray *)o)->data);
+        free(o);
+        break;
+    default:
+        free(o);
+        break;
+    }
+}
+
+void sweepObjects(void)
+{
+    size_t live = 0;
+    Obj **link = &objects;
+    while (*link)
+    {
+        Obj *o = *link;
+        if (o->marked || o->pinned)
+        {
+            o->marked = 0;
+            live += objectSize(o);
+            link = &o->next;
+            continue;
+        }
+        *link = o->next;
+        freeObject(o);
+    }
+    bytesAllocated = live;
+    nextGC = live * 2 > GC_MIN_BYTES ? live * 2 : GC_MIN_BYTES;
+}
+
+void freeAllObjects(void)
+{
+    while (objects)
+    {
+        Obj *o = objects;
+        objects = o->next;
+        freeObject(o);
+    }
+    slFreeTables();
+    free(gray);
+    gray = NULL;
+    grayCount = grayCap = 0;
+    bytesAllocated = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stddef.h>
+#include "value.h"
+#include "slstring.h"
+
+struct ASTNode;
+
+typedef struct ObjArray
+{
+    Obj obj;
+    int len;
+    int cap;
+    Value *data;
+} ObjArray;
+
+typedef struct ObjFunction
+{
+    Obj obj;
+    struct ASTNode *def;          // NODE_FUNC_DEF
+    struct Proto *proto;          // its bytecode when created by the VM
+    struct ThunkFunction *thunks; // its closure code when created by that engine
+    void *native;                 // its C function in a program built by --emit-c
+} ObjFunction;
+
+void *allocObject(size_t size, ObjType type);
+ObjArray *newArray(int len);                      // elements start at 0
+ObjArray *newArrayOwned(Value *data, int len);    // adopts a malloc'd buffer
+Value *arrayResize(ObjArray *arr, int len);       // keeps storage when it fits
+ObjFunction *newFunction(struct ASTNode *def);
+
+/* collector: callers mark their roots, then sweep */
+extern size_t bytesAllocated;
+extern size_t nextGC;
+static inline int gcShouldCollect(void)
+{
+    return bytesAllocated > nextGC;
+}
+void gcAccount(size_t bytes);
+void markValue(Value v);
+void sweepObjects(void);
+void freeAllObjects(void);
+
+#endif
@@ -0,0 +1,411 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every rewrite here must leave the output unchanged on every engine,
+   error messages included: only numbers (small ints and doubles) are
+   folded, and only where the runtime would not report anything. */
+
+static NodeList functions; // every function definition in the program
+
+/* the const declarations of one frame */
+static void collectConsts(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n || n->type == NODE_FUNC_DEF)
+        return;
+    if (n->type == NODE_ASSIGN && n->assign.isConst)
+        addNode((NodeList *)ctx, n);
+    visitChildren(n, collectConsts, ctx);
+}
+
+/* the one declaration of a const must be the only thing binding its
+   name in that frame, and nothing may assign a script-level const */
+static int checkConsts(struct ASTNode *body, struct ASTNode *def)
+{
+    NodeList consts = {0};
+    int ok = 1;
+    collectConsts(&body, &consts);
+    for (int i = 0; i < consts.count && ok; ++i)
+    {
+        const char *name = consts.items[i]->assign.varName;
+        NameUse u = {name, 0, 0, 0};
+        scanFrame(&body, &u);
+        int bound = u.decls > 1 || u.writes > 0;
+        for (int p = 0; def && p < def->funcDef.paramCount; ++p)
+            bound |= strcmp(def->funcDef.params[p], name) == 0;
+        for (int f = 0; !def && f < functions.count; ++f)
+            bound |= functionBinding(functions.items[f], name) == WRITES;
+        if (bound)
+        {
+            printf("Error: cannot assign to constant '%s'\n", name);
+            ok = 0;
+        }
+    }
+    free(consts.items);
+    return ok;
+}
+
+// ------------------- FOLDING -------------------
+
+typedef struct
+{
+    const char *name;
+    struct ASTNode *value; // NODE_NUM
+    int hidden;            // > 0 inside functions with a local of that name
+} Constant;
+
+static Constant *constants;
+static int constCount, constCap;
+static int inFunction;
+
+static int isFoldable(struct ASTNode *n)
+{
+    return n && n->type == NODE_NUM &&
+           (!n->num.isInt || (n->num.intValue >= SMALL_INT_MIN && n->num.intValue <= SMALL_INT_MAX));
+}
+
+static struct ASTNode *numNode(Value v)
+{
+    struct ASTNode *n = newNode(NODE_NUM);
+    if (IS_SMALL_INT(v))
+    {
+        n->num.intValue = AS_SMALL_INT(v);
+        n->num.value = (double)n->num.intValue;
+        n->num.isInt = 1;
+    }
+    else
+        n->num.value = AS_NUM(v);
+    return n;
+}
+
+static struct ASTNode *emptyBlock(void)
+{
+    return newNode(NODE_BLOCK);
+}
+
+static int isEmptyBlock(struct ASTNode *n)
+{
+    return !n || (n->type == NODE_BLOCK && n->block.count == 0);
+}
+
+/* -1 when cond is not a constant */
+static int constantTruth(struct ASTNode *cond)
+{
+    return isFoldable(cond) ? isTruthy(literalValue(cond)) : -1;
+}
+
+static Constant *findConstant(const char *name)
+{
+    for (int i = constCount - 1; i >= 0; --i)
+        if (!constants[i].hidden && strcmp(constants[i].name, name) == 0)
+            return &constants[i];
+    return NULL;
+}
+
+/* name is bound once, by the script, and no function assigns it */
+static int isPropagatable(struct ASTNode *root, const char *name)
+{
+    NameUse u = {name, 0, 0, 0};
+    scanFrame(&root, &u);
+    if (u.decls != 1 || u.writes != 0)
+        return 0;
+    for (int f = 0; f < functions.count; ++f)
+        if (functionBinding(functions.items[f], name) == WRITES)
+            return 0;
+    return 1;
+}
+
+/* replaces *slot with keep (which may be NULL), freeing the rest of it */
+static void replaceNode(struct ASTNode **slot, struct ASTNode **keep)
+{
+    struct ASTNode *n = *slot;
+    *slot = *keep ? *keep : emptyBlock();
+    *keep = NULL;
+    freeNode(n);
+}
+
+static void fold(struct ASTNode **slot, void *ctx);
+
+/* a break that would leave the statement: loops and switches take their own */
+static void findBreak(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n || n->type == NODE_FOR || n->type == NODE_WHILE || n->type == NODE_FOR_IN ||
+        n->type == NODE_SWITCH || n->type == NODE_FUNC_DEF)
+        return;
+    if (n->type == NODE_BREAK)
+        *(int *)ctx = 1;
+    visitChildren(n, findBreak, ctx);
+}
+
+static void foldBlock(struct ASTNode *block, struct ASTNode *root)
+{
+    int kept = 0;
+    for (int i = 0; i < block->block.count; ++i)
+    {
+        fold(&block->block.items[i], NULL);
+        struct ASTNode *s = block->block.items[i];
+
+        // a `let x = <number>` of the script: later statements use the number
+        if (block == root && s->type == NODE_ASSIGN && isFoldable(s->assign.value) &&
+            isPropagatable(root, s->assign.varName))
+        {
+            if (constCount >= constCap)
+                constants = (Constant *)growArray(constants, &constCap, sizeof(Constant));
+            constants[constCount++] = (Constant){s->assign.varName, s->assign.value, 0};
+        }
+
+        // isPropagatable walks this block: it holds no freed or moved node
+        block->block.items[i] = NULL;
+        if (isEmptyBlock(s))
+        {
+            freeNode(s);
+            continue;
+        }
+        block->block.items[kept++] = s;
+
+        // nothing after a return, break or continue runs
+        if ((inFunction && s->type == NODE_RETURN) || s->type == NODE_BREAK || s->type == NODE_CONTINUE)
+        {
+            for (int j = i + 1; j < block->block.count; ++j)
+                freeNode(block->block.items[j]);
+            break;
+        }
+    }
+    block->block.count = kept;
+}
+
+static void fold(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n)
+        return;
+
+    switch (n->type)
+    {
+    case NODE_VAR:
+    {
+        Constant *c = findConstant(n->varName);
+        if (c)
+        {
+            *slot = newNode(NODE_NUM);
+            (*slot)->num = c->value->num;
+            freeNode(n);
+        }
+        break;
+    }
+
+    case NODE_BINOP:
+    {
+        visitChildren(n, fold, ctx);
+        struct ASTNode *l = n->binop.left, *r = n->binop.right;
+        if (!isFoldable(l) || !isFoldable(r))
+            break;
+        if (n->binop.op == OP_DIV && !isTruthy(literalValue(r)))
+            break; // leave the division by zero to report at run time
+        Value v = binaryOp(n->binop.op, literalValue(l), literalValue(r));
+        if (IS_SMALL_INT(v) || IS_NUM(v))
+        {
+            *slot = numNode(v);
+            freeNode(n);
+        }
+        break;
+    }
+
+    case NODE_LOGICAL:
+    {
+        visitChildren(n, fold, ctx);
+        int left = constantTruth(n->logical.left);
+        int right = n->logical.right ? constantTruth(n->logical.right) : -1;
+        int truth = -1;
+        if (n->logical.op == LOGIC_NOT && left >= 0)
+            truth = !left;
+        else if (left == (n->logical.op == LOGIC_OR)) // decided: the right operand never runs
+            truth = left;
+        else if (left >= 0)
+            truth = right;
+        if (truth >= 0)
+        {
+            *slot = numNode(INT_VAL(truth));
+            freeNode(n);
+        }
+        break;
+    }
+
+    case NODE_BLOCK:
+        foldBlock(n, (struct ASTNode *)ctx);
+        break;
+
+    case NODE_IF:
+    {
+        fold(&n->ifstmt.cond, ctx);
+        int truth = constantTruth(n->ifstmt.cond);
+        if (truth < 0)
+        {
+            fold(&n->ifstmt.thenBlock, ctx);
+            fold(&n->ifstmt.elseBlock, ctx);
+            break;
+        }
+        // the taken branch replaces the if; blocks have no scope of their own
+        replaceNode(slot, truth ? &n->ifstmt.thenBlock : &n->ifstmt.elseBlock);
+        fold(slot, ctx);
+        break;
+    }
+
+    case NODE_SWITCH:
+    {
+        fold(&n->switchStmt.value, ctx);
+        int k = -1, breaks = 0;
+        if (isFoldable(n->switchStmt.value))
+        {
+            k = selectCase(&n->switchStmt.cases, literalValue(n->switchStmt.value));
+            if (k >= 0)
+                findBreak(&n->switchStmt.bodies[k], &breaks);
+        }
+        if (!isFoldable(n->switchStmt.value) || breaks)
+        {
+            for (int i = 0; i < n->switchStmt.bodyCount; ++i)
+                fold(&n->switchStmt.bodies[i], ctx);
+            break;
+        }
+        // the selected case replaces the switch, like the taken branch of an if
+        struct ASTNode *none = NULL;
+        replaceNode(slot, k >= 0 ? &n->switchStmt.bodies[k] : &none);
+        fold(slot, ctx);
+        break;
+    }
+
+    case NODE_WHILE:
+        fold(&n->WhileStmt.cond, ctx);
+        if (constantTruth(n->WhileStmt.cond) == 0)
+        {
+            struct ASTNode *none = NULL;
+            replaceNode(slot, &none);
+            break;
+        }
+        fold(&n->WhileStmt.body, ctx);
+        break;
+
+    case NODE_FOR:
+        fold(&n->forstmt.init, ctx);
+        fold(&n->forstmt.cond, ctx);
+        if (constantTruth(n->forstmt.cond) == 0)
+        {
+            replaceNode(slot, &n->forstmt.init);
+            break;
+        }
+        fold(&n->forstmt.incr, ctx);
+        fold(&n->forstmt.body, ctx);
+        break;
+
+    case NODE_FUNC_DEF:
+    {
+        int enclosing = inFunction;
+        for (int i = 0; i < constCount; ++i)
+            if (functionBinding(n, constants[i].name) != SEES_GLOBAL)
+                constants[i].hidden++;
+        inFunction = 1;
+        fold(&n->funcDef.body, ctx);
+        inFunction = enclosing;
+        for (int i = 0; i < constCount; ++i)
+            if (functionBinding(n, constants[i].name) != SEES_GLOBAL)
+                constants[i].hidden--;
+        break;
+    }
+
+    default:
+        visitChildren(n, fold, ctx);
+        break;
+    }
+}
+
+// ------------------- DEAD DEFINITIONS -------------------
+
+static struct ASTNode *program;
+static int removed;
+
+/* a function, or a variable bound to a literal, that nothing names */
+static int isDeadDefinition(struct ASTNode *s)
+{
+    NameUse u = {NULL, 0, 0, 0};
+    if (s->type == NODE_FUNC_DEF)
+        u.name = s->funcDef.funcName;
+    else if (s->type == NODE_ASSIGN && s->assign.isLet &&
+             (!s->assign.value || s->assign.value->type == NODE_NUM || s->assign.value->type == NODE_STR))
+        u.name = s->assign.varName;
+    else
+        return 0;
+    countRefs(&program, &u);
+    return u.refs == 0;
+}
+
+static void removeDead(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n)
+        return;
+    if (n->type == NODE_BLOCK)
+    {
+        // the later checks walk this block too: no freed node may stay in it
+        for (int i = 0; i < n->block.count; ++i)
+            if (isDeadDefinition(n->block.items[i]))
+            {
+                freeNode(n->block.items[i]);
+                n->block.items[i] = NULL;
+                removed++;
+            }
+        int kept = 0;
+        for (int i = 0; i < n->block.count; ++i)
+            if (n->block.items[i])
+                n->block.items[kept++] = n->block.items[i];
+        n->block.count = kept;
+    }
+    visitChildren(n, removeDead, ctx);
+}
+
+// ------------------- PROGRAM -------------------
+
+int optimizeProgram(struct ASTNode *root, int level)
+{
+    int ok = 1;
+    collectFunctions(&root, &functions);
+    ok = checkConsts(root, NULL);
+    for (int f = 0; f < functions.count && ok; ++f)
+        ok = checkConsts(functions.items[f]->funcDef.body, functions.items[f]);
+    free(functions.items);
+    functions = (NodeList){0};
+    if (ok && root->type == NODE_BLOCK)
+        reportTypeErrors(root);
+    if (!ok || level < 1 || root->type != NODE_BLOCK)
+        return ok;
+
+    inlineFunctions(root);
+    collectFunctions(&root, &functions);
+    fold(&root, root);
+    free(functions.items);
+    functions = (NodeList){0};
+    free(constants);
+    constants = NULL;
+    constCount = constCap = 0;
+
+    // a definition can be the only user of another
+    program = root;
+    do
+    {
+        removed = 0;
+        removeDead(&root, NULL);
+    } while (removed);
+
+    // matches loop conditions before their length() calls move out
+    eliminateBoundsChecks(root);
+    hoistInvariants(root);
+    vectorizeLoops(root);
+    eliminateCommonSubexpressions(root);
+    memoizeFunctions(root);
+    markKnownArrays(root);
+    return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+
+/* AST optimizer, run on the parsed program before any engine sees it.
+   -O1 (the default) copies small functions into their call sites, folds
+   constant arithmetic, replaces variables the script binds once to a
+   number with that number, drops branches and loops whose condition is
+   a constant, code after a `return` and definitions nothing refers to,
+   marks array accesses that counted loops keep in range, moves
+   loop-invariant expressions out of loops, runs loops that only store
+   an element-wise expression as one kernel call, then reuses the values of
+   expressions a block evaluates more than once, and gives pure
+   functions that are written with @memo, or that recurse more than
+   once, a table of their results. -O0 leaves the tree alone.
+
+   At every level it rejects assignments to a `const`; returns 0 after
+   printing the error. It also warns about operations whose types make
+   them fail whenever they run; at -O1 it then marks the array accesses
+   of variables that hold an array. */
+int optimizeProgram(struct ASTNode *root, int level);
+
+void inlineFunctions(struct ASTNode *root);               // inline.c
+void eliminateBoundsChecks(struct ASTNode *root);         // bounds.c
+void hoistInvariants(struct ASTNode *root);               // licm.c
+void vectorizeLoops(struct ASTNode *root);                // vectorize.c
+void eliminateCommonSubexpressions(struct ASTNode *root); // cse.c
+void memoizeFunctions(struct ASTNode *root);              // memoize.c
+void reportTypeErrors(struct ASTNode *root);              // typecheck.c
+void markKnownArrays(struct ASTNode *root);               // typecheck.c
+
+#endif
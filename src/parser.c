@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include "parser.h"
 #include "ast.h"
 #include "lexer.h"
@@ -9,18 +10,26 @@
 // Local pointer to source for tokenization (used only indirectly through getNextToken)
 static const char *p_src = NULL;
 
+// loops and switches around the statement being parsed, in the innermost function
+static int loopDepth = 0;
+static int switchDepth = 0;
+
 // Forward declarations
 static struct ASTNode *parseStatement(const char **p);
 static struct ASTNode *parseBlock(const char **p);
 static struct ASTNode *parseExpression(const char **p);
 static struct ASTNode *parseComparison(const char **p);
+static struct ASTNode *parseOr(const char **p);
 static struct ASTNode *parseTerm(const char **p);
 static struct ASTNode *parseFactor(const char **p);
 static struct ASTNode *parseIfStatement(const char **p);
 static struct ASTNode *parseFor(const char **p);
+static struct ASTNode *parseForIn(const char **p);
 static struct ASTNode *parseAssignmentNoSemi(const char **p); // helper for for-header assignments
 static struct ASTNode *parseFunctionDef(const char **p);
 static struct ASTNode *parseReturn(const char **p);
+static struct ASTNode *parseLoopBody(const char **p);
+static struct ASTNode *parseSwitch(const char **p);
 
 // Helper functions
 static int expectTokenType(const char **p, TokenType t, const char *errMsg)
@@ -55,7 +64,8 @@ static struct ASTNode *parseFactor(const char **p)
     Token tk = getNextToken(p);
 
     // Prevent keywords from being parsed as factors
-    if (tk.type == TOKEN_LET || tk.type == TOKEN_FUNC || tk.type == TOKEN_RETURN || tk.type == TOKEN_WHILE)
+    if (tk.type == TOKEN_LET || tk.type == TOKEN_CONST || tk.type == TOKEN_FUNC || tk.type == TOKEN_RETURN ||
+        tk.type == TOKEN_WHILE || tk.type == TOKEN_BREAK || tk.type == TOKEN_CONTINUE)
     {
         printf("Parser Error: Unexpected token '%s' in factor\n", tk.text);
         return NULL;
@@ -64,13 +74,24 @@ static struct ASTNode *parseFactor(const char **p)
     if (tk.type == TOKEN_NUM)
     {
         struct ASTNode *n = newNode(NODE_NUM);
-        n->number = strtod(tk.text, NULL);
+        n->num.value = strtod(tk.text, NULL);
+        if (!strchr(tk.text, '.'))
+        {
+            // integer literal: exact unless it does not fit in int64
+            errno = 0;
+            long long i = strtoll(tk.text, NULL, 10);
+            if (errno != ERANGE)
+            {
+                n->num.intValue = i;
+                n->num.isInt = 1;
+            }
+        }
         return n;
     }
     else if (tk.type == TOKEN_STR)
     {
         struct ASTNode *n = newNode(NODE_STR);
-        n->string = strdup(tk.text);
+        n->str.text = strdup(tk.text);
         return n;
     }
     else if (tk.type == TOKEN_ID)
@@ -89,7 +110,7 @@ static struct ASTNode *parseFactor(const char **p)
             {
                 while (1)
                 {
-                    struct ASTNode *arg = parseComparison(p);
+                    struct ASTNode *arg = parseOr(p);
                     if (!arg)
                         break;
                     fn->funcCall.args = realloc(fn->funcCall.args,
@@ -118,7 +139,7 @@ static struct ASTNode *parseFactor(const char **p)
             strncpy(varNode->varName, tk.text, sizeof(varNode->varName) - 1);
 
             getNextToken(p); // consume '['
-            struct ASTNode *idx = parseComparison(p);
+            struct ASTNode *idx = parseOr(p);
             expectTokenType(p, TOKEN_RBRACKET, "Expected ']' after array index");
 
             struct ASTNode *acc = newNode(NODE_ARR_ACCESS);
@@ -136,7 +157,7 @@ static struct ASTNode *parseFactor(const char **p)
     }
     else if (tk.type == TOKEN_LPAREN)
     {
-        struct ASTNode *e = parseComparison(p);
+        struct ASTNode *e = parseOr(p);
         expectTokenType(p, TOKEN_RPAREN, "Expected ')'");
         return e;
     }
@@ -144,7 +165,7 @@ static struct ASTNode *parseFactor(const char **p)
     {
         struct ASTNode *f = parseFactor(p);
         struct ASTNode *zero = newNode(NODE_NUM);
-        zero->number = 0.0;
+        zero->num.isInt = 1;
         struct ASTNode *bin = newNode(NODE_BINOP);
         bin->binop.op = OP_SUB;
         bin->binop.left = zero;
@@ -155,6 +176,13 @@ static struct ASTNode *parseFactor(const char **p)
     {
         return parseFactor(p);
     }
+    else if (tk.type == TOKEN_NOT)
+    {
+        struct ASTNode *n = newNode(NODE_LOGICAL);
+        n->logical.op = LOGIC_NOT;
+        n->logical.left = parseFactor(p);
+        return n;
+    }
     else if (tk.type == TOKEN_LBRACKET) // array literal
     {
         struct ASTNode *arr = newNode(NODE_ARRAY);
@@ -165,7 +193,7 @@ static struct ASTNode *parseFactor(const char **p)
         {
             while (1)
             {
-                struct ASTNode *elem = parseComparison(p);
+                struct ASTNode *elem = parseOr(p);
                 if (!elem)
                     break;
 
@@ -292,6 +320,41 @@ static struct ASTNode *parseComparison(const char **p)
     return bin;
 }
 
+// && binds tighter than ||; both below the comparisons
+static struct ASTNode *parseLogical(const char **p, TokenType token, LogicOpType op,
+                                    struct ASTNode *(*operand)(const char **))
+{
+    struct ASTNode *left = operand(p);
+    if (!left)
+        return NULL;
+
+    while (1)
+    {
+        const char *save = *p;
+        if (getNextToken(p).type != token)
+        {
+            *p = save;
+            break;
+        }
+        struct ASTNode *n = newNode(NODE_LOGICAL);
+        n->logical.op = op;
+        n->logical.left = left;
+        n->logical.right = operand(p);
+        left = n;
+    }
+    return left;
+}
+
+static struct ASTNode *parseAnd(const char **p)
+{
+    return parseLogical(p, TOKEN_AND, LOGIC_AND, parseComparison);
+}
+
+static struct ASTNode *parseOr(const char **p)
+{
+    return parseLogical(p, TOKEN_OR, LOGIC_OR, parseAnd);
+}
+
 // ----------------- Parsing Statements -----------------
 
 static struct ASTNode *parseBlock(const char **p)
@@ -337,7 +400,7 @@ static struct ASTNode *parseIfStatement(const char **p)
     if (!expectTokenType(p, TOKEN_LPAREN, "Expected '(' after if"))
         return NULL;
 
-    struct ASTNode *cond = parseComparison(p);
+    struct ASTNode *cond = parseOr(p);
     if (!expectTokenType(p, TOKEN_RPAREN, "Expected ')' after if condition"))
         return NULL;
 
@@ -377,11 +440,32 @@ static struct ASTNode *parseIfStatement(const char **p)
     return ifn;
 }
 
+/* the operator of +=, -=, *=, /=, ++ and --; -1 for any other token */
+static int updateOp(TokenType t)
+{
+    switch (t)
+    {
+    case TOKEN_PLUS_EQUAL:
+    case TOKEN_INC:
+        return OP_ADD;
+    case TOKEN_SUB_EQUAL:
+    case TOKEN_DEC:
+        return OP_SUB;
+    case TOKEN_MUL_EQUAL:
+        return OP_MUL;
+    case TOKEN_DIV_EQUAL:
+        return OP_DIV;
+    default:
+        return -1;
+    }
+}
+
 // Parse an assignment or let-declaration without ';'
 // Accepts:
 //   let id = expr
 //   id = expr
 //   id[expr] = expr
+//   id op= expr, id[expr] op= expr (op one of + - * /), id++, id--, id[expr]++ ...
 static struct ASTNode *parseAssignmentNoSemi(const char **p)
 {
     const char *save = *p;
@@ -400,11 +484,12 @@ static struct ASTNode *parseAssignmentNoSemi(const char **p)
         if (peekTokenType(p) == TOKEN_EQUAL)
         {
             getNextToken(p); // '='
-            rhs = parseComparison(p);
+            rhs = parseOr(p);
         }
         struct ASTNode *decl = newNode(NODE_ASSIGN);
         strncpy(decl->assign.varName, id.text, sizeof(decl->assign.varName) - 1);
         decl->assign.value = rhs;
+        decl->assign.isLet = 1;
         return decl;
     }
 
@@ -415,20 +500,42 @@ static struct ASTNode *parseAssignmentNoSemi(const char **p)
         return NULL;
 
     Token eq = getNextToken(p);
-    if (eq.type != TOKEN_EQUAL)
+    int op = updateOp(eq.type);
+    if (eq.type != TOKEN_EQUAL && op < 0)
     {
         *p = save;
         return NULL;
     }
-    struct ASTNode *rhs = parseComparison(p);
+    struct ASTNode *rhs;
+    if (eq.type == TOKEN_INC || eq.type == TOKEN_DEC)
+    {
+        rhs = newNode(NODE_NUM);
+        rhs->num.value = 1.0;
+        rhs->num.intValue = 1;
+        rhs->num.isInt = 1;
+    }
+    else
+        rhs = parseOr(p);
     if (!rhs)
         return NULL;
+    if (op >= 0)
+    {
+        // x op= v is x = x op v, the second x parsed again from the source
+        const char *target = save;
+        struct ASTNode *bin = newNode(NODE_BINOP);
+        bin->binop.op = op;
+        bin->binop.left = parseFactor(&target);
+        bin->binop.right = rhs;
+        rhs = bin;
+    }
 
     if (lhs->type == NODE_VAR)
     {
         struct ASTNode *stmt = newNode(NODE_ASSIGN);
         strncpy(stmt->assign.varName, lhs->varName, sizeof(stmt->assign.varName) - 1);
         stmt->assign.value = rhs;
+        stmt->assign.update = op >= 0;
+        freeNode(lhs);
         return stmt;
     }
     else if (lhs->type == NODE_ARR_ACCESS)
@@ -437,6 +544,8 @@ static struct ASTNode *parseAssignmentNoSemi(const char **p)
         strncpy(stmt->arrAssign.varName, lhs->ArrAccessNode.varName, sizeof(stmt->arrAssign.varName) - 1);
         stmt->arrAssign.index = lhs->ArrAccessNode.index;
         stmt->arrAssign.value = rhs;
+        stmt->arrAssign.update = op >= 0;
+        free(lhs);
         return stmt;
     }
 
@@ -446,6 +555,13 @@ static struct ASTNode *parseAssignmentNoSemi(const char **p)
 
 static struct ASTNode *parseFor(const char **p)
 {
+    const char *save = *p;
+    Token var = getNextToken(p);
+    int forIn = var.type == TOKEN_ID && peekTokenType(p) == TOKEN_IN;
+    *p = save;
+    if (forIn)
+        return parseForIn(p);
+
     struct ASTNode *node = newNode(NODE_FOR);
     if (!expectTokenType(p, TOKEN_LPAREN, "Expected '(' after for"))
         return NULL;
@@ -460,7 +576,7 @@ static struct ASTNode *parseFor(const char **p)
     // condition
     struct ASTNode *cond = NULL;
     if (peekTokenType(p) != TOKEN_SEMI)
-        cond = parseComparison(p);
+        cond = parseOr(p);
     if (!expectTokenType(p, TOKEN_SEMI, "Expected ';' after for condition"))
         return NULL;
 
@@ -471,7 +587,7 @@ static struct ASTNode *parseFor(const char **p)
     if (!expectTokenType(p, TOKEN_RPAREN, "Expected ')' after for header"))
         return NULL;
 
-    struct ASTNode *body = parseBlock(p);
+    struct ASTNode *body = parseLoopBody(p);
     node->forstmt.init = init;
     node->forstmt.cond = cond;
     node->forstmt.incr = incr;
@@ -479,19 +595,72 @@ static struct ASTNode *parseFor(const char **p)
     return node;
 }
 
+/*
+ * parseForIn:
+ *   for <name> in range(<end>) { ... }
+ *   for <name> in range(<start>, <end>[, <step>]) { ... }
+ *   for <name> in <array> { ... }
+ */
+static struct ASTNode *parseForIn(const char **p)
+{
+    Token var = getNextToken(p);
+    getNextToken(p); // in
+    struct ASTNode *node = newNode(NODE_FOR_IN);
+    strncpy(node->forIn.varName, var.text, sizeof(node->forIn.varName) - 1);
+
+    if (peekTokenType(p) == TOKEN_RANGE)
+    {
+        getNextToken(p);
+        if (!expectTokenType(p, TOKEN_LPAREN, "Expected '(' after range"))
+            return NULL;
+        struct ASTNode *args[3];
+        int count = 0;
+        while (count < 3)
+        {
+            args[count] = parseOr(p);
+            if (!args[count++])
+                return NULL;
+            if (peekTokenType(p) != TOKEN_COMMA)
+                break;
+            getNextToken(p);
+        }
+        if (!expectTokenType(p, TOKEN_RPAREN, "Expected ')' after range arguments"))
+            return NULL;
+        if (count == 1)
+            node->forIn.end = args[0];
+        else
+        {
+            node->forIn.start = args[0];
+            node->forIn.end = args[1];
+            node->forIn.step = count == 3 ? args[2] : NULL;
+        }
+    }
+    else
+    {
+        node->forIn.array = parseOr(p);
+        if (!node->forIn.array)
+            return NULL;
+    }
+
+    node->forIn.body = parseLoopBody(p);
+    if (!node->forIn.body)
+        return NULL;
+    return node;
+}
+
 static struct ASTNode *parseWhile(const char **p)
 {
     if (!expectTokenType(p, TOKEN_LPAREN, "Expected '(' after while"))
         return NULL;
 
-    struct ASTNode *cond = parseComparison(p);
+    struct ASTNode *cond = parseOr(p);
     if (!cond)
         return NULL;
 
     if (!expectTokenType(p, TOKEN_RPAREN, "Expected ')' after while condition."))
         return NULL;
 
-    struct ASTNode *body = parseBlock(p);
+    struct ASTNode *body = parseLoopBody(p);
     if (!body)
         return NULL;
 
@@ -552,8 +721,12 @@ static struct ASTNode *parseFunctionDef(const char **p)
         getNextToken(p); // consume ')'
     }
 
-    // Function body is a block
+    // Function body is a block; break and continue cannot leave it
+    int outerLoops = loopDepth, outerSwitches = switchDepth;
+    loopDepth = switchDepth = 0;
     func->funcDef.body = parseBlock(p);
+    loopDepth = outerLoops;
+    switchDepth = outerSwitches;
     return func;
 }
 
@@ -565,12 +738,171 @@ static struct ASTNode *parseFunctionDef(const char **p)
 static struct ASTNode *parseReturn(const char **p)
 {
     struct ASTNode *node = newNode(NODE_RETURN);
-    node->returnStmt.value = parseComparison(p);
+    node->returnStmt.value = parseOr(p);
     if (!expectTokenType(p, TOKEN_SEMI, "Expected ';' after return"))
         return NULL;
     return node;
 }
 
+static struct ASTNode *parseLoopBody(const char **p)
+{
+    loopDepth++;
+    struct ASTNode *body = parseBlock(p);
+    loopDepth--;
+    return body;
+}
+
+/*
+ * parseJump:
+ *   Assumes the break or continue keyword has already been consumed.
+ *   Parses: break ; | continue ;
+ */
+static struct ASTNode *parseJump(const char **p, Token keyword)
+{
+    if (!loopDepth && (keyword.type == TOKEN_CONTINUE || !switchDepth))
+    {
+        printf("Syntax Error: '%s' outside a loop\n", keyword.text);
+        return NULL;
+    }
+    if (!expectTokenType(p, TOKEN_SEMI, keyword.type == TOKEN_BREAK ? "Expected ';' after break"
+                                                                   : "Expected ';' after continue"))
+        return NULL;
+    return newNode(keyword.type == TOKEN_BREAK ? NODE_BREAK : NODE_CONTINUE);
+}
+
+/* a case label: an integer literal, optionally negative, in small-int
+   range, into *label */
+static int parseCaseLabel(const char **p, int64_t *label)
+{
+    Token tk = getNextToken(p);
+    int negative = tk.type == TOKEN_SUB;
+    if (negative)
+        tk = getNextToken(p);
+    if (tk.type != TOKEN_NUM || strchr(tk.text, '.'))
+    {
+        printf("Syntax Error: case label must be an integer (got '%s')\n", tk.text);
+        return 0;
+    }
+    errno = 0;
+    long long v = strtoll(tk.text, NULL, 10);
+    if (errno == ERANGE || v > SMALL_INT_MAX + negative)
+    {
+        printf("Syntax Error: case label must fit in 48 bits (got '%s%s')\n",
+               negative ? "-" : "", tk.text);
+        return 0;
+    }
+    *label = negative ? -v : v;
+    return 1;
+}
+
+/* the statements of a case, up to the next case, default or '}' */
+static struct ASTNode *parseCaseBody(const char **p)
+{
+    struct ASTNode *blk = newNode(NODE_BLOCK);
+    while (1)
+    {
+        int next = peekTokenType(p);
+        if (next == TOKEN_CASE || next == TOKEN_DEFAULT || next == TOKEN_RBRACE)
+            break;
+        if (next == TOKEN_EOF)
+        {
+            printf("Parser Error: Unexpected EOF in switch\n");
+            break;
+        }
+        struct ASTNode *stmt = parseStatement(p);
+        if (stmt)
+        {
+            blk->block.items = realloc(blk->block.items,
+                                       sizeof(struct ASTNode *) * (blk->block.count + 1));
+            blk->block.items[blk->block.count++] = stmt;
+        }
+        else if (peekTokenType(p) != TOKEN_RBRACE)
+            getNextToken(p);
+    }
+    return blk;
+}
+
+/*
+ * parseSwitch:
+ *   Assumes the switch keyword has already been consumed.
+ *   Parses: switch (expr) { case <int>, <int>...: stmts ... default: stmts }
+ *   A case does not fall through into the next; break leaves the switch.
+ */
+static struct ASTNode *parseSwitch(const char **p)
+{
+    if (!expectTokenType(p, TOKEN_LPAREN, "Expected '(' after switch"))
+        return NULL;
+    struct ASTNode *value = parseOr(p);
+    if (!value || !expectTokenType(p, TOKEN_RPAREN, "Expected ')' after switch value") ||
+        !expectTokenType(p, TOKEN_LBRACE, "Expected '{' after switch"))
+        return NULL;
+
+    struct ASTNode *node = newNode(NODE_SWITCH);
+    node->switchStmt.value = value;
+    CaseTable *t = &node->switchStmt.cases;
+    t->otherwise = -1;
+    int cap = 0;
+    while (1)
+    {
+        Token tk = getNextToken(p);
+        if (tk.type == TOKEN_RBRACE)
+            break;
+        if (tk.type == TOKEN_CASE)
+        {
+            while (1)
+            {
+                if (t->count == cap)
+                {
+                    cap = cap ? 2 * cap : 8;
+                    t->labels = realloc(t->labels, sizeof(int64_t) * cap);
+                    t->targets = realloc(t->targets, sizeof(int) * cap);
+                }
+                if (!parseCaseLabel(p, &t->labels[t->count]))
+                    return NULL;
+                t->targets[t->count++] = node->switchStmt.bodyCount;
+                if (peekTokenType(p) != TOKEN_COMMA)
+                    break;
+                getNextToken(p);
+            }
+        }
+        else if (tk.type == TOKEN_DEFAULT)
+        {
+            if (t->otherwise >= 0)
+            {
+                printf("Syntax Error: switch has two defaults\n");
+                return NULL;
+            }
+            t->otherwise = node->switchStmt.bodyCount;
+        }
+        else
+        {
+            printf("Syntax Error: Expected case or default in switch (got '%s')\n", tk.text);
+            return NULL;
+        }
+        if (!expectTokenType(p, TOKEN_COLON, "Expected ':' after case"))
+            return NULL;
+
+        switchDepth++;
+        struct ASTNode *body = parseCaseBody(p);
+        switchDepth--;
+        node->switchStmt.bodies = realloc(node->switchStmt.bodies,
+                                          sizeof(struct ASTNode *) * (node->switchStmt.bodyCount + 1));
+        node->switchStmt.bodies[node->switchStmt.bodyCount++] = body;
+    }
+
+    if (!indexCases(t))
+    {
+        for (int i = 1; i < t->count; ++i)
+            if (t->labels[i] == t->labels[i - 1])
+            {
+                printf("Syntax Error: duplicate case %lld\n", (long long)t->labels[i]);
+                break;
+            }
+        return NULL;
+    }
+    return node;
+}
+
 static struct ASTNode *parseStatement(const char **p)
 {
     const char *save = *p;
@@ -582,25 +914,27 @@ static struct ASTNode *parseStatement(const char **p)
         return parseBlock(p);
     }
 
-    if (tk.type == TOKEN_LET)
+    if (tk.type == TOKEN_LET || tk.type == TOKEN_CONST)
     {
         Token name = getNextToken(p);
         if (name.type != TOKEN_ID)
         {
-            printf("Parser Error: Expected identifier after let\n");
+            printf("Parser Error: Expected identifier after %s\n", tk.text);
             return NULL;
         }
 
         if (!expectTokenType(p, TOKEN_EQUAL, "Expected '=' after variable name"))
             return NULL;
 
-        struct ASTNode *val = parseComparison(p);
+        struct ASTNode *val = parseOr(p);
         if (!expectTokenType(p, TOKEN_SEMI, "Expected ';' after assignment"))
             return NULL;
 
         struct ASTNode *asn = newNode(NODE_ASSIGN);
         strncpy(asn->assign.varName, name.text, sizeof(asn->assign.varName) - 1);
         asn->assign.value = val;
+        asn->assign.isLet = 1;
+        asn->assign.isConst = tk.type == TOKEN_CONST;
         return asn;
     }
     else if (tk.type == TOKEN_PRINT)
@@ -612,7 +946,7 @@ static struct ASTNode *parseStatement(const char **p)
 
         while (1)
         {
-            struct ASTNode *expr = parseComparison(p);
+            struct ASTNode *expr = parseOr(p);
             if (!expr)
                 break;
             if (pn->print.count >= cap)
@@ -648,6 +982,10 @@ static struct ASTNode *parseStatement(const char **p)
     {
         return parseWhile(p);
     }
+    else if (tk.type == TOKEN_SWITCH)
+    {
+        return parseSwitch(p);
+    }
     else if (tk.type == TOKEN_SEMI || tk.type == TOKEN_EOF)
     {
         return NULL;
@@ -656,11 +994,30 @@ static struct ASTNode *parseStatement(const char **p)
     {
         return parseFunctionDef(p);
     }
+    else if (tk.type == TOKEN_ANNOTATION)
+    {
+        // @memo function f(...) { ... }: cache its results (see memoize.c)
+        if (strcmp(tk.text, "@memo") != 0)
+        {
+            printf("Syntax Error: Unknown annotation '%s'\n", tk.text);
+            return NULL;
+        }
+        if (!expectTokenType(p, TOKEN_FUNC, "Expected function after @memo"))
+            return NULL;
+        struct ASTNode *func = parseFunctionDef(p);
+        if (func)
+            func->funcDef.memoize = 1;
+        return func;
+    }
     else if (tk.type == TOKEN_RETURN)
     {
         // TOKEN_RETURN already consumed; parse rest
         return parseReturn(p);
     }
+    else if (tk.type == TOKEN_BREAK || tk.type == TOKEN_CONTINUE)
+    {
+        return parseJump(p, tk);
+    }
 
     // allow assignments and function-call statements starting with an identifier
     if (tk.type == TOKEN_ID)
@@ -697,6 +1054,7 @@ static struct ASTNode *parseStatement(const char **p)
 struct ASTNode *parseProgram(const char *src)
 {
     p_src = src;
+    loopDepth = switchDepth = 0;
     const char *p = src;
 
     struct ASTNode *root = newNode(NODE_BLOCK);
@@ -0,0 +1,522 @@
+#include "runtime.h"
+#include "object.h"
+#include "numio.h"
+#include "vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+
+uintptr_t cStackLimit = 0;
+
+void setStackLimit(size_t size)
+{
+    char here;
+    cStackLimit = (uintptr_t)&here - size + STACK_MARGIN;
+}
+
+// ------------------- ARITHMETIC -------------------
+
+const char *opSymbols[] = {"+", "-", "*", "/", "==", "!=", "<", "<=", ">", ">="};
+
+/* evalIntBinary: exact int64 arithmetic; returns 0 when the result has
+   to be computed in double instead (division, overflow) */
+static int evalIntBinary(BinOpType op, int64_t l, int64_t r, Value *out)
+{
+    int64_t res;
+    switch (op)
+    {
+    case OP_ADD:
+        if (__builtin_add_overflow(l, r, &res))
+            return 0;
+        *out = intValue(res);
+        return 1;
+    case OP_SUB:
+        if (__builtin_sub_overflow(l, r, &res))
+            return 0;
+        *out = intValue(res);
+        return 1;
+    case OP_MUL:
+        if (__builtin_mul_overflow(l, r, &res))
+            return 0;
+        *out = intValue(res);
+        return 1;
+    case OP_EQ:
+        *out = INT_VAL(l == r);
+        return 1;
+    case OP_NE:
+        *out = INT_VAL(l != r);
+        return 1;
+    case OP_LT:
+        *out = INT_VAL(l < r);
+        return 1;
+    case OP_LE:
+        *out = INT_VAL(l <= r);
+        return 1;
+    case OP_GT:
+        *out = INT_VAL(l > r);
+        return 1;
+    case OP_GE:
+        *out = INT_VAL(l >= r);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+Value binaryOp(BinOpType op, Value lv, Value rv)
+{
+    if (IS_SMALL_INT(lv) && IS_SMALL_INT(rv))
+    {
+        // 48-bit operands: only * can overflow int64
+        int64_t l = AS_SMALL_INT(lv), r = AS_SMALL_INT(rv);
+        switch (op)
+        {
+        case OP_ADD:
+            return intValue(l + r);
+        case OP_SUB:
+            return intValue(l - r);
+        case OP_MUL:
+        {
+            int64_t res;
+            if (!__builtin_mul_overflow(l, r, &res))
+                return intValue(res);
+            break;
+        }
+        case OP_LT:
+            return INT_VAL(l < r);
+        case OP_LE:
+            return INT_VAL(l <= r);
+        case OP_GT:
+            return INT_VAL(l > r);
+        case OP_GE:
+            return INT_VAL(l >= r);
+        case OP_EQ:
+            return INT_VAL(l == r);
+        case OP_NE:
+            return INT_VAL(l != r);
+        default:
+            break;
+        }
+    }
+
+    Value result;
+    if (IS_INT(lv) && IS_INT(rv) && evalIntBinary(op, AS_INT(lv), AS_INT(rv), &result))
+        return result;
+
+    if (IS_NUMERIC(lv) && IS_NUMERIC(rv))
+    {
+        double l = toNumber(lv);
+        double r = toNumber(rv);
+
+        switch (op)
+        {
+        case OP_ADD:
+            return NUM_VAL(l + r);
+        case OP_SUB:
+            return NUM_VAL(l - r);
+        case OP_MUL:
+            return NUM_VAL(l * r);
+        case OP_DIV:
+            return NUM_VAL(r == 0.0 ? (printf("Runtime Error: Division by zero\n"), 0.0) : l / r);
+        case OP_EQ:
+            return INT_VAL(l == r);
+        case OP_NE:
+            return INT_VAL(l != r);
+        case OP_LT:
+            return INT_VAL(l < r);
+        case OP_LE:
+            return INT_VAL(l <= r);
+        case OP_GT:
+            return INT_VAL(l > r);
+        case OP_GE:
+            return INT_VAL(l >= r);
+        default:
+            return NUM_VAL(0.0);
+        }
+    }
+
+    // at least one string operand
+    switch (op)
+    {
+    case OP_ADD:
+    {
+        SlString *ls = valueToString(lv);
+        SlString *rs = valueToString(rv);
+        if (ls && rs && (IS_STR(lv) || IS_STR(rv)))
+            return STR_VAL(slConcat(ls, rs));
+        break;
+    }
+    case OP_EQ:
+        return INT_VAL(valuesEqual(lv, rv));
+    case OP_NE:
+        return INT_VAL(!valuesEqual(lv, rv));
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+        if (IS_STR(lv) && IS_STR(rv))
+        {
+            int c = slCompare(AS_STR(lv), AS_STR(rv));
+            int res = op == OP_LT ? c < 0 : op == OP_LE ? c <= 0 : op == OP_GT ? c > 0 : c >= 0;
+            return INT_VAL(res);
+        }
+        break;
+    default:
+        break;
+    }
+    printf("Type Error: unsupported operand types for '%s': %s and %s\n",
+           opSymbols[op], valueTypeName(lv), valueTypeName(rv));
+    return NUM_VAL(0.0);
+}
+
+/* valueToIndex: integer indices are used as-is; doubles are truncated
+   and anything outside int range is reported as out of bounds */
+int valueToIndex(Value v)
+{
+    int64_t i;
+    if (IS_SMALL_INT(v))
+        i = AS_SMALL_INT(v);
+    else if (IS_NUMERIC(v))
+    {
+        double d = toNumber(v);
+        i = d > -2147483648.0 && d < 2147483648.0 ? (int64_t)d : -1;
+    }
+    else
+        i = 0;
+    return i >= INT_MIN && i <= INT_MAX ? (int)i : -1;
+}
+
+int searchCases(const CaseTable *t, int64_t key)
+{
+    int lo = 0, hi = t->count - 1;
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (t->labels[mid] == key)
+            return t->targets[mid];
+        if (t->labels[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return t->otherwise;
+}
+
+/* literalValue: the constant of a NODE_NUM for compiled code */
+Value literalValue(struct ASTNode *node)
+{
+    if (!node->num.isInt)
+        return NUM_VAL(node->num.value);
+    Value v = intValue(node->num.intValue);
+    if (IS_OBJ(v))
+        AS_OBJ(v)->pinned = 1; // boxed constants live as long as the code
+    return v;
+}
+
+// ------------------- ARRAYS -------------------
+
+const char *sourceName(const char *name)
+{
+    const char *u = strrchr(name, '_');
+    return u ? u + 1 : name;
+}
+
+/* a range() argument: an int, or a double holding one, of 48 bits */
+static int rangeArg(Value v, int64_t *out)
+{
+    if (IS_SMALL_INT(v))
+    {
+        *out = AS_SMALL_INT(v);
+        return 1;
+    }
+    if (!IS_NUM(v))
+        return 0;
+    double d = AS_NUM(v);
+    if (!(d >= (double)SMALL_INT_MIN && d <= (double)SMALL_INT_MAX) || d != (double)(int64_t)d)
+        return 0;
+    *out = (int64_t)d;
+    return 1;
+}
+
+int rangeBounds(const Value *args, Value *bounds, int quiet)
+{
+    int64_t start, end, step;
+    if (!rangeArg(args[0], &start) || !rangeArg(args[1], &end) || !rangeArg(args[2], &step))
+    {
+        if (!quiet)
+            printf("Runtime Error: range() arguments must be integers\n");
+        return -1;
+    }
+    if (step == 0)
+    {
+        if (!quiet)
+            printf("Runtime Error: range() step must not be 0\n");
+        return -1;
+    }
+    if (step > 0 ? start >= end : start <= end)
+        return 0;
+    // both ends fit in 48 bits, so no difference overflows
+    int64_t trips = step > 0 ? (end - start - 1) / step : (start - end - 1) / -step;
+    bounds[0] = INT_VAL(start);
+    bounds[1] = INT_VAL(start + trips * step);
+    bounds[2] = INT_VAL(step);
+    return 1;
+}
+
+int eachBounds(Value arr, Value *bounds, int quiet)
+{
+    if (!IS_ARRAY(arr))
+    {
+        if (!quiet)
+            printf("Type Error: for-in needs an array or range()\n");
+        return -1;
+    }
+    if (AS_ARRAY(arr)->len == 0)
+        return 0;
+    bounds[0] = INT_VAL(0);
+    bounds[1] = INT_VAL(AS_ARRAY(arr)->len - 1);
+    bounds[2] = INT_VAL(1);
+    return 1;
+}
+
+static ObjArray *checkArray(const char *name, Value arr)
+{
+    if (arr == UNDEF_VAL)
+    {
+        printf("Error: array '%s' not found\n", sourceName(name));
+        return NULL;
+    }
+    if (!IS_ARRAY(arr))
+    {
+        printf("Type Error: '%s' is not an array\n", sourceName(name));
+        return NULL;
+    }
+    return AS_ARRAY(arr);
+}
+
+int arrayGet(const char *name, Value arr, int idx, Value *out)
+{
+    ObjArray *a = checkArray(name, arr);
+    if (!a)
+        return 0;
+    if (idx < 0 || idx >= a->len)
+    {
+        printf("Index Error: '%s[%d]' out of bounds (len=%d)\n", sourceName(name), idx, a->len);
+        return 0;
+    }
+    *out = a->data[idx];
+    return 1;
+}
+
+int arraySet(const char *name, Value arr, int idx, Value value)
+{
+    ObjArray *a = checkArray(name, arr);
+    if (!a)
+        return 0;
+    if (idx < 0 || idx >= a->len)
+    {
+        printf("Index Error: '%s[%d]' out of bounds (len=%d)\n", sourceName(name), idx, a->len);
+        return 0;
+    }
+    a->data[idx] = value;
+    return 1;
+}
+
+// ------------------- STATS -------------------
+
+RuntimeStats stats;
+
+static void printRate(const char *what, uint64_t hits, uint64_t misses)
+{
+    uint64_t total = hits + misses;
+    fprintf(stderr, "%-14s %12" PRIu64 " hits %12" PRIu64 " misses", what, hits, misses);
+    if (total)
+        fprintf(stderr, "  (%.1f%% hit rate)", 100.0 * (double)hits / (double)total);
+    fputc('\n', stderr);
+}
+
+void printStats(void)
+{
+    fprintf(stderr, "--- runtime stats ---\n");
+    printRate("inline cache", stats.icHits, stats.icMisses);
+    fprintf(stderr, "%-14s %12" PRIu64 " evaluated\n", "expressions", stats.exprEvals);
+    fprintf(stderr, "%-14s %12" PRIu64 " compiled %8" PRIu64 " deopts\n", "jit",
+            stats.jitCompiled, stats.jitDeopts);
+    fprintf(stderr, "%-14s %12" PRIu64 " compiled %8" PRIu64 " exits\n", "trace",
+            stats.traceCompiled, stats.traceExits);
+    printRate("memo", stats.memoHits, stats.memoMisses);
+    fprintf(stderr, "%-14s %12" PRIu64 " elements\n", "vectorized", stats.vectorElements);
+}
+
+// ------------------- BUILTINS -------------------
+
+static const char *builtinNames[BI_COUNT] = {
+    "length", "readNumbers", "readColumn", "readLine", "openNumbers",
+    "openColumn", "readChunk", "closeNumbers", "eof", "@vector"};
+static const int arities[BI_COUNT] = {1, 1, 2, 0, 1, 2, 3, 1, 0, 2};
+
+int findBuiltin(const char *name)
+{
+    for (int b = 0; b < BI_COUNT; ++b)
+        if (strcmp(name, builtinNames[b]) == 0)
+            return b;
+    return -1;
+}
+
+int builtinArity(int b)
+{
+    return arities[b];
+}
+
+Value builtinArityError(int b, int argc)
+{
+    int expected = arities[b];
+    (void)argc;
+    printf("Runtime Error: %s() takes exactly %d argument%s\n",
+           builtinNames[b], expected, expected == 1 ? "" : "s");
+    // the readers still return an (empty) array
+    if (b == BI_READ_NUMBERS || b == BI_READ_COLUMN || b == BI_READ_LINE)
+        return OBJ_VAL(newArray(0));
+    return NUM_VAL(0.0);
+}
+
+static int intArg(Value v)
+{
+    return IS_NUMERIC(v) ? (int)toNumber(v) : 0;
+}
+
+static const char *pathArg(int b, Value v)
+{
+    if (!IS_STR(v))
+    {
+        printf("Runtime Error: %s() expects a string path\n", builtinNames[b]);
+        return NULL;
+    }
+    return slChars(AS_STR(v));
+}
+
+/* reads every remaining number (or line) of r into a new array;
+   numio parses straight into the array's storage */
+static Value readAll(NumReader *r, int stopAtNewline)
+{
+    int cap = 4096, len = 0;
+    Value *data = (Value *)malloc(sizeof(Value) * cap);
+    while (data)
+    {
+        int n = numRead(r, data + len, cap - len, stopAtNewline);
+        len += n;
+        if (len < cap)
+            break;
+        Value *grown = (Value *)realloc(data, sizeof(Value) * cap * 2);
+        if (!grown)
+        {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = grown;
+        cap *= 2;
+    }
+    if (!data)
+    {
+        printf("Runtime Error: out of memory\n");
+        return OBJ_VAL(newArray(0));
+    }
+    return OBJ_VAL(newArrayOwned(data, len));
+}
+
+Value callBuiltin(int b, Value *args)
+{
+    switch (b)
+    {
+    case BI_LENGTH:
+        if (IS_ARRAY(args[0]))
+            return INT_VAL(AS_ARRAY(args[0])->len);
+        if (IS_STR(args[0]))
+            return INT_VAL(AS_STR(args[0])->len);
+        printf("Runtime Error: length() argument must be an array or string\n");
+        return NUM_VAL(0.0);
+
+    case BI_READ_LINE:
+    {
+        NumReader *r = numStdin();
+        return r ? readAll(r, 1) : OBJ_VAL(newArray(0));
+    }
+
+    case BI_READ_NUMBERS:
+    case BI_READ_COLUMN:
+    {
+        int column = b == BI_READ_COLUMN ? intArg(args[1]) : -1;
+        const char *path = pathArg(b, args[0]);
+        if (!path)
+            return OBJ_VAL(newArray(0));
+        NumReader *r = numOpen(path, column);
+        if (!r)
+        {
+            printf("Runtime Error: cannot open '%s'\n", path);
+            return OBJ_VAL(newArray(0));
+        }
+        Value arr = readAll(r, 0);
+        numClose(r);
+        return arr;
+    }
+
+    case BI_OPEN_NUMBERS:
+    case BI_OPEN_COLUMN:
+    {
+        int column = b == BI_OPEN_COLUMN ? intArg(args[1]) : -1;
+        const char *path = pathArg(b, args[0]);
+        if (!path)
+            return NUM_VAL(0.0);
+        int h = numOpenHandle(path, column);
+        if (!h)
+            printf("Runtime Error: cannot open '%s'\n", path);
+        return INT_VAL(h);
+    }
+
+    case BI_CLOSE_NUMBERS:
+        numCloseHandle(intArg(args[0]));
+        return NUM_VAL(0.0);
+
+    case BI_EOF:
+    {
+        NumReader *r = numStdin();
+        return INT_VAL(r ? numEof(r) : 1);
+    }
+
+    case BI_VECTOR:
+        return runVectorLoop(args[0], args[1]);
+
+    default:
+        return NUM_VAL(0.0);
+    }
+}
+
+Value builtinReadChunk(Value handle, Value *buf, Value maxVal)
+{
+    NumReader *r = numHandle(intArg(handle));
+    int max = intArg(maxVal);
+    if (!r)
+    {
+        printf("Runtime Error: readChunk() on a closed reader\n");
+        return NUM_VAL(0.0);
+    }
+    if (!buf || max <= 0)
+    {
+        printf("Runtime Error: readChunk(reader, array, count) expects an array name and count > 0\n");
+        return NUM_VAL(0.0);
+    }
+    // keep the variable's storage when it already is an array, so
+    // streaming loops run in fixed memory
+    if (!IS_ARRAY(*buf))
+        *buf = OBJ_VAL(newArray(0));
+    ObjArray *arr = AS_ARRAY(*buf);
+    Value *data = arrayResize(arr, max);
+    if (!data)
+        return NUM_VAL(0.0);
+    int n = numRead(r, data, max, 0);
+    arrayResize(arr, n);
+    return INT_VAL(n);
+}
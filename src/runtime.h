@@ -0,0 +1,202 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "value.h"
+#include "ast.h"
+#include "object.h"
+#include <stdio.h>
+
+/* Operations shared by the execution engines (tree walker and VM), so
+   both compute the same results and print the same error messages. */
+
+Value binaryOp(BinOpType op, Value l, Value r);
+extern const char *opSymbols[]; // by BinOpType
+int valueToIndex(Value v); // array index; -1 when out of int range
+Value literalValue(struct ASTNode *node); // NODE_NUM constant of compiled code
+
+/* The tree walker and the closure engine recurse on the C stack for
+   every script call. main runs them on a thread with RUN_STACK bytes of
+   it; a call that finds less than STACK_MARGIN left is a stack overflow
+   (cStackLimit 0: no limit is known). */
+#define RUN_STACK ((size_t)256 << 20)
+#define STACK_MARGIN ((size_t)1 << 20)
+extern uintptr_t cStackLimit;
+void setStackLimit(size_t size); // for a stack of size bytes that starts about here
+
+static inline int cStackExhausted(void)
+{
+    char here;
+    return (uintptr_t)&here < cStackLimit;
+}
+
+/* element access; arr is UNDEF_VAL when the name is not bound */
+int arrayGet(const char *name, Value arr, int idx, Value *out);
+int arraySet(const char *name, Value arr, int idx, Value value);
+const char *sourceName(const char *name); // as written: inlining renames locals _<copy>_<name>
+
+/* for x in range(...) and for x in array: the first and last value of x
+   (of the index, for an array) and the step, as small ints, into
+   bounds[0..2]. 1: the loop runs, 0: it runs no iteration, -1: it
+   cannot run, reported unless quiet. args are start, end and step. */
+int rangeBounds(const Value *args, Value *bounds, int quiet);
+int eachBounds(Value arr, Value *bounds, int quiet);
+
+/* the engines' fast paths: 0/1 conditions, and in-range elements of an
+   array indexed by a small int; everything else takes the slow path */
+static inline int truthy(Value v)
+{
+    if (v == INT_VAL(0))
+        return 0;
+    if (v == INT_VAL(1))
+        return 1;
+    return isTruthy(v);
+}
+
+static inline Value indexArray(const char *name, Value arr, Value idx)
+{
+    if (IS_SMALL_INT(idx) && IS_ARRAY(arr))
+    {
+        ObjArray *a = AS_ARRAY(arr);
+        int64_t i = AS_SMALL_INT(idx);
+        if (i >= 0 && i < a->len)
+            return a->data[i];
+    }
+    Value out;
+    if (!arrayGet(name, arr, valueToIndex(idx), &out))
+        return NUM_VAL(0.0);
+    return out;
+}
+
+static inline void storeArray(const char *name, Value arr, Value idx, Value value)
+{
+    if (IS_SMALL_INT(idx) && IS_ARRAY(arr))
+    {
+        ObjArray *a = AS_ARRAY(arr);
+        int64_t i = AS_SMALL_INT(idx);
+        if (i >= 0 && i < a->len)
+        {
+            a->data[i] = value;
+            return;
+        }
+    }
+    int i = valueToIndex(idx);
+    if (!arraySet(name, arr, i, value))
+        printf("Runtime Error: invalid array assignment %s[%d]\n", sourceName(name), i);
+}
+
+/* a[i] op= v: where the element is, when the fast paths would find it;
+   NULL for anything the slow path has to report */
+static inline Value *elementSlot(Value arr, Value idx)
+{
+    if (IS_SMALL_INT(idx) && IS_ARRAY(arr))
+    {
+        ObjArray *a = AS_ARRAY(arr);
+        if ((uint64_t)AS_SMALL_INT(idx) < (uint64_t)a->len)
+            return &a->data[AS_SMALL_INT(idx)];
+    }
+    return NULL;
+}
+
+/* an access the optimizer marked knownArray: arr is an array, so only
+   the index is checked */
+static inline Value indexKnownArray(const char *name, Value arr, Value idx)
+{
+    ObjArray *a = AS_ARRAY(arr);
+    if (IS_SMALL_INT(idx) && (uint64_t)AS_SMALL_INT(idx) < (uint64_t)a->len)
+        return a->data[AS_SMALL_INT(idx)];
+    return indexArray(name, arr, idx);
+}
+
+static inline void storeKnownArray(const char *name, Value arr, Value idx, Value value)
+{
+    ObjArray *a = AS_ARRAY(arr);
+    if (IS_SMALL_INT(idx) && (uint64_t)AS_SMALL_INT(idx) < (uint64_t)a->len)
+        a->data[AS_SMALL_INT(idx)] = value;
+    else
+        storeArray(name, arr, idx, value);
+}
+
+/* an access the optimizer marked inBounds: arr is an array and idx a
+   small int within it */
+static inline Value elementAt(Value arr, Value idx)
+{
+    return AS_ARRAY(arr)->data[AS_SMALL_INT(idx)];
+}
+
+static inline void setElementAt(Value arr, Value idx, Value value)
+{
+    AS_ARRAY(arr)->data[AS_SMALL_INT(idx)] = value;
+}
+
+/* switch: the small int v equals (==), or CASE_NONE, which is no label */
+#define CASE_NONE INT64_MIN
+
+static inline int64_t caseKey(Value v)
+{
+    if (IS_SMALL_INT(v))
+        return AS_SMALL_INT(v);
+    if (IS_NUM(v))
+    {
+        double d = AS_NUM(v);
+        if (d >= SMALL_INT_MIN && d <= SMALL_INT_MAX && d == (double)(int64_t)d)
+            return (int64_t)d;
+    }
+    return CASE_NONE;
+}
+
+int searchCases(const CaseTable *t, int64_t key); // binary search
+
+/* the target of the case v selects: by the jump table when there is one */
+static inline int selectCase(const CaseTable *t, Value v)
+{
+    int64_t key = caseKey(v);
+    if (!t->table)
+        return searchCases(t, key);
+    uint64_t at = (uint64_t)key - (uint64_t)t->labels[0];
+    return at < (uint64_t)t->span ? t->table[at] : t->otherwise;
+}
+
+/* counters reported by --stats */
+typedef struct
+{
+    uint64_t icHits;   // tree walker: name lookups answered by a node's inline cache
+    uint64_t icMisses; // name lookups that had to resolve the name
+    uint64_t exprEvals; // expression nodes the tree walker evaluated
+    uint64_t jitCompiled; // VM: functions compiled to machine code
+    uint64_t jitDeopts;   // calls that left machine code for the interpreter
+    uint64_t traceCompiled; // loop traces and side traces compiled
+    uint64_t traceExits;    // times a trace handed its loop back to the interpreter
+    uint64_t memoHits;   // calls of memoized functions answered from their table
+    uint64_t memoMisses; // calls with numeric arguments that had to run
+    uint64_t vectorElements; // loop iterations @vector ran in one go
+} RuntimeStats;
+
+extern RuntimeStats stats;
+void printStats(void); // to stderr, so program output is unchanged
+
+typedef enum
+{
+    BI_LENGTH,
+    BI_READ_NUMBERS,
+    BI_READ_COLUMN,
+    BI_READ_LINE,
+    BI_OPEN_NUMBERS,
+    BI_OPEN_COLUMN,
+    BI_READ_CHUNK,
+    BI_CLOSE_NUMBERS,
+    BI_EOF,
+    BI_VECTOR, // "@vector", inserted by the optimizer; see vector.h
+    BI_COUNT
+} Builtin;
+
+int findBuiltin(const char *name);       // -1 for anything else
+int builtinArity(int b);
+Value builtinArityError(int b, int argc); // prints it, returns the fallback
+Value callBuiltin(int b, Value *args);   // every builtin but readChunk
+
+/* readChunk(reader, buf, max): buf points at the variable's value
+   (UNDEF_VAL when unbound) and may be replaced by a new array; it is
+   NULL when the argument is not a variable */
+Value builtinReadChunk(Value handle, Value *buf, Value max);
+
+#endif
@@ -0,0 +1,325 @@
+#include "scope.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------- NAME LISTS -------------------
+
+void *growArray(void *ptr, int *cap, size_t elemSize)
+{
+    *cap = *cap ? *cap * 2 : 16;
+    void *grown = realloc(ptr, elemSize * *cap);
+    if (!grown)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    return grown;
+}
+
+/* newest first, so a repeated parameter name means the last one */
+int findName(NameList *l, const char *name)
+{
+    for (int i = l->count - 1; i >= 0; --i)
+        if (strcmp(l->names[i], name) == 0)
+            return i;
+    return -1;
+}
+
+int appendName(NameList *l, const char *name)
+{
+    if (l->count >= l->cap)
+        l->names = (char **)growArray(l->names, &l->cap, sizeof(char *));
+    l->names[l->count] = strdup(name);
+    return l->count++;
+}
+
+int addName(NameList *l, const char *name)
+{
+    int i = findName(l, name);
+    return i >= 0 ? i : appendName(l, name);
+}
+
+void freeNames(NameList *l)
+{
+    for (int i = 0; i < l->count; ++i)
+        free(l->names[i]);
+    free(l->names);
+    l->names = NULL;
+    l->count = l->cap = 0;
+}
+
+// ------------------- BINDINGS -------------------
+
+const char *chunkBuffer(struct ASTNode *call)
+{
+    if (call->funcCall.argCount == 3 && findBuiltin(call->funcCall.funcName) == BI_READ_CHUNK &&
+        call->funcCall.args[1]->type == NODE_VAR)
+        return call->funcCall.args[1]->varName;
+    return NULL;
+}
+
+struct ASTNode *tailCall(struct ASTNode *ret)
+{
+    struct ASTNode *v = ret->returnStmt.value;
+    if (v && v->type == NODE_FUNC_CALL && findBuiltin(v->funcCall.funcName) < 0)
+        return v;
+    return NULL;
+}
+
+/* scanBindings: assignments, function definitions and readChunk
+   buffers; nested function bodies have frames of their own and are
+   skipped */
+void scanBindings(struct ASTNode *n, NameList *out)
+{
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < n->block.count; ++i)
+            scanBindings(n->block.items[i], out);
+        break;
+    case NODE_IF:
+        scanBindings(n->ifstmt.cond, out);
+        scanBindings(n->ifstmt.thenBlock, out);
+        scanBindings(n->ifstmt.elseBlock, out);
+        break;
+    case NODE_FOR:
+        scanBindings(n->forstmt.init, out);
+        scanBindings(n->forstmt.cond, out);
+        scanBindings(n->forstmt.incr, out);
+        scanBindings(n->forstmt.body, out);
+        break;
+    case NODE_WHILE:
+        scanBindings(n->WhileStmt.cond, out);
+        scanBindings(n->WhileStmt.body, out);
+        break;
+    case NODE_SWITCH:
+        scanBindings(n->switchStmt.value, out);
+        for (int i = 0; i < n->switchStmt.bodyCount; ++i)
+            scanBindings(n->switchStmt.bodies[i], out);
+        break;
+    case NODE_FOR_IN:
+        scanBindings(n->forIn.start, out);
+        scanBindings(n->forIn.end, out);
+        scanBindings(n->forIn.step, out);
+        scanBindings(n->forIn.array, out);
+        addName(out, n->forIn.varName);
+        scanBindings(n->forIn.body, out);
+        break;
+    case NODE_ASSIGN:
+        addName(out, n->assign.varName);
+        scanBindings(n->assign.value, out);
+        break;
+    case NODE_FUNC_DEF:
+        addName(out, n->funcDef.funcName);
+        break;
+    case NODE_ARR_ASSIGN:
+        scanBindings(n->arrAssign.index, out);
+        scanBindings(n->arrAssign.value, out);
+        break;
+    case NODE_PRINT:
+        for (int i = 0; i < n->print.count; ++i)
+            scanBindings(n->print.exprs[i], out);
+        break;
+    case NODE_RETURN:
+        scanBindings(n->returnStmt.value, out);
+        break;
+    case NODE_BINOP:
+        scanBindings(n->binop.left, out);
+        scanBindings(n->binop.right, out);
+        break;
+    case NODE_LOGICAL:
+        scanBindings(n->logical.left, out);
+        scanBindings(n->logical.right, out);
+        break;
+    case NODE_ARRAY:
+        for (int i = 0; i < n->ArrayNode.count; ++i)
+            scanBindings(n->ArrayNode.elements[i], out);
+        break;
+    case NODE_ARR_ACCESS:
+        scanBindings(n->ArrAccessNode.index, out);
+        break;
+    case NODE_FUNC_CALL:
+    {
+        const char *buf = chunkBuffer(n);
+        if (buf)
+            addName(out, buf);
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            scanBindings(n->funcCall.args[i], out);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// ------------------- DEFINITE BINDING -------------------
+
+/* useName: a local used where it may not be bound yet falls back to the
+   global of the same name at run time */
+static void useName(Scope *s, const char *name, unsigned char *bound)
+{
+    int l = findName(&s->locals, name);
+    if (l >= 0 && !bound[l])
+        s->dyn[l] = 1;
+}
+
+static void scanUses(Scope *s, struct ASTNode *n, unsigned char *bound);
+
+/* code that may not run: its bindings are not definite afterwards */
+static void scanUsesMaybe(Scope *s, struct ASTNode *n, unsigned char *bound)
+{
+    int count = s->locals.count;
+    unsigned char *copy = (unsigned char *)malloc(count ? count : 1);
+    memcpy(copy, bound, count);
+    scanUses(s, n, copy);
+    free(copy);
+}
+
+/* scanUses: walks a function body in evaluation order, tracking which
+   locals are definitely bound (parameters, `let`, nested functions) */
+static void scanUses(Scope *s, struct ASTNode *n, unsigned char *bound)
+{
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < n->block.count; ++i)
+            scanUses(s, n->block.items[i], bound);
+        break;
+    case NODE_IF:
+        scanUses(s, n->ifstmt.cond, bound);
+        scanUsesMaybe(s, n->ifstmt.thenBlock, bound);
+        scanUsesMaybe(s, n->ifstmt.elseBlock, bound);
+        break;
+    case NODE_FOR:
+        scanUses(s, n->forstmt.init, bound);
+        scanUses(s, n->forstmt.cond, bound);
+        scanUsesMaybe(s, n->forstmt.body, bound);
+        scanUsesMaybe(s, n->forstmt.incr, bound);
+        break;
+    case NODE_WHILE:
+        scanUses(s, n->WhileStmt.cond, bound);
+        scanUsesMaybe(s, n->WhileStmt.body, bound);
+        break;
+    case NODE_SWITCH:
+        scanUses(s, n->switchStmt.value, bound);
+        for (int i = 0; i < n->switchStmt.bodyCount; ++i)
+            scanUsesMaybe(s, n->switchStmt.bodies[i], bound);
+        break;
+    case NODE_FOR_IN:
+    {
+        scanUses(s, n->forIn.start, bound);
+        scanUses(s, n->forIn.end, bound);
+        scanUses(s, n->forIn.step, bound);
+        scanUses(s, n->forIn.array, bound);
+        // the loop variable is bound in the body, not after the loop
+        int count = s->locals.count;
+        unsigned char *copy = (unsigned char *)malloc(count ? count : 1);
+        memcpy(copy, bound, count);
+        copy[findName(&s->locals, n->forIn.varName)] = 1;
+        scanUses(s, n->forIn.body, copy);
+        free(copy);
+        break;
+    }
+    case NODE_ASSIGN:
+        scanUses(s, n->assign.value, bound);
+        if (n->assign.isLet)
+            bound[findName(&s->locals, n->assign.varName)] = 1;
+        else
+            useName(s, n->assign.varName, bound);
+        break;
+    case NODE_FUNC_DEF:
+        bound[findName(&s->locals, n->funcDef.funcName)] = 1;
+        break;
+    case NODE_ARR_ASSIGN:
+        scanUses(s, n->arrAssign.index, bound);
+        scanUses(s, n->arrAssign.value, bound);
+        useName(s, n->arrAssign.varName, bound);
+        break;
+    case NODE_PRINT:
+        for (int i = 0; i < n->print.count; ++i)
+            scanUses(s, n->print.exprs[i], bound);
+        break;
+    case NODE_RETURN:
+        scanUses(s, n->returnStmt.value, bound);
+        break;
+    case NODE_VAR:
+        useName(s, n->varName, bound);
+        break;
+    case NODE_BINOP:
+        scanUses(s, n->binop.left, bound);
+        scanUses(s, n->binop.right, bound);
+        break;
+    case NODE_LOGICAL:
+        scanUses(s, n->logical.left, bound);
+        scanUses(s, n->logical.right, bound);
+        break;
+    case NODE_ARRAY:
+        for (int i = 0; i < n->ArrayNode.count; ++i)
+            scanUses(s, n->ArrayNode.elements[i], bound);
+        break;
+    case NODE_ARR_ACCESS:
+        scanUses(s, n->ArrAccessNode.index, bound);
+        useName(s, n->ArrAccessNode.varName, bound);
+        break;
+    case NODE_FUNC_CALL:
+        if (findBuiltin(n->funcCall.funcName) < 0)
+            useName(s, n->funcCall.funcName, bound);
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            scanUses(s, n->funcCall.args[i], bound);
+        break;
+    default:
+        break;
+    }
+}
+
+// ------------------- SCOPES -------------------
+
+void beginFunctionScope(Scope *s, struct ASTNode *def, NameList *globalBound)
+{
+    memset(s, 0, sizeof(*s));
+    for (int i = 0; i < def->funcDef.paramCount; ++i)
+        appendName(&s->locals, def->funcDef.params[i]);
+    scanBindings(def->funcDef.body, &s->locals);
+    int count = s->locals.count;
+    s->dyn = (unsigned char *)calloc(count ? count : 1, 1);
+
+    // locals that shadow a global only after their `let` has run need
+    // the run-time check; parameters are always bound
+    int params = def->funcDef.paramCount;
+    unsigned char *bound = (unsigned char *)calloc(count ? count : 1, 1);
+    if (!s->dyn || !bound)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    memset(bound, 1, params);
+    scanUses(s, def->funcDef.body, bound);
+    free(bound);
+    for (int i = 0; i < count; ++i)
+        s->dyn[i] = i >= params && s->dyn[i] && findName(globalBound, s->locals.names[i]) >= 0;
+}
+
+void endScope(Scope *s)
+{
+    free(s->dyn);
+    s->dyn = NULL;
+}
+
+VarRef resolveName(Scope *s, NameList *globals, const char *name)
+{
+    VarRef r = {-1, -1};
+    if (!s->isScript)
+    {
+        r.local = findName(&s->locals, name);
+        if (r.local >= 0 && !s->dyn[r.local])
+            return r;
+    }
+    r.global = addName(globals, name);
+    return r;
+}
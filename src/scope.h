@@ -0,0 +1,56 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stddef.h>
+#include "ast.h"
+
+/* Compile-time name resolution shared by the compiling engines.
+   A function's locals are its parameters plus every name its body can
+   bind; anything else is a global. A local that may be read before its
+   `let` has run, while a global of the same name exists, is "dynamic":
+   it resolves to the local once bound and to the global before that,
+   like the tree walker's frame-then-globals lookup. */
+
+typedef struct
+{
+    char **names;
+    int count, cap;
+} NameList;
+
+void *growArray(void *ptr, int *cap, size_t elemSize); // exits when out of memory
+int findName(NameList *l, const char *name);          // newest first, -1 if absent
+int appendName(NameList *l, const char *name);
+int addName(NameList *l, const char *name);
+void freeNames(NameList *l);
+
+/* the buffer variable of readChunk(reader, buf, max), or NULL */
+const char *chunkBuffer(struct ASTNode *call);
+
+/* the call in `return f(...)` when f is not a builtin, or NULL: a tail
+   call, which runs in the frame of the function that returns it */
+struct ASTNode *tailCall(struct ASTNode *ret);
+
+/* names a block of code can bind in its own frame */
+void scanBindings(struct ASTNode *n, NameList *out);
+
+typedef struct
+{
+    int isScript;
+    NameList locals;    // functions only; parameters first
+    unsigned char *dyn; // per local: may also resolve to a global
+} Scope;
+
+typedef struct
+{
+    int local;  // -1: not a local of this function
+    int global; // -1: never resolves to a global
+} VarRef;
+
+/* globalBound: the names the script itself can bind */
+void beginFunctionScope(Scope *s, struct ASTNode *def, NameList *globalBound);
+void endScope(Scope *s); // the caller keeps s->locals
+
+/* resolves name, adding a global slot to globals when needed */
+VarRef resolveName(Scope *s, NameList *globals, const char *name);
+
+#endif
@@ -0,0 +1,267 @@
+#include "slstring.h"
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+static SlString **buckets = NULL;
+static int bucketCount = 0;
+static int internCount = 0;
+
+/* scratch stack for flattening ropes */
+static SlString **work = NULL;
+static int workCap = 0;
+
+/* -------------------- INTERNAL HELPERS -------------------- */
+
+static uint32_t hashBytes(const char *s, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t slHash(SlString *s)
+{
+    if (!(s->flags & SL_HASHED))
+    {
+        const char *c = slChars(s);
+        s->hash = hashBytes(c, s->len);
+        s->flags |= SL_HASHED;
+    }
+    return s->hash;
+}
+
+static int pushWork(int top, SlString *s)
+{
+    if (top >= workCap)
+    {
+        int cap = workCap ? workCap * 2 : 64;
+        SlString **grown = (SlString **)realloc(work, sizeof(SlString *) * cap);
+        if (!grown)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        work = grown;
+        workCap = cap;
+    }
+    work[top] = s;
+    return top + 1;
+}
+
+static SlString *allocString(int len, int inlineBytes)
+{
+    SlString *s = (SlString *)allocObject(sizeof(SlString) + inlineBytes, OBJ_STRING);
+    s->len = len;
+    return s;
+}
+
+static void growBuckets(void)
+{
+    int count = bucketCount ? bucketCount * 2 : 256;
+    SlString **fresh = (SlString **)calloc(count, sizeof(SlString *));
+    if (!fresh)
+        return;
+    for (int i = 0; i < bucketCount; ++i)
+    {
+        SlString *s = buckets[i];
+        while (s)
+        {
+            SlString *nx = s->internNext;
+            uint32_t b = s->hash & (uint32_t)(count - 1);
+            s->internNext = fresh[b];
+            fresh[b] = s;
+            s = nx;
+        }
+    }
+    free(buckets);
+    buckets = fresh;
+    bucketCount = count;
+}
+
+static SlString *findInterned(const char *chars, int len, uint32_t hash)
+{
+    if (!bucketCount)
+        return NULL;
+    for (SlString *s = buckets[hash & (uint32_t)(bucketCount - 1)]; s; s = s->internNext)
+        if (s->hash == hash && s->len == len && memcmp(s->chars, chars, len) == 0)
+            return s;
+    return NULL;
+}
+
+static void unintern(SlString *s)
+{
+    SlString **link = &buckets[s->hash & (uint32_t)(bucketCount - 1)];
+    while (*link && *link != s)
+        link = &(*link)->internNext;
+    if (*link)
+        *link = s->internNext;
+    internCount--;
+}
+
+static SlString *newFlat(const char *chars, int len)
+{
+    SlString *s = allocString(len, len + 1);
+    s->chars = s->data;
+    memcpy(s->data, chars, len);
+    s->data[len] = '\0';
+    return s;
+}
+
+/* -------------------- CONSTRUCTION -------------------- */
+
+SlString *slNew(const char *chars, int len)
+{
+    if (len > SL_INTERN_MAX)
+        return newFlat(chars, len);
+
+    uint32_t hash = hashBytes(chars, len);
+    SlString *s = findInterned(chars, len, hash);
+    if (s)
+        return s;
+
+    s = newFlat(chars, len);
+    s->hash = hash;
+    s->flags |= SL_HASHED | SL_INTERNED;
+    if (internCount + 1 > bucketCount * 3 / 4)
+        growBuckets();
+    uint32_t b = hash & (uint32_t)(bucketCount - 1);
+    s->internNext = buckets[b];
+    buckets[b] = s;
+    internCount++;
+    return s;
+}
+
+SlString *slLiteral(const char *chars)
+{
+    int len = (int)strlen(chars);
+    SlString *s = slNew(chars, len);
+    s->obj.pinned = 1;
+    return s;
+}
+
+SlString *slFromNumber(double n)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%g", n);
+    return slNew(buf, len);
+}
+
+SlString *slFromInt(int64_t n)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%" PRId64, n);
+    return slNew(buf, len);
+}
+
+/* slConcat:
+   Short results are built and interned directly. Longer ones become a
+   rope node, so building a string by repeated `s = s + x` stays linear. */
+SlString *slConcat(SlString *a, SlString *b)
+{
+    if (a->len == 0)
+        return b;
+    if (b->len == 0)
+        return a;
+
+    int len = a->len + b->len;
+    if (len <= SL_INTERN_MAX)
+    {
+        char buf[SL_INTERN_MAX];
+        memcpy(buf, slChars(a), a->len);
+        memcpy(buf + a->len, slChars(b), b->len);
+        return slNew(buf, len);
+    }
+
+    SlString *r = allocString(len, 0);
+    r->left = a;
+    r->right = b;
+    gcAccount(len); // flattening will need this much
+    return r;
+}
+
+/* -------------------- ACCESS -------------------- */
+
+const char *slChars(SlString *s)
+{
+    if (s->chars)
+        return s->chars;
+
+    char *out = (char *)malloc(s->len + 1);
+    if (!out)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+
+    // write leaves left to right with an explicit stack
+    int pos = 0;
+    int top = pushWork(0, s);
+    while (top > 0)
+    {
+        SlString *n = work[--top];
+        if (n->chars)
+        {
+            memcpy(out + pos, n->chars, n->len);
+            pos += n->len;
+        }
+        else
+        {
+            top = pushWork(top, n->right);
+            top = pushWork(top, n->left);
+        }
+    }
+    out[s->len] = '\0';
+    s->chars = out;
+    s->left = s->right = NULL;
+    return out;
+}
+
+int slEquals(SlString *a, SlString *b)
+{
+    if (a == b)
+        return 1;
+    if ((a->flags & b->flags & SL_INTERNED) || a->len != b->len)
+        return 0;
+    if (slHash(a) != slHash(b))
+        return 0;
+    return memcmp(slChars(a), slChars(b), a->len) == 0;
+}
+
+int slCompare(SlString *a, SlString *b)
+{
+    if (a == b)
+        return 0;
+    int n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(slChars(a), slChars(b), n);
+    if (c)
+        return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/* -------------------- COLLECTION -------------------- */
+
+void slFree(SlString *s)
+{
+    if (s->flags & SL_INTERNED)
+        unintern(s);
+    if (s->chars && s->chars != s->data)
+        free(s->chars);
+    free(s);
+}
+
+void slFreeTables(void)
+{
+    free(buckets);
+    buckets = NULL;
+    bucketCount = internCount = 0;
+    free(work);
+    work = NULL;
+    workCap = 0;
+}
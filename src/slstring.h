@@ -0,0 +1,43 @@
+#ifndef SLSTRING_H
+#define SLSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "value.h"
+
+/* strings up to this length are flattened and interned on creation */
+#define SL_INTERN_MAX 40
+
+#define SL_INTERNED 0x01
+#define SL_HASHED 0x02
+
+/* Immutable, length-prefixed string.
+   A concatenation of long strings is first kept as a rope (left/right)
+   and flattened into `chars` the first time its bytes are needed. */
+typedef struct SlString
+{
+    Obj obj;
+    struct SlString *internNext; // intern bucket chain
+    int len;
+    uint32_t hash;
+    unsigned char flags;
+    struct SlString *left, *right; // rope halves, NULL once flattened
+    char *chars;                   // NULL while the string is a rope
+    char data[];                   // inline storage of flat strings
+} SlString;
+
+SlString *slNew(const char *chars, int len); // interned when short
+SlString *slLiteral(const char *chars);      // interned and pinned
+SlString *slFromNumber(double n);
+SlString *slFromInt(int64_t n);
+SlString *slConcat(SlString *a, SlString *b);
+
+const char *slChars(SlString *s); // flattens ropes
+int slEquals(SlString *a, SlString *b);
+int slCompare(SlString *a, SlString *b);
+
+/* called by the collector for unreachable strings */
+void slFree(SlString *s);
+void slFreeTables(void);
+
+#endif
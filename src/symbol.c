@@ -1,5 +1,7 @@
 #include "symbol.h"
+#include "object.h"
 #include "ast.h"
+#include "runtime.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,41 +9,50 @@
 SymEntry table[MAX_SYMBOLS];
 int table_count = 0;
 
-SymEntry *lookupSym(const char *name);
+int frameBase = 0;
+uint64_t symEpoch = 1;
+/* number of global entries while a function frame is active */
+static int globalCount = 0;
 
 /* -------------------- INTERNAL HELPERS -------------------- */
 
-static int findIndex(const char *name)
+/* lookupSym: current frame from the newest entry down, then globals */
+int lookupSym(const char *name)
 {
-    for (int i = 0; i < table_count; ++i)
+    for (int i = table_count - 1; i >= frameBase; --i)
         if (strcmp(table[i].name, name) == 0)
             return i;
+    if (frameBase > 0)
+    {
+        for (int i = globalCount - 1; i >= 0; --i)
+            if (strcmp(table[i].name, name) == 0)
+                return i;
+    }
     return -1;
 }
 
-static void freeEntryInternal(SymEntry *e)
+/* findInFrame: bindings of the current frame only (globals at top level) */
+static int findInFrame(const char *name)
 {
-    if (!e)
-        return;
-    if (e->type == SYM_ARRAY && e->v.arr.data)
-    {
-        free(e->v.arr.data);
-        e->v.arr.data = NULL;
-        e->v.arr.len = 0;
-    }
+    for (int i = table_count - 1; i >= frameBase; --i)
+        if (strcmp(table[i].name, name) == 0)
+            return i;
+    return -1;
 }
 
-/* resolveArray: follows array references */
-static SymEntry *resolveArray(const char *name)
+static SymEntry *appendEntry(const char *name, Value value)
 {
-    SymEntry *sym = lookupSym(name);
-    if (!sym)
+    if (table_count >= MAX_SYMBOLS)
+    {
+        printf("Error: symbol table full\n");
         return NULL;
-
-    if (sym->type == SYM_ARRAY_REF)
-        return lookupSym(sym->v.arrRefName);
-
-    return sym;
+    }
+    SymEntry *e = &table[table_count++];
+    symEpoch++;
+    strncpy(e->name, name, sizeof(e->name) - 1);
+    e->name[sizeof(e->name) - 1] = '\0';
+    e->value = value;
+    return e;
 }
 
 /* -------------------- SYMBOL TABLE OPERATIONS -------------------- */
@@ -54,224 +65,133 @@ void popSymbolsTo(int new_count)
         return;
 
     for (int i = new_count; i < table_count; ++i)
-    {
-        freeEntryInternal(&table[i]);
         table[i].name[0] = '\0';
-        table[i].type = 0;
-    }
     table_count = new_count;
+    symEpoch++;
 }
 
-void setVar(const char *name, double value)
+SymFrame pushFrame(void)
+{
+    SymFrame saved = {frameBase, globalCount};
+    if (frameBase == 0)
+        globalCount = table_count;
+    frameBase = table_count;
+    symEpoch++;
+    return saved;
+}
+
+void popFrame(SymFrame saved)
 {
-    int idx = findIndex(name);
+    popSymbolsTo(frameBase);
+    frameBase = saved.base;
+    globalCount = saved.globals;
+    symEpoch++;
+}
+
+int setValue(const char *name, Value value)
+{
+    int idx = lookupSym(name);
     if (idx >= 0)
     {
-        freeEntryInternal(&table[idx]);
-        table[idx].type = SYM_NUM;
-        table[idx].v.num = value;
-        return;
-    }
-    if (table_count >= MAX_SYMBOLS)
-    {
-        printf("Error: symbol table full\n");
-        return;
+        table[idx].value = value;
+        return idx;
     }
-    SymEntry *e = &table[table_count++];
-    e->type = SYM_NUM;
-    strncpy(e->name, name, sizeof(e->name) - 1);
-    e->name[sizeof(e->name) - 1] = '\0';
-    e->v.num = value;
+    return appendEntry(name, value) ? table_count - 1 : -1;
 }
 
-/* Always append new numeric symbol (local) */
-void setVarLocal(const char *name, double value)
+int declareValue(const char *name, Value value)
 {
-    if (table_count >= MAX_SYMBOLS)
+    int idx = findInFrame(name);
+    if (idx >= 0)
     {
-        printf("Error: symbol table full\n");
-        return;
+        table[idx].value = value;
+        return idx;
     }
-    SymEntry *e = &table[table_count++];
-    e->type = SYM_NUM;
-    strncpy(e->name, name, sizeof(e->name) - 1);
-    e->name[sizeof(e->name) - 1] = '\0';
-    e->v.num = value;
+    return appendEntry(name, value) ? table_count - 1 : -1;
 }
 
-/* Append a local array reference */
-void setVarLocalArrayRef(const char *localName, const char *existingArrayName)
+/* Always append new symbol (local) */
+void setValueLocal(const char *name, Value value)
 {
-    if (table_count >= MAX_SYMBOLS)
-    {
-        printf("Error: symbol table full\n");
-        return;
-    }
-    SymEntry *e = &table[table_count++];
-    e->type = SYM_ARRAY_REF;
-    strncpy(e->name, localName, sizeof(e->name) - 1);
-    e->name[sizeof(e->name) - 1] = '\0';
-    e->v.arrRefName = existingArrayName;
+    appendEntry(name, value);
 }
 
-double getVar(const char *name)
+Value getValue(const char *name)
 {
-    int idx = findIndex(name);
+    int idx = lookupSym(name);
     if (idx < 0)
     {
         printf("Error: variable '%s' not found\n", name);
-        return 0.0;
+        return NUM_VAL(0.0);
     }
-    if (table[idx].type != SYM_NUM)
-    {
-        printf("Type Error: '%s' is not a number\n", name);
-        return 0.0;
-    }
-    return table[idx].v.num;
+    return table[idx].value;
 }
 
-SymEntry *lookupSym(const char *name)
+Value findValue(const char *name)
 {
-    int idx = findIndex(name);
-    if (idx < 0)
-        return NULL;
-    return &table[idx];
+    int idx = lookupSym(name);
+    return idx < 0 ? UNDEF_VAL : table[idx].value;
 }
 
-int isArray(const char *name)
+int hasValue(const char *name)
 {
-    SymEntry *sym = lookupSym(name);
-    return sym && (sym->type == SYM_ARRAY || sym->type == SYM_ARRAY_REF);
+    return lookupSym(name) >= 0;
 }
 
-int getArrayLen(const char *name)
+void setVar(const char *name, double value)
 {
-    SymEntry *sym = resolveArray(name);
-    if (!sym || sym->type != SYM_ARRAY)
-        return 0;
-    return sym->v.arr.len;
+    setValue(name, NUM_VAL(value));
 }
 
-void setArray(const char *name, const double *data, int len)
+double getVar(const char *name)
 {
-    int idx = findIndex(name);
-    if (idx < 0)
-    {
-        if (table_count >= MAX_SYMBOLS)
-        {
-            printf("Error: symbol table full\n");
-            return;
-        }
-        idx = table_count++;
-        SymEntry *e = &table[idx];
-        strncpy(e->name, name, sizeof(e->name) - 1);
-        e->name[sizeof(e->name) - 1] = '\0';
-        e->type = SYM_ARRAY;
-        e->v.arr.data = NULL;
-        e->v.arr.len = 0;
-    }
-    else
-    {
-        freeEntryInternal(&table[idx]);
-        table[idx].type = SYM_ARRAY;
-    }
-
-    if (len <= 0)
+    Value v = getValue(name);
+    if (!IS_NUMERIC(v))
     {
-        table[idx].v.arr.data = NULL;
-        table[idx].v.arr.len = 0;
-        return;
-    }
-
-    table[idx].v.arr.data = (double *)malloc(sizeof(double) * len);
-    if (!table[idx].v.arr.data)
-    {
-        printf("Error: out of memory\n");
-        table[idx].v.arr.len = 0;
-        return;
+        printf("Type Error: '%s' is not a number\n", name);
+        return 0.0;
     }
-    memcpy(table[idx].v.arr.data, data, sizeof(double) * len);
-    table[idx].v.arr.len = len;
+    return toNumber(v);
 }
 
-int getArrayElem(const char *name, int idx, double *out)
+int getArrayElem(const char *name, int idx, Value *out)
 {
-    SymEntry *sym = resolveArray(name);
-    if (!sym)
-    {
-        printf("Error: array '%s' not found\n", name);
-        return 0;
-    }
-    if (sym->type != SYM_ARRAY)
-    {
-        printf("Type Error: '%s' is not an array\n", name);
-        return 0;
-    }
-    if (idx < 0 || idx >= sym->v.arr.len)
-    {
-        printf("Index Error: '%s[%d]' out of bounds (len=%d)\n",
-               name, idx, sym->v.arr.len);
-        return 0;
-    }
-    *out = sym->v.arr.data[idx];
-    return 1;
+    return arrayGet(name, findValue(name), idx, out);
 }
 
-int setArrayAt(const char *name, int index, double value)
+int setArrayAt(const char *name, int index, Value value)
 {
-    SymEntry *sym = resolveArray(name);
-    if (!sym)
-    {
-        printf("Error: array '%s' not found\n", name);
-        return 0;
-    }
-    if (sym->type != SYM_ARRAY)
-    {
-        printf("Type Error: '%s' is not an array\n", name);
-        return 0;
-    }
-    if (index < 0 || index >= sym->v.arr.len)
-    {
-        printf("Index Error: '%s[%d]' out of bounds (len=%d)\n",
-               name, index, sym->v.arr.len);
-        return 0;
-    }
-    sym->v.arr.data[index] = value;
-    return 1;
+    return arraySet(name, findValue(name), index, value);
 }
 
 void setFunc(const char *name, struct ASTNode *def)
 {
-    int idx = findIndex(name);
-    if (idx >= 0)
-    {
-        table[idx].type = SYM_FUNC;
-        table[idx].v.func.def = def;
-        return;
-    }
-    if (table_count >= MAX_SYMBOLS)
-    {
-        printf("Error: symbol table full\n");
-        return;
-    }
-    SymEntry *e = &table[table_count++];
-    strncpy(e->name, name, sizeof(e->name) - 1);
-    e->name[sizeof(e->name) - 1] = '\0';
-    e->type = SYM_FUNC;
-    e->v.func.def = def;
+    declareValue(name, OBJ_VAL(newFunction(def)));
 }
 
 struct ASTNode *getFunc(const char *name)
 {
-    int idx = findIndex(name);
-    if (idx < 0 || table[idx].type != SYM_FUNC)
+    int idx = lookupSym(name);
+    if (idx < 0 || !IS_FUNC(table[idx].value))
         return NULL;
-    return table[idx].v.func.def;
+    return AS_FUNC(table[idx].value)->def;
 }
 
 void clearSymbols(void)
 {
-    for (int i = 0; i < table_count; ++i)
-        freeEntryInternal(&table[i]);
     table_count = 0;
+    frameBase = 0;
+    globalCount = 0;
+    symEpoch++;
+    freeAllObjects();
+}
+
+/* collectGarbage:
+   The symbol table is the only root, so this must run where no object
+   is held in a C local (top-level statement boundaries). */
+void collectGarbage(void)
+{
+    for (int i = 0; i < table_count; ++i)
+        markValue(table[i].value);
+    sweepObjects();
 }
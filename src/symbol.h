@@ -2,71 +2,80 @@
 #define SYMBOL_H
 
 #include <stddef.h>
+#include <string.h>
+#include "value.h"
 
-#define MAX_SYMBOLS 1024
+/* room for the tree walker's deepest call chain (4095 frames, as on the
+   VM) at 16 parameters and locals a frame */
+#define MAX_SYMBOLS (1 << 16)
 
 /* forward declare ASTNode so symbol.h doesn't require ast.h include */
 struct ASTNode;
 
-typedef enum
-{
-    SYM_NUM,
-    SYM_ARRAY,
-    SYM_FUNC,
-    SYM_ARRAY_REF
-} SymType;
-
+/* a named binding; the value carries its own type */
 typedef struct
 {
-    double *data;
-    int len;
-} SymArray;
-
-typedef struct
-{
-    SymType type;
     char name[64];
-    union
-    {
-        double num;
-        struct
-        {
-            double *data;
-            int len;
-        } arr;
-        struct
-        {
-            struct ASTNode *def;
-        } func;
-        const char *arrRefName; // for SYM_ARRAY_REF
-    } v;
+    Value value;
 } SymEntry;
 
 extern SymEntry table[MAX_SYMBOLS];
 extern int table_count;
+extern int frameBase; // first entry of the innermost function frame; 0 at top level
+/* bumped whenever a name may start to resolve to a different entry:
+   a binding is added, or a frame is pushed or popped */
+extern uint64_t symEpoch;
 
-/* numeric variables */
-void setVar(const char *name, double value);      // set or update global variable
-double getVar(const char *name);                  // get numeric variable
-void setVarLocal(const char *name, double value); // always append new local variable
-void setLocalVar(const char *name, double value); // alias for setVarLocal
+/* Lookups see the innermost function frame first, then globals.
+   Locals of calling functions are not visible. */
+/* setValue and declareValue return the entry's index, -1 if the table is full */
+int setValue(const char *name, Value value);       // update the visible binding or create one
+int declareValue(const char *name, Value value);   // `let`: binding in the current frame
+void setValueLocal(const char *name, Value value); // always append (parameters)
+Value getValue(const char *name);
+Value findValue(const char *name); // UNDEF_VAL when unbound, no error
+int hasValue(const char *name);
+int lookupSym(const char *name); // table index of the visible binding, -1 if unbound
 
-/* arrays */
-void setArray(const char *name, const double *data, int len); // create/copy array
-int getArrayElem(const char *name, int idx, double *out);     // read element
-int setArrayAt(const char *name, int idx, double value);      // write element
-int isArray(const char *name);                                // true if array or ref
-int getArrayLen(const char *name);
+/* frameEntry: the entry at a slot of the current frame if it still binds
+   name. A frame binds each name once (repeated parameter names aside),
+   so it is the binding lookupSym would find; callers cache slots that
+   lookupSym returned. */
+static inline SymEntry *frameEntry(int slot, const char *name)
+{
+    int i = frameBase + slot;
+    if (i < table_count && strcmp(table[i].name, name) == 0)
+        return &table[i];
+    return NULL;
+}
 
-/* array reference (for passing arrays by reference) */
-void setVarLocalArrayRef(const char *localName, const char *existingArrayName);
+/* numeric convenience wrappers */
+void setVar(const char *name, double value);
+double getVar(const char *name);
+
+/* arrays */
+int getArrayElem(const char *name, int idx, Value *out); // read element
+int setArrayAt(const char *name, int idx, Value value);  // write element
 
 /* functions */
 void setFunc(const char *name, struct ASTNode *funcDef);
 struct ASTNode *getFunc(const char *name);
 
+/* call frames */
+typedef struct
+{
+    int base;    // first entry of the frame
+    int globals; // entries visible as globals inside the frame
+} SymFrame;
+
+SymFrame pushFrame(void);
+void popFrame(SymFrame saved);
+
 /* symbol table management */
 void popSymbolsTo(int new_count);
 void clearSymbols(void);
 
+/* frees objects no longer reachable from the symbol table */
+void collectGarbage(void);
+
 #endif
@@ -0,0 +1,1619 @@
+#include "trace.h"
+#include "asm.h"
+#include "object.h"
+#include "runtime.h"
+#include "scope.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+int traceThreshold = TRACE_THRESHOLD;
+
+#ifdef JIT_SUPPORTED
+
+#define TRACE_MAX_INS 512   // IR instructions per trace
+#define TRACE_MAX_STEPS 1000 // bytecode instructions per recording
+#define TRACE_MAX_DEPTH 32  // operand stack entries
+#define TRACE_MAX_SIDE 16   // side traces per loop
+#define TRACE_MAX_ENTRY_EXITS 100 // runs that never got into the loop
+
+/* an exit stub jumps through target with rax pointing at its exit */
+typedef struct TraceExit
+{
+    void *target; // the epilogue, or a side trace once there is one
+    struct Trace *trace;
+    int pc, depth; // where the interpreter resumes
+    int hits;      // -1: no side trace from here
+} TraceExit;
+
+typedef struct Trace
+{
+    struct Trace *root; // itself for a loop's own trace
+    struct Trace *next; // every trace, for traceShutdown
+    void *code;
+    void *loopEntry; // roots: past the prologue; side traces jump here
+    void *epilogue;  // roots
+    TraceExit *exits; // one per snapshot
+    int sideCount;
+    int entryExits; // roots: runs that left in front of the loop
+} Trace;
+
+static Trace *traces = NULL;
+
+// ------------------- IR -------------------
+
+typedef enum
+{
+    IR_KINT,       // k
+    IR_KNUM,       // k: the double's bits
+    IR_LOAD,       // a: slot
+    IR_ADD,        // a b; on ints it guards the 48-bit range
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,        // doubles; guards a zero divisor
+    IR_TONUM,      // a: int -> double
+    IR_CMP,        // a b, c: BinOpType, k: operand type -> 0/1
+    IR_GUARD_CMP,  // a b, c: BinOpType, k: the outcome recorded
+    IR_GUARD_TRUE, // a, k: the outcome recorded
+    IR_LEN,        // a: array
+    IR_DATA,       // a: array -> its elements
+    IR_BOUNDS,     // a: index, b: length; c: predicate that drops it, or -1
+    IR_ALOAD,      // a: elements, b: index
+    IR_ASTORE      // a: elements, b: index, c: value
+} IrOp;
+
+/* what a value is unboxed to; a GUARD_CMP's type is its operands' */
+typedef enum
+{
+    T_NONE,
+    T_INT, // int64 within 48 bits
+    T_NUM, // double bits
+    T_ARR, // the boxed array
+    T_PTR  // raw pointer
+} IrType;
+
+#define F_INVARIANT 1 // computed once in front of the loop
+#define F_PHI 2       // LOAD of a slot the loop carries in a register
+
+typedef struct
+{
+    unsigned char op, type, flags;
+    int a, b, c;
+    int64_t k;
+    int snap; // guards: the state to exit with
+    int reg;
+} Ins;
+
+/* a slot is a local (>= 0; operand stack entries are the locals past
+   localCount) or global g (-(g+1)) */
+typedef struct
+{
+    int slot;
+    int ref;
+    int dirty; // written by the trace, so memory is stale
+    int phi;   // its F_PHI LOAD, or -1
+} SlotRef;
+
+typedef struct
+{
+    int pc, depth;
+    int stackAt;           // into Rec.snapRefs; -1: already in memory
+    int slotAt, slotCount; // dirty slots, into Rec.snapSlots
+} Snapshot;
+
+/* a bounds check the loop body drops when, in front of the loop,
+   phi + d >= 0 and limit + d (+ 1 unless strict) <= len */
+typedef struct
+{
+    int phi, limit, len;
+    int d;
+    int strict;
+} Pred;
+
+typedef struct
+{
+    Proto *proto;
+    Value *base, *globals;
+    int header;        // the loop's pc
+    TraceExit *parent; // side traces: the exit they start at
+    int pc;
+    Ins *ins;
+    int count;
+    int stack[TRACE_MAX_DEPTH];
+    int depth;
+    SlotRef *slots;
+    int slotCount, slotCap;
+    Snapshot *snaps;
+    int snapCount, snapCap;
+    int *snapRefs;
+    int snapRefCount, snapRefCap;
+    SlotRef *snapSlots;
+    int snapSlotCount, snapSlotCap;
+    int snap; // taken for the current instruction, or -1
+    Pred *preds;
+    int predCount, predCap;
+} Rec;
+
+static int isConst(Ins *x)
+{
+    return x->op == IR_KINT || x->op == IR_KNUM;
+}
+
+static int producesValue(int op)
+{
+    return op != IR_GUARD_CMP && op != IR_GUARD_TRUE && op != IR_BOUNDS && op != IR_ASTORE;
+}
+
+static int usesB(int op)
+{
+    return (op >= IR_ADD && op <= IR_DIV) || op == IR_CMP || op == IR_GUARD_CMP ||
+           op >= IR_BOUNDS;
+}
+
+static int addIns(Rec *r, int op, int type, int a, int b)
+{
+    Ins *x = &r->ins[r->count];
+    x->op = (unsigned char)op;
+    x->type = (unsigned char)type;
+    x->flags = 0;
+    x->a = a;
+    x->b = b;
+    x->c = -1;
+    x->k = 0;
+    x->snap = -1;
+    x->reg = -1;
+    return r->count++;
+}
+
+/* common subexpressions: the same pure instruction is emitted once */
+static int pure(Rec *r, int op, int type, int a, int b, int c, int64_t k)
+{
+    for (int i = r->count - 1; i >= 0; --i)
+    {
+        Ins *x = &r->ins[i];
+        if (x->op == op && x->type == type && x->a == a && x->b == b && x->c == c && x->k == k)
+            return i;
+    }
+    int ref = addIns(r, op, type, a, b);
+    r->ins[ref].c = c;
+    r->ins[ref].k = k;
+    return ref;
+}
+
+// ------------------- RECORDER -------------------
+
+/* the state the current instruction started with */
+static int snapshot(Rec *r)
+{
+    if (r->snap >= 0)
+        return r->snap;
+    if (r->snapCount >= r->snapCap)
+        r->snaps = (Snapshot *)growArray(r->snaps, &r->snapCap, sizeof(Snapshot));
+    Snapshot *s = &r->snaps[r->snapCount];
+    s->pc = r->pc;
+    s->depth = r->depth;
+    s->stackAt = r->snapRefCount;
+    for (int k = 0; k < r->depth; ++k)
+    {
+        if (r->snapRefCount >= r->snapRefCap)
+            r->snapRefs = (int *)growArray(r->snapRefs, &r->snapRefCap, sizeof(int));
+        r->snapRefs[r->snapRefCount++] = r->stack[k];
+    }
+    s->slotAt = r->snapSlotCount;
+    s->slotCount = 0;
+    for (int i = 0; i < r->slotCount; ++i)
+    {
+        if (!r->slots[i].dirty)
+            continue;
+        if (r->snapSlotCount >= r->snapSlotCap)
+            r->snapSlots = (SlotRef *)growArray(r->snapSlots, &r->snapSlotCap, sizeof(SlotRef));
+        r->snapSlots[r->snapSlotCount++] = r->slots[i];
+        s->slotCount++;
+    }
+    r->snap = r->snapCount++;
+    return r->snap;
+}
+
+static int guard(Rec *r, int ref)
+{
+    if (r->ins[ref].snap < 0)
+        r->ins[ref].snap = snapshot(r);
+    return ref;
+}
+
+static int valueType(Value v)
+{
+    if (IS_SMALL_INT(v))
+        return T_INT;
+    if (IS_NUM(v))
+        return T_NUM;
+    if (IS_ARRAY(v))
+        return T_ARR;
+    return T_NONE;
+}
+
+static int konst(Rec *r, Value v)
+{
+    if (IS_SMALL_INT(v))
+        return pure(r, IR_KINT, T_INT, -1, -1, -1, AS_SMALL_INT(v));
+    if (IS_NUM(v))
+        return pure(r, IR_KNUM, T_NUM, -1, -1, -1, (int64_t)v);
+    return -1;
+}
+
+static int toNum(Rec *r, int ref)
+{
+    Ins *x = &r->ins[ref];
+    if (x->type == T_NUM)
+        return ref;
+    if (x->op == IR_KINT)
+        return konst(r, NUM_VAL((double)x->k));
+    return pure(r, IR_TONUM, T_NUM, ref, -1, -1, 0);
+}
+
+static Value *slotValue(Rec *r, int slot)
+{
+    return slot >= 0 ? &r->base[slot] : &r->globals[-slot - 1];
+}
+
+static SlotRef *findSlot(Rec *r, int slot)
+{
+    for (int i = 0; i < r->slotCount; ++i)
+        if (r->slots[i].slot == slot)
+            return &r->slots[i];
+    return NULL;
+}
+
+static SlotRef *addSlot(Rec *r, int slot, int ref)
+{
+    if (r->slotCount >= r->slotCap)
+        r->slots = (SlotRef *)growArray(r->slots, &r->slotCap, sizeof(SlotRef));
+    SlotRef *e = &r->slots[r->slotCount++];
+    e->slot = slot;
+    e->ref = ref;
+    e->dirty = 0;
+    e->phi = -1;
+    return e;
+}
+
+/* the slot's current value: what the trace last stored, or a typed load */
+static int readSlot(Rec *r, int slot)
+{
+    SlotRef *e = findSlot(r, slot);
+    if (e)
+        return e->ref;
+    int type = valueType(*slotValue(r, slot));
+    if (type == T_NONE)
+        return -1; // unbound, or not a number or an array
+    int ref = guard(r, addIns(r, IR_LOAD, type, slot, -1));
+    addSlot(r, slot, ref);
+    return ref;
+}
+
+static void writeSlot(Rec *r, int slot, int ref)
+{
+    SlotRef *e = findSlot(r, slot);
+    if (!e)
+        e = addSlot(r, slot, ref);
+    e->ref = ref;
+    e->dirty = 1;
+}
+
+static void push(Rec *r, int ref, Value v)
+{
+    r->base[r->proto->localCount + r->depth] = v;
+    r->stack[r->depth++] = ref;
+}
+
+static int numeric(Value v)
+{
+    return IS_SMALL_INT(v) || IS_NUM(v);
+}
+
+/* l op rv (+ - * /) as the VM computes it; -1 when only the interpreter
+   can (strings, big ints, overflow, division by zero) */
+static int recordArith(Rec *r, BinOpType op, Value l, Value rv, int lref, int rref, Value *out)
+{
+    int irOp = IR_ADD + (op - OP_ADD);
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(rv) && op != OP_DIV)
+    {
+        int64_t a = AS_SMALL_INT(l), b = AS_SMALL_INT(rv), res;
+        if (op == OP_ADD)
+            res = a + b;
+        else if (op == OP_SUB)
+            res = a - b;
+        else if (__builtin_mul_overflow(a, b, &res))
+            return -1;
+        if (res < SMALL_INT_MIN || res > SMALL_INT_MAX)
+            return -1;
+        *out = INT_VAL(res);
+        return guard(r, pure(r, irOp, T_INT, lref, rref, -1, 0));
+    }
+    if (!numeric(l) || !numeric(rv))
+        return -1;
+    double a = toNumber(l), b = toNumber(rv);
+    if (op == OP_DIV && b == 0.0)
+        return -1;
+    *out = NUM_VAL(op == OP_ADD ? a + b : op == OP_SUB ? a - b : op == OP_MUL ? a * b : a / b);
+    int ref = pure(r, irOp, T_NUM, toNum(r, lref), toNum(r, rref), -1, 0);
+    return op == OP_DIV ? guard(r, ref) : ref;
+}
+
+static int compareInts(BinOpType op, int64_t a, int64_t b)
+{
+    switch (op)
+    {
+    case OP_EQ:
+        return a == b;
+    case OP_NE:
+        return a != b;
+    case OP_LT:
+        return a < b;
+    case OP_LE:
+        return a <= b;
+    case OP_GT:
+        return a > b;
+    default:
+        return a >= b;
+    }
+}
+
+static int compareNums(BinOpType op, double a, double b)
+{
+    switch (op)
+    {
+    case OP_EQ:
+        return a == b;
+    case OP_NE:
+        return a != b;
+    case OP_LT:
+        return a < b;
+    case OP_LE:
+        return a <= b;
+    case OP_GT:
+        return a > b;
+    default:
+        return a >= b;
+    }
+}
+
+/* l op rv as the VM compares them: returns the operand type (T_NONE
+   when the interpreter has to), converting the refs to it */
+static int recordCompare(Rec *r, BinOpType op, Value l, Value rv, int *lref, int *rref, int *t)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(rv))
+    {
+        *t = compareInts(op, AS_SMALL_INT(l), AS_SMALL_INT(rv));
+        return T_INT;
+    }
+    if (!numeric(l) || !numeric(rv))
+        return T_NONE;
+    *t = compareNums(op, toNumber(l), toNumber(rv));
+    *lref = toNum(r, *lref);
+    *rref = toNum(r, *rref);
+    return T_NUM;
+}
+
+/* the length and bounds check of an element access; returns the
+   elements pointer */
+/* checked 0: the optimizer proved the index in range (BC_ELEMENT_*) */
+static int arrayAccess(Rec *r, int aref, int iref, int checked)
+{
+    if (!checked)
+        return pure(r, IR_DATA, T_PTR, aref, -1, -1, 0);
+    int len = pure(r, IR_LEN, T_INT, aref, -1, -1, 0);
+    int i = r->count - 1;
+    while (i >= 0 && !(r->ins[i].op == IR_BOUNDS && r->ins[i].a == iref && r->ins[i].b == len))
+        i--;
+    if (i < 0)
+        guard(r, addIns(r, IR_BOUNDS, T_NONE, iref, len));
+    return pure(r, IR_DATA, T_PTR, aref, -1, -1, 0);
+}
+
+/* an element load reuses an earlier load or store of the same element
+   unless a store to some other element (maybe the same one) came since */
+static int loadElement(Rec *r, int data, int iref, int type)
+{
+    for (int i = r->count - 1; i >= 0; --i)
+    {
+        Ins *x = &r->ins[i];
+        if (x->op == IR_ALOAD && x->a == data && x->b == iref)
+            return i;
+        if (x->op == IR_ASTORE)
+        {
+            if (x->a == data && x->b == iref)
+                return x->c;
+            break;
+        }
+    }
+    return guard(r, addIns(r, IR_ALOAD, type, data, iref));
+}
+
+static int recordIndex(Rec *r, int slot, int checked)
+{
+    Value *live = r->base + r->proto->localCount;
+    int n = r->depth;
+    Value arr = *slotValue(r, slot), idx = live[n - 1];
+    if (!IS_ARRAY(arr) || !IS_SMALL_INT(idx))
+        return 0;
+    ObjArray *a = AS_ARRAY(arr);
+    int64_t i = AS_SMALL_INT(idx);
+    if (i < 0 || i >= a->len)
+        return 0;
+    int type = valueType(a->data[i]);
+    if (type == T_NONE)
+        return 0;
+    int data = arrayAccess(r, readSlot(r, slot), r->stack[n - 1], checked);
+    r->stack[n - 1] = loadElement(r, data, r->stack[n - 1], type);
+    live[n - 1] = a->data[i];
+    return 1;
+}
+
+static int recordStore(Rec *r, int slot, int checked)
+{
+    Value *live = r->base + r->proto->localCount;
+    int n = r->depth;
+    Value arr = *slotValue(r, slot), idx = live[n - 2];
+    if (!IS_ARRAY(arr) || !IS_SMALL_INT(idx))
+        return 0;
+    ObjArray *a = AS_ARRAY(arr);
+    int64_t i = AS_SMALL_INT(idx);
+    if (i < 0 || i >= a->len)
+        return 0;
+    int data = arrayAccess(r, readSlot(r, slot), r->stack[n - 2], checked);
+    int st = addIns(r, IR_ASTORE, T_NONE, data, r->stack[n - 2]);
+    r->ins[st].c = r->stack[n - 1];
+    a->data[i] = live[n - 1];
+    r->depth -= 2;
+    return 1;
+}
+
+/* records the instruction at r->pc and runs it exactly as the VM would.
+   Returns 1 to go on, 2 at the loop's back edge, 0 when the instruction
+   is left for the interpreter (nothing of it has run) */
+static int recordStep(Rec *r)
+{
+    Proto *p = r->proto;
+    int32_t *ip = p->code + r->pc;
+    Value *live = r->base + p->localCount;
+    int n = r->depth;
+    if (r->count > TRACE_MAX_INS - 16 || n > TRACE_MAX_DEPTH - 2)
+        return 0;
+
+    switch (*ip)
+    {
+    case BC_CONST:
+    {
+        Value v = p->consts[ip[1]];
+        int ref = konst(r, v);
+        if (ref < 0)
+            return 0;
+        push(r, ref, v);
+        r->pc += 2;
+        return 1;
+    }
+    case BC_POP:
+        r->depth--;
+        r->pc += 1;
+        return 1;
+    case BC_DUP:
+        push(r, r->stack[n - 1], live[n - 1]);
+        r->pc += 1;
+        return 1;
+    case BC_GET_LOCAL:
+    case BC_GET_GLOBAL:
+    {
+        int slot = *ip == BC_GET_LOCAL ? ip[1] : -ip[1] - 1;
+        int ref = readSlot(r, slot);
+        if (ref < 0)
+            return 0;
+        push(r, ref, *slotValue(r, slot));
+        r->pc += 2;
+        return 1;
+    }
+    case BC_SET_LOCAL:
+    case BC_SET_GLOBAL:
+    {
+        int slot = *ip == BC_SET_LOCAL ? ip[1] : -ip[1] - 1;
+        r->depth--;
+        *slotValue(r, slot) = live[r->depth];
+        writeSlot(r, slot, r->stack[r->depth]);
+        r->pc += 2;
+        return 1;
+    }
+
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+    case BC_DIV:
+    {
+        Value out;
+        int ref = recordArith(r, (BinOpType)(OP_ADD + (*ip - BC_ADD)), live[n - 2], live[n - 1],
+                              r->stack[n - 2], r->stack[n - 1], &out);
+        if (ref < 0)
+            return 0;
+        r->depth -= 2;
+        push(r, ref, out);
+        r->pc += 1;
+        return 1;
+    }
+    case BC_EQ:
+    case BC_NE:
+    case BC_LT:
+    case BC_LE:
+    case BC_GT:
+    case BC_GE:
+    {
+        BinOpType op = (BinOpType)(OP_EQ + (*ip - BC_EQ));
+        int l = r->stack[n - 2], rr = r->stack[n - 1], t;
+        int type = recordCompare(r, op, live[n - 2], live[n - 1], &l, &rr, &t);
+        if (type == T_NONE)
+            return 0;
+        int ref = pure(r, IR_CMP, T_INT, l, rr, op, type);
+        r->depth -= 2;
+        push(r, ref, INT_VAL(t));
+        r->pc += 1;
+        return 1;
+    }
+    case BC_ADD_CONST:
+    case BC_SUB_CONST:
+    {
+        Value k = p->consts[ip[1]], out;
+        int kref = konst(r, k);
+        if (kref < 0)
+            return 0;
+        int ref = recordArith(r, *ip == BC_ADD_CONST ? OP_ADD : OP_SUB, live[n - 1], k,
+                              r->stack[n - 1], kref, &out);
+        if (ref < 0)
+            return 0;
+        live[n - 1] = out;
+        r->stack[n - 1] = ref;
+        r->pc += 2;
+        return 1;
+    }
+
+    case BC_JUMP:
+        r->pc += 2 + ip[1];
+        return 1;
+    case BC_JUMP_IF_FALSE:
+    {
+        Value v = live[n - 1];
+        int ref = r->stack[n - 1];
+        if (!IS_SMALL_INT(v))
+            return 0;
+        int t = v != INT_VAL(0);
+        if (!isConst(&r->ins[ref]))
+            guard(r, pure(r, IR_GUARD_TRUE, T_NONE, ref, -1, -1, t));
+        r->depth--;
+        r->pc += t ? 2 : 2 + ip[1];
+        return 1;
+    }
+    case BC_SWITCH:
+    {
+        // guards keep the value on the case it took: equal to its label,
+        // or between the labels around it for the default
+        const CaseTable *t = &p->switches[ip[1]];
+        Value v = live[n - 1];
+        int ref = r->stack[n - 1];
+        if (r->ins[ref].type != T_INT)
+            return 0;
+        int64_t key = AS_SMALL_INT(v);
+        int lo = 0, hi = t->count; // labels[lo..hi) are above key once it is not one
+        while (lo < hi)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (t->labels[mid] < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (!isConst(&r->ins[ref]))
+        {
+            if (lo < t->count && t->labels[lo] == key)
+                guard(r, pure(r, IR_GUARD_CMP, T_INT, ref, konst(r, v), OP_EQ, 1));
+            else
+            {
+                if (lo > 0)
+                    guard(r, pure(r, IR_GUARD_CMP, T_INT, ref, konst(r, INT_VAL(t->labels[lo - 1])), OP_GT, 1));
+                if (lo < t->count)
+                    guard(r, pure(r, IR_GUARD_CMP, T_INT, ref, konst(r, INT_VAL(t->labels[lo])), OP_LT, 1));
+            }
+        }
+        r->depth--;
+        r->pc += 2 + selectCase(t, v);
+        return 1;
+    }
+    case BC_LOOP:
+        // an inner loop's back edge ends the recording too
+        return r->pc + 2 - ip[1] == r->header && n == 0 ? 2 : 0;
+    case BC_FOR_NEXT:
+    {
+        // the step is fixed for the loop: a constant, and i < last (or >)
+        // then means i != last, a bound that drops bounds checks
+        int i = readSlot(r, ip[1]), last = readSlot(r, ip[1] + 1), step = readSlot(r, ip[1] + 2);
+        if (i < 0 || last < 0 || step < 0 || r->ins[i].type != T_INT)
+            return 0;
+        Value iv = *slotValue(r, ip[1]), kv = *slotValue(r, ip[1] + 2), out;
+        int k = konst(r, kv);
+        guard(r, pure(r, IR_GUARD_CMP, T_INT, step, k, OP_EQ, 1));
+        BinOpType op = AS_SMALL_INT(kv) > 0 ? OP_LT : OP_GT;
+        int t = compareInts(op, AS_SMALL_INT(iv), AS_SMALL_INT(*slotValue(r, ip[1] + 1)));
+        guard(r, pure(r, IR_GUARD_CMP, T_INT, i, last, op, t));
+        if (!t)
+        {
+            r->pc += 3 + ip[2];
+            return 1;
+        }
+        int ref = recordArith(r, OP_ADD, iv, kv, i, k, &out);
+        *slotValue(r, ip[1]) = out;
+        writeSlot(r, ip[1], ref);
+        r->pc += 3;
+        return 1;
+    }
+    case BC_JUMP_IF_NOT_EQ:
+    case BC_JUMP_IF_NOT_NE:
+    case BC_JUMP_IF_NOT_LT:
+    case BC_JUMP_IF_NOT_LE:
+    case BC_JUMP_IF_NOT_GT:
+    case BC_JUMP_IF_NOT_GE:
+    {
+        BinOpType op = (BinOpType)(OP_EQ + (*ip - BC_JUMP_IF_NOT_EQ));
+        int l = r->stack[n - 2], rr = r->stack[n - 1], t;
+        int type = recordCompare(r, op, live[n - 2], live[n - 1], &l, &rr, &t);
+        if (type == T_NONE)
+            return 0;
+        if (!isConst(&r->ins[l]) || !isConst(&r->ins[rr]))
+            guard(r, pure(r, IR_GUARD_CMP, type, l, rr, op, t));
+        r->depth -= 2;
+        r->pc += t ? 2 : 2 + ip[1];
+        return 1;
+    }
+
+    case BC_INDEX_LOCAL:
+    case BC_INDEX_GLOBAL:
+    case BC_ELEMENT_LOCAL:
+    case BC_ELEMENT_GLOBAL:
+    {
+        int local = *ip == BC_INDEX_LOCAL || *ip == BC_ELEMENT_LOCAL;
+        if (!recordIndex(r, local ? ip[1] : -ip[1] - 1, *ip == BC_INDEX_LOCAL || *ip == BC_INDEX_GLOBAL))
+            return 0;
+        r->pc += 2;
+        return 1;
+    }
+    case BC_STORE_INDEX_LOCAL:
+    case BC_STORE_INDEX_GLOBAL:
+    case BC_STORE_ELEMENT_LOCAL:
+    case BC_STORE_ELEMENT_GLOBAL:
+    {
+        int local = *ip == BC_STORE_INDEX_LOCAL || *ip == BC_STORE_ELEMENT_LOCAL;
+        if (!recordStore(r, local ? ip[1] : -ip[1] - 1, *ip == BC_STORE_INDEX_LOCAL || *ip == BC_STORE_INDEX_GLOBAL))
+            return 0;
+        r->pc += 2;
+        return 1;
+    }
+    case BC_LENGTH:
+    {
+        Value v = live[n - 1];
+        if (!IS_ARRAY(v))
+            return 0;
+        r->stack[n - 1] = pure(r, IR_LEN, T_INT, r->stack[n - 1], -1, -1, 0);
+        live[n - 1] = INT_VAL(AS_ARRAY(v)->len);
+        r->pc += 1;
+        return 1;
+    }
+
+    default:
+        return 0; // calls, printing, strings, dynamic names...
+    }
+}
+
+// ------------------- LOOP OPTIMIZATION -------------------
+
+static int negateOp(int op)
+{
+    switch (op)
+    {
+    case OP_EQ:
+        return OP_NE;
+    case OP_NE:
+        return OP_EQ;
+    case OP_LT:
+        return OP_GE;
+    case OP_LE:
+        return OP_GT;
+    case OP_GT:
+        return OP_LE;
+    default:
+        return OP_LT;
+    }
+}
+
+/* a op b  <=>  b mirror(op) a */
+static int mirrorOp(int op)
+{
+    switch (op)
+    {
+    case OP_LT:
+        return OP_GT;
+    case OP_LE:
+        return OP_GE;
+    case OP_GT:
+        return OP_LT;
+    case OP_GE:
+        return OP_LE;
+    default:
+        return op;
+    }
+}
+
+/* ref as phi + d, phi being a loop-carried int the loop only counts up */
+static int inductionIndex(Rec *r, int ref, int *phi, int *d)
+{
+    Ins *x = &r->ins[ref];
+    *d = 0;
+    if ((x->op == IR_ADD || x->op == IR_SUB) && x->type == T_INT && r->ins[x->b].op == IR_KINT)
+    {
+        int64_t k = r->ins[x->b].k;
+        if (k > (1 << 20) || k < -(1 << 20))
+            return 0;
+        *d = (int)(x->op == IR_ADD ? k : -k);
+        ref = x->a;
+    }
+    Ins *p = &r->ins[ref];
+    if (p->op != IR_LOAD || !(p->flags & F_PHI))
+        return 0;
+    Ins *step = &r->ins[findSlot(r, p->a)->ref];
+    if (step->op != IR_ADD || step->a != ref || r->ins[step->b].op != IR_KINT || r->ins[step->b].k <= 0)
+        return 0;
+    *phi = ref;
+    return 1;
+}
+
+/* a guard ahead of instruction i that keeps phi below an invariant */
+static int loopBound(Rec *r, int i, int phi, int *limit, int *strict)
+{
+    for (int j = 0; j < i; ++j)
+    {
+        Ins *x = &r->ins[j];
+        if (x->op != IR_GUARD_CMP || x->type != T_INT)
+            continue;
+        int op = x->k ? x->c : negateOp(x->c), other;
+        if (x->a == phi)
+            other = x->b;
+        else if (x->b == phi)
+        {
+            other = x->a;
+            op = mirrorOp(op);
+        }
+        else
+            continue;
+        if (!(r->ins[other].flags & F_INVARIANT) || (op != OP_LT && op != OP_LE))
+            continue;
+        *limit = other;
+        *strict = op == OP_LT;
+        return 1;
+    }
+    return 0;
+}
+
+/* marks what the loop carries in registers and what it can compute in
+   front of itself, and which bounds checks a test there can replace */
+static void optimize(Rec *r)
+{
+    int hasStore = 0;
+    for (int i = 0; i < r->count; ++i)
+        hasStore |= r->ins[i].op == IR_ASTORE;
+
+    for (int i = 0; i < r->count; ++i)
+    {
+        Ins *x = &r->ins[i];
+        switch (x->op)
+        {
+        case IR_KINT:
+        case IR_KNUM:
+            x->flags |= F_INVARIANT;
+            break;
+        case IR_LOAD:
+        {
+            SlotRef *e = findSlot(r, x->a);
+            if (!e->dirty)
+                x->flags |= F_INVARIANT;
+            else if (e->ref != i && r->ins[e->ref].type == x->type)
+            {
+                // the value it ends the iteration with has the type it
+                // was loaded with: keep it in a register around the loop
+                x->flags |= F_PHI;
+                e->phi = i;
+            }
+            break;
+        }
+        case IR_ASTORE:
+            break;
+        case IR_ALOAD:
+            if (hasStore)
+                break;
+            // fall through
+        default:
+            if ((r->ins[x->a].flags & F_INVARIANT) &&
+                (!usesB(x->op) || (r->ins[x->b].flags & F_INVARIANT)))
+                x->flags |= F_INVARIANT;
+            break;
+        }
+    }
+
+    for (int i = 0; i < r->count; ++i)
+    {
+        Ins *x = &r->ins[i];
+        int phi, d, limit, strict;
+        if (x->op != IR_BOUNDS || (x->flags & F_INVARIANT) || !(r->ins[x->b].flags & F_INVARIANT) ||
+            !inductionIndex(r, x->a, &phi, &d) || !loopBound(r, i, phi, &limit, &strict))
+            continue;
+        if (r->predCount >= r->predCap)
+            r->preds = (Pred *)growArray(r->preds, &r->predCap, sizeof(Pred));
+        Pred *pr = &r->preds[r->predCount];
+        pr->phi = phi;
+        pr->limit = limit;
+        pr->len = x->b;
+        pr->d = d;
+        pr->strict = strict;
+        x->c = r->predCount++;
+    }
+}
+
+// ------------------- CODE GENERATION -------------------
+
+/* registers values live in; rbp holds the frame's base, r15 the
+   globals, and rax, rcx, rdx, xmm0-2 are scratch */
+#define TRACE_REGS 10
+static const int traceRegs[TRACE_REGS] = {RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14};
+
+typedef struct
+{
+    Asm as;
+    Rec *r;
+    Trace *t;
+    int root;
+    int *order; // instructions in the order they are emitted
+    int n, bodyStart;
+    int *lastUse; // position of the last use, n for the loop's end
+    int *patchAt, *patchSnap;
+    int patchCount, patchCap;
+} Cg;
+
+static void exitIf(Cg *g, int cc, int snap)
+{
+    if (g->patchCount >= g->patchCap)
+    {
+        int cap = g->patchCap;
+        g->patchAt = (int *)growArray(g->patchAt, &cap, sizeof(int));
+        g->patchSnap = (int *)growArray(g->patchSnap, &g->patchCap, sizeof(int));
+    }
+    g->patchAt[g->patchCount] = jcc(&g->as, cc);
+    g->patchSnap[g->patchCount++] = snap;
+}
+
+static void slotAddress(int slot, int *reg, int32_t *disp)
+{
+    *reg = slot >= 0 ? RBP : R15;
+    *disp = 8 * (slot >= 0 ? slot : -slot - 1);
+}
+
+/* ref's unboxed value in a register: its own, or scratch for a constant */
+static int operand(Cg *g, int ref, int scratch)
+{
+    Ins *x = &g->r->ins[ref];
+    if (!isConst(x))
+        return x->reg;
+    movImm(&g->as, scratch, (uint64_t)x->k);
+    return scratch;
+}
+
+static void moveOperand(Cg *g, int dst, int ref)
+{
+    movRR(&g->as, dst, operand(g, ref, dst));
+}
+
+/* ref as a Value in dst (clobbers rcx) */
+static void box(Cg *g, int dst, int ref)
+{
+    Ins *x = &g->r->ins[ref];
+    if (x->op == IR_KINT)
+        movImm(&g->as, dst, INT_VAL(x->k));
+    else if (x->op == IR_KNUM)
+        movImm(&g->as, dst, (uint64_t)x->k);
+    else
+    {
+        movRR(&g->as, dst, x->reg);
+        if (x->type == T_INT)
+        {
+            shiftImm(&g->as, EXT_SHL, dst, 16);
+            shiftImm(&g->as, EXT_SHR, dst, 16);
+            movImm(&g->as, RCX, QNAN | TAG_INT);
+            alu(&g->as, ALU_OR, dst, RCX);
+        }
+    }
+}
+
+/* exits unless the Value in rax has the type (clobbers rcx, rdx) */
+static void checkType(Cg *g, int type, int snap)
+{
+    Asm *as = &g->as;
+    if (type == T_INT)
+    {
+        testTag(as, RAX, 0x7ffd);
+        exitIf(g, CC_NE, snap);
+    }
+    else if (type == T_NUM)
+    {
+        movRR(as, RDX, RAX);
+        movImm(as, RCX, QNAN);
+        alu(as, ALU_AND, RDX, RCX);
+        alu(as, ALU_CMP, RDX, RCX);
+        exitIf(g, CC_E, snap);
+    }
+    else
+    {
+        testTag(as, RAX, 0xfffc);
+        exitIf(g, CC_NE, snap);
+        movRR(as, RDX, RAX);
+        shiftImm(as, EXT_SHL, RDX, 16);
+        shiftImm(as, EXT_SHR, RDX, 16);
+        // cmp byte [rdx + type], OBJ_ARRAY
+        emitByte(as, 0x80);
+        emitByte(as, 0x80 | (7 << 3) | RDX);
+        emitInt32(as, (int32_t)offsetof(Obj, type));
+        emitByte(as, OBJ_ARRAY);
+        exitIf(g, CC_NE, snap);
+    }
+}
+
+static void unbox(Cg *g, int dst, int type)
+{
+    movRR(&g->as, dst, RAX);
+    if (type == T_INT)
+        untag(&g->as, dst);
+}
+
+/* the elements pointer as an [base + index*8] base register */
+static int elementBase(Cg *g, int ref)
+{
+    int reg = g->r->ins[ref].reg;
+    if (reg == R13)
+    {
+        movRR(&g->as, RCX, reg);
+        return RCX;
+    }
+    return reg;
+}
+
+static int intCC(int op)
+{
+    static const int cc[] = {CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE};
+    return cc[op - OP_EQ];
+}
+
+/* compares x's operands; returns the condition code that holds when
+   "a op b" does (for doubles that is al != 0) */
+static int emitComparison(Cg *g, Ins *x, int type)
+{
+    Asm *as = &g->as;
+    moveOperand(g, RAX, x->a);
+    if (type == T_INT)
+    {
+        alu(as, ALU_CMP, RAX, operand(g, x->b, RCX));
+        return intCC(x->c);
+    }
+    MOVQ_TO_XMM(as, 0, RAX);
+    moveOperand(g, RAX, x->b);
+    MOVQ_TO_XMM(as, 1, RAX);
+    // ucomisd leaves unordered (NaN) as "below and equal": only the
+    // above/above-or-equal conditions and ZF with PF clear are exact
+    switch (x->c)
+    {
+    case OP_LT:
+        UCOMISD(as, 1, 0);
+        setcc(as, CC_A, 0);
+        break;
+    case OP_LE:
+        UCOMISD(as, 1, 0);
+        setcc(as, CC_AE, 0);
+        break;
+    case OP_GT:
+        UCOMISD(as, 0, 1);
+        setcc(as, CC_A, 0);
+        break;
+    case OP_GE:
+        UCOMISD(as, 0, 1);
+        setcc(as, CC_AE, 0);
+        break;
+    case OP_EQ:
+        UCOMISD(as, 0, 1);
+        setcc(as, CC_E, 0);
+        setcc(as, CC_NP, 1);
+        emitByte(as, 0x20); // and al, cl
+        emitByte(as, 0xc8);
+        break;
+    default:
+        UCOMISD(as, 0, 1);
+        setcc(as, CC_NE, 0);
+        setcc(as, CC_P, 1);
+        emitByte(as, 0x08); // or al, cl
+        emitByte(as, 0xc8);
+        break;
+    }
+    emitByte(as, 0x84); // test al, al
+    emitByte(as, 0xc0);
+    return CC_NE;
+}
+
+/* checked: keep the bounds checks an entry test would make redundant */
+static void emitIns(Cg *g, int i, int checked)
+{
+    Asm *as = &g->as;
+    Ins *x = &g->r->ins[i];
+    int snap = (x->flags & (F_INVARIANT | F_PHI)) ? 0 : x->snap;
+    int dst = x->reg;
+    switch (x->op)
+    {
+    case IR_LOAD:
+    {
+        int base;
+        int32_t disp;
+        slotAddress(x->a, &base, &disp);
+        load(as, RAX, base, disp);
+        checkType(g, x->type, snap);
+        unbox(g, dst, x->type);
+        break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+        if (x->type == T_INT)
+        {
+            moveOperand(g, RAX, x->a);
+            int rb = operand(g, x->b, RCX);
+            if (x->op == IR_MUL)
+            {
+                opRR(as, 1, 0x0faf, RAX, rb); // imul rax, rb
+                exitIf(g, CC_O, snap);
+            }
+            else
+                alu(as, x->op == IR_ADD ? ALU_ADD : ALU_SUB, RAX, rb);
+            // the result must survive a round trip through 48 bits
+            movRR(as, RDX, RAX);
+            untag(as, RDX);
+            alu(as, ALU_CMP, RDX, RAX);
+            exitIf(g, CC_NE, snap);
+            movRR(as, dst, RAX);
+        }
+        else
+        {
+            static const int sseOps[] = {0x58, 0x5c, 0x59, 0x5e}; // add sub mul div
+            moveOperand(g, RAX, x->a);
+            MOVQ_TO_XMM(as, 0, RAX);
+            moveOperand(g, RAX, x->b);
+            MOVQ_TO_XMM(as, 1, RAX);
+            if (x->op == IR_DIV)
+            {
+                XORPD(as, 2);
+                UCOMISD(as, 1, 2);
+                int nan = jcc(as, CC_P);
+                exitIf(g, CC_E, snap);
+                patchHere(as, nan);
+            }
+            sse(as, 0xf2, sseOps[x->op - IR_ADD], 0, 1, 0);
+            MOVQ_FROM_XMM(as, dst, 0);
+        }
+        break;
+    case IR_TONUM:
+        CVTSI2SD(as, 0, operand(g, x->a, RAX));
+        MOVQ_FROM_XMM(as, dst, 0);
+        break;
+    case IR_CMP:
+        setcc(as, emitComparison(g, x, (int)x->k), 0);
+        emitByte(as, 0x0f); // movzx eax, al
+        emitByte(as, 0xb6);
+        emitByte(as, 0xc0);
+        movRR(as, dst, RAX);
+        break;
+    case IR_GUARD_CMP:
+    {
+        int cc = emitComparison(g, x, x->type);
+        exitIf(g, x->k ? cc ^ 1 : cc, snap);
+        break;
+    }
+    case IR_GUARD_TRUE:
+        aluImm(as, 1, EXT_CMP, operand(g, x->a, RAX), 0);
+        exitIf(g, x->k ? CC_E : CC_NE, snap);
+        break;
+    case IR_LEN:
+    case IR_DATA:
+        movRR(as, RAX, g->r->ins[x->a].reg);
+        shiftImm(as, EXT_SHL, RAX, 16);
+        shiftImm(as, EXT_SHR, RAX, 16);
+        if (x->op == IR_LEN)
+            opRM(as, 1, 0x63, dst, RAX, (int32_t)offsetof(ObjArray, len)); // movsxd
+        else
+            load(as, dst, RAX, (int32_t)offsetof(ObjArray, data));
+        break;
+    case IR_BOUNDS:
+        if (x->c >= 0 && !checked)
+            break;
+        moveOperand(g, RAX, x->a);
+        alu(as, ALU_CMP, RAX, operand(g, x->b, RCX));
+        exitIf(g, CC_AE, snap); // unsigned: a negative index is huge
+        break;
+    case IR_ALOAD:
+    {
+        int base = elementBase(g, x->a);
+        opRX(as, 0x8b, RAX, base, operand(g, x->b, RDX));
+        checkType(g, x->type, snap);
+        unbox(g, dst, x->type);
+        break;
+    }
+    case IR_ASTORE:
+    {
+        box(g, RAX, x->c);
+        int base = elementBase(g, x->a);
+        opRX(as, 0x89, RAX, base, operand(g, x->b, RDX));
+        break;
+    }
+    default:
+        break; // constants are materialized where they are used
+    }
+}
+
+static void storeSlot(Cg *g, int slot, int ref)
+{
+    int base;
+    int32_t disp;
+    box(g, RAX, ref);
+    slotAddress(slot, &base, &disp);
+    store(&g->as, base, disp, RAX);
+}
+
+/* writes the state of snapshot s back to the frame and leaves */
+static void emitStub(Cg *g, int s)
+{
+    Rec *r = g->r;
+    Snapshot *sn = &r->snaps[s];
+    for (int i = 0; i < sn->slotCount; ++i)
+        storeSlot(g, r->snapSlots[sn->slotAt + i].slot, r->snapSlots[sn->slotAt + i].ref);
+    // a carried slot not yet written this iteration is in its phi's register
+    for (int i = 0; s != 0 && i < r->slotCount; ++i)
+    {
+        SlotRef *e = &r->slots[i];
+        int written = 0;
+        if (e->phi < 0)
+            continue;
+        for (int j = 0; j < sn->slotCount; ++j)
+            written |= r->snapSlots[sn->slotAt + j].slot == e->slot;
+        if (!written)
+            storeSlot(g, e->slot, e->phi);
+    }
+    for (int k = 0; k < sn->depth; ++k)
+        if (r->snapRefs[sn->stackAt + k] >= 0)
+            storeSlot(g, r->proto->localCount + k, r->snapRefs[sn->stackAt + k]);
+    movImm(&g->as, RAX, (uint64_t)(uintptr_t)&g->t->exits[s]);
+    emitByte(&g->as, 0xff); // jmp [rax + target]
+    emitByte(&g->as, 0xa0);
+    emitInt32(&g->as, (int32_t)offsetof(TraceExit, target));
+}
+
+/* end of an iteration: memory catches up with the trace's stores, and
+   carried slots move to their phis' registers */
+static void emitLoopEnd(Cg *g, int top)
+{
+    Rec *r = g->r;
+    Asm *as = &g->as;
+    int conflict = 0;
+    for (int i = 0; i < r->slotCount; ++i)
+    {
+        SlotRef *e = &r->slots[i];
+        if (e->dirty && e->phi < 0)
+            storeSlot(g, e->slot, e->ref);
+        if (e->phi < 0 || isConst(&r->ins[e->ref]))
+            continue;
+        for (int j = 0; j < r->slotCount; ++j)
+            if (j != i && r->slots[j].phi >= 0 && r->ins[r->slots[j].phi].reg == r->ins[e->ref].reg)
+                conflict = 1;
+    }
+    // the moves are parallel: go through the stack when one would
+    // overwrite another's source
+    for (int i = 0; i < r->slotCount; ++i)
+    {
+        SlotRef *e = &r->slots[i];
+        if (e->phi < 0)
+            continue;
+        if (!conflict)
+            moveOperand(g, r->ins[e->phi].reg, e->ref);
+        else
+            pushReg(as, operand(g, e->ref, RAX));
+    }
+    for (int i = r->slotCount - 1; conflict && i >= 0; --i)
+        if (r->slots[i].phi >= 0)
+            popReg(as, r->ins[r->slots[i].phi].reg);
+    patchRel32(as, jmp(as), top);
+}
+
+static void use(Cg *g, int ref, int pos)
+{
+    if (ref >= 0 && !isConst(&g->r->ins[ref]) && g->lastUse[ref] < pos)
+        g->lastUse[ref] = pos;
+}
+
+/* orders the instructions (loop-invariant ones first, then the phis,
+   then the body) and gives every value a register for its lifetime;
+   0 when they do not fit */
+static int allocate(Cg *g)
+{
+    Rec *r = g->r;
+    int owner[16];
+    g->n = 0;
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        for (int i = 0; i < r->count; ++i)
+        {
+            Ins *x = &r->ins[i];
+            int where = (x->flags & F_INVARIANT) ? 0 : (x->flags & F_PHI) ? 1 : 2;
+            if (where == pass && !isConst(x))
+                g->order[g->n++] = i;
+        }
+        if (pass == 1)
+            g->bodyStart = g->n;
+    }
+
+    for (int i = 0; i < r->count; ++i)
+        g->lastUse[i] = -1;
+    for (int pos = 0; pos < g->n; ++pos)
+    {
+        Ins *x = &r->ins[g->order[pos]];
+        if (x->op != IR_KINT && x->op != IR_KNUM && x->op != IR_LOAD)
+            use(g, x->a, pos);
+        if (usesB(x->op))
+            use(g, x->b, pos);
+        if (x->op == IR_ASTORE)
+            use(g, x->c, pos);
+        if (x->snap > 0 && !(x->flags & (F_INVARIANT | F_PHI)))
+        {
+            Snapshot *s = &r->snaps[x->snap];
+            for (int k = 0; k < s->depth; ++k)
+                use(g, r->snapRefs[s->stackAt + k], pos);
+            for (int k = 0; k < s->slotCount; ++k)
+                use(g, r->snapSlots[s->slotAt + k].ref, pos);
+        }
+    }
+    for (int i = 0; i < r->predCount; ++i)
+    {
+        use(g, r->preds[i].limit, g->bodyStart);
+        use(g, r->preds[i].len, g->bodyStart);
+    }
+    for (int i = 0; i < r->slotCount; ++i)
+        if (r->slots[i].dirty)
+            use(g, r->slots[i].ref, g->n);
+    // what the loop computes in front of itself lives all through it
+    for (int pos = 0; pos < g->bodyStart; ++pos)
+    {
+        int i = g->order[pos];
+        if ((r->ins[i].flags & F_PHI) || g->lastUse[i] >= g->bodyStart)
+            g->lastUse[i] = g->n;
+    }
+
+    for (int i = 0; i < 16; ++i)
+        owner[i] = -1;
+    for (int pos = 0; pos < g->n; ++pos)
+    {
+        int i = g->order[pos], reg = -1;
+        for (int k = 0; k < TRACE_REGS; ++k)
+        {
+            int rk = traceRegs[k];
+            if (owner[rk] >= 0 && g->lastUse[owner[rk]] < pos)
+                owner[rk] = -1;
+            if (owner[rk] < 0 && reg < 0)
+                reg = rk;
+        }
+        if (!producesValue(r->ins[i].op))
+            continue;
+        if (reg < 0)
+            return 0;
+        r->ins[i].reg = reg;
+        owner[reg] = i;
+    }
+    return 1;
+}
+
+/* one iteration's body; the loop's own copies jump back to top */
+static void emitBody(Cg *g, int checked)
+{
+    for (int pos = g->bodyStart; pos < g->n; ++pos)
+        emitIns(g, g->order[pos], checked);
+}
+
+static void emitPredicates(Cg *g, int *jumps)
+{
+    Asm *as = &g->as;
+    for (int i = 0; i < g->r->predCount; ++i)
+    {
+        Pred *pr = &g->r->preds[i];
+        movRR(as, RAX, g->r->ins[pr->phi].reg);
+        aluImm(as, 1, EXT_ADD, RAX, pr->d);
+        aluImm(as, 1, EXT_CMP, RAX, 0);
+        jumps[2 * i] = jcc(as, CC_L);
+        moveOperand(g, RAX, pr->limit);
+        aluImm(as, 1, EXT_ADD, RAX, pr->d + !pr->strict);
+        alu(as, ALU_CMP, RAX, operand(g, pr->len, RCX));
+        jumps[2 * i + 1] = jcc(as, CC_G);
+    }
+}
+
+static void emitEpilogue(Asm *as)
+{
+    popReg(as, R15);
+    popReg(as, R14);
+    popReg(as, R13);
+    popReg(as, R12);
+    popReg(as, RBX);
+    popReg(as, RBP);
+    emitByte(as, 0xc3);
+}
+
+/* a root trace is Exit *fn(Value *base, Value *globals); a side trace is
+   jumped to from its parent's exit stub and jumps to the loop's entry */
+static Trace *compile(Rec *r)
+{
+    Cg g;
+    memset(&g, 0, sizeof(g));
+    g.r = r;
+    g.root = r->parent == NULL;
+    if (g.root)
+        optimize(r);
+    g.order = (int *)malloc(sizeof(int) * r->count);
+    g.lastUse = (int *)malloc(sizeof(int) * r->count);
+    Trace *t = (Trace *)calloc(1, sizeof(Trace));
+    if (t)
+        t->exits = (TraceExit *)calloc(r->snapCount, sizeof(TraceExit));
+    if (!g.order || !g.lastUse || !t || !t->exits)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    g.t = t;
+    t->root = g.root ? t : r->parent->trace->root;
+    int ok = allocate(&g);
+
+    Asm *as = &g.as;
+    int entry = 0, epilogue = 0;
+    int *stubs = (int *)malloc(sizeof(int) * r->snapCount);
+    int *predJumps = (int *)malloc(sizeof(int) * (2 * r->predCount + 1));
+    if (!stubs || !predJumps)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    if (ok && g.root)
+    {
+        pushReg(as, RBP);
+        pushReg(as, RBX);
+        pushReg(as, R12);
+        pushReg(as, R13);
+        pushReg(as, R14);
+        pushReg(as, R15);
+        movRR(as, RBP, RDI);
+        movRR(as, R15, RSI);
+        entry = as->len;
+        for (int pos = 0; pos < g.bodyStart; ++pos)
+            emitIns(&g, g.order[pos], 0);
+        emitPredicates(&g, predJumps);
+        int top = as->len;
+        emitBody(&g, 0);
+        emitLoopEnd(&g, top);
+        if (r->predCount > 0)
+        {
+            top = as->len;
+            for (int i = 0; i < 2 * r->predCount; ++i)
+                patchHere(as, predJumps[i]);
+            emitBody(&g, 1);
+            emitLoopEnd(&g, top);
+        }
+        epilogue = as->len;
+        emitEpilogue(as);
+    }
+    else if (ok)
+    {
+        emitBody(&g, 1);
+        for (int i = 0; i < r->slotCount; ++i)
+            if (r->slots[i].dirty)
+                storeSlot(&g, r->slots[i].slot, r->slots[i].ref);
+        movImm(as, RAX, (uint64_t)(uintptr_t)t->root->loopEntry);
+        emitByte(as, 0xff); // jmp rax
+        emitByte(as, 0xe0);
+    }
+    for (int s = 0; s < r->snapCount; ++s)
+        stubs[s] = -1;
+    for (int i = 0; ok && i < g.patchCount; ++i)
+    {
+        int s = g.patchSnap[i];
+        if (stubs[s] < 0)
+        {
+            stubs[s] = as->len;
+            emitStub(&g, s);
+        }
+        patchRel32(as, g.patchAt[i], stubs[s]);
+    }
+
+    unsigned char *code = ok ? (unsigned char *)installCode(as) : NULL;
+    free(as->code);
+    free(g.order);
+    free(g.lastUse);
+    free(g.patchAt);
+    free(g.patchSnap);
+    free(stubs);
+    free(predJumps);
+    if (!code)
+    {
+        free(t->exits);
+        free(t);
+        return NULL;
+    }
+    t->code = code;
+    if (g.root)
+    {
+        t->loopEntry = code + entry;
+        t->epilogue = code + epilogue;
+    }
+    for (int s = 0; s < r->snapCount; ++s)
+    {
+        TraceExit *e = &t->exits[s];
+        e->target = t->root->epilogue;
+        e->trace = t;
+        e->pc = r->snaps[s].pc;
+        e->depth = r->snaps[s].depth;
+        e->hits = s == 0 ? -1 : 0; // where the trace started
+    }
+    t->next = traces;
+    traces = t;
+    stats.traceCompiled++;
+    return t;
+}
+
+// ------------------- ENTRY POINTS -------------------
+
+/* records from start until the loop's back edge, running the code as it
+   goes, and compiles what it saw; parent is the exit a side trace
+   starts at */
+static TraceResume record(Proto *p, int header, int start, int depth, Value *base, Value *globals,
+                          TraceExit *parent)
+{
+    TraceResume res = {p->code + start, depth};
+    Value *live = base + p->localCount;
+    if (depth > TRACE_MAX_DEPTH / 2)
+        return res;
+    for (int k = 0; k < depth; ++k)
+        if (valueType(live[k]) == T_NONE)
+            return res;
+
+    Rec r;
+    memset(&r, 0, sizeof(r));
+    r.proto = p;
+    r.base = base;
+    r.globals = globals;
+    r.header = header;
+    r.parent = parent;
+    r.pc = start;
+    r.snap = -1;
+    r.ins = (Ins *)malloc(sizeof(Ins) * TRACE_MAX_INS);
+    if (!r.ins)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    // snapshot 0: nothing to write back, the operands are in memory
+    r.depth = depth;
+    for (int k = 0; k < depth; ++k)
+        r.stack[k] = -1;
+    snapshot(&r);
+    for (int k = 0; k < depth; ++k)
+    {
+        r.stack[k] = addIns(&r, IR_LOAD, valueType(live[k]), p->localCount + k, -1);
+        r.ins[r.stack[k]].snap = 0;
+    }
+    r.snap = -1;
+
+    int status = 1;
+    for (int steps = 0; status == 1 && steps < TRACE_MAX_STEPS; ++steps)
+    {
+        status = recordStep(&r);
+        r.snap = -1;
+    }
+    res.ip = p->code + r.pc;
+    res.depth = r.depth;
+    if (status == 2)
+    {
+        Trace *t = compile(&r);
+        if (t && parent)
+        {
+            parent->target = t->code;
+            t->root->sideCount++;
+        }
+        else if (t)
+            p->loops[header].trace = t;
+    }
+    free(r.ins);
+    free(r.slots);
+    free(r.snaps);
+    free(r.snapRefs);
+    free(r.snapSlots);
+    free(r.preds);
+    return res;
+}
+
+TraceResume traceLoop(Proto *p, int32_t *ip, Value *base, Value *globals)
+{
+    TraceResume res = {ip, 0};
+    int pc = (int)(ip - p->code);
+    if (!p->loops)
+    {
+        p->loops = (TraceLoop *)calloc(p->count, sizeof(TraceLoop));
+        if (!p->loops)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+    }
+    TraceLoop *l = &p->loops[pc];
+    Trace *t = l->trace;
+    if (!t)
+    {
+        if (l->attempts >= TRACE_MAX_ATTEMPTS || ++l->hits < traceThreshold)
+            return res;
+        l->hits = 0;
+        l->attempts++;
+        return record(p, pc, pc, 0, base, globals, NULL);
+    }
+
+    TraceExit *e = ((TraceExit * (*)(Value *, Value *)) t->code)(base, globals);
+    stats.traceExits++;
+    res.ip = p->code + e->pc;
+    res.depth = e->depth;
+    if (e == t->exits)
+    {
+        // a hoisted guard failed: the loop no longer runs as recorded
+        if (++t->entryExits >= TRACE_MAX_ENTRY_EXITS)
+            l->trace = NULL;
+        return res;
+    }
+    if (e->hits < 0 || ++e->hits < TRACE_SIDE_THRESHOLD || t->sideCount >= TRACE_MAX_SIDE)
+        return res;
+    e->hits = -1;
+    return record(p, pc, e->pc, e->depth, base, globals, e);
+}
+
+void traceShutdown(void)
+{
+    while (traces)
+    {
+        Trace *next = traces->next;
+        free(traces->exits);
+        free(traces);
+        traces = next;
+    }
+}
+
+#else
+
+TraceResume traceLoop(Proto *p, int32_t *ip, Value *base, Value *globals)
+{
+    (void)p;
+    (void)base;
+    (void)globals;
+    TraceResume res = {ip, 0};
+    return res;
+}
+
+void traceShutdown(void)
+{
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "bytecode.h"
+
+/* Tracing JIT for the VM's loops (x86-64 only).
+   Once a loop's back edge has been taken traceThreshold times, the
+   recorder runs one iteration itself and writes down what it did as
+   typed SSA instructions, with a guard wherever the iteration depended
+   on a type, a branch or an array bound. Loop-invariant loads and
+   guards move in front of the loop, repeated bounds checks go, and the
+   accesses of an induction variable lose theirs when one test in front
+   of the loop proves them in range. The result is a native loop whose
+   failing guards are side exits: they write the live values back to
+   the frame and the interpreter carries on at that instruction. An exit
+   taken often gets a side trace, which runs the rest of that iteration
+   and jumps back into the loop. */
+
+#define TRACE_THRESHOLD 50      // back edges before a loop is recorded
+#define TRACE_SIDE_THRESHOLD 20 // exits before one gets a side trace
+#define TRACE_MAX_ATTEMPTS 4    // recordings per loop before giving up
+
+/* per loop header, in Proto.loops */
+typedef struct TraceLoop
+{
+    int hits;
+    int attempts;
+    struct Trace *trace;
+} TraceLoop;
+
+/* where the VM carries on, with depth operands on the stack */
+typedef struct
+{
+    int32_t *ip;
+    int depth;
+} TraceResume;
+
+extern int traceThreshold; // --jit-threshold=N sets it too
+
+/* called by BC_LOOP with ip at the loop header and an empty operand
+   stack; records, runs or skips the loop's trace */
+TraceResume traceLoop(Proto *p, int32_t *ip, Value *base, Value *globals);
+void traceShutdown(void); // the machine code itself goes with jitShutdown
+
+#endif
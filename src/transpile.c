@@ -0,0 +1,1148 @@
+#include "transpile.h"
+#include "scope.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#ifndef SLANG_HOME
+#define SLANG_HOME "." // the Makefile sets it to the build tree
+#endif
+
+/* a C expression: a temporary, a variable or a constant */
+#define OPERAND 256
+typedef char Operand[OPERAND];
+#define NAME 80 // l_<name>
+#define CONDITION (3 * OPERAND)
+
+typedef struct
+{
+    char *text;
+    int len, cap;
+} Buf;
+
+/* the loop a continue goes on with, at its next<n> label */
+typedef struct
+{
+    int label;
+    int continued; // some continue jumps to it
+} LoopLabel;
+
+static Buf *out;       // the function being written
+static Buf functions;  // the finished ones
+static Buf constInit;  // main's setup of the string and big int constants
+static int constCount;
+static NameList globals;     // every global, as g_<name>
+static NameList globalBound; // names the script itself can bind
+static Scope *scope;
+static int temps; // t<n> (values), c<n> (callees), a<n> (arguments), b<n> (truths)
+static int depth; // indentation
+
+static struct ASTNode **defs; // every function definition: def<k>, fn<k>_<name>
+static int defCount, defCap;
+static int current = -1; // the function being written
+static int restarts;     // it makes tail calls to itself: it needs its start label
+static int eachRoots;    // e<n>: the arrays of the script's for-in loops, for collect()
+static int *eachLive;    // e<k>: the arrays of the function's for-in loops around this point
+static int eachCount, eachCap, eachBase;
+static LoopLabel innerLoop = {-1, 0};
+
+static const char *builtinIds[BI_COUNT] = {
+    "BI_LENGTH", "BI_READ_NUMBERS", "BI_READ_COLUMN", "BI_READ_LINE", "BI_OPEN_NUMBERS",
+    "BI_OPEN_COLUMN", "BI_READ_CHUNK", "BI_CLOSE_NUMBERS", "BI_EOF", "BI_VECTOR"};
+static const char *binaryFns[] = {"rtAdd", "rtSub", "rtMul", "rtDiv", "rtEq",
+                                  "rtNe", "rtLt", "rtLe", "rtGt", "rtGe"};
+static const char *testFns[] = {"rtTestEq", "rtTestNe", "rtTestLt", "rtTestLe", "rtTestGt", "rtTestGe"};
+
+static void emitStmt(struct ASTNode *node);
+static void emitExpr(struct ASTNode *node, char *dst);
+static void emitCondition(struct ASTNode *cond, char *dst);
+
+// ------------------- OUTPUT -------------------
+
+static void vappend(Buf *b, const char *fmt, va_list ap)
+{
+    for (;;)
+    {
+        va_list copy;
+        va_copy(copy, ap);
+        int room = b->cap - b->len;
+        int n = vsnprintf(b->text ? b->text + b->len : NULL, room, fmt, copy);
+        va_end(copy);
+        if (n < room)
+        {
+            b->len += n;
+            return;
+        }
+        while (b->cap - b->len <= n)
+            b->text = (char *)growArray(b->text, &b->cap, 1);
+    }
+}
+
+static void append(Buf *b, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vappend(b, fmt, ap);
+    va_end(ap);
+}
+
+static void indent(void)
+{
+    append(out, "%*s", 4 * depth, "");
+}
+
+static void line(const char *fmt, ...)
+{
+    va_list ap;
+    indent();
+    va_start(ap, fmt);
+    vappend(out, fmt, ap);
+    va_end(ap);
+    append(out, "\n");
+}
+
+/* a C string literal with the same bytes */
+static void appendString(Buf *b, const char *s)
+{
+    append(b, "\"");
+    for (; *s; ++s)
+    {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\' || ch == '?')
+            append(b, "\\%c", ch);
+        else if (ch == '\n')
+            append(b, "\\n");
+        else if (ch == '\t')
+            append(b, "\\t");
+        else if (ch < 32 || ch >= 127)
+            append(b, "\\%03o", ch);
+        else
+            append(b, "%c", ch);
+    }
+    append(b, "\"");
+}
+
+static void appendList(Operand *items, int count)
+{
+    for (int i = 0; i < count; ++i)
+        append(out, i ? ", %s" : "%s", items[i]);
+}
+
+// ------------------- NAMES -------------------
+
+static void localName(int i, char dst[NAME])
+{
+    const char *name = scope->locals.names[i];
+    // a repeated parameter name means the last one; earlier ones are renamed
+    if (findName(&scope->locals, name) == i)
+        snprintf(dst, NAME, "l_%s", name);
+    else
+        snprintf(dst, NAME, "l%d_%s", i, name);
+}
+
+static VarRef resolve(const char *name)
+{
+    return resolveName(scope, &globals, name);
+}
+
+/* the variable's value, UNDEF_VAL when unbound (a dynamic local falls
+   back to the global until it is bound) */
+static void varValue(VarRef r, char *dst)
+{
+    char l[NAME];
+    if (r.global < 0)
+        localName(r.local, dst);
+    else if (r.local < 0)
+        snprintf(dst, OPERAND, "g_%s", globals.names[r.global]);
+    else
+    {
+        localName(r.local, l);
+        snprintf(dst, OPERAND, "(%s != UNDEF_VAL ? %s : g_%s)", l, l, globals.names[r.global]);
+    }
+}
+
+static void storeVar(VarRef r, const char *v)
+{
+    char l[NAME];
+    if (r.global < 0)
+    {
+        localName(r.local, l);
+        line("%s = %s;", l, v);
+    }
+    else if (r.local < 0)
+        line("g_%s = %s;", globals.names[r.global], v);
+    else
+    {
+        localName(r.local, l);
+        line("if (%s == UNDEF_VAL && g_%s != UNDEF_VAL)", l, globals.names[r.global]);
+        line("    g_%s = %s;", globals.names[r.global], v);
+        line("else");
+        line("    %s = %s;", l, v);
+    }
+}
+
+/* `let` and function definitions bind in the current frame */
+static void declare(const char *name, const char *v)
+{
+    char l[NAME];
+    if (scope->isScript)
+    {
+        addName(&globals, name);
+        line("g_%s = %s;", name, v);
+    }
+    else
+    {
+        localName(findName(&scope->locals, name), l);
+        line("%s = %s;", l, v);
+    }
+}
+
+static void newTemp(char *dst)
+{
+    snprintf(dst, OPERAND, "t%d", temps++);
+}
+
+// ------------------- ROOTS -------------------
+
+static void findUserCall(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *n = *slot;
+    if (!n)
+        return;
+    if (n->type == NODE_FUNC_CALL && findBuiltin(n->funcCall.funcName) < 0)
+        *(int *)ctx = 1;
+    visitChildren(n, findUserCall, ctx);
+}
+
+/* n calls a user function, so the collector may run while it does:
+   values computed before it and used after it go on the shadow stack */
+static int makesCalls(struct ASTNode *n)
+{
+    int found = 0;
+    findUserCall(&n, &found);
+    return found;
+}
+
+/* the function's locals and for-in arrays onto the shadow stack;
+   returns how many were pushed (the script's are all in collect()) */
+static int holdFrame(void)
+{
+    char l[NAME];
+    if (scope->isScript)
+        return 0;
+    for (int i = 0; i < scope->locals.count; ++i)
+    {
+        localName(i, l);
+        line("rtHold(%s);", l);
+    }
+    for (int i = eachBase; i < eachCount; ++i)
+        line("rtHold(e%d);", eachLive[i]);
+    return scope->locals.count + eachCount - eachBase;
+}
+
+static void drop(int count)
+{
+    if (count > 0)
+        line("rtDrop(%d);", count);
+}
+
+// ------------------- EXPRESSIONS -------------------
+
+static void literal(struct ASTNode *node, char *dst)
+{
+    if (!node->num.isInt)
+    {
+        uint64_t bits;
+        memcpy(&bits, &node->num.value, sizeof(bits));
+        snprintf(dst, OPERAND, "(Value)0x%016" PRIx64 "u /* %g */", bits, node->num.value);
+        return;
+    }
+    int64_t i = node->num.intValue;
+    if (i >= SMALL_INT_MIN && i <= SMALL_INT_MAX)
+    {
+        snprintf(dst, OPERAND, "INT_VAL(%" PRId64 ")", i);
+        return;
+    }
+    append(&constInit, "    k%d = rtConstInt((int64_t)0x%016" PRIx64 "u);\n", constCount, (uint64_t)i);
+    snprintf(dst, OPERAND, "k%d", constCount++);
+}
+
+/* each value is held while a later one makes calls */
+static Operand *emitList(struct ASTNode **items, int count)
+{
+    Operand *ops = (Operand *)malloc(sizeof(Operand) * (count ? count : 1));
+    if (!ops)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    int last = -1, held = 0;
+    for (int i = 0; i < count; ++i)
+        if (makesCalls(items[i]))
+            last = i;
+    for (int i = 0; i < count; ++i)
+    {
+        emitExpr(items[i], ops[i]);
+        if (i < last)
+        {
+            line("rtHold(%s);", ops[i]);
+            held++;
+        }
+    }
+    drop(held);
+    return ops;
+}
+
+/* the one definition a call by this name can reach, when there is
+   exactly one and its arity matches: such calls go to it directly */
+static int directCallee(const char *name, int argc)
+{
+    int found = -1;
+    for (int k = 0; k < defCount; ++k)
+    {
+        if (strcmp(defs[k]->funcDef.funcName, name) != 0)
+            continue;
+        if (found >= 0)
+            return -1;
+        found = k;
+    }
+    return found >= 0 && defs[found]->funcDef.paramCount == argc ? found : -1;
+}
+
+static void emitBuiltin(struct ASTNode *node, int b, char *dst)
+{
+    int argc = node->funcCall.argCount;
+    if (argc != builtinArity(b))
+    {
+        newTemp(dst);
+        line("Value %s = builtinArityError(%s, %d);", dst, builtinIds[b], argc);
+        return;
+    }
+    if (b == BI_READ_CHUNK)
+    {
+        // the buffer variable is read without the unbound check and
+        // takes the (possibly new) array back
+        const char *buf = chunkBuffer(node);
+        Operand handle, max, bufv, v;
+        emitExpr(node->funcCall.args[0], handle);
+        if (buf)
+        {
+            varValue(resolve(buf), v);
+            newTemp(bufv);
+            line("Value %s = %s;", bufv, v);
+        }
+        int held = makesCalls(node->funcCall.args[2]);
+        if (held)
+            line("rtHold(%s);", handle);
+        if (held && buf)
+            line("rtHold(%s);", bufv);
+        emitExpr(node->funcCall.args[2], max);
+        drop(held ? 1 + (buf != NULL) : 0);
+        newTemp(dst);
+        if (!buf)
+        {
+            line("Value %s = builtinReadChunk(%s, NULL, %s);", dst, handle, max);
+            return;
+        }
+        line("Value %s = builtinReadChunk(%s, &%s, %s);", dst, handle, bufv, max);
+        storeVar(resolve(buf), bufv);
+        return;
+    }
+    Operand *args = emitList(node->funcCall.args, argc);
+    newTemp(dst);
+    if (b == BI_LENGTH)
+        line("Value %s = rtLength(%s);", dst, args[0]);
+    else if (argc == 0)
+        line("Value %s = callBuiltin(%s, NULL);", dst, builtinIds[b]);
+    else
+    {
+        indent();
+        append(out, "Value %s = callBuiltin(%s, (Value[]){", dst, builtinIds[b]);
+        appendList(args, argc);
+        append(out, "});\n");
+    }
+    free(args);
+}
+
+static void emitCall(struct ASTNode *node, char *dst)
+{
+    const char *name = node->funcCall.funcName;
+    int argc = node->funcCall.argCount;
+    int b = findBuiltin(name);
+    if (b >= 0)
+    {
+        emitBuiltin(node, b, dst);
+        return;
+    }
+
+    // the callee is checked before any argument is evaluated; on error
+    // the call is 0 and the arguments are skipped
+    Operand callee;
+    varValue(resolve(name), callee);
+    newTemp(dst);
+    int c = temps++;
+    line("Value %s = NUM_VAL(0.0);", dst);
+    line("NativeFn c%d = rtCallee(%s, \"%s\", %d);", c, callee, name, argc);
+    line("if (c%d)", c);
+    line("{");
+    depth++;
+    Operand *args = emitList(node->funcCall.args, argc);
+    Operand argv;
+    if (argc > 0)
+    {
+        indent();
+        append(out, "Value a%d[] = {", c);
+        appendList(args, argc);
+        append(out, "};\n");
+        snprintf(argv, OPERAND, "a%d", c);
+    }
+    else
+        strcpy(argv, "NULL");
+    free(args);
+    line("rtEnter();");
+    int held = holdFrame();
+    int k = directCallee(name, argc);
+    if (k >= 0)
+        line("%s = rtTailCalls(c%d == fn%d_%s ? fn%d_%s(%s) : c%d(%s));", dst, c, k, name, k, name, argv, c,
+             argv);
+    else
+        line("%s = rtTailCalls(c%d(%s));", dst, c, argv);
+    drop(held);
+    line("rtLeave();");
+    depth--;
+    line("}");
+}
+
+/* return f(...): when f is this function, the arguments become its
+   parameters and it starts over; any other callee is left to
+   rtTailCalls, which the caller's call site runs once this function
+   has returned, so tail calls take no C stack */
+static void emitTailCall(struct ASTNode *node)
+{
+    const char *name = node->funcCall.funcName;
+    int argc = node->funcCall.argCount;
+    Operand callee;
+    varValue(resolve(name), callee);
+    int c = temps++;
+    line("NativeFn c%d = rtCallee(%s, \"%s\", %d);", c, callee, name, argc);
+    line("if (!c%d)", c);
+    line("    return NUM_VAL(0.0);");
+    Operand *args = emitList(node->funcCall.args, argc);
+    if (argc > 0)
+    {
+        indent();
+        append(out, "Value a%d[] = {", c);
+        appendList(args, argc);
+        append(out, "};\n");
+    }
+    free(args);
+    line("if (c%d == fn%d_%s)", c, current, defs[current]->funcDef.funcName);
+    line("{");
+    depth++;
+    for (int i = 0; i < scope->locals.count; ++i)
+    {
+        char l[NAME];
+        localName(i, l);
+        if (i < argc)
+            line("%s = a%d[%d];", l, c, i);
+        else
+            line("%s = UNDEF_VAL;", l);
+    }
+    line("goto start;");
+    depth--;
+    line("}");
+    if (argc > 0)
+        line("return rtTail(c%d, a%d, %d);", c, c, argc);
+    else
+        line("return rtTail(c%d, NULL, 0);", c);
+    restarts = 1;
+}
+
+/* the element of an array access at index idx, already computed */
+static void emitElement(struct ASTNode *node, const char *idx, char *dst)
+{
+    Operand a;
+    VarRef r = resolve(node->ArrAccessNode.varName);
+    varValue(r, a);
+    newTemp(dst);
+    if (node->ArrAccessNode.inBounds && (r.local < 0 || r.global < 0))
+        line("Value %s = elementAt(%s, %s);", dst, a, idx);
+    else if (node->ArrAccessNode.knownArray && (r.local < 0 || r.global < 0))
+        line("Value %s = indexKnownArray(\"%s\", %s, %s);", dst, node->ArrAccessNode.varName, a, idx);
+    else
+        line("Value %s = indexArray(\"%s\", %s, %s);", dst, node->ArrAccessNode.varName, a, idx);
+}
+
+/* a binary operator's operands, the left held while the right makes calls */
+static void emitOperands(struct ASTNode *node, char *a, char *b)
+{
+    int held = makesCalls(node->binop.right);
+    emitExpr(node->binop.left, a);
+    if (held)
+        line("rtHold(%s);", a);
+    emitExpr(node->binop.right, b);
+    drop(held);
+}
+
+static void emitExpr(struct ASTNode *node, char *dst)
+{
+    Operand a, b;
+    if (!node)
+    {
+        strcpy(dst, "NUM_VAL(0.0)");
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_NUM:
+        literal(node, dst);
+        break;
+
+    case NODE_STR:
+        append(&constInit, "    k%d = STR_VAL(slLiteral(", constCount);
+        appendString(&constInit, node->str.text);
+        append(&constInit, "));\n");
+        snprintf(dst, OPERAND, "k%d", constCount++);
+        break;
+
+    case NODE_VAR:
+        varValue(resolve(node->varName), a);
+        newTemp(dst);
+        line("Value %s = rtGet(%s, \"%s\");", dst, a, node->varName);
+        break;
+
+    case NODE_BINOP:
+        emitOperands(node, a, b);
+        newTemp(dst);
+        line("Value %s = %s(%s, %s);", dst, binaryFns[node->binop.op], a, b);
+        break;
+
+    case NODE_LOGICAL:
+    {
+        char c[CONDITION];
+        emitCondition(node, c);
+        newTemp(dst);
+        line("Value %s = INT_VAL(%s);", dst, c);
+        break;
+    }
+
+    case NODE_ARRAY:
+    {
+        int count = node->ArrayNode.count;
+        Operand *items = emitList(node->ArrayNode.elements, count);
+        newTemp(dst);
+        if (count == 0)
+            line("Value %s = rtArray(0, NULL);", dst);
+        else
+        {
+            indent();
+            append(out, "Value %s = rtArray(%d, (Value[]){", dst, count);
+            appendList(items, count);
+            append(out, "});\n");
+        }
+        free(items);
+        break;
+    }
+
+    case NODE_ARR_ACCESS:
+        emitExpr(node->ArrAccessNode.index, b);
+        emitElement(node, b, dst);
+        break;
+
+    case NODE_FUNC_CALL:
+        emitCall(node, dst);
+        break;
+
+    default:
+        strcpy(dst, "NUM_VAL(0.0)");
+        break;
+    }
+}
+
+// ------------------- STATEMENTS -------------------
+
+/* a C condition; comparisons test without building the 0/1 value */
+static void emitCondition(struct ASTNode *cond, char *dst)
+{
+    Operand a, b;
+    if (cond->type == NODE_BINOP && cond->binop.op >= OP_EQ)
+    {
+        emitOperands(cond, a, b);
+        snprintf(dst, CONDITION, "%s(%s, %s)", testFns[cond->binop.op - OP_EQ], a, b);
+        return;
+    }
+    if (cond->type == NODE_LOGICAL)
+    {
+        // b<n>: the left operand's truth, then the right's when it decides
+        int k = temps++;
+        char c[CONDITION];
+        emitCondition(cond->logical.left, c);
+        line(cond->logical.op == LOGIC_NOT ? "int b%d = !(%s);" : "int b%d = %s;", k, c);
+        if (cond->logical.op != LOGIC_NOT)
+        {
+            line(cond->logical.op == LOGIC_AND ? "if (b%d)" : "if (!b%d)", k);
+            line("{");
+            depth++;
+            emitCondition(cond->logical.right, c);
+            line("b%d = %s;", k, c);
+            depth--;
+            line("}");
+        }
+        snprintf(dst, CONDITION, "b%d", k);
+        return;
+    }
+    emitExpr(cond, a);
+    snprintf(dst, CONDITION, "truthy(%s)", a);
+}
+
+/* between two statements nothing lives in a temporary: the roots are
+   collect()'s and, in a function, its locals and for-in arrays */
+static void safePoint(void)
+{
+    line("if (gcShouldCollect())");
+    if (scope->isScript)
+    {
+        line("    collect();");
+        return;
+    }
+    line("{");
+    depth++;
+    int held = holdFrame();
+    line("collect();");
+    drop(held);
+    depth--;
+    line("}");
+}
+
+static void emitBlock(struct ASTNode *node)
+{
+    line("{");
+    depth++;
+    emitStmt(node);
+    depth--;
+    line("}");
+}
+
+static int emitFunction(struct ASTNode *def);
+
+/* a break is C's; a continue skips to the end of the body, which goes
+   on with the loop's increment or last-trip check */
+static LoopLabel beginBody(void)
+{
+    LoopLabel enclosing = innerLoop;
+    innerLoop.label = temps++;
+    innerLoop.continued = 0;
+    return enclosing;
+}
+
+static void endBody(LoopLabel enclosing)
+{
+    if (innerLoop.continued)
+        line("next%d:;", innerLoop.label);
+    innerLoop = enclosing;
+}
+
+static void emitLoop(struct ASTNode *cond, struct ASTNode *body, struct ASTNode *incr)
+{
+    char c[CONDITION];
+    line("for (;;)");
+    line("{");
+    depth++;
+    if (cond)
+    {
+        emitCondition(cond, c);
+        line("if (!%s)", c);
+        line("    break;");
+    }
+    LoopLabel enclosing = beginBody();
+    emitStmt(body);
+    endBody(enclosing);
+    emitStmt(incr);
+    safePoint();
+    depth--;
+    line("}");
+}
+
+/* for-in: the bounds are computed once, and the counter is a C int */
+static void emitForIn(struct ASTNode *node)
+{
+    Operand a, b, c, v;
+    int k = temps++;
+    char arr[NAME];
+    if (node->forIn.array)
+    {
+        emitExpr(node->forIn.array, a);
+        // the script's safe points see only what collect() marks
+        if (scope->isScript)
+            snprintf(arr, NAME, "e%d", eachRoots++);
+        else
+            snprintf(arr, NAME, "e%d", k);
+        line(scope->isScript ? "%s = %s;" : "Value %s = %s;", arr, a);
+        if (!scope->isScript)
+        {
+            if (eachCount >= eachCap)
+                eachLive = (int *)growArray(eachLive, &eachCap, sizeof(int));
+            eachLive[eachCount++] = k;
+        }
+        line("Value f%d[3];", k);
+        line("if (eachBounds(%s, f%d, 0) > 0)", arr, k);
+    }
+    else
+    {
+        // range(start, end, step) evaluates its arguments as a call does
+        struct ASTNode *args[3] = {node->forIn.start, node->forIn.end, node->forIn.step};
+        int first = args[0] ? 0 : 1, argc = args[2] ? 3 : 2;
+        Operand *ops = emitList(args + first, argc - first);
+        strcpy(a, first ? "INT_VAL(0)" : ops[0]);
+        strcpy(b, ops[1 - first]);
+        strcpy(c, argc == 3 ? ops[2 - first] : "INT_VAL(1)");
+        free(ops);
+        line("Value r%d[3] = {%s, %s, %s}, f%d[3];", k, a, b, c, k);
+        line("if (rangeBounds(r%d, f%d, 0) > 0)", k, k);
+    }
+    line("{");
+    depth++;
+    line("int64_t last%d = AS_SMALL_INT(f%d[1]), step%d = AS_SMALL_INT(f%d[2]);", k, k, k, k);
+    line("for (int64_t i%d = AS_SMALL_INT(f%d[0]);; i%d += step%d)", k, k, k, k);
+    line("{");
+    depth++;
+    if (node->forIn.array)
+    {
+        struct ASTNode *e = node->forIn.array;
+        snprintf(v, OPERAND, "indexArray(\"%s\", %s, INT_VAL(i%d))", e->type == NODE_VAR ? e->varName : "in",
+                 arr, k);
+    }
+    else
+        snprintf(v, OPERAND, "INT_VAL(i%d)", k);
+    declare(node->forIn.varName, v);
+    LoopLabel enclosing = beginBody();
+    emitStmt(node->forIn.body);
+    endBody(enclosing);
+    line("if (i%d == last%d)", k, k);
+    line("    break;");
+    safePoint();
+    depth--;
+    line("}");
+    depth--;
+    line("}");
+    if (node->forIn.array && scope->isScript)
+        line("%s = UNDEF_VAL;", arr);
+    else if (node->forIn.array)
+        eachCount--;
+}
+
+static void emitStmt(struct ASTNode *node)
+{
+    Operand a, b, v;
+    char c[CONDITION];
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < node->block.count; ++i)
+            emitStmt(node->block.items[i]);
+        break;
+
+    case NODE_PRINT:
+        // each value is printed as soon as it is evaluated
+        for (int i = 0; i < node->print.count; ++i)
+        {
+            emitExpr(node->print.exprs[i], v);
+            line("rtPrint(%s, %d);", v, i == node->print.count - 1);
+        }
+        if (node->print.count == 0)
+            line("putchar('\\n');");
+        break;
+
+    case NODE_IF:
+        emitCondition(node->ifstmt.cond, c);
+        line("if (%s)", c);
+        emitBlock(node->ifstmt.thenBlock);
+        if (node->ifstmt.elseBlock)
+        {
+            line("else");
+            emitBlock(node->ifstmt.elseBlock);
+        }
+        break;
+
+    case NODE_SWITCH:
+    {
+        // C's switch picks the case, and its break leaves it as ours does
+        const CaseTable *t = &node->switchStmt.cases;
+        emitExpr(node->switchStmt.value, v);
+        line("switch (caseKey(%s))", v);
+        line("{");
+        for (int i = 0; i < node->switchStmt.bodyCount; ++i)
+        {
+            for (int j = 0; j < t->count; ++j)
+                if (t->targets[j] == i)
+                    line("case %" PRId64 ":", t->labels[j]);
+            if (t->otherwise == i)
+                line("default:");
+            emitBlock(node->switchStmt.bodies[i]);
+            line("break;");
+        }
+        line("}");
+        break;
+    }
+
+    case NODE_FOR:
+        emitStmt(node->forstmt.init);
+        emitLoop(node->forstmt.cond, node->forstmt.body, node->forstmt.incr);
+        break;
+
+    case NODE_WHILE:
+        // a while without condition never runs
+        if (node->WhileStmt.cond)
+            emitLoop(node->WhileStmt.cond, node->WhileStmt.body, NULL);
+        break;
+
+    case NODE_FOR_IN:
+        emitForIn(node);
+        break;
+
+    case NODE_ASSIGN:
+        emitExpr(node->assign.value, v);
+        if (node->assign.isLet)
+            declare(node->assign.varName, v);
+        else
+            storeVar(resolve(node->assign.varName), v);
+        break;
+
+    case NODE_ARR_ASSIGN:
+    {
+        emitExpr(node->arrAssign.index, a);
+        if (updateOperand(node))
+        {
+            // a[i] op= v: i is computed once
+            struct ASTNode *bin = node->arrAssign.value;
+            Operand old, operand;
+            emitElement(bin->binop.left, a, old);
+            int held = makesCalls(bin->binop.right);
+            if (held)
+            {
+                line("rtHold(%s);", a);
+                line("rtHold(%s);", old);
+            }
+            emitExpr(bin->binop.right, operand);
+            drop(2 * held);
+            newTemp(b);
+            line("Value %s = %s(%s, %s);", b, binaryFns[bin->binop.op], old, operand);
+        }
+        else
+        {
+            int held = makesCalls(node->arrAssign.value);
+            if (held)
+                line("rtHold(%s);", a);
+            emitExpr(node->arrAssign.value, b);
+            drop(held);
+        }
+        VarRef r = resolve(node->arrAssign.varName);
+        varValue(r, v);
+        if (node->arrAssign.inBounds && (r.local < 0 || r.global < 0))
+            line("setElementAt(%s, %s, %s);", v, a, b);
+        else if (node->arrAssign.knownArray && (r.local < 0 || r.global < 0))
+            line("storeKnownArray(\"%s\", %s, %s, %s);", node->arrAssign.varName, v, a, b);
+        else
+            line("storeArray(\"%s\", %s, %s, %s);", node->arrAssign.varName, v, a, b);
+        break;
+    }
+
+    case NODE_FUNC_DEF:
+    {
+        int k = emitFunction(node);
+        snprintf(v, OPERAND, "rtFunction(&def%d, fn%d_%s)", k, k, node->funcDef.funcName);
+        declare(node->funcDef.funcName, v);
+        break;
+    }
+
+    case NODE_RETURN:
+        // like the tree walker, a top-level return does nothing
+        if (scope->isScript)
+            break;
+        if (tailCall(node))
+        {
+            emitTailCall(tailCall(node));
+            break;
+        }
+        emitExpr(node->returnStmt.value, v);
+        line("return %s;", v);
+        break;
+
+    case NODE_BREAK:
+        line("break;");
+        break;
+
+    case NODE_CONTINUE:
+        line("goto next%d;", innerLoop.label);
+        innerLoop.continued = 1;
+        break;
+
+    case NODE_FUNC_CALL:
+        emitExpr(node, v);
+        line("(void)%s;", v);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// ------------------- FUNCTIONS -------------------
+
+/* numbers the definitions emitStmt will reach, so calls written before
+   a definition can name its C function */
+static void collectDefs(struct ASTNode *n)
+{
+    if (!n)
+        return;
+    switch (n->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < n->block.count; ++i)
+            collectDefs(n->block.items[i]);
+        break;
+    case NODE_IF:
+        collectDefs(n->ifstmt.thenBlock);
+        collectDefs(n->ifstmt.elseBlock);
+        break;
+    case NODE_FOR:
+        collectDefs(n->forstmt.init);
+        collectDefs(n->forstmt.body);
+        collectDefs(n->forstmt.incr);
+        break;
+    case NODE_WHILE:
+        if (n->WhileStmt.cond)
+            collectDefs(n->WhileStmt.body);
+        break;
+    case NODE_SWITCH:
+        for (int i = 0; i < n->switchStmt.bodyCount; ++i)
+            collectDefs(n->switchStmt.bodies[i]);
+        break;
+    case NODE_FOR_IN:
+        collectDefs(n->forIn.body);
+        break;
+    case NODE_FUNC_DEF:
+        if (defCount >= defCap)
+            defs = (struct ASTNode **)growArray(defs, &defCap, sizeof(struct ASTNode *));
+        defs[defCount++] = n;
+        collectDefs(n->funcDef.body);
+        break;
+    default:
+        break;
+    }
+}
+
+static int emitFunction(struct ASTNode *def)
+{
+    int k = 0;
+    while (defs[k] != def)
+        k++;
+
+    Buf body = {0}, code = {0};
+    Scope s;
+    beginFunctionScope(&s, def, &globalBound);
+    Buf *enclosingOut = out;
+    Scope *enclosing = scope;
+    int enclosingTemps = temps, enclosingDepth = depth;
+    int enclosingCurrent = current, enclosingRestarts = restarts;
+    int enclosingEachBase = eachBase;
+    LoopLabel enclosingLoop = innerLoop;
+    scope = &s;
+    temps = 0;
+    innerLoop.label = -1;
+    current = k;
+    restarts = 0;
+    eachBase = eachCount;
+
+    // the body first: the start label goes in only when it is used
+    out = &code;
+    depth = 1;
+    emitStmt(def->funcDef.body);
+    line("return NUM_VAL(0.0);");
+
+    out = &body;
+    depth = 0;
+    if (def->funcDef.memo)
+        line("static Value body%d(Value *args)", k);
+    else
+        line("static Value fn%d_%s(Value *args)", k, def->funcDef.funcName);
+    line("{");
+    depth++;
+    if (def->funcDef.paramCount == 0)
+        line("(void)args;");
+    for (int i = 0; i < s.locals.count; ++i)
+    {
+        char l[NAME];
+        localName(i, l);
+        if (i < def->funcDef.paramCount)
+            line("Value %s = args[%d];", l, i);
+        else
+            line("Value %s = UNDEF_VAL;", l);
+    }
+    if (restarts)
+        line("start:;");
+    safePoint();
+    append(&body, "%.*s", code.len, code.text);
+    depth--;
+    line("}");
+    line("");
+    if (def->funcDef.memo)
+    {
+        // the body may assign its parameters, and a tail call reuses the
+        // arguments' buffer: the result is stored under a copy
+        line("static Value fn%d_%s(Value *args)", k, def->funcDef.funcName);
+        line("{");
+        depth++;
+        line("Value result, key[MEMO_MAX_ARGS];");
+        line("if (memoFind(memo%d, args, &result))", k);
+        line("    return result;");
+        for (int i = 0; i < def->funcDef.paramCount; ++i)
+            line("key[%d] = args[%d];", i, i);
+        line("result = rtTailCalls(body%d(args));", k);
+        line("memoStore(memo%d, key, result);", k);
+        line("return result;");
+        depth--;
+        line("}");
+        line("");
+    }
+    append(&functions, "%.*s", body.len, body.text);
+
+    free(body.text);
+    free(code.text);
+    endScope(&s);
+    freeNames(&s.locals);
+    out = enclosingOut;
+    scope = enclosing;
+    temps = enclosingTemps;
+    depth = enclosingDepth;
+    current = enclosingCurrent;
+    restarts = enclosingRestarts;
+    eachBase = enclosingEachBase;
+    innerLoop = enclosingLoop;
+    return k;
+}
+
+// ------------------- PROGRAM -------------------
+
+void emitC(struct ASTNode *root, const char *source, FILE *f)
+{
+    collectDefs(root);
+    scanBindings(root, &globalBound);
+
+    Buf script = {0};
+    Scope scriptScope;
+    memset(&scriptScope, 0, sizeof(scriptScope));
+    scriptScope.isScript = 1;
+    out = &script;
+    scope = &scriptScope;
+    depth = 1;
+    if (root->type == NODE_BLOCK)
+        for (int i = 0; i < root->block.count; ++i)
+        {
+            emitStmt(root->block.items[i]);
+            safePoint();
+        }
+    else
+        emitStmt(root);
+
+    fprintf(f, "/* %s, compiled to C by slangc --emit-c */\n", source);
+    fprintf(f, "#include \"native.h\"\n\n");
+    for (int i = 0; i < globals.count; ++i)
+        fprintf(f, "static Value g_%s = UNDEF_VAL;\n", globals.names[i]);
+    for (int i = 0; i < constCount; ++i)
+        fprintf(f, "static Value k%d;\n", i);
+    for (int i = 0; i < eachRoots; ++i)
+        fprintf(f, "static Value e%d = UNDEF_VAL;\n", i);
+    fprintf(f, "\n");
+    for (int k = 0; k < defCount; ++k)
+    {
+        fprintf(f, "static struct ASTNode def%d = {.type = NODE_FUNC_DEF, .funcDef = {.funcName = \"%s\", .paramCount = %d}};\n",
+                k, defs[k]->funcDef.funcName, defs[k]->funcDef.paramCount);
+        fprintf(f, "static Value fn%d_%s(Value *args);\n", k, defs[k]->funcDef.funcName);
+        if (defs[k]->funcDef.memo)
+            fprintf(f, "static MemoTable *memo%d;\n", k);
+    }
+    fprintf(f, "\nstatic void collect(void)\n{\n");
+    for (int i = 0; i < globals.count; ++i)
+        fprintf(f, "    markValue(g_%s);\n", globals.names[i]);
+    for (int i = 0; i < eachRoots; ++i)
+        fprintf(f, "    markValue(e%d);\n", i);
+    fprintf(f, "    for (Value *v = rtRoots; v < rtTop; ++v)\n        markValue(*v);\n");
+    fprintf(f, "    sweepObjects();\n}\n\n");
+    fwrite(functions.text, 1, functions.len, f);
+    fprintf(f, "int main(void)\n{\n");
+    for (int k = 0; k < defCount; ++k)
+        if (defs[k]->funcDef.memo)
+            fprintf(f, "    memo%d = newMemoTable(%d);\n", k, defs[k]->funcDef.paramCount);
+    fwrite(constInit.text, 1, constInit.len, f);
+    fwrite(script.text, 1, script.len, f);
+    fprintf(f, "    numCloseAll();\n    return 0;\n}\n");
+
+    free(script.text);
+    free(functions.text);
+    free(constInit.text);
+    free(defs);
+    free(eachLive);
+    eachLive = NULL;
+    eachCap = 0;
+    memset(&functions, 0, sizeof(functions));
+    memset(&constInit, 0, sizeof(constInit));
+    defs = NULL;
+    defCount = defCap = constCount = temps = eachRoots = 0;
+    freeNames(&globals);
+    freeNames(&globalBound);
+    out = NULL;
+    scope = NULL;
+}
+
+int buildNative(struct ASTNode *root, const char *source)
+{
+    const char *home = getenv("SLANG_HOME");
+    if (!home || !*home)
+        home = SLANG_HOME;
+    if (strchr(home, '\'') || strchr(source, '\''))
+    {
+        printf("Error: cannot build from a path with a quote in it\n");
+        return 1;
+    }
+
+    char csrc[] = "/tmp/slangcXXXXXX.c";
+    int fd = mkstemps(csrc, 2);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f)
+    {
+        perror("build");
+        return 1;
+    }
+    emitC(root, source, f);
+    fclose(f);
+
+    // prog.slc -> prog
+    int len = (int)strlen(source) - 4;
+    size_t size = 2 * strlen(home) + strlen(source) + sizeof(csrc) + 64;
+    char *cmd = (char *)malloc(size);
+    if (!cmd)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    snprintf(cmd, size, "cc -O2 -I'%s/src' -o '%.*s' '%s' '%s/libslang.a' -lm", home, len, source, csrc,
+             home);
+    int status = system(cmd);
+    remove(csrc);
+    free(cmd);
+    if (status != 0)
+    {
+        printf("Error: cc could not build '%.*s'\n", len, source);
+        return 1;
+    }
+    return 0;
+}
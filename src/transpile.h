@@ -0,0 +1,19 @@
+#ifndef TRANSPILE_H
+#define TRANSPILE_H
+
+#include <stdio.h>
+#include "ast.h"
+
+/* Ahead-of-time compiler to C. The script's variables become C globals,
+   each function's locals C locals and each function a C function; the
+   program links against the runtime the engines use (libslang.a, with
+   native.h on top), so it prints exactly what the VM prints. */
+
+/* writes the C for a parsed program; source is named in a comment */
+void emitC(struct ASTNode *root, const char *source, FILE *out);
+
+/* --build: compiles dir/prog.slc to the executable dir/prog with cc -O2;
+   returns the exit status for main */
+int buildNative(struct ASTNode *root, const char *source);
+
+#endif
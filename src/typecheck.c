@@ -0,0 +1,393 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Type checking. Each frame is walked in evaluation order with the type
+   each of its variables holds at that point: after x = "a", x holds a
+   string until something binds it again, where paths join it holds
+   whatever any of them gave it, and a loop is walked until what its
+   variables hold at the top stops changing. A variable that is not
+   definitely bound, a script variable some function assigns and a
+   parameter of a function whose calls are not all known hold anything.
+
+   reportTypeErrors prints the operations those types make fail every
+   time they run (indexing a number, arithmetic on an array, ordering a
+   string against a number, length() of a number) before the program
+   starts; they still fail when they run. markKnownArrays marks the
+   array reads and writes whose variable holds an array there, which the
+   engines index without checking what the variable holds. */
+
+typedef struct
+{
+    ProgramTypes *types;
+    Frame *frame;
+    StaticType *env; // per frame name; TYPE_NONE before anything binds it
+    char *fixed;     // script names some function assigns; NULL in functions
+    NameList bound;
+    int quiet;  // in a loop still being walked to its fixed point
+    int report; // reportTypeErrors; markKnownArrays otherwise
+    StaticType *breaks, *continues; // the innermost loop's, met; NULL outside loops
+    int continued; // its body has a continue
+} Checker;
+
+static const char *typeNames[] = {"nothing", "number", "string", "array", "anything"};
+
+static void checkExpr(struct ASTNode **slot, void *ctx);
+static void checkStmt(Checker *c, struct ASTNode *s);
+
+static StaticType varType(Checker *c, const char *name)
+{
+    int i = findName(&c->frame->names, name);
+    if (i < 0 || (c->fixed && c->fixed[i]) || findName(&c->bound, name) < 0 || c->env[i] == TYPE_NONE)
+        return TYPE_ANY;
+    return c->env[i];
+}
+
+static StaticType typeOf(Checker *c, struct ASTNode *e)
+{
+    if (!e)
+        return TYPE_ANY;
+    switch (e->type)
+    {
+    case NODE_VAR:
+        return varType(c, e->varName);
+    case NODE_BINOP:
+        return binopType(e->binop.op, typeOf(c, e->binop.left), typeOf(c, e->binop.right));
+    case NODE_LOGICAL:
+        return TYPE_NUMBER;
+    case NODE_NUM:
+    case NODE_STR:
+    case NODE_ARRAY:
+    case NODE_FUNC_CALL: // only builtins have a type
+        return exprType(c->frame, e, &c->bound);
+    default:
+        return TYPE_ANY;
+    }
+}
+
+/* the runtime's message, once, before the program runs */
+static void warn(Checker *c, const char *fmt, ...)
+{
+    if (!c->report || c->quiet)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    printf("Warning: ");
+    vprintf(fmt, ap);
+    va_end(ap);
+    if (c->frame->def)
+        printf(" (in function '%s')", sourceName(c->frame->def->funcDef.funcName));
+    printf("\n");
+}
+
+/* a binding of name to a t; strong when it certainly replaces the old one */
+static void bindVar(Checker *c, const char *name, StaticType t, int strong)
+{
+    int i = findName(&c->frame->names, name);
+    if (i >= 0)
+        c->env[i] = strong ? t : meet(c->env[i], t);
+}
+
+static void checkArray(Checker *c, const char *name, int *known)
+{
+    StaticType t = varType(c, name);
+    if (t == TYPE_NUMBER || t == TYPE_STRING)
+        warn(c, "'%s' is not an array", sourceName(name));
+    if (!c->report && !c->quiet)
+        *known = t == TYPE_ARRAY;
+}
+
+static void checkExpr(struct ASTNode **slot, void *ctx)
+{
+    struct ASTNode *e = *slot;
+    Checker *c = (Checker *)ctx;
+    if (!e)
+        return;
+    visitChildren(e, checkExpr, c);
+    if (e->type == NODE_BINOP)
+    {
+        StaticType l = typeOf(c, e->binop.left), r = typeOf(c, e->binop.right);
+        if (binopFails(e->binop.op, l, r))
+            warn(c, "unsupported operand types for '%s': %s and %s", opSymbols[e->binop.op],
+                 typeNames[l], typeNames[r]);
+    }
+    else if (e->type == NODE_ARR_ACCESS)
+        checkArray(c, e->ArrAccessNode.varName, &e->ArrAccessNode.knownArray);
+    else if (e->type == NODE_FUNC_CALL && e->funcCall.argCount == 1 &&
+             strcmp(e->funcCall.funcName, "length") == 0 &&
+             typeOf(c, e->funcCall.args[0]) == TYPE_NUMBER)
+        warn(c, "length() argument must be an array or string");
+    else if (e->type == NODE_FUNC_CALL && chunkBuffer(e))
+        bindVar(c, chunkBuffer(e), TYPE_ARRAY, 0);
+}
+
+/* the types where two paths meet */
+static void meetEnv(Checker *c, StaticType *other)
+{
+    for (int i = 0; i < c->frame->names.count; ++i)
+        c->env[i] = meet(c->env[i], other[i]);
+}
+
+static StaticType *copyEnv(Checker *c)
+{
+    int n = c->frame->names.count;
+    StaticType *copy = (StaticType *)malloc(sizeof(StaticType) * (n ? n : 1));
+    if (!copy)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, c->env, sizeof(StaticType) * n);
+    return copy;
+}
+
+/* s may not run: its bindings are not definite afterwards */
+static void checkMaybe(Checker *c, struct ASTNode *s, struct ASTNode *then)
+{
+    int mark = c->bound.count;
+    checkStmt(c, s);
+    checkStmt(c, then);
+    popNames(&c->bound, mark);
+}
+
+/* a break or continue: the types it leaves with join those where it goes */
+static void addJump(Checker *c, StaticType *paths)
+{
+    for (int i = 0; i < c->frame->names.count; ++i)
+        paths[i] = meet(paths[i], c->env[i]);
+}
+
+/* one trip: a continue goes on with incr, where what the body bound after
+   it may not be */
+static void checkTrip(Checker *c, struct ASTNode *body, struct ASTNode *incr)
+{
+    int mark = c->bound.count;
+    checkStmt(c, body);
+    if (c->continued)
+        popNames(&c->bound, mark);
+    meetEnv(c, c->continues);
+    checkStmt(c, incr);
+    popNames(&c->bound, mark);
+}
+
+static void checkLoop(Checker *c, struct ASTNode **cond, struct ASTNode *body, struct ASTNode *incr)
+{
+    int n = c->frame->names.count;
+    StaticType *top = copyEnv(c);
+    StaticType *outerBreaks = c->breaks, *outerContinues = c->continues;
+    int outerContinued = c->continued;
+    c->breaks = (StaticType *)calloc(n ? n : 1, sizeof(StaticType));
+    c->continues = (StaticType *)calloc(n ? n : 1, sizeof(StaticType));
+    if (!c->breaks || !c->continues)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    c->continued = 0;
+    // walked quietly until the types at the top hold for every trip,
+    // then once more to report and mark
+    c->quiet++;
+    for (;;)
+    {
+        checkExpr(cond, c);
+        checkTrip(c, body, incr);
+        meetEnv(c, top);
+        if (memcmp(c->env, top, sizeof(StaticType) * n) == 0)
+            break;
+        memcpy(top, c->env, sizeof(StaticType) * n);
+    }
+    c->quiet--;
+    checkExpr(cond, c);
+    checkTrip(c, body, incr);
+    // it ends at the top, or at a break
+    memcpy(c->env, top, sizeof(StaticType) * n);
+    meetEnv(c, c->breaks);
+    free(top);
+    free(c->breaks);
+    free(c->continues);
+    c->breaks = outerBreaks;
+    c->continues = outerContinues;
+    c->continued = outerContinued;
+}
+
+static void checkStmt(Checker *c, struct ASTNode *s)
+{
+    if (!s)
+        return;
+    switch (s->type)
+    {
+    case NODE_BLOCK:
+        for (int i = 0; i < s->block.count; ++i)
+            checkStmt(c, s->block.items[i]);
+        break;
+    case NODE_IF:
+    {
+        checkExpr(&s->ifstmt.cond, c);
+        StaticType *before = copyEnv(c);
+        checkMaybe(c, s->ifstmt.thenBlock, NULL);
+        StaticType *then = copyEnv(c);
+        memcpy(c->env, before, sizeof(StaticType) * c->frame->names.count);
+        checkMaybe(c, s->ifstmt.elseBlock, NULL);
+        meetEnv(c, then);
+        free(before);
+        free(then);
+        break;
+    }
+    case NODE_SWITCH:
+    {
+        checkExpr(&s->switchStmt.value, c);
+        int n = c->frame->names.count;
+        StaticType *before = copyEnv(c), *outerBreaks = c->breaks;
+        // one case runs, or none when there is no default; a break
+        // leaves the switch
+        StaticType *after = s->switchStmt.cases.otherwise < 0 ? copyEnv(c)
+                                                               : (StaticType *)calloc(n ? n : 1, sizeof(StaticType));
+        c->breaks = (StaticType *)calloc(n ? n : 1, sizeof(StaticType));
+        if (!after || !c->breaks)
+        {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < s->switchStmt.bodyCount; ++i)
+        {
+            memcpy(c->env, before, sizeof(StaticType) * n);
+            checkMaybe(c, s->switchStmt.bodies[i], NULL);
+            addJump(c, after);
+        }
+        memcpy(c->env, after, sizeof(StaticType) * n);
+        meetEnv(c, c->breaks);
+        free(before);
+        free(after);
+        free(c->breaks);
+        c->breaks = outerBreaks;
+        break;
+    }
+    case NODE_FOR:
+        checkStmt(c, s->forstmt.init);
+        checkLoop(c, &s->forstmt.cond, s->forstmt.body, s->forstmt.incr);
+        break;
+    case NODE_WHILE:
+        checkLoop(c, &s->WhileStmt.cond, s->WhileStmt.body, NULL);
+        break;
+    case NODE_FOR_IN:
+    {
+        struct ASTNode *none = NULL, **args[] = {&s->forIn.start, &s->forIn.end, &s->forIn.step};
+        if (s->forIn.array)
+        {
+            checkExpr(&s->forIn.array, c);
+            StaticType t = typeOf(c, s->forIn.array);
+            if (t == TYPE_NUMBER || t == TYPE_STRING)
+                warn(c, "for-in needs an array or range()");
+        }
+        else
+        {
+            int fails = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                checkExpr(args[i], c);
+                StaticType t = *args[i] ? typeOf(c, *args[i]) : TYPE_NUMBER;
+                fails |= t == TYPE_STRING || t == TYPE_ARRAY;
+            }
+            if (fails)
+                warn(c, "range() arguments must be integers");
+        }
+        // every trip binds the variable first; there may be none
+        StaticType *before = copyEnv(c);
+        int mark = c->bound.count;
+        bindVar(c, s->forIn.varName, s->forIn.array ? TYPE_ANY : TYPE_NUMBER, 1);
+        addName(&c->bound, s->forIn.varName);
+        checkLoop(c, &none, s->forIn.body, NULL);
+        popNames(&c->bound, mark);
+        meetEnv(c, before);
+        free(before);
+        break;
+    }
+    case NODE_ASSIGN:
+    {
+        checkExpr(&s->assign.value, c);
+        // a function's assignment to a local it has not bound yet may
+        // go to the global instead
+        const char *name = s->assign.varName;
+        int strong = s->assign.isLet || !c->frame->def || findName(&c->bound, name) >= 0;
+        bindVar(c, name, typeOf(c, s->assign.value), strong);
+        bindStmt(c->frame, &c->bound, s);
+        break;
+    }
+    case NODE_ARR_ASSIGN:
+        checkExpr(&s->arrAssign.index, c);
+        checkExpr(&s->arrAssign.value, c);
+        checkArray(c, s->arrAssign.varName, &s->arrAssign.knownArray);
+        break;
+    case NODE_FUNC_DEF:
+        // its body is a frame of its own
+        bindVar(c, s->funcDef.funcName, TYPE_ANY, 1);
+        bindStmt(c->frame, &c->bound, s);
+        break;
+    case NODE_BREAK:
+        addJump(c, c->breaks);
+        break;
+    case NODE_CONTINUE:
+        addJump(c, c->continues);
+        c->continued = 1;
+        break;
+    default:
+        checkExpr(&s, c);
+        break;
+    }
+}
+
+static void checkFrame(ProgramTypes *t, Frame *f, char *fixed, int report)
+{
+    Checker c = {t, f, NULL, fixed, {0}, 0, report, NULL, NULL, 0};
+    c.env = (StaticType *)calloc(f->names.count ? f->names.count : 1, sizeof(StaticType));
+    if (!c.env)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    struct ASTNode *def = f->def;
+    for (int i = 0; def && i < def->funcDef.paramCount; ++i)
+    {
+        bindVar(&c, def->funcDef.params[i], f->params ? f->params[i] : TYPE_ANY, 1);
+        addName(&c.bound, def->funcDef.params[i]);
+    }
+    checkStmt(&c, def ? def->funcDef.body : t->root);
+    freeNames(&c.bound);
+    free(c.env);
+}
+
+static void checkProgram(struct ASTNode *root, int report)
+{
+    ProgramTypes t;
+    inferProgram(&t, root);
+    int n = t.script.names.count;
+    char *fixed = (char *)calloc(n ? n : 1, 1);
+    if (!fixed)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < n; ++i)
+        for (int k = 0; k < t.functions.count; ++k)
+            fixed[i] |= functionBinding(t.functions.items[k], t.script.names.names[i]) == WRITES;
+
+    checkFrame(&t, &t.script, fixed, report);
+    for (int i = 0; i < t.functions.count; ++i)
+        checkFrame(&t, &t.frames[i], NULL, report);
+    free(fixed);
+    freeProgramTypes(&t);
+}
+
+void reportTypeErrors(struct ASTNode *root)
+{
+    checkProgram(root, 1);
+}
+
+void markKnownArrays(struct ASTNode *root)
+{
+    checkProgram(root, 0);
+}
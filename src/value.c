@@ -0,0 +1,112 @@
+#include "value.h"
+#include "object.h"
+#include "ast.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+/* nested arrays deeper than this (or cyclic ones) print as [...] */
+#define MAX_PRINT_DEPTH 32
+
+static void printArrayValue(ObjArray *arr, int depth)
+{
+    if (depth >= MAX_PRINT_DEPTH)
+    {
+        printf("[...]");
+        return;
+    }
+    printf("[");
+    for (int j = 0; j < arr->len; j++)
+    {
+        Value v = arr->data[j];
+        if (IS_ARRAY(v))
+            printArrayValue(AS_ARRAY(v), depth + 1);
+        else
+            printValueQuoted(v);
+        if (j < arr->len - 1)
+            printf(", ");
+    }
+    printf("]");
+}
+
+void printValue(Value v)
+{
+    if (IS_NUM(v))
+        printf("%g", AS_NUM(v));
+    else if (IS_INT(v))
+        printf("%" PRId64, AS_INT(v));
+    else if (IS_NIL(v))
+        printf("nil");
+    else if (IS_BOOL(v))
+        printf(AS_BOOL(v) ? "true" : "false");
+    else if (IS_STR(v))
+        fwrite(slChars(AS_STR(v)), 1, AS_STR(v)->len, stdout);
+    else if (IS_ARRAY(v))
+        printArrayValue(AS_ARRAY(v), 0);
+    else if (IS_FUNC(v))
+        printf("<function %s>", AS_FUNC(v)->def->funcDef.funcName);
+}
+
+void printValueQuoted(Value v)
+{
+    if (IS_STR(v))
+    {
+        putchar('"');
+        printValue(v);
+        putchar('"');
+    }
+    else
+        printValue(v);
+}
+
+int valuesEqual(Value a, Value b)
+{
+    if (IS_INT(a) && IS_INT(b))
+        return AS_INT(a) == AS_INT(b);
+    if (IS_NUMERIC(a) && IS_NUMERIC(b))
+        return toNumber(a) == toNumber(b);
+    if (IS_STR(a) && IS_STR(b))
+        return slEquals(AS_STR(a), AS_STR(b));
+    return a == b; // nil, booleans, arrays and functions by identity
+}
+
+/* numbers are true when non-zero, strings when non-empty */
+int isTruthy(Value v)
+{
+    if (IS_NUM(v))
+        return AS_NUM(v) != 0.0;
+    if (IS_INT(v))
+        return AS_INT(v) != 0;
+    if (IS_NIL(v))
+        return 0;
+    if (IS_BOOL(v))
+        return AS_BOOL(v);
+    if (IS_STR(v))
+        return AS_STR(v)->len > 0;
+    return 1;
+}
+
+SlString *valueToString(Value v)
+{
+    if (IS_STR(v))
+        return AS_STR(v);
+    if (IS_INT(v))
+        return slFromInt(AS_INT(v));
+    if (IS_NUM(v))
+        return slFromNumber(AS_NUM(v));
+    return NULL;
+}
+
+const char *valueTypeName(Value v)
+{
+    if (IS_NUMERIC(v))
+        return "number";
+    if (IS_NIL(v))
+        return "nil";
+    if (IS_BOOL(v))
+        return "boolean";
+    if (IS_STR(v))
+        return "string";
+    if (IS_ARRAY(v))
+        return "array";
+    return "function";
+}
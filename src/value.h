@@ -0,0 +1,126 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* A Value is a NaN-boxed 64-bit word:
+     - any double that is not one of the quiet NaNs below is a number
+     - 0x7ffc... : nil, false, true
+     - 0x7ffd... : 48-bit signed small integer
+     - 0xfffc... : pointer to a heap object (string, array, function,
+                   or an int64 that does not fit in 48 bits)
+   Arithmetic only ever produces the canonical NaN 0x7ff8..., so the
+   tagged patterns cannot appear as the result of a computation. */
+typedef uint64_t Value;
+
+typedef enum
+{
+    OBJ_STRING,
+    OBJ_ARRAY,
+    OBJ_FUNCTION,
+    OBJ_INT
+} ObjType;
+
+/* common header of every heap object */
+typedef struct Obj
+{
+    struct Obj *next; // all objects, for the collector
+    unsigned char type;
+    unsigned char marked;
+    unsigned char pinned; // owned by the AST, never collected
+} Obj;
+
+/* boxed integer outside the 48-bit inline range; declared here so that
+   AS_INT can read it inline */
+typedef struct ObjInt
+{
+    Obj obj;
+    int64_t value;
+} ObjInt;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+#define TAG_INT ((uint64_t)0x0001000000000000)
+#define PAYLOAD_MASK ((uint64_t)0x0000ffffffffffff)
+
+#define SMALL_INT_MIN (-((int64_t)1 << 47))
+#define SMALL_INT_MAX (((int64_t)1 << 47) - 1)
+
+#define NIL_VAL ((Value)(QNAN | 1))
+#define FALSE_VAL ((Value)(QNAN | 2))
+#define TRUE_VAL ((Value)(QNAN | 3))
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+/* marks an unbound variable slot inside the engines; never a script value */
+#define UNDEF_VAL ((Value)(QNAN | 4))
+
+static inline Value numToValue(double num)
+{
+    Value v;
+    memcpy(&v, &num, sizeof(double));
+    return v;
+}
+
+static inline double valueToNum(Value v)
+{
+    double num;
+    memcpy(&num, &v, sizeof(double));
+    return num;
+}
+
+#define NUM_VAL(n) numToValue(n)
+/* only for values known to fit in 48 bits; see intValue() */
+#define INT_VAL(i) ((Value)(QNAN | TAG_INT | ((uint64_t)(int64_t)(i) & PAYLOAD_MASK)))
+#define OBJ_VAL(o) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(o)))
+
+#define IS_NUM(v) (((v) & QNAN) != QNAN)
+#define IS_SMALL_INT(v) (((v) >> 48) == 0x7ffd)
+#define IS_NIL(v) ((v) == NIL_VAL)
+#define IS_BOOL(v) (((v) | 1) == TRUE_VAL)
+#define IS_OBJ(v) (((v) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+
+#define AS_NUM(v) valueToNum(v)
+#define AS_SMALL_INT(v) (((int64_t)((v) << 16)) >> 16)
+#define AS_BOOL(v) ((v) == TRUE_VAL)
+#define AS_OBJ(v) ((Obj *)(uintptr_t)((v) & ~(SIGN_BIT | QNAN)))
+
+#define OBJ_TYPE(v) (AS_OBJ(v)->type)
+#define IS_STR(v) (IS_OBJ(v) && OBJ_TYPE(v) == OBJ_STRING)
+#define IS_ARRAY(v) (IS_OBJ(v) && OBJ_TYPE(v) == OBJ_ARRAY)
+#define IS_FUNC(v) (IS_OBJ(v) && OBJ_TYPE(v) == OBJ_FUNCTION)
+#define IS_BIG_INT(v) (IS_OBJ(v) && OBJ_TYPE(v) == OBJ_INT)
+#define IS_INT(v) (IS_SMALL_INT(v) || IS_BIG_INT(v))
+#define AS_INT(v) (IS_SMALL_INT(v) ? AS_SMALL_INT(v) : ((ObjInt *)AS_OBJ(v))->value)
+
+#define AS_STR(v) ((struct SlString *)AS_OBJ(v))
+#define AS_ARRAY(v) ((struct ObjArray *)AS_OBJ(v))
+#define AS_FUNC(v) ((struct ObjFunction *)AS_OBJ(v))
+#define STR_VAL(s) OBJ_VAL(s)
+
+/* doubles and integers both count as numeric */
+#define IS_NUMERIC(v) (IS_NUM(v) || IS_INT(v))
+static inline double toNumber(Value v)
+{
+    if (IS_NUM(v))
+        return valueToNum(v);
+    return (double)AS_INT(v);
+}
+
+Value boxInt(int64_t i); // heap ObjInt, see intValue()
+
+/* intValue: inline when it fits in 48 bits, boxed otherwise */
+static inline Value intValue(int64_t i)
+{
+    if (i >= SMALL_INT_MIN && i <= SMALL_INT_MAX)
+        return INT_VAL(i);
+    return boxInt(i);
+}
+
+void printValue(Value v);       // as `print` shows it
+void printValueQuoted(Value v); // strings in double quotes (array elements)
+int valuesEqual(Value a, Value b);
+int isTruthy(Value v);
+struct SlString *valueToString(Value v); // NULL for arrays and functions
+const char *valueTypeName(Value v);
+
+#endif
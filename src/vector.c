@@ -0,0 +1,428 @@
+#include "vector.h"
+#include "object.h"
+#include "runtime.h"
+#include "slstring.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define VECTOR_SIMD 1
+#endif
+
+#define BLOCK 64 // elements a block of doubles is computed in
+
+typedef struct
+{
+    int strict; // i < limit rather than i <= limit
+    int length; // the limit is length(limit)
+    int dst;
+    int count;
+    char ops[VECTOR_MAX_OPS]; // 'a' an element, 'A' an input, '$' or an operator
+    int args[VECTOR_MAX_OPS]; // the input of an 'a' or an 'A'
+} Kernel;
+
+static int parseKernel(const char *s, int inputs, Kernel *k)
+{
+    if (s[0] != '<' && s[0] != '=')
+        return 0;
+    k->strict = *s++ == '<';
+    k->length = *s == '#';
+    s += k->length;
+    if (*s < 'a' || *s >= 'a' + inputs)
+        return 0;
+    k->dst = *s - 'a';
+    k->count = 0;
+    int depth = 0;
+    for (const char *p = s + 1; *p; ++p)
+    {
+        char op = *p;
+        int arg = 0;
+        if (k->count == VECTOR_MAX_OPS)
+            return 0;
+        if (op >= 'a' && op < 'a' + inputs)
+            arg = op - 'a', op = 'a', depth++;
+        else if (op >= 'A' && op < 'A' + inputs)
+            arg = op - 'A', op = 'A', depth++;
+        else if (op == '$')
+            depth++;
+        else if ((op == '+' || op == '-' || op == '*' || op == '/') && depth >= 2)
+            depth--;
+        else
+            return 0;
+        if (depth > VECTOR_MAX_DEPTH)
+            return 0;
+        k->ops[k->count] = op;
+        k->args[k->count++] = arg;
+    }
+    return depth == 1;
+}
+
+/* the first counter value the condition stops; INT64_MIN when it stops
+   every one (or is an error the loop should report) */
+static int64_t loopEnd(Value limit, int strict)
+{
+    if (IS_SMALL_INT(limit))
+        return AS_SMALL_INT(limit) + !strict;
+    if (IS_BIG_INT(limit))
+        return AS_INT(limit) > 0 ? INT64_MAX : INT64_MIN;
+    if (!IS_NUM(limit))
+        return INT64_MIN;
+    double d = AS_NUM(limit);
+    if (!(d > -1e15)) // NaN too
+        return INT64_MIN;
+    if (d > 1e15)
+        return INT64_MAX;
+    int64_t t = (int64_t)d;
+    return strict ? t + (d > (double)t) : t - (d < (double)t) + 1;
+}
+
+// ------------------- ELEMENTS -------------------
+
+/* l op r as binaryOp computes it, for small ints and doubles; 0 when it
+   would print an error or make a big int */
+static int elementOp(char op, Value l, Value r, Value *out)
+{
+    if (IS_SMALL_INT(l) && IS_SMALL_INT(r))
+    {
+        int64_t a = AS_SMALL_INT(l), b = AS_SMALL_INT(r), res;
+        switch (op)
+        {
+        case '+':
+            res = a + b;
+            break;
+        case '-':
+            res = a - b;
+            break;
+        case '*':
+            if (__builtin_mul_overflow(a, b, &res))
+                return 0;
+            break;
+        default:
+            if (b == 0)
+                return 0;
+            *out = NUM_VAL((double)a / (double)b);
+            return 1;
+        }
+        if (res < SMALL_INT_MIN || res > SMALL_INT_MAX)
+            return 0;
+        *out = INT_VAL(res);
+        return 1;
+    }
+    double a = toNumber(l), b = toNumber(r);
+    switch (op)
+    {
+    case '+':
+        *out = NUM_VAL(a + b);
+        return 1;
+    case '-':
+        *out = NUM_VAL(a - b);
+        return 1;
+    case '*':
+        *out = NUM_VAL(a * b);
+        return 1;
+    default:
+        if (b == 0.0)
+            return 0;
+        *out = NUM_VAL(a / b);
+        return 1;
+    }
+}
+
+/* iteration i on its own; 0 (having stored nothing) when the loop has
+   to run it */
+static int runElement(const Kernel *k, Value *inputs, int64_t i)
+{
+    Value stack[VECTOR_MAX_DEPTH];
+    int sp = 0;
+    for (int p = 0; p < k->count; ++p)
+    {
+        Value v;
+        switch (k->ops[p])
+        {
+        case 'a':
+            v = AS_ARRAY(inputs[k->args[p]])->data[i];
+            if (!IS_SMALL_INT(v) && !IS_NUM(v))
+                return 0;
+            stack[sp++] = v;
+            break;
+        case 'A':
+            stack[sp++] = inputs[k->args[p]];
+            break;
+        case '$':
+            stack[sp++] = INT_VAL(i);
+            break;
+        default:
+            sp--;
+            if (!elementOp(k->ops[p], stack[sp - 1], stack[sp], &v))
+                return 0;
+            stack[sp - 1] = v;
+            break;
+        }
+    }
+    AS_ARRAY(inputs[k->dst])->data[i] = stack[0];
+    return 1;
+}
+
+// ------------------- BLOCKS -------------------
+
+static int hasZero(const Value *y, int n)
+{
+    for (int j = 0; j < n; ++j)
+        if (AS_NUM(y[j]) == 0.0)
+            return 1;
+    return 0;
+}
+
+/* r = x op y from element j on */
+static void columnTail(char op, const Value *x, const Value *y, Value *r, int j, int n)
+{
+    for (; j < n; ++j)
+    {
+        double a = AS_NUM(x[j]), b = AS_NUM(y[j]);
+        r[j] = NUM_VAL(op == '+' ? a + b : op == '-' ? a - b : op == '*' ? a * b : a / b);
+    }
+}
+
+#ifdef VECTOR_SIMD
+#define COLUMN_LOOP(width, load, store, apply)                                             \
+    for (; j + (width) <= n; j += (width))                                                 \
+    store((double *)(r + j), apply(load((const double *)(x + j)), load((const double *)(y + j))))
+
+__attribute__((target("avx2"))) static void columnAvx2(char op, const Value *x, const Value *y,
+                                                      Value *r, int n)
+{
+    int j = 0;
+    switch (op)
+    {
+    case '+':
+        COLUMN_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd);
+        break;
+    case '-':
+        COLUMN_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd);
+        break;
+    case '*':
+        COLUMN_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd);
+        break;
+    default:
+        COLUMN_LOOP(4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd);
+        break;
+    }
+    columnTail(op, x, y, r, j, n);
+}
+
+static void columnSse2(char op, const Value *x, const Value *y, Value *r, int n)
+{
+    int j = 0;
+    switch (op)
+    {
+    case '+':
+        COLUMN_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd);
+        break;
+    case '-':
+        COLUMN_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd);
+        break;
+    case '*':
+        COLUMN_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd);
+        break;
+    default:
+        COLUMN_LOOP(2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd);
+        break;
+    }
+    columnTail(op, x, y, r, j, n);
+}
+#endif
+
+/* r = x op y on n doubles; 0 for a zero divisor */
+static int column(char op, const Value *x, const Value *y, Value *r, int n)
+{
+    if (op == '/' && hasZero(y, n))
+        return 0;
+#ifdef VECTOR_SIMD
+    static int avx2 = -1;
+    if (avx2 < 0)
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+    if (avx2)
+        columnAvx2(op, x, y, r, n);
+    else
+        columnSse2(op, x, y, r, n);
+#else
+    columnTail(op, x, y, r, 0, n);
+#endif
+    return 1;
+}
+
+/* x op y on n small ints; 0 when a result is not one */
+static int intColumn(char op, const int64_t *x, const int64_t *y, int64_t *r, int n)
+{
+    int fits = 1;
+    switch (op)
+    {
+    case '+':
+        for (int j = 0; j < n; ++j)
+            r[j] = x[j] + y[j];
+        break;
+    case '-':
+        for (int j = 0; j < n; ++j)
+            r[j] = x[j] - y[j];
+        break;
+    default:
+        for (int j = 0; j < n; ++j)
+            fits &= !__builtin_mul_overflow(x[j], y[j], &r[j]);
+        break;
+    }
+    for (int j = 0; j < n; ++j)
+        fits &= r[j] >= SMALL_INT_MIN && r[j] <= SMALL_INT_MAX;
+    return fits;
+}
+
+static void toDoubles(const int64_t *x, Value *r, int n)
+{
+    for (int j = 0; j < n; ++j)
+        r[j] = NUM_VAL((double)x[j]);
+}
+
+typedef struct
+{
+    const Value *doubles; // NULL: the column is ints
+    const int64_t *ints;
+} Column;
+
+/* n iterations from i, operator by operator over the whole block, on
+   columns of small ints or of doubles; 0 (having stored nothing) when
+   an indexed column holds anything else, a result leaves the small ints
+   or a divisor is zero */
+static int runBlock(const Kernel *k, Value *inputs, int64_t i, int n)
+{
+    Value doubles[VECTOR_MAX_DEPTH][BLOCK];
+    int64_t ints[VECTOR_MAX_DEPTH][BLOCK];
+    Column stack[VECTOR_MAX_DEPTH];
+    int sp = 0;
+    for (int p = 0; p < k->count; ++p)
+    {
+        Column *c = &stack[sp];
+        switch (k->ops[p])
+        {
+        case 'a':
+        {
+            const Value *e = AS_ARRAY(inputs[k->args[p]])->data + i;
+            int isInt = IS_SMALL_INT(e[0]), same = 1;
+            for (int j = 0; j < n; ++j)
+                same &= isInt ? IS_SMALL_INT(e[j]) : IS_NUM(e[j]);
+            if (!same)
+                return 0;
+            if (isInt)
+                for (int j = 0; j < n; ++j)
+                    ints[sp][j] = AS_SMALL_INT(e[j]);
+            *c = isInt ? (Column){NULL, ints[sp]} : (Column){e, NULL};
+            break;
+        }
+        case 'A':
+        {
+            Value v = inputs[k->args[p]];
+            if (IS_SMALL_INT(v))
+                for (int j = 0; j < n; ++j)
+                    ints[sp][j] = AS_SMALL_INT(v);
+            else
+                for (int j = 0; j < n; ++j)
+                    doubles[sp][j] = v;
+            *c = IS_SMALL_INT(v) ? (Column){NULL, ints[sp]} : (Column){doubles[sp], NULL};
+            break;
+        }
+        case '$':
+            for (int j = 0; j < n; ++j)
+                ints[sp][j] = i + j;
+            *c = (Column){NULL, ints[sp]};
+            break;
+        default:
+        {
+            char op = k->ops[p];
+            Column *x = &stack[sp - 2], *y = &stack[sp - 1];
+            sp -= 2;
+            c = x;
+            if (x->ints && y->ints && op != '/')
+            {
+                if (!intColumn(op, x->ints, y->ints, ints[sp], n))
+                    return 0;
+                *c = (Column){NULL, ints[sp]};
+                break;
+            }
+            // an int meets a double, or is divided: as binaryOp does
+            if (x->ints)
+                toDoubles(x->ints, doubles[sp], n), x->doubles = doubles[sp];
+            if (y->ints)
+                toDoubles(y->ints, doubles[sp + 1], n), y->doubles = doubles[sp + 1];
+            if (!column(op, x->doubles, y->doubles, doubles[sp], n))
+                return 0;
+            *c = (Column){doubles[sp], NULL};
+            break;
+        }
+        }
+        sp++;
+    }
+    Value *dst = AS_ARRAY(inputs[k->dst])->data + i;
+    if (stack[0].doubles)
+        memmove(dst, stack[0].doubles, sizeof(Value) * n);
+    else
+        for (int j = 0; j < n; ++j)
+            dst[j] = INT_VAL(stack[0].ints[j]);
+    return 1;
+}
+
+// ------------------- LOOPS -------------------
+
+/* end is lowered to the length of every array the kernel indexes */
+static int checkInputs(const Kernel *k, Value *inputs, int64_t *end)
+{
+    for (int p = -1; p < k->count; ++p)
+    {
+        char op = p < 0 ? 'a' : k->ops[p];
+        Value v = inputs[p < 0 ? k->dst : k->args[p]];
+        if (op == 'a')
+        {
+            if (!IS_ARRAY(v))
+                return 0;
+            if (AS_ARRAY(v)->len < *end)
+                *end = AS_ARRAY(v)->len;
+        }
+        else if (op == 'A' && !IS_SMALL_INT(v) && !IS_NUM(v))
+            return 0;
+    }
+    return 1;
+}
+
+Value runVectorLoop(Value kernel, Value args)
+{
+    if (!IS_ARRAY(args) || AS_ARRAY(args)->len < 2)
+        return NUM_VAL(0.0);
+    ObjArray *a = AS_ARRAY(args);
+    Value start = a->data[0];
+    Value *inputs = a->data + 2;
+    Kernel k;
+    if (!IS_STR(kernel) || a->len - 2 > VECTOR_MAX_INPUTS || !IS_SMALL_INT(start) ||
+        !parseKernel(slChars(AS_STR(kernel)), a->len - 2, &k))
+        return start;
+    Value limit = a->data[1];
+    if (k.length) // only arrays: anything else is up to the loop
+        limit = IS_ARRAY(limit) ? INT_VAL(AS_ARRAY(limit)->len) : NIL_VAL;
+    int64_t i = AS_SMALL_INT(start), end = loopEnd(limit, k.strict);
+    if (i < 0 || !checkInputs(&k, inputs, &end) || i >= end)
+        return start;
+
+    int64_t from = i;
+    while (i < end)
+    {
+        int n = end - i < BLOCK ? (int)(end - i) : BLOCK;
+        if (runBlock(&k, inputs, i, n))
+        {
+            i += n;
+            continue;
+        }
+        int64_t stop = i + n;
+        while (i < stop && runElement(&k, inputs, i))
+            i++;
+        if (i < stop)
+            break;
+    }
+    stats.vectorElements += (uint64_t)(i - from);
+    return i == from ? start : INT_VAL(i);
+}
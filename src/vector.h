@@ -0,0 +1,30 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "value.h"
+
+/* Element-wise array loops run in one go (the @vector builtin, see
+   vectorize.c). The optimizer turns the init of
+
+       for (let i = <start>; i < <limit>; i = i + 1) { c[i] = <expr>; }
+
+   into let i = @vector(<kernel>, [<start>, <limit>, <inputs>...]): the
+   kernel runs the iterations it can and returns where the loop goes on.
+
+   A kernel is a string: '<' (or '=' for <=), '#' when the limit is
+   length(<limit>), the store's array, then expr in postfix. Operands are 'a' + k, element i of inputs[k]; 'A' + k,
+   inputs[k] itself; '$', i. Operators are + - * /. */
+
+#define VECTOR_MAX_INPUTS 26
+#define VECTOR_MAX_DEPTH 8
+#define VECTOR_MAX_OPS 48
+
+/* Iterations stop before the first one that would not run exactly as
+   the loop runs it: an index out of range, an element or input that is
+   not a small int or a double, a division by zero, an int result that
+   leaves the small range. The loop does that one and the rest. Blocks
+   of 64 are computed an operator at a time over columns of ints or of
+   doubles, the doubles with SSE2, or AVX2 where the CPU has it. */
+Value runVectorLoop(Value kernel, Value args);
+
+#endif
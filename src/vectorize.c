@@ -0,0 +1,260 @@
+#include "optimize.h"
+#include "analysis.h"
+#include "runtime.h"
+#include "vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Loop vectorization. A counted loop whose body is one element-wise store
+
+       for (let i = <start>; i < <limit>; i = i + 1) { c[i] = <expr>; }
+
+   where expr is built from +, -, * and / on numbers, variables, i and
+   a[i], and the limit from numbers, variables and length() of arrays and
+   strings, or is length() of any variable, gets a kernel (see vector.h): its init becomes
+
+       let i = @vector(<kernel>, [<start>, <limit>, <inputs>...]);
+
+   The body binds no variable and resizes no array, so the limit and the
+   inputs keep the values they have when the loop starts, and iteration i
+   reads and writes element i only: the kernel may run the iterations in
+   blocks. It returns the first one it could not run exactly as the loop
+   would, and the loop goes on from there. */
+
+#define MIN_TRIPS 8 // a loop to a constant below this runs faster as it is
+
+typedef struct
+{
+    FrameWalk *walk;
+    const char *counter;
+    char kernel[VECTOR_MAX_OPS + 4]; // room for "<#", the store and a '\0'
+    int prefix, length, depth;      // expr starts at kernel[prefix + 1]
+    NodeList inputs; // what the kernel's letters stand for
+    char roles[VECTOR_MAX_INPUTS]; // 'a' (indexed) or 'A'
+} Kernel;
+
+static int isVar(struct ASTNode *n, const char *name)
+{
+    return n && n->type == NODE_VAR && strcmp(n->varName, name) == 0;
+}
+
+static int isBound(Kernel *k, const char *name)
+{
+    return findName(&k->walk->bound, name) >= 0;
+}
+
+static struct ASTNode *newVar(const char *name)
+{
+    struct ASTNode *v = newNode(NODE_VAR);
+    snprintf(v->varName, sizeof(v->varName), "%s", name);
+    return v;
+}
+
+static struct ASTNode *copyExpr(struct ASTNode *n)
+{
+    struct ASTNode *m = newNode(n->type);
+    if (!m)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    *m = *n;
+    switch (n->type)
+    {
+    case NODE_BINOP:
+        m->binop.left = copyExpr(n->binop.left);
+        m->binop.right = copyExpr(n->binop.right);
+        break;
+    case NODE_FUNC_CALL:
+        m->funcCall.funcName = strdup(n->funcCall.funcName);
+        m->funcCall.args = malloc(sizeof(struct ASTNode *) * n->funcCall.argCount);
+        for (int i = 0; i < n->funcCall.argCount; ++i)
+            m->funcCall.args[i] = copyExpr(n->funcCall.args[i]);
+        break;
+    default:
+        break; // numbers and variables
+    }
+    return m;
+}
+
+/* evaluating e twice gives the same number and reports nothing */
+static int isQuietLimit(Kernel *k, struct ASTNode *e)
+{
+    Frame *f = k->walk->frame;
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return 1;
+    case NODE_VAR:
+        return !isVar(e, k->counter) && isBound(k, e->varName);
+    case NODE_BINOP:
+        return (e->binop.op == OP_ADD || e->binop.op == OP_SUB || e->binop.op == OP_MUL) &&
+               isQuietLimit(k, e->binop.left) && isQuietLimit(k, e->binop.right) &&
+               exprType(f, e->binop.left, &k->walk->bound) == TYPE_NUMBER &&
+               exprType(f, e->binop.right, &k->walk->bound) == TYPE_NUMBER;
+    case NODE_FUNC_CALL:
+    {
+        if (findBuiltin(e->funcCall.funcName) != BI_LENGTH || e->funcCall.argCount != 1)
+            return 0;
+        struct ASTNode *arg = e->funcCall.args[0];
+        if (arg->type != NODE_VAR || isVar(arg, k->counter) || !isBound(k, arg->varName))
+            return 0;
+        StaticType t = nameType(f, arg->varName);
+        return t == TYPE_ARRAY || t == TYPE_STRING;
+    }
+    default:
+        return 0;
+    }
+}
+
+/* v when e is length(v) of a bound variable v: the kernel can take the
+   length of an array itself, and leave anything else to the loop */
+static struct ASTNode *lengthArg(Kernel *k, struct ASTNode *e)
+{
+    if (e->type != NODE_FUNC_CALL || findBuiltin(e->funcCall.funcName) != BI_LENGTH ||
+        e->funcCall.argCount != 1)
+        return NULL;
+    struct ASTNode *arg = e->funcCall.args[0];
+    return arg->type == NODE_VAR && !isVar(arg, k->counter) && isBound(k, arg->varName) ? arg : NULL;
+}
+
+static int emit(Kernel *k, char c, int pushes)
+{
+    if (k->length == VECTOR_MAX_OPS)
+        return 0;
+    k->kernel[k->prefix + 1 + k->length++] = c;
+    k->depth += pushes;
+    return k->depth <= VECTOR_MAX_DEPTH;
+}
+
+/* the letter of an input: a variable used as role says, or a number */
+static int emitInput(Kernel *k, struct ASTNode *e, char role)
+{
+    for (int i = 0; i < k->inputs.count; ++i)
+    {
+        struct ASTNode *in = k->inputs.items[i];
+        if (k->roles[i] == role && in->type == e->type &&
+            (e->type == NODE_VAR ? strcmp(in->varName, e->varName) == 0 : sameExpr(in, e)))
+            return emit(k, role + i, 1);
+    }
+    if (k->inputs.count == VECTOR_MAX_INPUTS)
+        return 0;
+    k->roles[k->inputs.count] = role;
+    addNode(&k->inputs, copyExpr(e));
+    return emit(k, role + k->inputs.count - 1, 1);
+}
+
+static int emitExpr(Kernel *k, struct ASTNode *e)
+{
+    switch (e->type)
+    {
+    case NODE_NUM:
+        return emitInput(k, e, 'A');
+    case NODE_VAR:
+        if (isVar(e, k->counter))
+            return emit(k, '$', 1);
+        return isBound(k, e->varName) && emitInput(k, e, 'A');
+    case NODE_ARR_ACCESS:
+    {
+        struct ASTNode v = {.type = NODE_VAR};
+        snprintf(v.varName, sizeof(v.varName), "%s", e->ArrAccessNode.varName);
+        return isVar(e->ArrAccessNode.index, k->counter) && !isVar(&v, k->counter) &&
+               isBound(k, v.varName) && emitInput(k, &v, 'a');
+    }
+    case NODE_BINOP:
+    {
+        static const char ops[] = {[OP_ADD] = '+', [OP_SUB] = '-', [OP_MUL] = '*', [OP_DIV] = '/'};
+        if (e->binop.op > OP_DIV)
+            return 0;
+        return emitExpr(k, e->binop.left) && emitExpr(k, e->binop.right) &&
+               emit(k, ops[e->binop.op], -1);
+    }
+    default:
+        return 0;
+    }
+}
+
+/* the store of a loop body, if that is all it is */
+static struct ASTNode *onlyStore(struct ASTNode *body)
+{
+    if (body && body->type == NODE_BLOCK && body->block.count == 1)
+        body = body->block.items[0];
+    return body && body->type == NODE_ARR_ASSIGN ? body : NULL;
+}
+
+static int vectorizeLoop(FrameWalk *w, struct ASTNode *block, int at, void *ctx)
+{
+    (void)ctx;
+    struct ASTNode *loop = block->block.items[at];
+    if (loop->type != NODE_FOR)
+        return 0;
+    struct ASTNode *init = loop->forstmt.init, *cond = loop->forstmt.cond;
+    struct ASTNode *incr = loop->forstmt.incr, *store = onlyStore(loop->forstmt.body);
+    if (!cond || cond->type != NODE_BINOP || (cond->binop.op != OP_LT && cond->binop.op != OP_LE) ||
+        cond->binop.left->type != NODE_VAR || !store)
+        return 0;
+    const char *i = cond->binop.left->varName;
+    if (!incr || incr->type != NODE_ASSIGN || incr->assign.isLet || strcmp(incr->assign.varName, i) != 0 ||
+        incr->assign.value->type != NODE_BINOP || incr->assign.value->binop.op != OP_ADD ||
+        !isVar(incr->assign.value->binop.left, i) || incr->assign.value->binop.right->type != NODE_NUM ||
+        !incr->assign.value->binop.right->num.isInt || incr->assign.value->binop.right->num.intValue != 1)
+        return 0;
+    if (init ? init->type != NODE_ASSIGN || strcmp(init->assign.varName, i) != 0
+             : findName(&w->bound, i) < 0)
+        return 0;
+
+    struct ASTNode *limit = cond->binop.right;
+    if (limit->type == NODE_NUM && limit->num.value < MIN_TRIPS)
+        return 0;
+
+    // the store's array is input 'a'
+    Kernel k = {.walk = w, .counter = i, .kernel = {cond->binop.op == OP_LT ? '<' : '='}, .roles = {'a'}};
+    struct ASTNode *array = lengthArg(&k, limit);
+    k.prefix = 1;
+    if (array && !isQuietLimit(&k, limit))
+        k.kernel[k.prefix++] = '#', limit = array;
+    k.kernel[k.prefix] = 'a';
+    addNode(&k.inputs, newVar(store->arrAssign.varName));
+    int ok = isVar(store->arrAssign.index, i) && !isVar(k.inputs.items[0], i) &&
+             isBound(&k, store->arrAssign.varName) && isQuietLimit(&k, limit) &&
+             emitExpr(&k, store->arrAssign.value) && k.depth == 1;
+    if (!ok)
+    {
+        for (int j = 0; j < k.inputs.count; ++j)
+            freeNode(k.inputs.items[j]);
+        free(k.inputs.items);
+        return 0;
+    }
+
+    struct ASTNode *args = newNode(NODE_ARRAY);
+    args->ArrayNode.count = k.inputs.count + 2;
+    args->ArrayNode.elements = malloc(sizeof(struct ASTNode *) * args->ArrayNode.count);
+    args->ArrayNode.elements[0] = init ? init->assign.value : newVar(i);
+    args->ArrayNode.elements[1] = copyExpr(limit);
+    memcpy(args->ArrayNode.elements + 2, k.inputs.items, sizeof(struct ASTNode *) * k.inputs.count);
+    free(k.inputs.items);
+
+    struct ASTNode *call = newNode(NODE_FUNC_CALL);
+    call->funcCall.funcName = strdup("@vector");
+    call->funcCall.argCount = 2;
+    call->funcCall.args = malloc(sizeof(struct ASTNode *) * 2);
+    call->funcCall.args[0] = newNode(NODE_STR);
+    call->funcCall.args[0]->str.text = strdup(k.kernel);
+    call->funcCall.args[1] = args;
+    if (!init)
+    {
+        init = loop->forstmt.init = newNode(NODE_ASSIGN);
+        snprintf(init->assign.varName, sizeof(init->assign.varName), "%s", i);
+    }
+    init->assign.value = call;
+    return 0;
+}
+
+void vectorizeLoops(struct ASTNode *root)
+{
+    ProgramTypes types;
+    inferProgram(&types, root);
+    walkLoops(&types, vectorizeLoop, NULL);
+    freeProgramTypes(&types);
+}
@@ -0,0 +1,706 @@
+#include "vm.h"
+#include "object.h"
+#include "runtime.h"
+#include "ast.h"
+#include "jit.h"
+#include "trace.h"
+#include "memo.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STACK_MAX (1 << 20)
+#define FRAMES_MAX 4096
+/* temporaries an expression may push on top of a frame's locals */
+#define STACK_SLACK 1024
+
+/* GCC and Clang dispatch through a table of label addresses; other
+   compilers (or -DSLANG_NO_COMPUTED_GOTO) use the portable switch */
+#if defined(__GNUC__) && !defined(SLANG_NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO 1
+#endif
+
+/* keep GCC from merging the per-instruction dispatch jumps back into
+   one shared jump, which would undo the point of threaded dispatch */
+#if defined(USE_COMPUTED_GOTO) && !defined(__clang__)
+#define DISPATCH_LOOP __attribute__((optimize("no-gcse", "no-crossjumping")))
+#else
+#define DISPATCH_LOOP
+#endif
+
+typedef struct
+{
+    Proto *proto;
+    int32_t *ip;
+    Value *base; // first local (parameters first)
+} CallFrame;
+
+static Program *program = NULL;
+static Value *stack = NULL;
+static Value *vmGlobals = NULL;
+static CallFrame *frames = NULL;
+
+// ------------------- HELPERS -------------------
+
+static void undefinedVariable(const char *name)
+{
+    printf("Error: variable '%s' not found\n", name);
+}
+
+/* the VM's roots are its globals and everything on the value stack */
+static void collect(Value *sp)
+{
+    for (int i = 0; i < program->globalCount; ++i)
+        markValue(vmGlobals[i]);
+    for (Value *v = stack; v < sp; ++v)
+        markValue(*v);
+    sweepObjects();
+}
+
+static Value *makeArray(Value *sp, int n)
+{
+    ObjArray *arr = newArray(n);
+    for (int i = 0; i < n; ++i)
+        arr->data[i] = sp[i - n];
+    sp -= n;
+    *sp++ = OBJ_VAL(arr);
+    return sp;
+}
+
+/* arithmetic with the int and double fast paths inline; everything
+   else (strings, overflow, division) goes through binaryOp */
+#define ARITH(op, cop)                                                \
+    {                                                                 \
+        Value r = sp[-1], l = sp[-2];                                 \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            sp[-2] = intValue(AS_SMALL_INT(l) cop AS_SMALL_INT(r));   \
+        else if (IS_NUM(l) && IS_NUM(r))                              \
+            sp[-2] = NUM_VAL(AS_NUM(l) cop AS_NUM(r));                \
+        else                                                          \
+            sp[-2] = binaryOp(op, l, r);                              \
+        sp--;                                                         \
+    }
+
+#define ARITH_CONST(op, cop)                                          \
+    {                                                                 \
+        Value r = consts[*ip++], l = sp[-1];                          \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            sp[-1] = intValue(AS_SMALL_INT(l) cop AS_SMALL_INT(r));   \
+        else if (IS_NUM(l) && IS_NUM(r))                              \
+            sp[-1] = NUM_VAL(AS_NUM(l) cop AS_NUM(r));                \
+        else                                                          \
+            sp[-1] = binaryOp(op, l, r);                              \
+    }
+
+/* compare-and-branch: jumps when the comparison is false */
+#define COMPARE_JUMP(op, cop)                                         \
+    {                                                                 \
+        int off = *ip++;                                              \
+        Value r = sp[-1], l = sp[-2];                                 \
+        int t;                                                        \
+        sp -= 2;                                                      \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            t = AS_SMALL_INT(l) cop AS_SMALL_INT(r);                  \
+        else if (IS_NUM(l) && IS_NUM(r))                              \
+            t = AS_NUM(l) cop AS_NUM(r);                              \
+        else                                                          \
+            t = truthy(binaryOp(op, l, r));                           \
+        if (!t)                                                       \
+            ip += off;                                                \
+    }
+
+#define COMPARE(op, cop)                                              \
+    {                                                                 \
+        Value r = sp[-1], l = sp[-2];                                 \
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r))                       \
+            sp[-2] = INT_VAL(AS_SMALL_INT(l) cop AS_SMALL_INT(r));    \
+        else if (IS_NUM(l) && IS_NUM(r))                              \
+            sp[-2] = INT_VAL(AS_NUM(l) cop AS_NUM(r));                \
+        else                                                          \
+            sp[-2] = binaryOp(op, l, r);                              \
+        sp--;                                                         \
+    }
+
+// ------------------- DISPATCH LOOP -------------------
+
+DISPATCH_LOOP int runProgram(Program *prog)
+{
+    program = prog;
+    stack = (Value *)malloc(sizeof(Value) * STACK_MAX);
+    frames = (CallFrame *)malloc(sizeof(CallFrame) * FRAMES_MAX);
+    vmGlobals = (Value *)malloc(sizeof(Value) * (prog->globalCount ? prog->globalCount : 1));
+    if (!stack || !frames || !vmGlobals)
+    {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < prog->globalCount; ++i)
+        vmGlobals[i] = UNDEF_VAL;
+    jitInit(vmGlobals, stack + STACK_MAX - STACK_SLACK, FRAMES_MAX);
+
+    int status = 0;
+    CallFrame *frame = frames;
+    frame->proto = prog->protos[0];
+    frame->base = stack;
+    int32_t *ip = frame->proto->code;
+    Value *sp = stack + frame->proto->localCount; // the hidden locals of script loops
+    for (Value *slot = stack; slot < sp; ++slot)
+        *slot = UNDEF_VAL;
+    Value *base = stack;
+    Value *consts = frame->proto->consts;
+    char **localNames = frame->proto->localNames;
+    char **globalNames = prog->globalNames;
+    Value *globals = vmGlobals; // kept in a register by the loop
+    int callArgc = 0;           // BC_CALL's operand, or BC_TAIL_CALL's
+
+#ifdef USE_COMPUTED_GOTO
+#define LABEL_ADDRESS(op) &&L_##op,
+    static void *dispatchTable[] = {OPCODES(LABEL_ADDRESS)};
+#undef LABEL_ADDRESS
+#define CASE(op) L_##op:
+#define DISPATCH() goto *dispatchTable[*ip++]
+    DISPATCH();
+#else
+#define CASE(op) case op:
+#define DISPATCH() continue
+    for (;;)
+    {
+        switch (*ip++)
+        {
+#endif
+
+    CASE(BC_CONST)
+    {
+        *sp++ = consts[*ip++];
+        DISPATCH();
+    }
+    CASE(BC_POP)
+    {
+        sp--;
+        DISPATCH();
+    }
+    CASE(BC_DUP)
+    {
+        *sp = sp[-1];
+        sp++;
+        DISPATCH();
+    }
+    CASE(BC_GET_LOCAL)
+    {
+        int s = *ip++;
+        Value v = base[s];
+        if (v == UNDEF_VAL)
+        {
+            undefinedVariable(localNames[s]);
+            v = NUM_VAL(0.0);
+        }
+        *sp++ = v;
+        DISPATCH();
+    }
+    CASE(BC_SET_LOCAL)
+    {
+        base[*ip++] = *--sp;
+        DISPATCH();
+    }
+    CASE(BC_GET_GLOBAL)
+    {
+        int g = *ip++;
+        Value v = globals[g];
+        if (v == UNDEF_VAL)
+        {
+            undefinedVariable(globalNames[g]);
+            v = NUM_VAL(0.0);
+        }
+        *sp++ = v;
+        DISPATCH();
+    }
+    CASE(BC_SET_GLOBAL)
+    {
+        globals[*ip++] = *--sp;
+        DISPATCH();
+    }
+    CASE(BC_GET_VAR)
+    {
+        int s = ip[0], g = ip[1];
+        ip += 2;
+        Value v = base[s] != UNDEF_VAL ? base[s] : globals[g];
+        if (v == UNDEF_VAL)
+        {
+            undefinedVariable(localNames[s]);
+            v = NUM_VAL(0.0);
+        }
+        *sp++ = v;
+        DISPATCH();
+    }
+    CASE(BC_SET_VAR)
+    {
+        int s = ip[0], g = ip[1];
+        ip += 2;
+        Value v = *--sp;
+        if (base[s] == UNDEF_VAL && globals[g] != UNDEF_VAL)
+            globals[g] = v;
+        else
+            base[s] = v;
+        DISPATCH();
+    }
+    CASE(BC_PEEK_VAR)
+    {
+        int s = ip[0], g = ip[1];
+        ip += 2;
+        Value v = s >= 0 ? base[s] : UNDEF_VAL;
+        if (v == UNDEF_VAL && g >= 0)
+            v = globals[g];
+        *sp++ = v;
+        DISPATCH();
+    }
+
+    CASE(BC_ADD)
+    {
+        ARITH(OP_ADD, +);
+        DISPATCH();
+    }
+    CASE(BC_SUB)
+    {
+        ARITH(OP_SUB, -);
+        DISPATCH();
+    }
+    CASE(BC_MUL)
+    {
+        Value r = sp[-1], l = sp[-2];
+        int64_t res;
+        if (IS_SMALL_INT(l) && IS_SMALL_INT(r) &&
+            !__builtin_mul_overflow(AS_SMALL_INT(l), AS_SMALL_INT(r), &res))
+            sp[-2] = intValue(res);
+        else if (IS_NUM(l) && IS_NUM(r))
+            sp[-2] = NUM_VAL(AS_NUM(l) * AS_NUM(r));
+        else
+            sp[-2] = binaryOp(OP_MUL, l, r);
+        sp--;
+        DISPATCH();
+    }
+    CASE(BC_DIV)
+    {
+        sp[-2] = binaryOp(OP_DIV, sp[-2], sp[-1]);
+        sp--;
+        DISPATCH();
+    }
+    CASE(BC_EQ)
+    {
+        COMPARE(OP_EQ, ==);
+        DISPATCH();
+    }
+    CASE(BC_NE)
+    {
+        COMPARE(OP_NE, !=);
+        DISPATCH();
+    }
+    CASE(BC_LT)
+    {
+        COMPARE(OP_LT, <);
+        DISPATCH();
+    }
+    CASE(BC_LE)
+    {
+        COMPARE(OP_LE, <=);
+        DISPATCH();
+    }
+    CASE(BC_GT)
+    {
+        COMPARE(OP_GT, >);
+        DISPATCH();
+    }
+    CASE(BC_GE)
+    {
+        COMPARE(OP_GE, >=);
+        DISPATCH();
+    }
+
+    CASE(BC_ADD_CONST)
+    {
+        ARITH_CONST(OP_ADD, +);
+        DISPATCH();
+    }
+    CASE(BC_SUB_CONST)
+    {
+        ARITH_CONST(OP_SUB, -);
+        DISPATCH();
+    }
+
+    CASE(BC_JUMP)
+    {
+        int off = *ip++;
+        ip += off;
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_FALSE)
+    {
+        int off = *ip++;
+        if (!truthy(*--sp))
+            ip += off;
+        DISPATCH();
+    }
+    CASE(BC_LOOP)
+    {
+        int off = *ip++;
+        ip -= off;
+        if (gcShouldCollect())
+            collect(sp);
+        if (jitEnabled && sp == base + frame->proto->localCount)
+        {
+            TraceResume r = traceLoop(frame->proto, ip, base, globals);
+            ip = r.ip;
+            sp = base + frame->proto->localCount + r.depth;
+        }
+        DISPATCH();
+    }
+
+    CASE(BC_JUMP_IF_NOT_EQ)
+    {
+        COMPARE_JUMP(OP_EQ, ==);
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_NOT_NE)
+    {
+        COMPARE_JUMP(OP_NE, !=);
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_NOT_LT)
+    {
+        COMPARE_JUMP(OP_LT, <);
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_NOT_LE)
+    {
+        COMPARE_JUMP(OP_LE, <=);
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_NOT_GT)
+    {
+        COMPARE_JUMP(OP_GT, >);
+        DISPATCH();
+    }
+    CASE(BC_JUMP_IF_NOT_GE)
+    {
+        COMPARE_JUMP(OP_GE, >=);
+        DISPATCH();
+    }
+
+    CASE(BC_SWITCH)
+    {
+        const CaseTable *t = &frame->proto->switches[*ip++];
+        ip += selectCase(t, *--sp);
+        DISPATCH();
+    }
+
+    CASE(BC_FOR_RANGE)
+    {
+        int s = ip[0], off = ip[1];
+        ip += 2;
+        sp -= 3;
+        if (rangeBounds(sp, base + s, 0) <= 0)
+            ip += off;
+        DISPATCH();
+    }
+    CASE(BC_FOR_EACH)
+    {
+        int s = ip[0], off = ip[1];
+        ip += 2;
+        Value arr = *--sp;
+        if (eachBounds(arr, base + s, 0) <= 0)
+            ip += off;
+        else
+            base[s + 3] = arr;
+        DISPATCH();
+    }
+    CASE(BC_FOR_NEXT)
+    {
+        // the locals only ever hold what BC_FOR_RANGE put there
+        int s = ip[0], off = ip[1];
+        ip += 2;
+        if (base[s] == base[s + 1])
+            ip += off;
+        else
+            base[s] = INT_VAL(AS_SMALL_INT(base[s]) + AS_SMALL_INT(base[s + 2]));
+        DISPATCH();
+    }
+
+    CASE(BC_ARRAY)
+    {
+        int n = *ip++;
+        sp = makeArray(sp, n);
+        DISPATCH();
+    }
+    CASE(BC_INDEX_LOCAL)
+    {
+        int s = *ip++;
+        sp[-1] = indexArray(localNames[s], base[s], sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_INDEX_GLOBAL)
+    {
+        int g = *ip++;
+        sp[-1] = indexArray(globalNames[g], globals[g], sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_INDEX_VAR)
+    {
+        int s = ip[0], g = ip[1];
+        ip += 2;
+        Value arr = base[s] != UNDEF_VAL ? base[s] : globals[g];
+        sp[-1] = indexArray(localNames[s], arr, sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_STORE_INDEX_LOCAL)
+    {
+        int s = *ip++;
+        storeArray(localNames[s], base[s], sp[-2], sp[-1]);
+        sp -= 2;
+        DISPATCH();
+    }
+    CASE(BC_STORE_INDEX_GLOBAL)
+    {
+        int g = *ip++;
+        storeArray(globalNames[g], globals[g], sp[-2], sp[-1]);
+        sp -= 2;
+        DISPATCH();
+    }
+    CASE(BC_STORE_INDEX_VAR)
+    {
+        int s = ip[0], g = ip[1];
+        ip += 2;
+        Value arr = base[s] != UNDEF_VAL ? base[s] : globals[g];
+        storeArray(localNames[s], arr, sp[-2], sp[-1]);
+        sp -= 2;
+        DISPATCH();
+    }
+    CASE(BC_ELEMENT_LOCAL)
+    {
+        sp[-1] = elementAt(base[*ip++], sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_ELEMENT_GLOBAL)
+    {
+        sp[-1] = elementAt(globals[*ip++], sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_STORE_ELEMENT_LOCAL)
+    {
+        setElementAt(base[*ip++], sp[-2], sp[-1]);
+        sp -= 2;
+        DISPATCH();
+    }
+    CASE(BC_STORE_ELEMENT_GLOBAL)
+    {
+        setElementAt(globals[*ip++], sp[-2], sp[-1]);
+        sp -= 2;
+        DISPATCH();
+    }
+
+    CASE(BC_PRINT)
+    {
+        int last = *ip++;
+        printValue(*--sp);
+        putchar(last ? '\n' : ' ');
+        DISPATCH();
+    }
+    CASE(BC_PRINT_NEWLINE)
+    {
+        putchar('\n');
+        DISPATCH();
+    }
+
+    CASE(BC_FUNCTION)
+    {
+        Proto *p = program->protos[*ip++];
+        ObjFunction *fn = newFunction(p->def);
+        fn->proto = p;
+        *sp++ = OBJ_VAL(fn);
+        DISPATCH();
+    }
+    CASE(BC_CALLEE)
+    {
+        int s = ip[0], g = ip[1], argc = ip[2], skip = ip[3];
+        ip += 4;
+        const char *name = s >= 0 ? localNames[s] : globalNames[g];
+        Value v = s >= 0 ? base[s] : UNDEF_VAL;
+        if (v == UNDEF_VAL && g >= 0)
+            v = globals[g];
+        if (!IS_FUNC(v))
+        {
+            printf("Runtime Error: unknown function '%s'\n", name);
+            *sp++ = NUM_VAL(0.0);
+            ip += skip;
+            DISPATCH();
+        }
+        struct ASTNode *def = AS_FUNC(v)->def;
+        if (def->funcDef.paramCount != argc)
+        {
+            printf("Runtime Error: function '%s' expects %d args, got %d\n",
+                   def->funcDef.funcName, def->funcDef.paramCount, argc);
+            *sp++ = NUM_VAL(0.0);
+            ip += skip;
+            DISPATCH();
+        }
+        *sp++ = v;
+        DISPATCH();
+    }
+    CASE(BC_CALL)
+    {
+        callArgc = *ip++;
+    call:;
+        int argc = callArgc;
+        Proto *p = AS_FUNC(sp[-argc - 1])->proto;
+        if (frame == frames + FRAMES_MAX - 1 ||
+            sp + p->localCount + STACK_SLACK > stack + STACK_MAX)
+        {
+            printf("Runtime Error: stack overflow\n");
+            status = 1;
+            goto done;
+        }
+        frame->ip = ip;
+        if (jitEnabled && p->jitState != JIT_FAILED &&
+            (p->jitState == JIT_READY || (++p->calls >= jitThreshold && jitCompile(p))))
+        {
+            Value *args = sp - argc;
+            int n = jitCall(p, args, (int)(frame - frames) + 1);
+            if (n == 0)
+            {
+                sp = args; // the result is in the callee's slot
+                DISPATCH();
+            }
+            // deoptimized: the frames it left go on top of ours, and the
+            // innermost resumes at the instruction that gave up
+            for (int i = n - 1; i >= 0; --i)
+            {
+                frame++;
+                frame->proto = jitFrames[i].proto;
+                frame->base = jitFrames[i].base;
+                frame->ip = jitFrames[i].ip;
+            }
+            base = frame->base;
+            ip = frame->ip;
+            sp = jitFrames[0].sp;
+            consts = frame->proto->consts;
+            localNames = frame->proto->localNames;
+            DISPATCH();
+        }
+        frame++;
+        frame->proto = p;
+        frame->base = base = sp - argc;
+        for (Value *v = sp; v < base + p->localCount; ++v)
+            *v = UNDEF_VAL;
+        sp = base + p->localCount;
+        ip = p->code;
+        consts = p->consts;
+        localNames = p->localNames;
+        if (gcShouldCollect())
+            collect(sp);
+        DISPATCH();
+    }
+    CASE(BC_TAIL_CALL)
+    {
+        // the callee and its arguments replace this frame's, and the call
+        // is made from our caller, so recursion in tail position runs in
+        // constant space
+        callArgc = *ip++;
+        Value *callee = frame->base - 1;
+        for (int i = 0; i <= callArgc; ++i)
+            callee[i] = sp[i - callArgc - 1];
+        sp = callee + callArgc + 1;
+        frame--;
+        ip = frame->ip;
+        base = frame->base;
+        consts = frame->proto->consts;
+        localNames = frame->proto->localNames;
+        goto call;
+    }
+    CASE(BC_MEMO_FIND)
+    {
+        int key = *ip++;
+        for (int i = 0; i < frame->proto->arity; ++i)
+            base[key + i] = base[i];
+        Value known;
+        if (!memoFind(frame->proto->def->funcDef.memo, base + key, &known))
+            DISPATCH();
+        *sp++ = known;
+        goto ret;
+    }
+    CASE(BC_MEMO_STORE)
+    {
+        memoStore(frame->proto->def->funcDef.memo, base + *ip++, sp[-1]);
+        DISPATCH();
+    }
+    CASE(BC_RETURN)
+    {
+    ret:;
+        Value result = *--sp;
+        sp = frame->base - 1; // drop locals and the callee
+        frame--;
+        ip = frame->ip;
+        base = frame->base;
+        consts = frame->proto->consts;
+        localNames = frame->proto->localNames;
+        *sp++ = result;
+        DISPATCH();
+    }
+
+    CASE(BC_BUILTIN)
+    {
+        int b = ip[0], argc = ip[1];
+        ip += 2;
+        sp -= argc;
+        *sp = callBuiltin(b, sp);
+        sp++;
+        DISPATCH();
+    }
+    CASE(BC_LENGTH)
+    {
+        Value v = sp[-1];
+        if (IS_ARRAY(v))
+            sp[-1] = INT_VAL(AS_ARRAY(v)->len);
+        else
+            sp[-1] = callBuiltin(BI_LENGTH, sp - 1);
+        DISPATCH();
+    }
+    CASE(BC_READ_CHUNK)
+    {
+        int isVar = *ip++;
+        Value buf = sp[-2];
+        Value n = builtinReadChunk(sp[-3], isVar ? &buf : NULL, sp[-1]);
+        sp -= 3;
+        *sp++ = n;
+        if (isVar)
+            *sp++ = buf;
+        DISPATCH();
+    }
+    CASE(BC_ARITY_ERROR)
+    {
+        int b = ip[0], argc = ip[1];
+        ip += 2;
+        *sp++ = builtinArityError(b, argc);
+        DISPATCH();
+    }
+    CASE(BC_HALT)
+    {
+        goto done;
+    }
+
+#ifndef USE_COMPUTED_GOTO
+        default:
+            printf("Runtime Error: bad instruction\n");
+            status = 1;
+            goto done;
+        }
+    }
+#endif
+
+done:
+    traceShutdown();
+    jitShutdown();
+    free(stack);
+    free(frames);
+    free(vmGlobals);
+    stack = vmGlobals = NULL;
+    frames = NULL;
+    program = NULL;
+    return status;
+}
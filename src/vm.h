@@ -0,0 +1,9 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+
+/* runs a compiled program; returns 0, or 1 if it had to be aborted */
+int runProgram(Program *prog);
+
+#endif